@@ -15,6 +15,7 @@
 #if defined(CONFIG_BT_ENABLED)
 #include <esp_log.h>
 #include <sstream>
+#include <string.h>
 #include "BLEAdvertisedDevice.h"
 #include "BLEUtils.h"
 #ifdef ARDUINO_ARCH_ESP32
@@ -24,22 +25,11 @@ static const char* LOG_TAG="BLEAdvertisedDevice";
 
 BLEAdvertisedDevice::BLEAdvertisedDevice() {
 	m_adFlag           = 0;
-	m_appearance       = 0;
-	m_deviceType       = 0;
-	m_manufacturerData = "";
-	m_name             = "";
 	m_rssi             = -9999;
-	m_serviceData      = "";
-	m_txPower          = 0;
 	m_pScan            = nullptr;
+	m_payloadLength    = 0;
 
-	m_haveAppearance       = false;
-	m_haveManufacturerData = false;
-	m_haveName             = false;
 	m_haveRSSI             = false;
-	m_haveServiceData      = false;
-	m_haveServiceUUID      = false;
-	m_haveTXPower          = false;
 
 } // BLEAdvertisedDevice
 
@@ -66,7 +56,7 @@ BLEAddress BLEAdvertisedDevice::getAddress() {
  * @return The appearance of the advertised device.
  */
 uint16_t BLEAdvertisedDevice::getAppearance() {
-	return m_appearance;
+	return getView().getAppearance();
 } // getAppearance
 
 
@@ -75,7 +65,7 @@ uint16_t BLEAdvertisedDevice::getAppearance() {
  * @return The manufacturer data of the advertised device.
  */
 std::string BLEAdvertisedDevice::getManufacturerData() {
-	return m_manufacturerData;
+	return getView().getManufacturerData();
 } // getManufacturerData
 
 
@@ -84,7 +74,7 @@ std::string BLEAdvertisedDevice::getManufacturerData() {
  * @return The name of the advertised device.
  */
 std::string BLEAdvertisedDevice::getName() {
-	return m_name;
+	return getView().getName();
 } // getName
 
 
@@ -111,7 +101,7 @@ BLEScan* BLEAdvertisedDevice::getScan() {
  * @return The ServiceData of the advertised device.
  */
 std::string BLEAdvertisedDevice::getServiceData() {
-	return m_serviceData;
+	return getView().getServiceData();
 } //getServiceData
 
 
@@ -120,7 +110,7 @@ std::string BLEAdvertisedDevice::getServiceData() {
  * @return The service data UUID.
  */
 BLEUUID BLEAdvertisedDevice::getServiceDataUUID() {
-	return m_serviceDataUUID;
+	return getView().getServiceDataUUID();
 } // getServiceDataUUID
 
 
@@ -129,7 +119,7 @@ BLEUUID BLEAdvertisedDevice::getServiceDataUUID() {
  * @return The Service UUID of the advertised device.
  */
 BLEUUID BLEAdvertisedDevice::getServiceUUID() {  //TODO Remove it eventually, is no longer useful
-	return m_serviceUUIDs[0];
+	return getView().getServiceUUID(0);
 } // getServiceUUID
 
 /**
@@ -137,11 +127,7 @@ BLEUUID BLEAdvertisedDevice::getServiceUUID() {  //TODO Remove it eventually, is
  * @return Return true if service is advertised
  */
 bool BLEAdvertisedDevice::isAdvertisingService(BLEUUID uuid){
-	for (int i = 0; i < m_serviceUUIDs.size(); ++i) {
-		if(m_serviceUUIDs[i].equals(uuid))
-			return true;
-	}
-	return false;
+	return getView().isAdvertisingService(uuid);
 }
 
 /**
@@ -149,7 +135,7 @@ bool BLEAdvertisedDevice::isAdvertisingService(BLEUUID uuid){
  * @return The TX Power of the advertised device.
  */
 int8_t BLEAdvertisedDevice::getTXPower() {
-	return m_txPower;
+	return getView().getTXPower();
 } // getTXPower
 
 
@@ -159,7 +145,7 @@ int8_t BLEAdvertisedDevice::getTXPower() {
  * @return True if there is an appearance value present.
  */
 bool BLEAdvertisedDevice::haveAppearance() {
-	return m_haveAppearance;
+	return getView().haveAppearance();
 } // haveAppearance
 
 
@@ -168,7 +154,7 @@ bool BLEAdvertisedDevice::haveAppearance() {
  * @return True if there is manufacturer data present.
  */
 bool BLEAdvertisedDevice::haveManufacturerData() {
-	return m_haveManufacturerData;
+	return getView().haveManufacturerData();
 } // haveManufacturerData
 
 
@@ -177,7 +163,7 @@ bool BLEAdvertisedDevice::haveManufacturerData() {
  * @return True if there is a name value present.
  */
 bool BLEAdvertisedDevice::haveName() {
-	return m_haveName;
+	return getView().haveName();
 } // haveName
 
 
@@ -195,7 +181,7 @@ bool BLEAdvertisedDevice::haveRSSI() {
  * @return True if there is a service data value present.
  */
 bool BLEAdvertisedDevice::haveServiceData() {
-	return m_haveServiceData;
+	return getView().haveServiceData();
 } // haveServiceData
 
 
@@ -204,7 +190,7 @@ bool BLEAdvertisedDevice::haveServiceData() {
  * @return True if there is a service UUID value present.
  */
 bool BLEAdvertisedDevice::haveServiceUUID() {
-	return m_haveServiceUUID;
+	return getView().haveServiceUUID();
 } // haveServiceUUID
 
 
@@ -213,152 +199,10 @@ bool BLEAdvertisedDevice::haveServiceUUID() {
  * @return True if there is a transmission power value present.
  */
 bool BLEAdvertisedDevice::haveTXPower() {
-	return m_haveTXPower;
+	return getView().haveTXPower();
 } // haveTXPower
 
 
-/**
- * @brief Parse the advertising pay load.
- *
- * The pay load is a buffer of bytes that is either 31 bytes long or terminated by
- * a 0 length value.  Each entry in the buffer has the format:
- * [length][type][data...]
- *
- * The length does not include itself but does include everything after it until the next record.  A record
- * with a length value of 0 indicates a terminator.
- *
- * https://www.bluetooth.com/specifications/assigned-numbers/generic-access-profile
- */
-void BLEAdvertisedDevice::parseAdvertisement(uint8_t* payload) {
-	uint8_t length;
-	uint8_t ad_type;
-	uint8_t sizeConsumed = 0;
-	bool finished = false;
-	setPayload(payload);
-
-	while(!finished) {
-		length = *payload;          // Retrieve the length of the record.
-		payload++;                  // Skip to type
-		sizeConsumed += 1 + length; // increase the size consumed.
-
-		if (length != 0) { // A length of 0 indicates that we have reached the end.
-			ad_type = *payload;
-			payload++;
-			length--;
-
-			char* pHex = BLEUtils::buildHexData(nullptr, payload, length);
-			ESP_LOGD(LOG_TAG, "Type: 0x%.2x (%s), length: %d, data: %s",
-					ad_type, BLEUtils::advTypeToString(ad_type), length, pHex);
-			free(pHex);
-
-			switch(ad_type) {
-				case ESP_BLE_AD_TYPE_NAME_CMPL: {   // Adv Data Type: 0x09
-					setName(std::string(reinterpret_cast<char*>(payload), length));
-					break;
-				} // ESP_BLE_AD_TYPE_NAME_CMPL
-
-				case ESP_BLE_AD_TYPE_TX_PWR: {      // Adv Data Type: 0x0A
-					setTXPower(*payload);
-					break;
-				} // ESP_BLE_AD_TYPE_TX_PWR
-
-				case ESP_BLE_AD_TYPE_APPEARANCE: { // Adv Data Type: 0x19
-					setAppearance(*reinterpret_cast<uint16_t*>(payload));
-					break;
-				} // ESP_BLE_AD_TYPE_APPEARANCE
-
-				case ESP_BLE_AD_TYPE_FLAG: {        // Adv Data Type: 0x01
-					setAdFlag(*payload);
-					break;
-				} // ESP_BLE_AD_TYPE_FLAG
-
-				case ESP_BLE_AD_TYPE_16SRV_CMPL:
-				case ESP_BLE_AD_TYPE_16SRV_PART: {   // Adv Data Type: 0x02
-					for (int var = 0; var < length/2; ++var) {
-						setServiceUUID(BLEUUID(*reinterpret_cast<uint16_t*>(payload+var*2)));
-					}
-					break;
-				} // ESP_BLE_AD_TYPE_16SRV_PART
-
-				case ESP_BLE_AD_TYPE_32SRV_CMPL:
-				case ESP_BLE_AD_TYPE_32SRV_PART: {   // Adv Data Type: 0x04
-					for (int var = 0; var < length/4; ++var) {
-						setServiceUUID(BLEUUID(*reinterpret_cast<uint32_t*>(payload+var*4)));
-					}
-					break;
-				} // ESP_BLE_AD_TYPE_32SRV_PART
-
-				case ESP_BLE_AD_TYPE_128SRV_CMPL: { // Adv Data Type: 0x07
-					setServiceUUID(BLEUUID(payload, 16, false));
-					break;
-				} // ESP_BLE_AD_TYPE_128SRV_CMPL
-
-				case ESP_BLE_AD_TYPE_128SRV_PART: { // Adv Data Type: 0x06
-					setServiceUUID(BLEUUID(payload, 16, false));
-					break;
-				} // ESP_BLE_AD_TYPE_128SRV_PART
-
-				// See CSS Part A 1.4 Manufacturer Specific Data
-				case ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE: {
-					setManufacturerData(std::string(reinterpret_cast<char*>(payload), length));
-					break;
-				} // ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE
-
-				case ESP_BLE_AD_TYPE_SERVICE_DATA: {  // Adv Data Type: 0x16 (Service Data) - 2 byte UUID
-					if (length < 2) {
-						ESP_LOGE(LOG_TAG, "Length too small for ESP_BLE_AD_TYPE_SERVICE_DATA");
-						break;
-					}
-					uint16_t uuid = *(uint16_t *)payload;
-					setServiceDataUUID(BLEUUID(uuid));
-					if (length > 2) {
-						setServiceData(std::string(reinterpret_cast<char*>(payload+2), length-2));
-					}
-					break;
-				} //ESP_BLE_AD_TYPE_SERVICE_DATA
-
-				case ESP_BLE_AD_TYPE_32SERVICE_DATA: {  // Adv Data Type: 0x20 (Service Data) - 4 byte UUID
-					if (length < 4) {
-						ESP_LOGE(LOG_TAG, "Length too small for ESP_BLE_AD_TYPE_32SERVICE_DATA");
-						break;
-					}
-					uint32_t uuid = *(uint32_t *)payload;
-					setServiceDataUUID(BLEUUID(uuid));
-					if (length > 4) {
-						setServiceData(std::string(reinterpret_cast<char*>(payload+4), length-4));
-					}
-					break;
-				} //ESP_BLE_AD_TYPE_32SERVICE_DATA
-
-				case ESP_BLE_AD_TYPE_128SERVICE_DATA: {  // Adv Data Type: 0x21 (Service Data) - 16 byte UUID
-					if (length < 16) {
-						ESP_LOGE(LOG_TAG, "Length too small for ESP_BLE_AD_TYPE_128SERVICE_DATA");
-						break;
-					}
-
-					setServiceDataUUID(BLEUUID(payload, (size_t)16, false));
-					if (length > 16) {
-						setServiceData(std::string(reinterpret_cast<char*>(payload+16), length-16));
-					}
-					break;
-				} //ESP_BLE_AD_TYPE_32SERVICE_DATA
-
-				default: {
-					ESP_LOGD(LOG_TAG, "Unhandled type: adType: %d - 0x%.2x", ad_type, ad_type);
-					break;
-				}
-			} // switch
-			payload += length;
-		} // Length <> 0
-
-
-		if (sizeConsumed >=31 || length == 0) {
-			finished = true;
-		}
-	} // !finished
-} // parseAdvertisement
-
-
 /**
  * @brief Set the address of the advertised device.
  * @param [in] address The address of the advertised device.
@@ -377,41 +221,6 @@ void BLEAdvertisedDevice::setAdFlag(uint8_t adFlag) {
 } // setAdFlag
 
 
-/**
- * @brief Set the appearance for this device.
- * @param [in] The discovered appearance.
- */
-void BLEAdvertisedDevice::setAppearance(uint16_t appearance) {
-	m_appearance     = appearance;
-	m_haveAppearance = true;
-	ESP_LOGD(LOG_TAG, "- appearance: %d", m_appearance);
-} // setAppearance
-
-
-/**
- * @brief Set the manufacturer data for this device.
- * @param [in] The discovered manufacturer data.
- */
-void BLEAdvertisedDevice::setManufacturerData(std::string manufacturerData) {
-	m_manufacturerData     = manufacturerData;
-	m_haveManufacturerData = true;
-	char* pHex = BLEUtils::buildHexData(nullptr, (uint8_t*)m_manufacturerData.data(), (uint8_t)m_manufacturerData.length());
-	ESP_LOGD(LOG_TAG, "- manufacturer data: %s", pHex);
-	free(pHex);
-} // setManufacturerData
-
-
-/**
- * @brief Set the name for this device.
- * @param [in] name The discovered name.
- */
-void BLEAdvertisedDevice::setName(std::string name) {
-	m_name     = name;
-	m_haveName = true;
-	ESP_LOGD(LOG_TAG, "- setName(): name: %s", m_name.c_str());
-} // setName
-
-
 /**
  * @brief Set the RSSI for this device.
  * @param [in] rssi The discovered RSSI.
@@ -432,57 +241,6 @@ void BLEAdvertisedDevice::setScan(BLEScan* pScan) {
 } // setScan
 
 
-/**
- * @brief Set the Service UUID for this device.
- * @param [in] serviceUUID The discovered serviceUUID
- */
-void BLEAdvertisedDevice::setServiceUUID(const char* serviceUUID) {
-	return setServiceUUID(BLEUUID(serviceUUID));
-} // setServiceUUID
-
-
-/**
- * @brief Set the Service UUID for this device.
- * @param [in] serviceUUID The discovered serviceUUID
- */
-void BLEAdvertisedDevice::setServiceUUID(BLEUUID serviceUUID) {
-	m_serviceUUIDs.push_back(serviceUUID);
-	m_haveServiceUUID = true;
-	ESP_LOGD(LOG_TAG, "- addServiceUUID(): serviceUUID: %s", serviceUUID.toString().c_str());
-} // setServiceUUID
-
-
-/**
- * @brief Set the ServiceData value.
- * @param [in] data ServiceData value.
- */
-void BLEAdvertisedDevice::setServiceData(std::string serviceData) {
-	m_haveServiceData = true;         // Set the flag that indicates we have service data.
-	m_serviceData     = serviceData;  // Save the service data that we received.
-} //setServiceData
-
-
-/**
- * @brief Set the ServiceDataUUID value.
- * @param [in] data ServiceDataUUID value.
- */
-void BLEAdvertisedDevice::setServiceDataUUID(BLEUUID uuid) {
-	m_haveServiceData = true;         // Set the flag that indicates we have service data.
-	m_serviceDataUUID = uuid;
-} // setServiceDataUUID
-
-
-/**
- * @brief Set the power level for this device.
- * @param [in] txPower The discovered power level.
- */
-void BLEAdvertisedDevice::setTXPower(int8_t txPower) {
-	m_txPower     = txPower;
-	m_haveTXPower = true;
-	ESP_LOGD(LOG_TAG, "- txPower: %d", m_txPower);
-} // setTXPower
-
-
 /**
  * @brief Create a string representation of this device.
  * @return A string representation of this device.
@@ -507,13 +265,55 @@ std::string BLEAdvertisedDevice::toString() {
 	return ss.str();
 } // toString
 
+/**
+ * @brief Get the raw advertisement, followed by the raw scan response if one was received.
+ * @return The payload.
+ */
 uint8_t* BLEAdvertisedDevice::getPayload() {
 	return m_payload;
-}
+} // getPayload
 
-void BLEAdvertisedDevice::setPayload(uint8_t* payload) {
-	m_payload = payload;
-}
+
+/**
+ * @brief Get the length of the payload.
+ * @return The length of the payload.
+ */
+size_t BLEAdvertisedDevice::getPayloadLength() {
+	return m_payloadLength;
+} // getPayloadLength
+
+
+/**
+ * @brief Get a view of the advertisement that decodes its fields.
+ * The view is only valid for as long as this device is.
+ * @return The view.
+ */
+BLEAdvertisementView BLEAdvertisedDevice::getView() {
+	return BLEAdvertisementView(*m_address.getNative(), m_payload, m_payloadLength, m_rssi);
+} // getView
+
+
+/**
+ * @brief Set the raw advertisement.
+ * @param [in] payload The advertisement, optionally followed by the scan response.
+ * @param [in] length The length of the payload.
+ */
+void BLEAdvertisedDevice::setPayload(uint8_t* payload, size_t length) {
+	if (length > sizeof(m_payload)) {
+		length = sizeof(m_payload);
+	}
+	memcpy(m_payload, payload, length);
+	m_payloadLength = length;
+} // setPayload
+
+
+/**
+ * @brief Decode a scan result and pass it to onResult().
+ * @param [in] record The scan result.
+ */
+void BLEAdvertisedDeviceCallbacks::onRecord(BLEScanRecord& record) {
+	onResult(record.getAdvertisedDevice());
+} // onRecord
 
 
 #endif /* CONFIG_BT_ENABLED */
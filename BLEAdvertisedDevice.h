@@ -14,16 +14,21 @@
 #include <map>
 
 #include "BLEAddress.h"
+#include "BLEAdvertisementView.h"
 #include "BLEScan.h"
 #include "BLEUUID.h"
 
 
 class BLEScan;
+class BLEScanRecord;
 /**
  * @brief A representation of a %BLE advertised device found by a scan.
  *
  * When we perform a %BLE scan, the result will be a set of devices that are advertising.  This
  * class provides a model of a detected device.
+ *
+ * The device keeps a copy of the raw advertisement and decodes a field only when it is asked for, through
+ * a BLEAdvertisementView.
  */
 class BLEAdvertisedDevice {
 public:
@@ -40,6 +45,8 @@ public:
 	BLEUUID     getServiceUUID();
 	int8_t      getTXPower();
 	uint8_t* 	getPayload();
+	size_t      getPayloadLength();
+	BLEAdvertisementView getView();
 
 
 	bool		isAdvertisingService(BLEUUID uuid);
@@ -55,46 +62,22 @@ public:
 
 private:
 	friend class BLEScan;
+	friend class BLEScanRecord;
 
-	void parseAdvertisement(uint8_t* payload);
 	void setAddress(BLEAddress address);
 	void setAdFlag(uint8_t adFlag);
-	void setAdvertizementResult(uint8_t* payload);
-	void setAppearance(uint16_t appearance);
-	void setManufacturerData(std::string manufacturerData);
-	void setName(std::string name);
+	void setPayload(uint8_t* payload, size_t length);
 	void setRSSI(int rssi);
 	void setScan(BLEScan* pScan);
-	void setServiceData(std::string data);
-	void setServiceDataUUID(BLEUUID uuid);
-	void setServiceUUID(const char* serviceUUID);
-	void setServiceUUID(BLEUUID serviceUUID);
-	void setTXPower(int8_t txPower);
-	void setPayload(uint8_t* payload);
-
 
-	bool m_haveAppearance;
-	bool m_haveManufacturerData;
-	bool m_haveName;
 	bool m_haveRSSI;
-	bool m_haveServiceData;
-	bool m_haveServiceUUID;
-	bool m_haveTXPower;
-
 
 	BLEAddress  m_address = BLEAddress((uint8_t*)"\0\0\0\0\0\0");
 	uint8_t     m_adFlag;
-	uint16_t    m_appearance;
-	int         m_deviceType;
-	std::string m_manufacturerData;
-	std::string m_name;
 	BLEScan*    m_pScan;
 	int         m_rssi;
-	std::vector<BLEUUID> m_serviceUUIDs;
-	int8_t      m_txPower;
-	std::string m_serviceData;
-	BLEUUID     m_serviceDataUUID;
-	uint8_t*	m_payload;
+	uint8_t     m_payload[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+	uint8_t     m_payloadLength;
 };
 
 /**
@@ -113,7 +96,16 @@ public:
 	 * As we are scanning, we will find new devices.  When found, this call back is invoked with a reference to the
 	 * device that was found.  During any individual scan, a device will only be detected one time.
 	 */
-	virtual void onResult(BLEAdvertisedDevice advertisedDevice) = 0;
+	virtual void onResult(BLEAdvertisedDevice advertisedDevice) {};
+
+	/**
+	 * @brief Called when a new scan result is detected, before it is decoded.
+	 *
+	 * The record belongs to the scan and is only valid until the callback returns.  Override this
+	 * rather than onResult() to look at results without copying them.  By default, the record is
+	 * decoded into a BLEAdvertisedDevice that is passed to onResult().
+	 */
+	virtual void onRecord(BLEScanRecord& record);
 };
 
 #endif /* CONFIG_BT_ENABLED */
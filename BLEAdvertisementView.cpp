@@ -0,0 +1,380 @@
+/*
+ * BLEAdvertisementView.cpp
+ *
+ * See also:
+ * https://www.bluetooth.com/specifications/assigned-numbers/generic-access-profile
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <string.h>
+#include "BLEAdvertisementView.h"
+
+
+/**
+ * @brief Get the size of the UUIDs held by an AD structure.
+ * @param [in] adType The type of the AD structure.
+ * @return The size of each UUID in bytes or 0 if the structure isn't a list of service UUIDs.
+ */
+static int serviceUUIDSize(uint8_t adType) {
+	switch(adType) {
+		case ESP_BLE_AD_TYPE_16SRV_PART:
+		case ESP_BLE_AD_TYPE_16SRV_CMPL:
+			return 2;
+		case ESP_BLE_AD_TYPE_32SRV_PART:
+		case ESP_BLE_AD_TYPE_32SRV_CMPL:
+			return 4;
+		case ESP_BLE_AD_TYPE_128SRV_PART:
+		case ESP_BLE_AD_TYPE_128SRV_CMPL:
+			return 16;
+		default:
+			return 0;
+	}
+} // serviceUUIDSize
+
+
+/**
+ * @brief Make a UUID from its little endian bytes.
+ * @param [in] pData The bytes of the UUID.
+ * @param [in] size The size of the UUID, 2, 4 or 16 bytes.
+ * @return The UUID.
+ */
+static BLEUUID makeUUID(const uint8_t* pData, int size) {
+	if (size == 2) {
+		return BLEUUID((uint16_t) (pData[0] | (pData[1] << 8)));
+	}
+	if (size == 4) {
+		return BLEUUID((uint32_t) (pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t) pData[3] << 24)));
+	}
+	return BLEUUID((uint8_t*) pData, 16, false);
+} // makeUUID
+
+
+/**
+ * @brief Create a view of a raw advertisement.
+ * @param [in] pAddress The 6 byte address of the device that sent the advertisement.
+ * @param [in] pPayload The advertisement, optionally followed by the scan response.
+ * @param [in] length The length of the payload.
+ * @param [in] rssi The signal strength that the advertisement was received with.
+ */
+BLEAdvertisementView::BLEAdvertisementView(const uint8_t* pAddress, const uint8_t* pPayload, size_t length, int rssi) {
+	memcpy(m_address, pAddress, ESP_BD_ADDR_LEN);
+	m_pPayload = pPayload;
+	m_length   = length;
+	m_rssi     = rssi;
+} // BLEAdvertisementView
+
+
+/**
+ * @brief Find the first AD structure of a given type.
+ *
+ * A structure that would run past the end of the payload, or a structure with a length of 0, ends the search.
+ *
+ * @param [in] adType The type of the structure to find.
+ * @param [out] pLength The length of the data of the structure.
+ * @return The data of the structure (after the type) or nullptr if there is no such structure.
+ */
+const uint8_t* BLEAdvertisementView::find(uint8_t adType, uint8_t* pLength) const {
+	const uint8_t* p   = m_pPayload;
+	const uint8_t* end = m_pPayload + m_length;
+	while (p + 1 < end && p[0] != 0 && p + 1 + p[0] <= end) {
+		if (p[1] == adType) {
+			*pLength = p[0] - 1;
+			return p + 2;
+		}
+		p += 1 + p[0];
+	}
+	return nullptr;
+} // find
+
+
+/**
+ * @brief Find the first service data structure, whatever the size of its UUID.
+ * @param [out] pLength The length of the data of the structure, including the UUID.
+ * @param [out] pUUIDLength The size of the UUID at the start of the data.
+ * @return The data of the structure or nullptr if there is none.
+ */
+const uint8_t* BLEAdvertisementView::findServiceData(uint8_t* pLength, uint8_t* pUUIDLength) const {
+	const uint8_t* pData;
+	if ((pData = find(ESP_BLE_AD_TYPE_SERVICE_DATA, pLength)) != nullptr) {
+		*pUUIDLength = 2;
+	} else if ((pData = find(ESP_BLE_AD_TYPE_32SERVICE_DATA, pLength)) != nullptr) {
+		*pUUIDLength = 4;
+	} else if ((pData = find(ESP_BLE_AD_TYPE_128SERVICE_DATA, pLength)) != nullptr) {
+		*pUUIDLength = 16;
+	} else {
+		return nullptr;
+	}
+	if (*pLength < *pUUIDLength) {   // Too short to hold its own UUID.
+		return nullptr;
+	}
+	return pData;
+} // findServiceData
+
+
+/**
+ * @brief Get the address of the device that sent the advertisement.
+ * @return The address.
+ */
+BLEAddress BLEAdvertisementView::getAddress() const {
+	return BLEAddress((uint8_t*) m_address);
+} // getAddress
+
+
+/**
+ * @brief Get the appearance.
+ * @return The appearance or 0 if there is none.
+ */
+uint16_t BLEAdvertisementView::getAppearance() const {
+	uint8_t length;
+	const uint8_t* pData = find(ESP_BLE_AD_TYPE_APPEARANCE, &length);
+	if (pData == nullptr || length < 2) {
+		return 0;
+	}
+	return pData[0] | (pData[1] << 8);
+} // getAppearance
+
+
+/**
+ * @brief Get the company identifier at the start of the manufacturer data.
+ * @return The company identifier or 0xffff if there is no manufacturer data.
+ */
+uint16_t BLEAdvertisementView::getManufacturerId() const {
+	uint8_t length;
+	const uint8_t* pData = find(ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, &length);
+	if (pData == nullptr || length < 2) {
+		return 0xffff;
+	}
+	return pData[0] | (pData[1] << 8);
+} // getManufacturerId
+
+
+/**
+ * @brief Get the manufacturer data, including the company identifier.
+ * @return The manufacturer data.
+ */
+std::string BLEAdvertisementView::getManufacturerData() const {
+	uint8_t length;
+	const uint8_t* pData = find(ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, &length);
+	if (pData == nullptr) {
+		return "";
+	}
+	return std::string((const char*) pData, length);
+} // getManufacturerData
+
+
+/**
+ * @brief Get the name, preferring the complete name to the shortened one.
+ * @return The name.
+ */
+std::string BLEAdvertisementView::getName() const {
+	uint8_t length;
+	const uint8_t* pData = find(ESP_BLE_AD_TYPE_NAME_CMPL, &length);
+	if (pData == nullptr) {
+		pData = find(ESP_BLE_AD_TYPE_NAME_SHORT, &length);
+	}
+	if (pData == nullptr) {
+		return "";
+	}
+	return std::string((const char*) pData, length);
+} // getName
+
+
+/**
+ * @brief Get the raw payload.
+ * @return The payload.
+ */
+const uint8_t* BLEAdvertisementView::getPayload() const {
+	return m_pPayload;
+} // getPayload
+
+
+/**
+ * @brief Get the length of the raw payload.
+ * @return The length of the payload.
+ */
+size_t BLEAdvertisementView::getPayloadLength() const {
+	return m_length;
+} // getPayloadLength
+
+
+/**
+ * @brief Get the signal strength that the advertisement was received with.
+ * @return The RSSI.
+ */
+int BLEAdvertisementView::getRSSI() const {
+	return m_rssi;
+} // getRSSI
+
+
+/**
+ * @brief Get the service data that follows the service data UUID.
+ * @return The service data.
+ */
+std::string BLEAdvertisementView::getServiceData() const {
+	uint8_t length;
+	uint8_t uuidLength;
+	const uint8_t* pData = findServiceData(&length, &uuidLength);
+	if (pData == nullptr) {
+		return "";
+	}
+	return std::string((const char*) pData + uuidLength, length - uuidLength);
+} // getServiceData
+
+
+/**
+ * @brief Get the UUID of the service that the service data belongs to.
+ * @return The UUID, which has no value if there is no service data.
+ */
+BLEUUID BLEAdvertisementView::getServiceDataUUID() const {
+	uint8_t length;
+	uint8_t uuidLength;
+	const uint8_t* pData = findServiceData(&length, &uuidLength);
+	if (pData == nullptr) {
+		return BLEUUID();
+	}
+	return makeUUID(pData, uuidLength);
+} // getServiceDataUUID
+
+
+/**
+ * @brief Get one of the advertised service UUIDs.
+ * @param [in] index The index of the UUID, counting across all the lists of service UUIDs.
+ * @return The UUID, which has no value if the index is out of range.
+ */
+BLEUUID BLEAdvertisementView::getServiceUUID(int index) const {
+	const uint8_t* p   = m_pPayload;
+	const uint8_t* end = m_pPayload + m_length;
+	while (p + 1 < end && p[0] != 0 && p + 1 + p[0] <= end) {
+		int size = serviceUUIDSize(p[1]);
+		if (size != 0) {
+			int count = (p[0] - 1) / size;
+			if (index < count) {
+				return makeUUID(p + 2 + index * size, size);
+			}
+			index -= count;
+		}
+		p += 1 + p[0];
+	}
+	return BLEUUID();
+} // getServiceUUID
+
+
+/**
+ * @brief Get the number of advertised service UUIDs.
+ * @return The number of service UUIDs.
+ */
+int BLEAdvertisementView::getServiceUUIDCount() const {
+	int count = 0;
+	const uint8_t* p   = m_pPayload;
+	const uint8_t* end = m_pPayload + m_length;
+	while (p + 1 < end && p[0] != 0 && p + 1 + p[0] <= end) {
+		int size = serviceUUIDSize(p[1]);
+		if (size != 0) {
+			count += (p[0] - 1) / size;
+		}
+		p += 1 + p[0];
+	}
+	return count;
+} // getServiceUUIDCount
+
+
+/**
+ * @brief Get the transmission power.
+ * @return The transmission power or 0 if there is none.
+ */
+int8_t BLEAdvertisementView::getTXPower() const {
+	uint8_t length;
+	const uint8_t* pData = find(ESP_BLE_AD_TYPE_TX_PWR, &length);
+	if (pData == nullptr || length < 1) {
+		return 0;
+	}
+	return (int8_t) pData[0];
+} // getTXPower
+
+
+/**
+ * @brief Does the advertisement have an appearance value?
+ * @return True if there is an appearance value present.
+ */
+bool BLEAdvertisementView::haveAppearance() const {
+	uint8_t length;
+	return find(ESP_BLE_AD_TYPE_APPEARANCE, &length) != nullptr;
+} // haveAppearance
+
+
+/**
+ * @brief Does the advertisement have manufacturer data?
+ * @return True if there is manufacturer data present.
+ */
+bool BLEAdvertisementView::haveManufacturerData() const {
+	uint8_t length;
+	return find(ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, &length) != nullptr;
+} // haveManufacturerData
+
+
+/**
+ * @brief Does the advertisement have a name?
+ * @return True if there is a complete or shortened name present.
+ */
+bool BLEAdvertisementView::haveName() const {
+	uint8_t length;
+	return find(ESP_BLE_AD_TYPE_NAME_CMPL, &length) != nullptr || find(ESP_BLE_AD_TYPE_NAME_SHORT, &length) != nullptr;
+} // haveName
+
+
+/**
+ * @brief Does the advertisement have service data?
+ * @return True if there is service data present.
+ */
+bool BLEAdvertisementView::haveServiceData() const {
+	uint8_t length;
+	uint8_t uuidLength;
+	return findServiceData(&length, &uuidLength) != nullptr;
+} // haveServiceData
+
+
+/**
+ * @brief Does the advertisement list any service UUIDs?
+ * @return True if there is at least one service UUID present.
+ */
+bool BLEAdvertisementView::haveServiceUUID() const {
+	return getServiceUUIDCount() != 0;
+} // haveServiceUUID
+
+
+/**
+ * @brief Does the advertisement have a transmission power value?
+ * @return True if there is a transmission power value present.
+ */
+bool BLEAdvertisementView::haveTXPower() const {
+	uint8_t length;
+	return find(ESP_BLE_AD_TYPE_TX_PWR, &length) != nullptr;
+} // haveTXPower
+
+
+/**
+ * @brief Is a service listed in the advertisement?
+ * @param [in] uuid The UUID of the service.
+ * @return True if the service UUID is present.
+ */
+bool BLEAdvertisementView::isAdvertisingService(const BLEUUID& uuid) const {
+	const uint8_t* p   = m_pPayload;
+	const uint8_t* end = m_pPayload + m_length;
+	while (p + 1 < end && p[0] != 0 && p + 1 + p[0] <= end) {
+		int size = serviceUUIDSize(p[1]);
+		if (size != 0) {
+			for (const uint8_t* pUUID = p + 2; pUUID + size <= p + 1 + p[0]; pUUID += size) {
+				if (makeUUID(pUUID, size).equals(uuid)) {
+					return true;
+				}
+			}
+		}
+		p += 1 + p[0];
+	}
+	return false;
+} // isAdvertisingService
+
+#endif /* CONFIG_BT_ENABLED */
@@ -0,0 +1,67 @@
+/*
+ * BLEAdvertisementView.h
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_BLEADVERTISEMENTVIEW_H_
+#define COMPONENTS_CPP_UTILS_BLEADVERTISEMENTVIEW_H_
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <esp_gap_ble_api.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "BLEAddress.h"
+#include "BLEUUID.h"
+
+/**
+ * @brief A read only view of a raw advertisement.
+ *
+ * An advertisement is a sequence of AD structures, each of the form [length][type][data...].  The view
+ * holds a pointer to the raw bytes and only decodes the structure that a getter asks for, so that a scan
+ * result can be looked at, and usually discarded, without copying or allocating anything.  Only the
+ * getters that return a std::string allocate.
+ *
+ * The view doesn't own the bytes.  It is only valid for as long as they are.
+ */
+class BLEAdvertisementView {
+public:
+	BLEAdvertisementView(const uint8_t* pAddress, const uint8_t* pPayload, size_t length, int rssi);
+
+	const uint8_t* find(uint8_t adType, uint8_t* pLength) const;
+	BLEAddress     getAddress() const;
+	uint16_t       getAppearance() const;
+	uint16_t       getManufacturerId() const;
+	std::string    getManufacturerData() const;
+	std::string    getName() const;
+	const uint8_t* getPayload() const;
+	size_t         getPayloadLength() const;
+	int            getRSSI() const;
+	std::string    getServiceData() const;
+	BLEUUID        getServiceDataUUID() const;
+	BLEUUID        getServiceUUID(int index = 0) const;
+	int            getServiceUUIDCount() const;
+	int8_t         getTXPower() const;
+
+	bool           haveAppearance() const;
+	bool           haveManufacturerData() const;
+	bool           haveName() const;
+	bool           haveServiceData() const;
+	bool           haveServiceUUID() const;
+	bool           haveTXPower() const;
+	bool           isAdvertisingService(const BLEUUID& uuid) const;
+
+private:
+	esp_bd_addr_t  m_address;
+	const uint8_t* m_pPayload;
+	size_t         m_length;
+	int            m_rssi;
+
+	const uint8_t* findServiceData(uint8_t* pLength, uint8_t* pUUIDLength) const;
+}; // BLEAdvertisementView
+
+#endif /* CONFIG_BT_ENABLED */
+#endif /* COMPONENTS_CPP_UTILS_BLEADVERTISEMENTVIEW_H_ */
@@ -0,0 +1,141 @@
+/*
+ * BLEAttributeCache.cpp
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <esp_err.h>
+#include <esp_log.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "BLEAttributeCache.h"
+#include "GeneralUtils.h"
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp32-hal-log.h"
+#endif
+
+static const char* LOG_TAG = "BLEAttributeCache";
+
+
+/**
+ * @brief Get the key of the table of a server.
+ * @param [in] address The address of the server.
+ * @return The address as 12 hex digits, which fits within the 15 characters of an NVS key.
+ */
+std::string BLEAttributeCache::getKey(BLEAddress address) {
+	static const char digits[] = "0123456789abcdef";
+	uint8_t* pAddress = *address.getNative();
+	std::string key;
+	for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+		key += digits[pAddress[i] >> 4];
+		key += digits[pAddress[i] & 0xf];
+	}
+	return key;
+} // getKey
+
+
+/**
+ * @brief Create an attribute cache in NVS.
+ * @param [in] name The NVS namespace to keep the tables in.
+ */
+BLENVSAttributeCache::BLENVSAttributeCache(std::string name) : m_nvs(name) {
+} // BLENVSAttributeCache
+
+
+bool BLENVSAttributeCache::load(BLEAddress address, std::string* pTable) {
+	std::string key = getKey(address);
+	size_t length = 0;
+	if (m_nvs.get(key, nullptr, length) != ESP_OK) {   // Ask for the length first.
+		return false;
+	}
+	pTable->resize(length);
+	return m_nvs.get(key, (uint8_t*) &(*pTable)[0], length) == ESP_OK;
+} // load
+
+
+void BLENVSAttributeCache::remove(BLEAddress address) {
+	std::string key = getKey(address);
+	esp_err_t errRc = m_nvs.erase(key);
+	if (errRc == ESP_ERR_NVS_NOT_FOUND) {   // Nothing was cached.
+		return;
+	}
+	if (errRc == ESP_OK) {
+		errRc = m_nvs.commit();
+	}
+	if (errRc != ESP_OK) {
+		ESP_LOGE(LOG_TAG, "Failed to remove %s: rc=%d %s", key.c_str(), errRc, GeneralUtils::errorToString(errRc));
+	}
+} // remove
+
+
+void BLENVSAttributeCache::store(BLEAddress address, std::string table) {
+	std::string key = getKey(address);
+	esp_err_t errRc = m_nvs.set(key, (uint8_t*) table.data(), table.length());
+	if (errRc == ESP_OK) {
+		errRc = m_nvs.commit();
+	}
+	if (errRc != ESP_OK) {
+		ESP_LOGE(LOG_TAG, "Failed to store %s: rc=%d %s", key.c_str(), errRc, GeneralUtils::errorToString(errRc));
+	}
+} // store
+
+
+/**
+ * @brief Create an attribute cache in a directory.
+ * @param [in] directory The path of an existing directory, such as "/spiffs/ble".
+ */
+BLEFileAttributeCache::BLEFileAttributeCache(std::string directory) {
+	m_directory = directory;
+} // BLEFileAttributeCache
+
+
+/**
+ * @brief Get the path of the file that holds the table of a server.
+ * @param [in] address The address of the server.
+ * @return The path of the file.
+ */
+std::string BLEFileAttributeCache::getPath(BLEAddress address) {
+	return m_directory + "/" + getKey(address);
+} // getPath
+
+
+bool BLEFileAttributeCache::load(BLEAddress address, std::string* pTable) {
+	FILE* file = ::fopen(getPath(address).c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	pTable->clear();
+	char buffer[128];
+	size_t length;
+	while ((length = ::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		pTable->append(buffer, length);
+	}
+	bool ok = !::ferror(file);
+	::fclose(file);
+	return ok;
+} // load
+
+
+void BLEFileAttributeCache::remove(BLEAddress address) {
+	::unlink(getPath(address).c_str());
+} // remove
+
+
+void BLEFileAttributeCache::store(BLEAddress address, std::string table) {
+	std::string path = getPath(address);
+	FILE* file = ::fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		ESP_LOGE(LOG_TAG, "fopen: %s: errno=%d", path.c_str(), errno);
+		return;
+	}
+	bool ok = ::fwrite(table.data(), 1, table.length(), file) == table.length();
+	if (::fclose(file) != 0 || !ok) {
+		ESP_LOGE(LOG_TAG, "Failed to write %s: errno=%d", path.c_str(), errno);
+		::unlink(path.c_str());   // Don't leave a partial table behind.
+	}
+} // store
+
+#endif /* CONFIG_BT_ENABLED */
@@ -0,0 +1,89 @@
+/*
+ * BLEAttributeCache.h
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_BLEATTRIBUTECACHE_H_
+#define COMPONENTS_CPP_UTILS_BLEATTRIBUTECACHE_H_
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <string>
+
+#include "BLEAddress.h"
+#include "CPPNVS.h"
+
+/**
+ * @brief A persistent store of the attribute tables of the servers that a client has discovered.
+ *
+ * A table is an opaque blob, built and read by BLEClient, that describes the services, characteristics
+ * and descriptors of one server along with the Database Hash that the server had when they were discovered.
+ * Tables are kept by the address of the server.  Give a cache to BLEClient::setAttributeCache() so that a
+ * reconnect to a known server can skip service discovery.
+ */
+class BLEAttributeCache {
+public:
+	virtual ~BLEAttributeCache() {};
+	/**
+	 * @brief Get the table of a server.
+	 * @param [in] address The address of the server.
+	 * @param [out] pTable The table.
+	 * @return True if there is a table for the server.
+	 */
+	virtual bool load(BLEAddress address, std::string* pTable) = 0;
+	/**
+	 * @brief Forget the table of a server.
+	 * @param [in] address The address of the server.
+	 */
+	virtual void remove(BLEAddress address) = 0;
+	/**
+	 * @brief Keep the table of a server, replacing any that was kept before.
+	 * @param [in] address The address of the server.
+	 * @param [in] table The table.
+	 */
+	virtual void store(BLEAddress address, std::string table) = 0;
+
+protected:
+	static std::string getKey(BLEAddress address);
+}; // BLEAttributeCache
+
+
+/**
+ * @brief An attribute cache kept in a namespace of NVS.
+ *
+ * NVS holds a blob of at most 1984 bytes, which is room for the table of a server with a few dozen
+ * characteristics.  The NVS partition must be sized for the number of servers to be remembered.
+ */
+class BLENVSAttributeCache : public BLEAttributeCache {
+public:
+	BLENVSAttributeCache(std::string name = "blecache");
+	bool load(BLEAddress address, std::string* pTable) override;
+	void remove(BLEAddress address) override;
+	void store(BLEAddress address, std::string table) override;
+
+private:
+	NVS m_nvs;
+}; // BLENVSAttributeCache
+
+
+/**
+ * @brief An attribute cache kept as one file per server in a directory of a mounted file system.
+ *
+ * The file names are 12 characters long so a FAT file system needs long file name support.
+ */
+class BLEFileAttributeCache : public BLEAttributeCache {
+public:
+	BLEFileAttributeCache(std::string directory);
+	bool load(BLEAddress address, std::string* pTable) override;
+	void remove(BLEAddress address) override;
+	void store(BLEAddress address, std::string table) override;
+
+private:
+	std::string m_directory;
+
+	std::string getPath(BLEAddress address);
+}; // BLEFileAttributeCache
+
+#endif /* CONFIG_BT_ENABLED */
+#endif /* COMPONENTS_CPP_UTILS_BLEATTRIBUTECACHE_H_ */
@@ -6,6 +6,7 @@
  */
 #include "sdkconfig.h"
 #if defined(CONFIG_BT_ENABLED)
+#include <algorithm>
 #include <sstream>
 #include <string.h>
 #include <iomanip>
@@ -46,6 +47,14 @@ BLECharacteristic::BLECharacteristic(BLEUUID uuid, uint32_t properties) {
 	m_handle     = NULL_HANDLE;
 	m_properties = (esp_gatt_char_prop_t)0;
 	m_pCallbacks = nullptr;
+	m_pBulkValue = nullptr;
+	m_writePending = false;
+
+	m_pCCCD              = nullptr;
+	m_notifySentCount    = 0;
+	m_notifyDroppedCount = 0;
+	m_notifyRateCount    = 0;
+	m_notifyRateTime     = FreeRTOS::getTimeSinceStart();
 
 	setBroadcastProperty((properties & PROPERTY_BROADCAST) !=0);
 	setReadProperty((properties & PROPERTY_READ) !=0);
@@ -71,10 +80,38 @@ BLECharacteristic::~BLECharacteristic() {
 void BLECharacteristic::addDescriptor(BLEDescriptor* pDescriptor) {
 	ESP_LOGD(LOG_TAG, ">> addDescriptor(): Adding %s to %s", pDescriptor->toString().c_str(), toString().c_str());
 	m_descriptorMap.setByUUID(pDescriptor->getUUID(), pDescriptor);
+	if (pDescriptor->getUUID().equals(BLEUUID((uint16_t) 0x2902))) {
+		m_pCCCD = pDescriptor;    // Subscriptions are kept for each client by the server.
+	}
 	ESP_LOGD(LOG_TAG, "<< addDescriptor()");
 } // addDescriptor
 
 
+/**
+ * @brief Note that a client has confirmed, or can no longer confirm, the indication being sent.
+ * The indication is complete when no client is left to confirm it.
+ * @param [in] connId The connection of the client.
+ * @return True if an indication was waiting for the client.
+ */
+bool BLECharacteristic::confirmIndication(uint16_t connId) {
+	m_semaphoreNotify.take("confirmIndication");
+	bool found = false;
+	for (auto it = m_indicateWaiting.begin(); it != m_indicateWaiting.end(); ++it) {
+		if (*it == connId) {
+			m_indicateWaiting.erase(it);
+			found = true;
+			break;
+		}
+	}
+	bool complete = found && m_indicateWaiting.empty();
+	m_semaphoreNotify.give();
+	if (complete) {
+		m_semaphoreConfEvt.give();
+	}
+	return found;
+} // confirmIndication
+
+
 /**
  * @brief Register a new characteristic with the ESP runtime.
  * @param [in] pService The service with which to associate this characteristic.
@@ -168,6 +205,41 @@ void BLECharacteristic::setAccessPermissions(esp_gatt_perm_t perm) {
 	m_permissions = perm;
 }
 
+
+/**
+ * @brief Get the number of notifications that were never sent because a newer value replaced them.
+ * @return The number of notifications dropped.
+ */
+uint32_t BLECharacteristic::getNotifyDroppedCount() {
+	return m_notifyDroppedCount;
+} // getNotifyDroppedCount
+
+
+/**
+ * @brief Get the rate at which notifications have been sent since the previous call.
+ * @return The notifications sent per second.
+ */
+float BLECharacteristic::getNotifyRate() {
+	uint32_t now   = FreeRTOS::getTimeSinceStart();
+	uint32_t count = m_notifySentCount;
+	float rate = 0;
+	if (now != m_notifyRateTime) {
+		rate = (count - m_notifyRateCount) * 1000.0 / (now - m_notifyRateTime);
+	}
+	m_notifyRateCount = count;
+	m_notifyRateTime  = now;
+	return rate;
+} // getNotifyRate
+
+
+/**
+ * @brief Get the number of notifications sent.
+ * @return The number of notifications sent.
+ */
+uint32_t BLECharacteristic::getNotifySentCount() {
+	return m_notifySentCount;
+} // getNotifySentCount
+
 esp_gatt_char_prop_t BLECharacteristic::getProperties() {
 	return m_properties;
 } // getProperties
@@ -213,6 +285,7 @@ void BLECharacteristic::handleGATTServerEvent(
 	//
 	// ESP_GATTS_ADD_CHAR_EVT
 	// ESP_GATTS_CONF_EVT
+	// ESP_GATTS_CONGEST_EVT
 	// ESP_GATTS_CONNECT_EVT
 	// ESP_GATTS_DISCONNECT_EVT
 	// ESP_GATTS_EXEC_WRITE_EVT
@@ -222,6 +295,7 @@ void BLECharacteristic::handleGATTServerEvent(
 		//
 		// ESP_GATTS_EXEC_WRITE_EVT
 		// When we receive this event it is an indication that a previous write long needs to be committed.
+		// Only the characteristic that received the parts acts on it; the server sends the one response.
 		//
 		// exec_write:
 		// - uint16_t conn_id
@@ -230,22 +304,26 @@ void BLECharacteristic::handleGATTServerEvent(
 		// - uint8_t exec_write_flag - Either ESP_GATT_PREP_WRITE_EXEC or ESP_GATT_PREP_WRITE_CANCEL
 		//
 		case ESP_GATTS_EXEC_WRITE_EVT: {
+			if (!m_writePending) {
+				break;
+			}
+			m_writePending = false;
 			if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC) {
-				m_value.commit();
+				if (m_pBulkValue != nullptr) {
+					m_pBulkValue->commit();
+				} else {
+					m_semaphoreNotify.take("commit");
+					m_value.commit();
+					m_semaphoreNotify.give();
+				}
 				if (m_pCallbacks != nullptr) {
 					m_pCallbacks->onWrite(this); // Invoke the onWrite callback handler.
 				}
+			} else if (m_pBulkValue != nullptr) {
+				m_pBulkValue->cancel();
 			} else {
 				m_value.cancel();
 			}
-
-			esp_err_t errRc = ::esp_ble_gatts_send_response(
-					gatts_if,
-					param->write.conn_id,
-					param->write.trans_id, ESP_GATT_OK, nullptr);
-			if (errRc != ESP_OK) {
-				ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_response: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-			}
 			break;
 		} // ESP_GATTS_EXEC_WRITE_EVT
 
@@ -280,12 +358,41 @@ void BLECharacteristic::handleGATTServerEvent(
 		// - uint8_t      *value
 		//
 		case ESP_GATTS_WRITE_EVT: {
+			// A write of our 0x2902 descriptor is a client subscribing.  The descriptor keeps the value
+			// last written by any client while the server keeps the value written by each.
+			if (m_pCCCD != nullptr && param->write.handle == m_pCCCD->getHandle() && !param->write.is_prep) {
+				uint16_t value = 0;
+				if (param->write.len >= 1) {
+					value = param->write.value[0];
+				}
+				if (param->write.len >= 2) {
+					value |= param->write.value[1] << 8;
+				}
+				getService()->getServer()->setSubscription(param->write.conn_id, m_handle, value);
+			}
 // We check if this write request is for us by comparing the handles in the event.  If it is for us
-// we save the new value.  Next we look at the need_rsp flag which indicates whether or not we need
-// to send a response.  If we do, then we formulate a response and send it.
+// we save the new value.  Each part of a long write is stored, at its offset, as it arrives.  Next we
+// look at the need_rsp flag which indicates whether or not we need to send a response.  If we do, then
+// we formulate a response and send it.
 			if (param->write.handle == m_handle) {
+				esp_gatt_status_t status = ESP_GATT_OK;
 				if (param->write.is_prep) {
-					m_value.addPart(param->write.value, param->write.len);
+					m_writePending = true;
+					bool accepted;
+					if (m_pBulkValue != nullptr) {
+						accepted = m_pBulkValue->write(param->write.offset, param->write.value, param->write.len);
+					} else {
+						accepted = m_value.addPart(param->write.value, param->write.len, param->write.offset);
+					}
+					if (!accepted) {
+						status = ESP_GATT_INVALID_OFFSET;
+					}
+				} else if (m_pBulkValue != nullptr) {
+					if (m_pBulkValue->write(0, param->write.value, param->write.len)) {
+						m_pBulkValue->commit();
+					} else {
+						status = ESP_GATT_INVALID_ATTR_LEN;
+					}
 				} else {
 					setValue(param->write.value, param->write.len);
 				}
@@ -309,13 +416,13 @@ void BLECharacteristic::handleGATTServerEvent(
 					esp_err_t errRc = ::esp_ble_gatts_send_response(
 							gatts_if,
 							param->write.conn_id,
-							param->write.trans_id, ESP_GATT_OK, &rsp);
+							param->write.trans_id, status, &rsp);
 					if (errRc != ESP_OK) {
 						ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_response: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
 					}
 				} // Response needed
 
-				if (m_pCallbacks != nullptr && param->write.is_prep != true) {
+				if (m_pCallbacks != nullptr && param->write.is_prep != true && status == ESP_GATT_OK) {
 					m_pCallbacks->onWrite(this); // Invoke the onWrite callback handler.
 				}
 			} // Match on handles.
@@ -335,88 +442,61 @@ void BLECharacteristic::handleGATTServerEvent(
 		// - bool          need_rsp
 		//
 		case ESP_GATTS_READ_EVT: {
+			// A read of our 0x2902 descriptor answers with the subscription of the client reading it.
+			if (m_pCCCD != nullptr && param->read.handle == m_pCCCD->getHandle()) {
+				uint16_t subscription = getService()->getServer()->getSubscription(param->read.conn_id, m_handle);
+				uint8_t data[2] = { (uint8_t) (subscription & 0xff), (uint8_t) (subscription >> 8) };
+				m_pCCCD->setValue(data, 2);
+			}
 			if (param->read.handle == m_handle) {
 
-
-
-// Here's an interesting thing.  The read request has the option of saying whether we need a response
-// or not.  What would it "mean" to receive a read request and NOT send a response back?  That feels like
-// a very strange read.
-//
-// We have to handle the case where the data we wish to send back to the client is greater than the maximum
-// packet size of 22 bytes.  In this case, we become responsible for chunking the data into units of 22 bytes.
-// The apparent algorithm is as follows:
-//
-// If the is_long flag is set then this is a follow on from an original read and we will already have sent at least 22 bytes.
-// If the is_long flag is not set then we need to check how much data we are going to send.  If we are sending LESS than
-// 22 bytes, then we "just" send it and thats the end of the story.
-// If we are sending 22 bytes exactly, we just send it BUT we will get a follow on request.
-// If we are sending more than 22 bytes, we send the first 22 bytes and we will get a follow on request.
-// Because of follow on request processing, we need to maintain an offset of how much data we have already sent
-// so that when a follow on request arrives, we know where to start in the data to send the next sequence.
-// Note that the indication that the client will send a follow on request is that we sent exactly 22 bytes as a response.
-// If our payload is divisible by 22 then the last response will be a response of 0 bytes in length.
-//
-// The following code has deliberately not been factored to make it fewer statements because this would cloud the
-// the logic flow comprehension.
-//
-				// TODO requires some more research to confirm that 512 is max PDU like in bluetooth specs
-				uint16_t maxOffset = BLEDevice::getMTU() - 1;
-				if (BLEDevice::getMTU() > 512) {
-					maxOffset = 512;
-				}
+// A value that doesn't fit in one response is read as a series of requests, the first a plain read and the
+// rest read blob requests (is_long) that each ask for the value from an offset onwards.  Each response
+// carries as much of the value from that offset as the MTU of the client allows; a response shorter than
+// that tells the client that it has reached the end.  The read callback is invoked for the first request
+// only so that the value doesn't change part way through.
 				if (param->read.need_rsp) {
 					ESP_LOGD(LOG_TAG, "Sending a response (esp_ble_gatts_send_response)");
-					esp_gatt_rsp_t rsp;
-
-					if (param->read.is_long) {
-						std::string value = m_value.getValue();
-
-						if (value.length() - m_value.getReadOffset() < maxOffset) {
-							// This is the last in the chain
-							rsp.attr_value.len    = value.length() - m_value.getReadOffset();
-							rsp.attr_value.offset = m_value.getReadOffset();
-							memcpy(rsp.attr_value.value, value.data() + rsp.attr_value.offset, rsp.attr_value.len);
-							m_value.setReadOffset(0);
-						} else {
-							// There will be more to come.
-							rsp.attr_value.len    = maxOffset;
-							rsp.attr_value.offset = m_value.getReadOffset();
-							memcpy(rsp.attr_value.value, value.data() + rsp.attr_value.offset, rsp.attr_value.len);
-							m_value.setReadOffset(rsp.attr_value.offset + maxOffset);
-						}
-					} else { // read.is_long == false
-
-						if (m_pCallbacks != nullptr) {  // If is.long is false then this is the first (or only) request to read data, so invoke the callback
-							m_pCallbacks->onRead(this);   // Invoke the read callback.
-						}
+					if (!param->read.is_long && m_pCallbacks != nullptr) {
+						m_pCallbacks->onRead(this);   // Invoke the read callback.
+					}
 
-						std::string value = m_value.getValue();
+					BLEServerSession* pSession = getService()->getServer()->getSession(param->read.conn_id);
+					size_t maxLength = (pSession != nullptr ? pSession->getMTU() : 23) - 1;   // A read response has a 1 byte header.
+					if (maxLength > ESP_GATT_MAX_ATTR_LEN) {
+						maxLength = ESP_GATT_MAX_ATTR_LEN;
+					}
 
-						if (value.length()+1 > maxOffset) {
-							// Too big for a single shot entry.
-							m_value.setReadOffset(maxOffset);
-							rsp.attr_value.len    = maxOffset;
-							rsp.attr_value.offset = 0;
-							memcpy(rsp.attr_value.value, value.data(), rsp.attr_value.len);
+					esp_gatt_rsp_t rsp;
+					esp_gatt_status_t status = ESP_GATT_OK;
+					m_semaphoreNotify.take("read");
+					size_t length = m_pBulkValue != nullptr ? m_pBulkValue->getLength() : m_value.getLength();
+					if (param->read.offset > length) {
+						status = ESP_GATT_INVALID_OFFSET;
+						rsp.attr_value.len = 0;
+					} else {
+						rsp.attr_value.len = std::min(length - param->read.offset, maxLength);
+						if (m_pBulkValue != nullptr) {
+							rsp.attr_value.len = m_pBulkValue->read(param->read.offset, rsp.attr_value.value, rsp.attr_value.len);
 						} else {
-							// Will fit in a single packet with no callbacks required.
-							rsp.attr_value.len    = value.length();
-							rsp.attr_value.offset = 0;
-							memcpy(rsp.attr_value.value, value.data(), rsp.attr_value.len);
+							memcpy(rsp.attr_value.value, m_value.getData() + param->read.offset, rsp.attr_value.len);
 						}
 					}
+					m_semaphoreNotify.give();
+					rsp.attr_value.offset   = param->read.offset;
 					rsp.attr_value.handle   = param->read.handle;
 					rsp.attr_value.auth_req = ESP_GATT_AUTH_REQ_NONE;
 
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG  // Don't build the hex for a value that won't be logged.
 					char *pHexData = BLEUtils::buildHexData(nullptr, rsp.attr_value.value, rsp.attr_value.len);
 					ESP_LOGD(LOG_TAG, " - Data: length=%d, data=%s, offset=%d", rsp.attr_value.len, pHexData, rsp.attr_value.offset);
 					free(pHexData);
+#endif
 
 					esp_err_t errRc = ::esp_ble_gatts_send_response(
 							gatts_if, param->read.conn_id,
 							param->read.trans_id,
-							ESP_GATT_OK,
+							status,
 							&rsp);
 					if (errRc != ESP_OK) {
 						ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_response: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
@@ -428,25 +508,32 @@ void BLECharacteristic::handleGATTServerEvent(
 
 
 		// ESP_GATTS_CONF_EVT
+		// Sent when an indication has been confirmed or a notification has been sent.  An indication
+		// is complete once every client it was sent to has confirmed it.  A notification returns its
+		// credit to the client's session.
 		//
 		// conf:
 		// - esp_gatt_status_t status  – The status code.
 		// - uint16_t          conn_id – The connection used.
+		// - uint16_t          handle  – The attribute handle.
 		//
 		case ESP_GATTS_CONF_EVT: {
-			m_semaphoreConfEvt.give();
-			break;
-		}
-
-		case ESP_GATTS_CONNECT_EVT: {
-			m_semaphoreConfEvt.give();
+			if (param->conf.handle != getHandle()) {
+				break;
+			}
+			if (!confirmIndication(param->conf.conn_id)) {
+				getService()->getServer()->notifySent(param->conf.conn_id);
+			}
 			break;
-		}
+		} // ESP_GATTS_CONF_EVT
 
+		// ESP_GATTS_DISCONNECT_EVT
+		// A client that has gone won't confirm an indication.
+		//
 		case ESP_GATTS_DISCONNECT_EVT: {
-			m_semaphoreConfEvt.give();
+			confirmIndication(param->disconnect.conn_id);
 			break;
-		}
+		} // ESP_GATTS_DISCONNECT_EVT
 
 		default: {
 			break;
@@ -464,48 +551,28 @@ void BLECharacteristic::handleGATTServerEvent(
 
 /**
  * @brief Send an indication.
- * An indication is a transmission of up to the first 20 bytes of the characteristic value.  An indication
- * will block waiting a positive confirmation from the client.
+ * An indication is a transmission of up to the first (MTU - 3) bytes of the characteristic value.  An indication
+ * will block waiting a positive confirmation from each client that it was sent to.
  * @return N/A
  */
 void BLECharacteristic::indicate() {
 
-	ESP_LOGD(LOG_TAG, ">> indicate: length: %d", m_value.getValue().length());
+	ESP_LOGD(LOG_TAG, ">> indicate: length: %d", m_value.getLength());
 
 	assert(getService() != nullptr);
 	assert(getService()->getServer() != nullptr);
 
-	GeneralUtils::hexDump((uint8_t*)m_value.getValue().data(), m_value.getValue().length());
-
 	if (getService()->getServer()->getConnectedCount() == 0) {
 		ESP_LOGD(LOG_TAG, "<< indicate: No connected clients.");
 		return;
 	}
 
-	// Test to see if we have a 0x2902 descriptor.  If we do, then check to see if indications are enabled
-	// and, if not, prevent the indication.
-
-	BLE2902 *p2902 = (BLE2902*)getDescriptorByUUID((uint16_t)0x2902);
-	if (p2902 != nullptr && !p2902->getIndications()) {
-		ESP_LOGD(LOG_TAG, "<< indications disabled; ignoring");
-		return;
-	}
-
-	if (m_value.getValue().length() > (BLEDevice::getMTU() - 3)) {
-		ESP_LOGI(LOG_TAG, "- Truncating to %d bytes (maximum indicate size)", BLEDevice::getMTU() - 3);
-	}
-
-	size_t length = m_value.getValue().length();
-
+	// The indication is sent to each client that has enabled indications in our 0x2902 descriptor or, if
+	// we have no such descriptor, to every client.
 	m_semaphoreConfEvt.take("indicate");
-
-	esp_err_t errRc = ::esp_ble_gatts_send_indicate(
-			getService()->getServer()->getGattsIf(),
-			getService()->getServer()->getConnId(),
-			getHandle(), length, (uint8_t*)m_value.getValue().data(), true); // The need_confirm = true makes this an indication.
-
-	if (errRc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "<< esp_ble_gatts_send_indicate: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+	if (getService()->getServer()->indicate(this) == 0) {
+		ESP_LOGD(LOG_TAG, "<< indicate: No client to indicate");
+		m_semaphoreConfEvt.give();
 		return;
 	}
 
@@ -516,54 +583,29 @@ void BLECharacteristic::indicate() {
 
 /**
  * @brief Send a notify.
- * A notification is a transmission of up to the first 20 bytes of the characteristic value.  An notification
- * will not block; it is a fire and forget.
+ * A notification is a transmission of up to the first (MTU - 3) bytes of the characteristic value to
+ * each client that has enabled notifications in our 0x2902 descriptor or, if we have no such descriptor,
+ * to every client.  A notification doesn't wait; up to the number of credits (see
+ * BLEServer::setNotifyCredits()) may be in flight to each client at once.  When a client's credits are all
+ * in use, or its connection is congested, the notification is sent to it as soon as a credit is returned.
+ * Only the latest value waits to be sent, so a value that is replaced before then is never sent to that
+ * client and is counted as dropped.
  * @return N/A.
  */
 void BLECharacteristic::notify() {
-	ESP_LOGD(LOG_TAG, ">> notify: length: %d", m_value.getValue().length());
-
+	ESP_LOGV(LOG_TAG, ">> notify: length: %d", m_value.getLength());
 
 	assert(getService() != nullptr);
 	assert(getService()->getServer() != nullptr);
 
-
-	GeneralUtils::hexDump((uint8_t*)m_value.getValue().data(), m_value.getValue().length());
-
 	if (getService()->getServer()->getConnectedCount() == 0) {
 		ESP_LOGD(LOG_TAG, "<< notify: No connected clients.");
 		return;
 	}
 
-	// Test to see if we have a 0x2902 descriptor.  If we do, then check to see if notification is enabled
-	// and, if not, prevent the notification.
-
-	BLE2902 *p2902 = (BLE2902*)getDescriptorByUUID((uint16_t)0x2902);
-	if (p2902 != nullptr && !p2902->getNotifications()) {
-		ESP_LOGD(LOG_TAG, "<< notifications disabled; ignoring");
-		return;
-	}
-
-	if (m_value.getValue().length() > (BLEDevice::getMTU() - 3)) {
-		ESP_LOGI(LOG_TAG, "- Truncating to %d bytes (maximum notify size)", BLEDevice::getMTU() - 3);
-	}
-
-	size_t length = m_value.getValue().length();
-
-	m_semaphoreConfEvt.take("notify");
-
-	esp_err_t errRc = ::esp_ble_gatts_send_indicate(
-			getService()->getServer()->getGattsIf(),
-			getService()->getServer()->getConnId(),
-			getHandle(), length, (uint8_t*)m_value.getValue().data(), false); // The need_confirm = false makes this a notify.
-	if (errRc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "<< esp_ble_gatts_send_indicate: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-		return;
-	}
-
-	m_semaphoreConfEvt.wait("notify");
+	getService()->getServer()->notify(this);
 
-	ESP_LOGD(LOG_TAG, "<< notify");
+	ESP_LOGV(LOG_TAG, "<< notify");
 } // Notify
 
 
@@ -584,6 +626,20 @@ void BLECharacteristic::setBroadcastProperty(bool value) {
 } // setBroadcastProperty
 
 
+/**
+ * @brief Serve reads and writes of this characteristic from a bulk value rather than from a value held in memory.
+ *
+ * Use a bulk value for values too large to hold whole, such as configuration blobs or small images, that
+ * clients read and write with long reads and long (prepared) writes.  Notifications and indications still
+ * send the value set with setValue().
+ *
+ * @param [in] pBulkValue The bulk value, or nullptr to go back to the value set with setValue().
+ */
+void BLECharacteristic::setBulkValue(BLEBulkValue* pBulkValue) {
+	m_pBulkValue = pBulkValue;
+} // setBulkValue
+
+
 /**
  * @brief Set the callback handlers for this characteristic.
  * @param [in] pCallbacks An instance of a callbacks structure used to define any callbacks for the characteristic.
@@ -660,14 +716,18 @@ void BLECharacteristic::setReadProperty(bool value) {
  * @param [in] length The length of the data in bytes.
  */
 void BLECharacteristic::setValue(uint8_t* data, size_t length) {
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG  // Don't build the hex for a value that won't be logged.
 	char *pHex = BLEUtils::buildHexData(nullptr, data, length);
 	ESP_LOGD(LOG_TAG, ">> setValue: length=%d, data=%s, characteristic UUID=%s", length, pHex, getUUID().toString().c_str());
 	free(pHex);
+#endif
 	if (length > ESP_GATT_MAX_ATTR_LEN) {
 		ESP_LOGE(LOG_TAG, "Size %d too large, must be no bigger than %d", length, ESP_GATT_MAX_ATTR_LEN);
 		return;
 	}
+	m_semaphoreNotify.take("setValue");  // A pending notification may be sent from the value at any time.
 	m_value.setValue(data, length);
+	m_semaphoreNotify.give();
 	ESP_LOGD(LOG_TAG, "<< setValue");
 } // setValue
 
@@ -11,6 +11,8 @@
 #if defined(CONFIG_BT_ENABLED)
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include "BLEUUID.h"
 #include <esp_gatts_api.h>
 #include <esp_gap_ble_api.h>
@@ -43,6 +45,7 @@ public:
 private:
 	std::map<std::string, BLEDescriptor *> m_uuidMap;
 	std::map<uint16_t,    BLEDescriptor *> m_handleMap;
+	std::unordered_multimap<uint32_t, BLEDescriptor *> m_uuidIndex;  // Hash of the UUID to the descriptor.
 	std::map<std::string, BLEDescriptor *>::iterator m_iterator;
 };
 
@@ -63,12 +66,16 @@ public:
 	BLEDescriptor* getDescriptorByUUID(const char* descriptorUUID);
 	BLEDescriptor* getDescriptorByUUID(BLEUUID descriptorUUID);
 	//size_t         getLength();
+	uint32_t       getNotifyDroppedCount();
+	float          getNotifyRate();
+	uint32_t       getNotifySentCount();
 	BLEUUID        getUUID();
 	std::string    getValue();
 
 	void indicate();
 	void notify();
 	void setBroadcastProperty(bool value);
+	void setBulkValue(BLEBulkValue* pBulkValue);
 	void setCallbacks(BLECharacteristicCallbacks* pCallbacks);
 	void setIndicateProperty(bool value);
 	void setNotifyProperty(bool value);
@@ -96,6 +103,7 @@ public:
 private:
 
 	friend class BLEServer;
+	friend class BLEServerSession;
 	friend class BLEService;
 	friend class BLEDescriptor;
 	friend class BLECharacteristicMap;
@@ -107,19 +115,29 @@ private:
 	BLECharacteristicCallbacks* m_pCallbacks;
 	BLEService*                 m_pService;
 	BLEValue                    m_value;
+	BLEBulkValue*               m_pBulkValue;          // Used in place of m_value for reads and writes, if set.
+	bool                        m_writePending;        // Have parts of a long write arrived that await execution?
 	esp_gatt_perm_t             m_permissions = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
+	BLEDescriptor*              m_pCCCD;               // The 0x2902 descriptor, if any.
+	std::vector<uint16_t>       m_indicateWaiting;     // Connections that haven't yet confirmed the indication.
+	uint32_t                    m_notifySentCount;
+	uint32_t                    m_notifyDroppedCount;  // Notifications replaced by a newer value before they could be sent.
+	uint32_t                    m_notifyRateCount;     // Sent count at the last call to getNotifyRate().
+	uint32_t                    m_notifyRateTime;      // Time of the last call to getNotifyRate() (ms).
 
 	void handleGATTServerEvent(
 			esp_gatts_cb_event_t      event,
 			esp_gatt_if_t             gatts_if,
 			esp_ble_gatts_cb_param_t* param);
 
+	bool                 confirmIndication(uint16_t connId);
 	void                 executeCreate(BLEService* pService);
 	esp_gatt_char_prop_t getProperties();
 	BLEService*          getService();
 	void                 setHandle(uint16_t handle);
 	FreeRTOS::Semaphore m_semaphoreCreateEvt = FreeRTOS::Semaphore("CreateEvt");
 	FreeRTOS::Semaphore m_semaphoreConfEvt   = FreeRTOS::Semaphore("ConfEvt");
+	FreeRTOS::Semaphore m_semaphoreNotify    = FreeRTOS::Semaphore("Notify");  // Guards the value and the indications waiting.
 }; // BLECharacteristic
 
 
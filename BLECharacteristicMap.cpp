@@ -40,12 +40,12 @@ BLECharacteristic* BLECharacteristicMap::getByUUID(const char* uuid) {
  * @return The characteristic.
  */
 BLECharacteristic* BLECharacteristicMap::getByUUID(BLEUUID uuid) {
-	for (auto &myPair : m_uuidMap) {
-		if (myPair.first->getUUID().equals(uuid)) {
-			return myPair.first;
+	auto range = m_uuidIndex.equal_range(uuid.hash());
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second->getUUID().equals(uuid)) {
+			return it->second;
 		}
 	}
-	//return m_uuidMap.at(uuid.toString());
 	return nullptr;
 } // getByUUID
 
@@ -118,6 +118,7 @@ void BLECharacteristicMap::setByUUID(
 		BLECharacteristic *pCharacteristic,
 		BLEUUID            uuid) {
 	m_uuidMap.insert(std::pair<BLECharacteristic *, std::string>(pCharacteristic, uuid.toString()));
+	m_uuidIndex.insert(std::pair<uint32_t, BLECharacteristic *>(uuid.hash(), pCharacteristic));
 } // setByUUID
 
 
@@ -12,9 +12,11 @@
 #include <esp_gap_ble_api.h>
 #include <esp_gattc_api.h>
 #include "BLEClient.h"
+#include "BLEDevice.h"
 #include "BLEUtils.h"
 #include "BLEService.h"
 #include "GeneralUtils.h"
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <unordered_set>
@@ -44,12 +46,93 @@
  */
 static const char* LOG_TAG = "BLEClient";
 
+static const BLEUUID GATT_SERVICE_UUID((uint16_t) 0x1801);      // The Generic Attribute service.
+static const BLEUUID SERVICE_CHANGED_UUID((uint16_t) 0x2a05);   // Indicated when the server's attributes change.
+static const BLEUUID DATABASE_HASH_UUID((uint16_t) 0x2b2a);     // A hash of the server's attributes.
+static const BLEUUID CCCD_UUID((uint16_t) 0x2902);              // Client Characteristic Configuration.
+static const uint8_t ATTRIBUTE_TABLE_VERSION = 1;               // The format of an encoded attribute table.
+
+
+/**
+ * @brief Reads the fields of an encoded attribute table, remembering if it ran past the end.
+ */
+class BLEAttributeTableReader {
+public:
+	BLEAttributeTableReader(const std::string& table) : m_table(table), m_offset(0), m_ok(true) {}
+
+	std::string getBytes(size_t length) {
+		if (m_offset + length > m_table.length()) {
+			m_ok = false;
+			return "";
+		}
+		m_offset += length;
+		return m_table.substr(m_offset - length, length);
+	}
+
+	uint8_t getUInt8() {
+		std::string bytes = getBytes(1);
+		return m_ok ? (uint8_t) bytes[0] : 0;
+	}
+
+	uint16_t getUInt16() {
+		std::string bytes = getBytes(2);
+		return m_ok ? (uint8_t) bytes[0] | ((uint8_t) bytes[1] << 8) : 0;
+	}
+
+	esp_bt_uuid_t getUUID() {
+		esp_bt_uuid_t uuid;
+		memset(&uuid, 0, sizeof(uuid));
+		uuid.len = getUInt8();
+		if (uuid.len != ESP_UUID_LEN_16 && uuid.len != ESP_UUID_LEN_32 && uuid.len != ESP_UUID_LEN_128) {
+			m_ok = false;
+			return uuid;
+		}
+		std::string bytes = getBytes(uuid.len);
+		if (m_ok) {
+			memcpy(&uuid.uuid, bytes.data(), uuid.len);
+		}
+		return uuid;
+	}
+
+	bool hasFailed() {
+		return !m_ok;
+	}
+
+	bool isComplete() {
+		return m_ok && m_offset == m_table.length();   // Trailing bytes mean the table isn't what we think it is.
+	}
+
+private:
+	const std::string& m_table;
+	size_t             m_offset;
+	bool               m_ok;
+}; // BLEAttributeTableReader
+
+
+static void putUInt16(std::string* pTable, uint16_t value) {
+	*pTable += (char) (value & 0xff);
+	*pTable += (char) (value >> 8);
+} // putUInt16
+
+
+static void putUUID(std::string* pTable, BLEUUID uuid) {
+	esp_bt_uuid_t* pNative = uuid.getNative();
+	*pTable += (char) pNative->len;
+	pTable->append((char*) &pNative->uuid, pNative->len);
+} // putUUID
+
+
 BLEClient::BLEClient() {
+	m_pAttributeCache  = nullptr;
 	m_pClientCallbacks = nullptr;
+	m_appId            = 0;
 	m_conn_id          = 0;
-	m_gattc_if         = 0;
+	m_gattc_if         = ESP_GATT_IF_NONE;   // Not registered until the first connect.
 	m_haveServices     = false;
 	m_isConnected      = false;  // Initially, we are flagged as not connected.
+	m_mtu              = 23;
+	m_congested        = false;
+	m_operationStarted = false;
 } // BLEClient
 
 
@@ -63,9 +146,64 @@ BLEClient::~BLEClient() {
 	   delete myPair.second;
 	}
 	m_servicesMap.clear();
+	for (auto &pOperation : m_operations) {
+		delete pOperation;
+	}
+	BLEDevice::removeClient(this);
+	if (m_gattc_if != ESP_GATT_IF_NONE) {
+		::esp_ble_gattc_app_unregister(m_gattc_if);
+	}
 } // ~BLEClient
 
 
+/**
+ * @brief Complete all the queued operations with an error.
+ *
+ * Called when the connection is lost.  Nothing that was queued will now be sent.
+ */
+void BLEClient::cancelOperations() {
+	m_semaphoreOperations.take("cancelOperations");
+	std::deque<Operation*> operations;
+	operations.swap(m_operations);
+	m_operationStarted = false;
+	m_congested        = false;
+	m_semaphoreOperations.give();
+
+	for (auto &pOperation : operations) {
+		completeOperation(pOperation, ESP_GATT_ERROR, nullptr, 0);
+	}
+} // cancelOperations
+
+
+/**
+ * @brief Tell the owner of an operation of its outcome and release the operation.
+ * @param [in] pOperation The operation, which is no longer queued.
+ * @param [in] status The outcome of the operation.
+ * @param [in] pData The value read, if the operation was a read.
+ * @param [in] length The length of the value read.
+ */
+void BLEClient::completeOperation(Operation* pOperation, esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	if (status != ESP_GATT_OK) {
+		ESP_LOGD(LOG_TAG, "Operation failed: %s", BLEUtils::gattStatusToString(status).c_str());
+	}
+	BLEOperationCallbacks* pCallbacks = pOperation->pCallbacks;
+	if (pCallbacks != nullptr) {
+		switch (pOperation->type) {
+			case OPERATION_READ:
+				pCallbacks->onRead(pOperation->pCharacteristic, status, pData, length);
+				break;
+			case OPERATION_READ_MULTIPLE:
+				pCallbacks->onReadMultiple(this, status, pData, length);
+				break;
+			default:
+				pCallbacks->onWrite(pOperation->pCharacteristic, status);
+				break;
+		}
+	}
+	delete pOperation;
+} // completeOperation
+
+
 /**
  * @brief Clear any existing services.
  *
@@ -90,20 +228,24 @@ void BLEClient::clearServices() {
 bool BLEClient::connect(BLEAddress address) {
 	ESP_LOGD(LOG_TAG, ">> connect(%s)", address.toString().c_str());
 
-// We need the connection handle that we get from registering the application.  We register the app
-// and then block on its completion.  When the event has arrived, we will have the handle.
-	m_semaphoreRegEvt.take("connect");
-
 	clearServices(); // Delete any services that may exist.
 
-	esp_err_t errRc = ::esp_ble_gattc_app_register(0);
-	if (errRc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "esp_ble_gattc_app_register: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-		return false;
+// We need the interface that we get from registering the application.  We register the app and then
+// block on its completion.  When the event has arrived, we will have the interface.  The app stays
+// registered until the client is deleted so that connecting again doesn't use up another of the
+// applications that the stack can hold.
+	esp_err_t errRc;
+	if (m_gattc_if == ESP_GATT_IF_NONE) {
+		m_semaphoreRegEvt.take("connect");
+		errRc = ::esp_ble_gattc_app_register(m_appId);
+		if (errRc != ESP_OK) {
+			ESP_LOGE(LOG_TAG, "esp_ble_gattc_app_register: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+			m_semaphoreRegEvt.give();
+			return false;
+		}
+		m_semaphoreRegEvt.wait("connect");
 	}
 
-	m_semaphoreRegEvt.wait("connect");
-
 	m_peerAddress = address;
 
 	// Perform the open connection request against the target BLE Server.
@@ -120,14 +262,86 @@ bool BLEClient::connect(BLEAddress address) {
 	}
 
 	uint32_t rc = m_semaphoreOpenEvt.wait("connect");   // Wait for the connection to complete.
+
+// If we want a bigger MTU than the default, ask for it now and wait for the exchange to complete so that
+// the first transfers over the connection can already use it.
+	if (rc == ESP_GATT_OK && BLEDevice::getMTU() > 23) {
+		m_semaphoreCfgMtuEvt.take("connect");
+		errRc = ::esp_ble_gattc_send_mtu_req(getGattcIf(), getConnId());
+		if (errRc != ESP_OK) {
+			ESP_LOGE(LOG_TAG, "esp_ble_gattc_send_mtu_req: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+			m_semaphoreCfgMtuEvt.give();
+		} else {
+			m_semaphoreCfgMtuEvt.wait("connect");
+		}
+	}
 	ESP_LOGD(LOG_TAG, "<< connect(), rc=%d", rc==ESP_GATT_OK);
 	return rc == ESP_GATT_OK;
 } // connect
 
 
+/**
+ * @brief Build the services, characteristics and descriptors of the server from an encoded attribute table.
+ *
+ * The table is laid out as:
+ *
+ * ```
+ * version, hash length, hash, service count,
+ *   for each service: uuid, instance id, start handle, end handle, characteristic count,
+ *     for each characteristic: handle, properties, uuid, descriptor count,
+ *       for each descriptor: handle, uuid
+ * ```
+ *
+ * where a count is one byte except for the characteristic count, a handle is two bytes, least significant
+ * first, and a uuid is its length followed by its bytes in the order of esp_bt_uuid_t.
+ *
+ * @param [in] table The table.
+ * @param [out] pHash The Database Hash that the server had when the table was built, or empty if it has none.
+ * @return True if the table was well formed.  If it wasn't, some of the services may have been built.
+ */
+bool BLEClient::decodeAttributes(const std::string& table, std::string* pHash) {
+	BLEAttributeTableReader reader(table);
+	if (reader.getUInt8() != ATTRIBUTE_TABLE_VERSION) {
+		return false;
+	}
+	*pHash = reader.getBytes(reader.getUInt8());
+	uint8_t serviceCount = reader.getUInt8();
+	for (int i = 0; i < serviceCount && !reader.hasFailed(); i++) {
+		esp_gatt_id_t srvcId;
+		srvcId.uuid    = reader.getUUID();
+		srvcId.inst_id = reader.getUInt8();
+		uint16_t startHandle = reader.getUInt16();
+		uint16_t endHandle   = reader.getUInt16();
+		BLERemoteService* pService = new BLERemoteService(srvcId, this, startHandle, endHandle);
+		m_servicesMap.insert(std::pair<std::string, BLERemoteService*>(pService->getUUID().toString(), pService));
+
+		uint16_t characteristicCount = reader.getUInt16();
+		for (int j = 0; j < characteristicCount && !reader.hasFailed(); j++) {
+			uint16_t             handle     = reader.getUInt16();
+			esp_gatt_char_prop_t properties = reader.getUInt8();
+			BLERemoteCharacteristic* pCharacteristic = new BLERemoteCharacteristic(handle, BLEUUID(reader.getUUID()), properties, pService);
+			pService->m_characteristicMap.insert(std::pair<std::string, BLERemoteCharacteristic*>(pCharacteristic->getUUID().toString(), pCharacteristic));
+
+			uint8_t descriptorCount = reader.getUInt8();
+			for (int k = 0; k < descriptorCount && !reader.hasFailed(); k++) {
+				uint16_t handle = reader.getUInt16();
+				BLERemoteDescriptor* pDescriptor = new BLERemoteDescriptor(handle, BLEUUID(reader.getUUID()), pCharacteristic);
+				pCharacteristic->m_descriptorMap.insert(std::pair<std::string, BLERemoteDescriptor*>(pDescriptor->getUUID().toString(), pDescriptor));
+			}
+		}
+		pService->m_haveCharacteristics = true;
+	}
+	return reader.isComplete();
+} // decodeAttributes
+
+
 /**
  * @brief Disconnect from the peer.
- * @return N/A.
+ *
+ * The link is closed by the stack after we return.  Our application stays registered so that the
+ * ESP_GATTC_DISCONNECT_EVT that follows reaches us and is handled just as when the server drops the
+ * link: onDisconnect() is called, the queued operations are cancelled and any waiting task is released.
+ * Until then isConnected() is still true.  The application is unregistered when the client is deleted.
  */
 void BLEClient::disconnect() {
 	ESP_LOGD(LOG_TAG, ">> disconnect()");
@@ -136,12 +350,74 @@ void BLEClient::disconnect() {
 		ESP_LOGE(LOG_TAG, "esp_ble_gattc_close: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
 		return;
 	}
-	esp_ble_gattc_app_unregister(getGattcIf());
-	m_peerAddress = BLEAddress("00:00:00:00:00:00");
 	ESP_LOGD(LOG_TAG, "<< disconnect()");
 } // disconnect
 
 
+/**
+ * @brief Encode the services, characteristics and descriptors of the server as an attribute table.
+ *
+ * See decodeAttributes() for the layout.  All the characteristics of the services must have been retrieved.
+ *
+ * @param [in] hash The value of the Database Hash of the server, or empty if it has none.
+ * @return The table or an empty string if the server has too many attributes for the layout.
+ */
+std::string BLEClient::encodeAttributes(const std::string& hash) {
+	if (m_servicesMap.size() > 0xff) {
+		return "";
+	}
+	std::string table;
+	table += (char) ATTRIBUTE_TABLE_VERSION;
+	table += (char) hash.length();
+	table += hash;
+	table += (char) m_servicesMap.size();
+	for (auto &servicePair : m_servicesMap) {
+		BLERemoteService* pService = servicePair.second;
+		putUUID(&table, BLEUUID(pService->m_srvcId.uuid));
+		table += (char) pService->m_srvcId.inst_id;
+		putUInt16(&table, pService->m_startHandle);
+		putUInt16(&table, pService->m_endHandle);
+		putUInt16(&table, pService->m_characteristicMap.size());
+		for (auto &characteristicPair : pService->m_characteristicMap) {
+			BLERemoteCharacteristic* pCharacteristic = characteristicPair.second;
+			if (pCharacteristic->m_descriptorMap.size() > 0xff) {
+				return "";
+			}
+			putUInt16(&table, pCharacteristic->getHandle());
+			table += (char) pCharacteristic->m_charProp;
+			putUUID(&table, pCharacteristic->getUUID());
+			table += (char) pCharacteristic->m_descriptorMap.size();
+			for (auto &descriptorPair : pCharacteristic->m_descriptorMap) {
+				putUInt16(&table, descriptorPair.second->getHandle());
+				putUUID(&table, descriptorPair.second->getUUID());
+			}
+		}
+	}
+	return table;
+} // encodeAttributes
+
+
+/**
+ * @brief Find a characteristic of the server without discovering anything.
+ * @param [in] serviceUUID The UUID of the service of the characteristic.
+ * @param [in] characteristicUUID The UUID of the characteristic.
+ * @return The characteristic or nullptr if it isn't known.
+ */
+BLERemoteCharacteristic* BLEClient::findCharacteristic(BLEUUID serviceUUID, BLEUUID characteristicUUID) {
+	for (auto &servicePair : m_servicesMap) {
+		if (!servicePair.second->getUUID().equals(serviceUUID)) {
+			continue;
+		}
+		for (auto &characteristicPair : servicePair.second->m_characteristicMap) {
+			if (characteristicPair.second->getUUID().equals(characteristicUUID)) {
+				return characteristicPair.second;
+			}
+		}
+	}
+	return nullptr;
+} // findCharacteristic
+
+
 /**
  * @brief Handle GATT Client events
  */
@@ -150,6 +426,15 @@ void BLEClient::gattClientEventHandler(
 	esp_gatt_if_t             gattc_if,
 	esp_ble_gattc_cb_param_t* evtParam) {
 
+	// Every client is given every event.  Look only at those of our own application.
+	if (event == ESP_GATTC_REG_EVT) {
+		if (evtParam->reg.app_id != m_appId) {
+			return;
+		}
+	} else if (gattc_if != m_gattc_if && gattc_if != ESP_GATT_IF_NONE) {
+		return;
+	}
+
 	// Execute handler code based on the type of event received.
 	switch(event) {
 
@@ -160,18 +445,44 @@ void BLEClient::gattClientEventHandler(
 		// - esp_gatt_status_t status
 		// - uint16_t          conn_id
 		// - esp_bd_addr_t     remote_bda
+		//
+		// The stack tells every application of every link that goes down, not just of its own.
+		//
 		case ESP_GATTC_DISCONNECT_EVT: {
+				if (!m_isConnected || !m_peerAddress.equals(BLEAddress(evtParam->disconnect.remote_bda))) {
+					break;
+				}
 				// If we receive a disconnect event, set the class flag that indicates that we are
 				// no longer connected.
 				if (m_pClientCallbacks != nullptr) {
 					m_pClientCallbacks->onDisconnect(this);
 				}
 				m_isConnected = false;
+				m_mtu         = 23;
+				cancelOperations();
 				m_semaphoreRssiCmplEvt.give();
+				m_semaphoreCfgMtuEvt.give();
 				m_semaphoreSearchCmplEvt.give(1);
 				break;
 		} // ESP_GATTC_DISCONNECT_EVT
 
+		//
+		// ESP_GATTC_CONGEST_EVT
+		//
+		// congest:
+		// - uint16_t conn_id
+		// - bool     congested
+		//
+		// Writes without response are held back while the connection is congested.
+		//
+		case ESP_GATTC_CONGEST_EVT: {
+			m_congested = evtParam->congest.congested;
+			if (!m_congested) {
+				runOperations();
+			}
+			break;
+		} // ESP_GATTC_CONGEST_EVT
+
 		//
 		// ESP_GATTC_OPEN_EVT
 		//
@@ -183,6 +494,7 @@ void BLEClient::gattClientEventHandler(
 		//
 		case ESP_GATTC_OPEN_EVT: {
 			m_conn_id = evtParam->open.conn_id;
+			m_mtu     = evtParam->open.mtu;
 			if (m_pClientCallbacks != nullptr) {
 				m_pClientCallbacks->onConnect(this);
 			}
@@ -194,6 +506,79 @@ void BLEClient::gattClientEventHandler(
 		} // ESP_GATTC_OPEN_EVT
 
 
+		//
+		// ESP_GATTC_CFG_MTU_EVT
+		//
+		// cfg_mtu:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		// - uint16_t          mtu
+		//
+		case ESP_GATTC_CFG_MTU_EVT: {
+			if (evtParam->cfg_mtu.status == ESP_GATT_OK) {
+				m_mtu = evtParam->cfg_mtu.mtu;
+			} else {
+				ESP_LOGE(LOG_TAG, "MTU exchange failed: %s", BLEUtils::gattStatusToString(evtParam->cfg_mtu.status).c_str());
+			}
+			m_semaphoreCfgMtuEvt.give();
+			break;
+		} // ESP_GATTC_CFG_MTU_EVT
+
+
+		//
+		// ESP_GATTC_READ_CHAR_EVT
+		//
+		// read:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		// - uint16_t          handle
+		// - uint8_t*          value
+		// - uint16_t          value_len
+		//
+		case ESP_GATTC_READ_CHAR_EVT: {
+			Operation* pOperation = getOperation();
+			if (pOperation == nullptr || pOperation->type != OPERATION_READ ||
+					pOperation->pCharacteristic->getHandle() != evtParam->read.handle) {
+				break;
+			}
+			finishOperation(evtParam->read.status, evtParam->read.value, evtParam->read.value_len);
+			runOperations();
+			break;
+		} // ESP_GATTC_READ_CHAR_EVT
+
+
+		//
+		// ESP_GATTC_READ_MULTIPLE_EVT
+		// The values of a read multiple, one after another.
+		//
+		// read:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		// - uint8_t*          value
+		// - uint16_t          value_len
+		//
+		case ESP_GATTC_READ_MULTIPLE_EVT: {
+			Operation* pOperation = getOperation();
+			if (pOperation == nullptr || pOperation->type != OPERATION_READ_MULTIPLE) {
+				break;
+			}
+			esp_gatt_status_t status = evtParam->read.status;
+			if (status == ESP_GATT_OK) {
+				pOperation->value.append((char*) evtParam->read.value, evtParam->read.value_len);
+				// A request holds at most ESP_GATT_MAX_READ_MULTI_HANDLES handles, so a longer list takes more than one.
+				if (pOperation->next < pOperation->handles.size()) {
+					if (startOperation(pOperation) == ESP_OK) {
+						break;
+					}
+					status = ESP_GATT_ERROR;
+				}
+			}
+			finishOperation(status, (uint8_t*) pOperation->value.data(), pOperation->value.length());
+			runOperations();
+			break;
+		} // ESP_GATTC_READ_MULTIPLE_EVT
+
+
 		//
 		// ESP_GATTC_REG_EVT
 		//
@@ -243,6 +628,93 @@ void BLEClient::gattClientEventHandler(
 		} // ESP_GATTC_SEARCH_RES_EVT
 
 
+		//
+		// ESP_GATTC_SRVC_CHG_EVT
+		// The stack has received a Service Changed indication from the server.
+		//
+		// srvc_chg:
+		// - esp_bd_addr_t remote_bda
+		//
+		case ESP_GATTC_SRVC_CHG_EVT: {
+			invalidateAttributes();
+			break;
+		} // ESP_GATTC_SRVC_CHG_EVT
+
+
+		//
+		// ESP_GATTC_WRITE_CHAR_EVT
+		// A write with response has been answered or a write without response has been handed to the link layer.
+		//
+		// write:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		// - uint16_t          handle
+		//
+		case ESP_GATTC_WRITE_CHAR_EVT: {
+			Operation* pOperation = getOperation();
+			if (pOperation == nullptr || (pOperation->type != OPERATION_WRITE && pOperation->type != OPERATION_WRITE_NO_RSP) ||
+					pOperation->pCharacteristic->getHandle() != evtParam->write.handle) {
+				break;
+			}
+			finishOperation(evtParam->write.status, nullptr, 0);
+			runOperations();
+			break;
+		} // ESP_GATTC_WRITE_CHAR_EVT
+
+
+		//
+		// ESP_GATTC_PREP_WRITE_EVT
+		// The server has queued a part of a long write.
+		//
+		// write:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		// - uint16_t          handle
+		// - uint16_t          offset
+		//
+		case ESP_GATTC_PREP_WRITE_EVT: {
+			Operation* pOperation = getOperation();
+			if (pOperation == nullptr || pOperation->type != OPERATION_PREPARE_WRITE ||
+					pOperation->pCharacteristic->getHandle() != evtParam->write.handle) {
+				break;
+			}
+			// Send the next part or, once they have all been sent or one has been refused, end the write.
+			pOperation->next += std::min(partLength(), pOperation->length - pOperation->next);
+			if (evtParam->write.status != ESP_GATT_OK) {
+				pOperation->status = evtParam->write.status;
+			}
+			if (pOperation->status != ESP_GATT_OK || pOperation->next >= pOperation->length) {
+				pOperation->type = OPERATION_EXECUTE_WRITE;
+			}
+			if (startOperation(pOperation) == ESP_OK) {
+				break;
+			}
+			finishOperation(ESP_GATT_ERROR, nullptr, 0);
+			runOperations();
+			break;
+		} // ESP_GATTC_PREP_WRITE_EVT
+
+
+		//
+		// ESP_GATTC_EXEC_EVT
+		// The server has written or dropped the queued parts of a long write.
+		//
+		// exec_cmpl:
+		// - esp_gatt_status_t status
+		// - uint16_t          conn_id
+		//
+		case ESP_GATTC_EXEC_EVT: {
+			Operation* pOperation = getOperation();
+			if (pOperation == nullptr || pOperation->type != OPERATION_EXECUTE_WRITE) {
+				break;
+			}
+			// A refused part is the outcome, even though dropping the parts succeeded.
+			finishOperation(pOperation->status != ESP_GATT_OK ? pOperation->status : evtParam->exec_cmpl.status, nullptr, 0);
+			runOperations();
+			break;
+		} // ESP_GATTC_EXEC_EVT
+
+
 		default: {
 			break;
 		}
@@ -256,6 +728,15 @@ void BLEClient::gattClientEventHandler(
 } // gattClientEventHandler
 
 
+/**
+ * @brief Get the MTU agreed with the server.
+ * @return The MTU, 23 until a bigger one has been agreed.
+ */
+uint16_t BLEClient::getMTU() {
+	return m_mtu;
+} // getMTU
+
+
 uint16_t BLEClient::getConnId() {
 	return m_conn_id;
 } // getConnId
@@ -267,6 +748,34 @@ esp_gatt_if_t BLEClient::getGattcIf() {
 } // getGattcIf
 
 
+/**
+ * @brief Finish the operation that was sent and remove it from the queue.
+ * @param [in] status The outcome of the operation.
+ * @param [in] pData The value read, if the operation was a read.
+ * @param [in] length The length of the value read.
+ */
+void BLEClient::finishOperation(esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	m_semaphoreOperations.take("finishOperation");
+	Operation* pOperation = m_operations.front();
+	m_operations.pop_front();
+	m_operationStarted = false;
+	m_semaphoreOperations.give();
+	completeOperation(pOperation, status, pData, length);   // Outside of the lock so that the callbacks can queue more.
+} // finishOperation
+
+
+/**
+ * @brief Get the operation that has been sent and is waiting for its event.
+ * @return The operation or nullptr if there is none.
+ */
+BLEClient::Operation* BLEClient::getOperation() {
+	m_semaphoreOperations.take("getOperation");
+	Operation* pOperation = m_operationStarted ? m_operations.front() : nullptr;
+	m_semaphoreOperations.give();
+	return pOperation;
+} // getOperation
+
+
 /**
  * @brief Retrieve the address of the peer.
  *
@@ -359,6 +868,15 @@ std::map<std::string, BLERemoteService*>* BLEClient::getServices() {
 
 	clearServices(); // Clear any services that may exist.
 
+	// If we have the attributes of the server from an earlier connection, and they haven't changed, there
+	// is nothing to discover.
+	if (m_pAttributeCache != nullptr && loadAttributes()) {
+		m_haveServices = true;
+		watchServiceChanged();
+		ESP_LOGD(LOG_TAG, "<< getServices: from the attribute cache");
+		return &m_servicesMap;
+	}
+
 	esp_err_t errRc = esp_ble_gattc_search_service(
 		getGattcIf(),
 		getConnId(),
@@ -371,6 +889,10 @@ std::map<std::string, BLERemoteService*>* BLEClient::getServices() {
 	}
 	// If sucessfull, remember that we now have services.
 	m_haveServices = (m_semaphoreSearchCmplEvt.wait("getServices") == 0);
+	if (m_haveServices && m_pAttributeCache != nullptr) {
+		saveAttributes();
+		watchServiceChanged();
+	}
 	ESP_LOGD(LOG_TAG, "<< getServices");
 	return &m_servicesMap;
 } // getServices
@@ -410,6 +932,9 @@ void BLEClient::handleGAPEvent(
 		// - esp_bd_addr_t remote_addr
 		//
 		case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT: {
+			if (!m_peerAddress.equals(BLEAddress(param->read_rssi_cmpl.remote_addr))) {
+				break;   // The RSSI of another client's peer.
+			}
 			m_semaphoreRssiCmplEvt.give((uint32_t)param->read_rssi_cmpl.rssi);
 			break;
 		} // ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT
@@ -429,6 +954,219 @@ bool BLEClient::isConnected() {
 } // isConnected
 
 
+/**
+ * @brief Forget the attributes of the server, which it has told us have changed.
+ *
+ * The services already built are kept, since the application may hold references to them, but the next
+ * call to getServices() discovers them again.
+ */
+void BLEClient::invalidateAttributes() {
+	ESP_LOGD(LOG_TAG, "The attributes of %s have changed", m_peerAddress.toString().c_str());
+	if (m_pAttributeCache != nullptr) {
+		m_pAttributeCache->remove(m_peerAddress);
+	}
+	m_haveServices = false;
+} // invalidateAttributes
+
+
+/**
+ * @brief Build the services of the server from the attribute cache.
+ *
+ * If the server has a Database Hash characteristic, its value is read and compared against the value it had
+ * when the attributes were cached.  The read is all that a reconnect needs to do in place of discovery.
+ * Without a Database Hash, the cached attributes are trusted until the server indicates Service Changed.
+ *
+ * @return True if the services were built.  If not, there are no services and the server must be discovered.
+ */
+bool BLEClient::loadAttributes() {
+	std::string table;
+	if (!m_pAttributeCache->load(m_peerAddress, &table)) {
+		return false;
+	}
+	std::string hash;
+	if (!decodeAttributes(table, &hash)) {
+		ESP_LOGE(LOG_TAG, "The cached attributes of %s are corrupt", m_peerAddress.toString().c_str());
+		clearServices();
+		m_pAttributeCache->remove(m_peerAddress);
+		return false;
+	}
+	BLERemoteCharacteristic* pHash = findCharacteristic(GATT_SERVICE_UUID, DATABASE_HASH_UUID);
+	if (pHash == nullptr) {
+		return true;
+	}
+	if (!hash.empty()) {
+		std::string value = pHash->readValue();
+		if (pHash->getReadStatus() != ESP_GATT_OK) {
+			// We can't tell whether the attributes have changed, but that is no reason to forget them.
+			ESP_LOGE(LOG_TAG, "Couldn't read the Database Hash of %s", m_peerAddress.toString().c_str());
+			clearServices();
+			return false;
+		}
+		if (value == hash) {
+			return true;
+		}
+	}
+	ESP_LOGD(LOG_TAG, "The Database Hash of %s has changed", m_peerAddress.toString().c_str());
+	clearServices();
+	m_pAttributeCache->remove(m_peerAddress);
+	return false;
+} // loadAttributes
+
+
+/**
+ * @brief Forget the attributes of the server when it indicates that they have changed.
+ *
+ * Registered for the Service Changed characteristic when the stack doesn't know of it itself, which is the
+ * case when the attributes came from the cache.
+ */
+void BLEClient::onServiceChanged(BLERemoteCharacteristic* pCharacteristic, uint8_t* pData, size_t length, bool isNotify) {
+	pCharacteristic->getRemoteService()->getClient()->invalidateAttributes();
+} // onServiceChanged
+
+
+/**
+ * @brief Get the length of each part of a long write.
+ * A prepare write request has a handle and an offset as well as the part.
+ * @return The most that the MTU lets a part hold.
+ */
+size_t BLEClient::partLength() {
+	return getMTU() - 5;
+} // partLength
+
+
+/**
+ * @brief Queue a GATT operation.
+ *
+ * The stack takes one request per connection at a time, so the operations are sent one after another in the
+ * order that they were queued.  Each is sent from the event that completes the one before it, without waking
+ * up the task that queued it.
+ *
+ * @param [in] pOperation The operation, which the queue now owns.
+ */
+void BLEClient::queueOperation(Operation* pOperation) {
+	m_semaphoreOperations.take("queueOperation");
+	m_operations.push_back(pOperation);
+	m_semaphoreOperations.give();
+	runOperations();
+} // queueOperation
+
+
+/**
+ * @brief Read the values of several characteristics with ATT Read Multiple requests.
+ *
+ * The server answers with the values one after another, with nothing to say where one ends and the next
+ * begins, so all but the last value must be of a known, fixed length.  A request asks for up to
+ * ESP_GATT_MAX_READ_MULTI_HANDLES values and its answer is cut short at the MTU; a longer list is read with
+ * as many requests as it takes and their answers are joined.  Sensors that expose many small readings can
+ * be read in a few round trips rather than one per characteristic.
+ *
+ * @param [in] characteristics The characteristics to read.
+ * @param [in] pCallbacks Told of the values with onReadMultiple().
+ * @throws BLEDisconnectedException
+ */
+void BLEClient::readMultiple(std::vector<BLERemoteCharacteristic*> characteristics, BLEOperationCallbacks* pCallbacks) {
+	ESP_LOGD(LOG_TAG, ">> readMultiple(), count: %d", characteristics.size());
+	if (!isConnected()) {
+		ESP_LOGE(LOG_TAG, "Disconnected");
+		throw BLEDisconnectedException();
+	}
+	Operation* pOperation       = new Operation();
+	pOperation->type            = OPERATION_READ_MULTIPLE;
+	pOperation->pCharacteristic = nullptr;
+	pOperation->next            = 0;
+	pOperation->pCallbacks      = pCallbacks;
+	for (auto &pCharacteristic : characteristics) {
+		pOperation->handles.push_back(pCharacteristic->getHandle());
+	}
+	queueOperation(pOperation);
+	ESP_LOGD(LOG_TAG, "<< readMultiple");
+} // readMultiple
+
+
+/**
+ * @brief Read the values of several characteristics with ATT Read Multiple requests and wait for them.
+ * @param [in] characteristics The characteristics to read.
+ * @return The values, one after another, or an empty string if the read failed.
+ * @throws BLEDisconnectedException
+ */
+std::string BLEClient::readMultiple(std::vector<BLERemoteCharacteristic*> characteristics) {
+	BLEOperationFuture future;
+	readMultiple(characteristics, &future);
+	future.wait();
+	return future.getValue();
+} // readMultiple
+
+
+/**
+ * @brief Send the next queued operation, unless one is already waiting for its event.
+ *
+ * A write without response isn't sent while the connection is congested.  The ESP_GATTC_CONGEST_EVT that
+ * reports the end of the congestion sends it.
+ */
+void BLEClient::runOperations() {
+	while (true) {
+		m_semaphoreOperations.take("runOperations");
+		if (m_operationStarted || m_operations.empty() ||
+				(m_congested && m_operations.front()->type == OPERATION_WRITE_NO_RSP)) {
+			m_semaphoreOperations.give();
+			return;
+		}
+		Operation* pOperation = m_operations.front();
+		m_operationStarted = true;
+		m_semaphoreOperations.give();
+
+		if (startOperation(pOperation) == ESP_OK) {
+			return;
+		}
+		finishOperation(ESP_GATT_ERROR, nullptr, 0);   // Couldn't be sent, so move on to the next.
+	}
+} // runOperations
+
+
+
+
+/**
+ * @brief Retrieve all the characteristics of the server and keep them in the attribute cache.
+ */
+void BLEClient::saveAttributes() {
+	for (auto &servicePair : m_servicesMap) {
+		servicePair.second->getCharacteristics();   // Retrieve those not yet retrieved.
+	}
+	std::string hash;
+	BLERemoteCharacteristic* pHash = findCharacteristic(GATT_SERVICE_UUID, DATABASE_HASH_UUID);
+	if (pHash != nullptr) {
+		hash = pHash->readValue();
+		if (pHash->getReadStatus() != ESP_GATT_OK) {
+			ESP_LOGE(LOG_TAG, "Couldn't read the Database Hash of %s", m_peerAddress.toString().c_str());
+			return;
+		}
+		if (hash.empty()) {   // Without the hash we couldn't validate the attributes later.
+			return;
+		}
+	}
+	std::string table = encodeAttributes(hash);
+	if (table.empty()) {
+		ESP_LOGE(LOG_TAG, "%s has too many attributes to cache", m_peerAddress.toString().c_str());
+		return;
+	}
+	m_pAttributeCache->store(m_peerAddress, table);
+	ESP_LOGD(LOG_TAG, "Cached the attributes of %s: %d bytes", m_peerAddress.toString().c_str(), table.length());
+} // saveAttributes
+
+
+/**
+ * @brief Remember the services, characteristics and descriptors of the servers that we connect to.
+ *
+ * Service discovery dominates the time it takes to connect to a server.  With a cache, the first connection
+ * to a server discovers it and stores its attributes.  Later connections build them from the cache and,
+ * if the server has a Database Hash, check that it hasn't changed, in place of discovery.  A Service Changed
+ * indication from the server forgets its attributes.
+ *
+ * @param [in] pAttributeCache The cache, which may be shared by many clients, or nullptr to always discover.
+ */
+void BLEClient::setAttributeCache(BLEAttributeCache* pAttributeCache) {
+	m_pAttributeCache = pAttributeCache;
+} // setAttributeCache
 
 
 /**
@@ -452,6 +1190,85 @@ void BLEClient::setValue(BLEUUID serviceUUID, BLEUUID characteristicUUID, std::s
 } // setValue
 
 
+/**
+ * @brief Send an operation to the server.
+ * @param [in] pOperation The operation.
+ * @return ESP_OK if the stack has accepted the request.
+ */
+esp_err_t BLEClient::startOperation(Operation* pOperation) {
+	esp_err_t errRc;
+	switch (pOperation->type) {
+		case OPERATION_READ: {
+			errRc = ::esp_ble_gattc_read_char(
+				getGattcIf(),
+				getConnId(),
+				pOperation->pCharacteristic->getHandle(),
+				ESP_GATT_AUTH_REQ_NONE);
+			break;
+		}
+
+		case OPERATION_READ_MULTIPLE: {
+			esp_gattc_multi_t multi;
+			multi.num_attr = std::min(pOperation->handles.size() - pOperation->next, (size_t) ESP_GATT_MAX_READ_MULTI_HANDLES);
+			memcpy(multi.handles, &pOperation->handles[pOperation->next], multi.num_attr * sizeof(uint16_t));
+			pOperation->next += multi.num_attr;
+			errRc = ::esp_ble_gattc_read_multiple(getGattcIf(), getConnId(), &multi, ESP_GATT_AUTH_REQ_NONE);
+			break;
+		}
+
+		case OPERATION_PREPARE_WRITE: {
+			errRc = ::esp_ble_gattc_prepare_write(
+				getGattcIf(),
+				getConnId(),
+				pOperation->pCharacteristic->getHandle(),
+				pOperation->next,
+				std::min(partLength(), pOperation->length - pOperation->next),
+				(uint8_t*) pOperation->pData + pOperation->next,
+				ESP_GATT_AUTH_REQ_NONE);
+			break;
+		}
+
+		case OPERATION_EXECUTE_WRITE: {
+			errRc = ::esp_ble_gattc_execute_write(getGattcIf(), getConnId(), pOperation->status == ESP_GATT_OK);
+			break;
+		}
+
+		default: {
+			errRc = ::esp_ble_gattc_write_char(
+				getGattcIf(),
+				getConnId(),
+				pOperation->pCharacteristic->getHandle(),
+				pOperation->length,
+				(uint8_t*) pOperation->pData,
+				pOperation->type == OPERATION_WRITE ? ESP_GATT_WRITE_TYPE_RSP : ESP_GATT_WRITE_TYPE_NO_RSP,
+				ESP_GATT_AUTH_REQ_NONE);
+			break;
+		}
+	}
+	if (errRc != ESP_OK) {
+		ESP_LOGE(LOG_TAG, "startOperation: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+	}
+	return errRc;
+} // startOperation
+
+
+/**
+ * @brief Ask the server to indicate Service Changed, so that we know when the attributes we cached are stale.
+ */
+void BLEClient::watchServiceChanged() {
+	BLERemoteCharacteristic* pServiceChanged = findCharacteristic(GATT_SERVICE_UUID, SERVICE_CHANGED_UUID);
+	if (pServiceChanged == nullptr) {
+		return;
+	}
+	pServiceChanged->registerForNotify(onServiceChanged);
+	BLERemoteDescriptor* pCCCD = pServiceChanged->getDescriptor(CCCD_UUID);
+	if (pCCCD != nullptr) {
+		uint8_t value[] = {0x02, 0x00};   // Indications.
+		pCCCD->writeValue(value, sizeof(value), true);
+	}
+} // watchServiceChanged
+
+
 /**
  * @brief Return a string representation of this client.
  * @return A string representation of this client.
@@ -468,4 +1285,89 @@ std::string BLEClient::toString() {
 } // toString
 
 
+void BLEOperationCallbacks::onRead(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	ESP_LOGD("BLEOperationCallbacks", ">> onRead(): Default");
+	ESP_LOGD("BLEOperationCallbacks", "<< onRead()");
+} // onRead
+
+
+void BLEOperationCallbacks::onReadMultiple(BLEClient* pClient, esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	ESP_LOGD("BLEOperationCallbacks", ">> onReadMultiple(): Default");
+	ESP_LOGD("BLEOperationCallbacks", "<< onReadMultiple()");
+} // onReadMultiple
+
+
+void BLEOperationCallbacks::onWrite(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status) {
+	ESP_LOGD("BLEOperationCallbacks", ">> onWrite(): Default");
+	ESP_LOGD("BLEOperationCallbacks", "<< onWrite()");
+} // onWrite
+
+
+/**
+ * @brief Create a future for an operation that is about to be queued.
+ */
+BLEOperationFuture::BLEOperationFuture() {
+	m_status = ESP_GATT_PENDING;
+	m_semaphore.take("BLEOperationFuture");   // Given when the operation completes.
+} // BLEOperationFuture
+
+
+/**
+ * @brief Record the outcome of the operation and release the waiter.
+ * @param [in] status The outcome of the operation.
+ * @param [in] pData The value read, if any.
+ * @param [in] length The length of the value read.
+ */
+void BLEOperationFuture::complete(esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	m_status = status;
+	if (status == ESP_GATT_OK && pData != nullptr) {
+		m_value.assign((char*) pData, length);
+	}
+	m_semaphore.give();
+} // complete
+
+
+/**
+ * @brief Get the outcome of the operation.
+ * @return The status of the operation, ESP_GATT_PENDING until it has completed.
+ */
+esp_gatt_status_t BLEOperationFuture::getStatus() {
+	return m_status;
+} // getStatus
+
+
+/**
+ * @brief Get the value read by the operation.
+ * @return The value, empty if the operation wasn't a read or failed.
+ */
+std::string BLEOperationFuture::getValue() {
+	return m_value;
+} // getValue
+
+
+void BLEOperationFuture::onRead(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	complete(status, pData, length);
+} // onRead
+
+
+void BLEOperationFuture::onReadMultiple(BLEClient* pClient, esp_gatt_status_t status, uint8_t* pData, size_t length) {
+	complete(status, pData, length);
+} // onReadMultiple
+
+
+void BLEOperationFuture::onWrite(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status) {
+	complete(status, nullptr, 0);
+} // onWrite
+
+
+/**
+ * @brief Block until the operation has completed.
+ * @return The status of the operation.
+ */
+esp_gatt_status_t BLEOperationFuture::wait() {
+	m_semaphore.wait("wait");
+	return m_status;
+} // wait
+
+
 #endif // CONFIG_BT_ENABLED
@@ -13,15 +13,20 @@
 
 #include <esp_gattc_api.h>
 #include <string.h>
+#include <deque>
 #include <map>
 #include <string>
+#include <vector>
+#include "BLEAttributeCache.h"
 #include "BLEExceptions.h"
 #include "BLERemoteService.h"
 #include "BLEService.h"
 #include "BLEAddress.h"
 
 class BLERemoteService;
+class BLERemoteCharacteristic;
 class BLEClientCallbacks;
+class BLEOperationCallbacks;
 
 /**
  * @brief A model of a %BLE client.
@@ -35,6 +40,7 @@ public:
 	void                                       disconnect();                  // Disconnect from the remote BLE Server
 	BLEAddress                                 getPeerAddress();              // Get the address of the remote BLE Server
 	int                                        getRssi();                     // Get the RSSI of the remote BLE Server
+	uint16_t                                   getMTU();                      // Get the MTU agreed with the remote BLE Server
 	std::map<std::string, BLERemoteService*>*  getServices();                 // Get a map of the services offered by the remote BLE Server
 	BLERemoteService*                          getService(const char* uuid);  // Get a reference to a specified service offered by the remote BLE server.
 	BLERemoteService*                          getService(BLEUUID uuid);      // Get a reference to a specified service offered by the remote BLE server.
@@ -46,7 +52,10 @@ public:
                                                 esp_ble_gap_cb_param_t* param);
 
 	bool                                       isConnected();                 // Return true if we are connected.
+	std::string                                readMultiple(std::vector<BLERemoteCharacteristic*> characteristics);   // Read several characteristics at once.
+	void                                       readMultiple(std::vector<BLERemoteCharacteristic*> characteristics, BLEOperationCallbacks* pCallbacks);
 
+	void                                       setAttributeCache(BLEAttributeCache* pAttributeCache);   // Remember the attributes of servers.
 	void                                       setClientCallbacks(BLEClientCallbacks *pClientCallbacks);
 	void                                       setValue(BLEUUID serviceUUID, BLEUUID characteristicUUID, std::string value);   // Set the value of a given characteristic at a given service.
 
@@ -64,20 +73,65 @@ private:
 		esp_gatt_if_t gattc_if,
 		esp_ble_gattc_cb_param_t* param);
 
+	/**
+	 * @brief A GATT operation waiting in the queue of the client.
+	 */
+	struct Operation {
+		uint8_t                  type;              // One of the OPERATION_ values.
+		BLERemoteCharacteristic* pCharacteristic;   // The characteristic to read or write.
+		const uint8_t*           pData;             // The value to write.
+		size_t                   length;            // The length of the value to write.
+		std::vector<uint16_t>    handles;           // The handles to read with a read multiple.
+		size_t                   next;              // The first of the handles not yet asked for.
+		std::string              value;             // The copy of a value to write or the value read so far.
+		esp_gatt_status_t        status;            // The outcome of the parts of a long write.
+		BLEOperationCallbacks*   pCallbacks;        // Told of the outcome, if not null.
+	};
+	static const uint8_t OPERATION_READ          = 0;
+	static const uint8_t OPERATION_READ_MULTIPLE = 1;
+	static const uint8_t OPERATION_WRITE         = 2;
+	static const uint8_t OPERATION_WRITE_NO_RSP  = 3;
+	static const uint8_t OPERATION_PREPARE_WRITE = 4;   // Sends the parts of a long write, from next on.
+	static const uint8_t OPERATION_EXECUTE_WRITE = 5;   // Writes the parts or, if status isn't ESP_GATT_OK, drops them.
+
+	void                                       cancelOperations();
+	bool                                       decodeAttributes(const std::string& table, std::string* pHash);
+	std::string                                encodeAttributes(const std::string& hash);
+	BLERemoteCharacteristic*                   findCharacteristic(BLEUUID serviceUUID, BLEUUID characteristicUUID);
+	void                                       completeOperation(Operation* pOperation, esp_gatt_status_t status, uint8_t* pData, size_t length);
+	void                                       finishOperation(esp_gatt_status_t status, uint8_t* pData, size_t length);
 	uint16_t                                   getConnId();
 	esp_gatt_if_t                              getGattcIf();
+	Operation*                                 getOperation();
+	void                                       invalidateAttributes();
+	bool                                       loadAttributes();
+	size_t                                     partLength();
+	void                                       queueOperation(Operation* pOperation);
+	void                                       runOperations();
+	void                                       saveAttributes();
+	esp_err_t                                  startOperation(Operation* pOperation);
+	void                                       watchServiceChanged();
+	static void                                onServiceChanged(BLERemoteCharacteristic* pCharacteristic, uint8_t* pData, size_t length, bool isNotify);
 	BLEAddress    m_peerAddress = BLEAddress((uint8_t*)"\0\0\0\0\0\0");   // The BD address of the remote server.
+	uint16_t      m_appId;           // The id of our GATT client application, given by BLEDevice.
 	uint16_t      m_conn_id;
 //	int           m_deviceType;
 	esp_gatt_if_t m_gattc_if;
 	bool          m_haveServices;    // Have we previously obtain the set of services from the remote server.
 	bool          m_isConnected;     // Are we currently connected.
+	uint16_t      m_mtu;             // The MTU agreed with the server.
+	bool          m_congested;       // Has the stack reported that the connection is congested?
+	bool          m_operationStarted;   // Has the operation at the front of the queue been sent?
+	std::deque<Operation*> m_operations;   // The queued operations, oldest first.
 
+	BLEAttributeCache*  m_pAttributeCache;
 	BLEClientCallbacks* m_pClientCallbacks;
 	FreeRTOS::Semaphore m_semaphoreRegEvt        = FreeRTOS::Semaphore("RegEvt");
 	FreeRTOS::Semaphore m_semaphoreOpenEvt       = FreeRTOS::Semaphore("OpenEvt");
 	FreeRTOS::Semaphore m_semaphoreSearchCmplEvt = FreeRTOS::Semaphore("SearchCmplEvt");
 	FreeRTOS::Semaphore m_semaphoreRssiCmplEvt   = FreeRTOS::Semaphore("RssiCmplEvt");
+	FreeRTOS::Semaphore m_semaphoreCfgMtuEvt     = FreeRTOS::Semaphore("CfgMtuEvt");
+	FreeRTOS::Semaphore m_semaphoreOperations    = FreeRTOS::Semaphore("Operations");   // Guards the operation queue.
 	std::map<std::string, BLERemoteService*> m_servicesMap;
 	void clearServices();   // Clear any existing services.
 
@@ -94,5 +148,45 @@ public:
 	virtual void onDisconnect(BLEClient *pClient) = 0;
 };
 
+
+/**
+ * @brief Callbacks invoked when a queued GATT operation completes.
+ *
+ * The callbacks are invoked from the %BLE event task.  They mustn't block but they may queue further
+ * operations.  If the connection is lost, the operations still queued complete with ESP_GATT_ERROR.
+ */
+class BLEOperationCallbacks {
+public:
+	virtual ~BLEOperationCallbacks() {};
+	virtual void onRead(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status, uint8_t* pData, size_t length);
+	virtual void onReadMultiple(BLEClient* pClient, esp_gatt_status_t status, uint8_t* pData, size_t length);
+	virtual void onWrite(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status);
+};
+
+
+/**
+ * @brief The outcome of a queued GATT operation that a task can wait for.
+ *
+ * A future is used for one operation only.  It must outlive the operation.
+ */
+class BLEOperationFuture : public BLEOperationCallbacks {
+public:
+	BLEOperationFuture();
+	esp_gatt_status_t getStatus();
+	std::string       getValue();
+	esp_gatt_status_t wait();
+
+	void onRead(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status, uint8_t* pData, size_t length) override;
+	void onReadMultiple(BLEClient* pClient, esp_gatt_status_t status, uint8_t* pData, size_t length) override;
+	void onWrite(BLERemoteCharacteristic* pCharacteristic, esp_gatt_status_t status) override;
+
+private:
+	esp_gatt_status_t   m_status;
+	std::string         m_value;
+	FreeRTOS::Semaphore m_semaphore = FreeRTOS::Semaphore("OperationFuture");
+
+	void complete(esp_gatt_status_t status, uint8_t* pData, size_t length);
+};
+
 #endif // CONFIG_BT_ENABLED
 #endif /* MAIN_BLEDEVICE_H_ */
@@ -0,0 +1,400 @@
+/*
+ * BLEConnectionManager.cpp
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <esp_err.h>
+#include <esp_gap_ble_api.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <algorithm>
+#include "BLEConnectionManager.h"
+#include "BLEDevice.h"
+#include "GeneralUtils.h"
+#ifdef ARDUINO_ARCH_ESP32
+#include "esp32-hal-log.h"
+#endif
+
+static const char* LOG_TAG = "BLEConnectionManager";
+
+static const uint32_t POLL_PERIOD = 100;   // How often the task looks at the links, in milliseconds.
+
+
+/**
+ * @brief Create a connection manager.
+ * @param [in] maxLinks The most links that the manager will hold.  The connection interval is chosen
+ * for this many links, whether or not they are all in use.
+ */
+BLEConnectionManager::BLEConnectionManager(uint8_t maxLinks) {
+	m_maxLinks    = maxLinks;
+	m_eventLength = 3;        // 3.75ms, room for a request and its response with a few packets to spare.
+	m_minDelay    = 1000;
+	m_maxDelay    = 60000;
+	m_running     = false;
+	m_pCallbacks  = nullptr;
+} // BLEConnectionManager
+
+
+/**
+ * @brief Destructor.
+ *
+ * Stops the task and disconnects from all the servers.
+ */
+BLEConnectionManager::~BLEConnectionManager() {
+	stop();
+	for (auto &pLink : m_links) {
+		if (pLink->pClient->isConnected()) {
+			pLink->pClient->disconnect();
+		}
+		delete pLink->pClient;
+		delete pLink;
+	}
+	for (auto &pClient : m_idleClients) {
+		delete pClient;
+	}
+} // ~BLEConnectionManager
+
+
+/**
+ * @brief Add a server to keep a link to.
+ *
+ * The task connects to the server as soon as it can.
+ *
+ * @param [in] address The address of the server.
+ * @return The client that the link is held by, or nullptr if the manager already holds as many links as it may.
+ */
+BLEClient* BLEConnectionManager::addPeer(BLEAddress address) {
+	ESP_LOGD(LOG_TAG, ">> addPeer(%s)", address.toString().c_str());
+	m_semaphoreLinks.take("addPeer");
+	Link* pLink = findLink(address);
+	if (pLink == nullptr) {
+		if (m_links.size() >= m_maxLinks) {
+			m_semaphoreLinks.give();
+			ESP_LOGE(LOG_TAG, "Can't add %s: already holding %d links", address.toString().c_str(), m_maxLinks);
+			return nullptr;
+		}
+		// Reuse an idle client whose link has finished closing, if there is one.
+		BLEClient* pClient = nullptr;
+		for (auto it = m_idleClients.begin(); it != m_idleClients.end(); ++it) {
+			if (!(*it)->isConnected()) {
+				pClient = *it;
+				m_idleClients.erase(it);
+				break;
+			}
+		}
+		if (pClient == nullptr) {
+			pClient = BLEDevice::createClient();
+		}
+		uint32_t now = FreeRTOS::getTimeSinceStart();
+		pLink = new Link { address, pClient, false, m_minDelay, now, now };
+		m_links.push_back(pLink);
+	}
+	BLEClient* pClient = pLink->pClient;
+	m_semaphoreLinks.give();
+	ESP_LOGD(LOG_TAG, "<< addPeer");
+	return pClient;
+} // addPeer
+
+
+/**
+ * @brief Connect to the server of a link.
+ *
+ * Called by the task with the GAP held.
+ *
+ * @param [in] pLink The link.
+ * @return True if the link is now up.
+ */
+bool BLEConnectionManager::connect(Link* pLink) {
+	ESP_LOGD(LOG_TAG, ">> connect(%s)", pLink->address.toString().c_str());
+	uint16_t interval = getConnectionInterval();
+	uint16_t timeout  = std::max(400, interval * 6 / 8 + 1);   // 4s, or six intervals if that is longer, in units of 10ms.
+	esp_err_t errRc = ::esp_ble_gap_set_prefer_conn_params(*pLink->address.getNative(), interval, interval, 0, timeout);
+	if (errRc != ESP_OK) {
+		ESP_LOGE(LOG_TAG, "esp_ble_gap_set_prefer_conn_params: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+	}
+
+	bool ok = pLink->pClient->connect(pLink->address);
+
+	m_semaphoreLinks.take("connect");
+	if (ok) {
+		pLink->connected   = true;
+		pLink->connectTime = FreeRTOS::getTimeSinceStart();
+	} else {
+		failed(pLink);
+	}
+	m_semaphoreLinks.give();
+	ESP_LOGD(LOG_TAG, "<< connect: %d", ok);
+	return ok;
+} // connect
+
+
+/**
+ * @brief Put off the next attempt to connect a link after one failed.
+ *
+ * Called with the links held.
+ *
+ * @param [in] pLink The link.
+ */
+void BLEConnectionManager::failed(Link* pLink) {
+	uint32_t jitter = esp_random() % (pLink->retryDelay / 4 + 1);
+	pLink->retryTime  = FreeRTOS::getTimeSinceStart() + pLink->retryDelay + jitter;
+	ESP_LOGI(LOG_TAG, "%s: retrying in %dms", pLink->address.toString().c_str(), pLink->retryDelay + jitter);
+	pLink->retryDelay = std::min(pLink->retryDelay * 2, m_maxDelay);
+} // failed
+
+
+/**
+ * @brief Find the link to a server.
+ *
+ * Called with the links held.
+ *
+ * @param [in] address The address of the server.
+ * @return The link or nullptr if there is none.
+ */
+BLEConnectionManager::Link* BLEConnectionManager::findLink(BLEAddress address) {
+	for (auto &pLink : m_links) {
+		if (pLink->address.equals(address)) {
+			return pLink;
+		}
+	}
+	return nullptr;
+} // findLink
+
+
+/**
+ * @brief Get the client that holds the link to a server.
+ * @param [in] address The address of the server.
+ * @return The client or nullptr if the server hasn't been added.
+ */
+BLEClient* BLEConnectionManager::getClient(BLEAddress address) {
+	m_semaphoreLinks.take("getClient");
+	Link* pLink = findLink(address);
+	BLEClient* pClient = pLink == nullptr ? nullptr : pLink->pClient;
+	m_semaphoreLinks.give();
+	return pClient;
+} // getClient
+
+
+/**
+ * @brief Get the number of links that are up.
+ * @return The number of connected clients.
+ */
+uint8_t BLEConnectionManager::getConnectedCount() {
+	m_semaphoreLinks.take("getConnectedCount");
+	uint8_t count = 0;
+	for (auto &pLink : m_links) {
+		if (pLink->pClient->isConnected()) {
+			count++;
+		}
+	}
+	m_semaphoreLinks.give();
+	return count;
+} // getConnectedCount
+
+
+/**
+ * @brief Get the connection interval that every link is asked for.
+ *
+ * The interval is long enough for one connection event of each of the links that the manager may hold.
+ *
+ * @return The connection interval in units of 1.25ms.
+ */
+uint16_t BLEConnectionManager::getConnectionInterval() {
+	uint32_t interval = (uint32_t) m_maxLinks * m_eventLength;
+	return (uint16_t) std::min<uint32_t>(std::max<uint32_t>(interval, 6), 3200);   // 7.5ms to 4s.
+} // getConnectionInterval
+
+
+/**
+ * @brief Look for links that went down and connect one link that is due.
+ *
+ * The lost links are told to the callbacks before the GAP is taken, so that a scan in progress doesn't
+ * hold them up.
+ */
+void BLEConnectionManager::poll() {
+	std::vector<BLEClient*> lost;
+	bool due = false;
+	uint32_t now = FreeRTOS::getTimeSinceStart();
+
+	m_semaphoreLinks.take("poll");
+	for (auto &pLink : m_links) {
+		if (pLink->connected) {
+			if (!pLink->pClient->isConnected()) {
+				pLink->connected = false;
+				lost.push_back(pLink->pClient);
+				// A link that stayed up for as long as the longest delay has recovered.  One that dropped
+				// soon after it was made keeps backing off.
+				if (now - pLink->connectTime >= m_maxDelay) {
+					pLink->retryDelay = m_minDelay;
+				}
+				failed(pLink);
+			}
+		} else if ((int32_t) (now - pLink->retryTime) >= 0) {
+			due = true;
+		}
+	}
+	m_semaphoreLinks.give();
+
+	for (auto &pClient : lost) {
+		ESP_LOGI(LOG_TAG, "Lost link to %s", pClient->getPeerAddress().toString().c_str());
+		if (m_pCallbacks != nullptr) {
+			m_pCallbacks->onDisconnect(pClient);
+		}
+	}
+	if (!due) {
+		return;
+	}
+
+	// Connect the link that has waited longest.  A link can't be removed while the GAP is held so it
+	// is safe to use after the links are given back.
+	m_semaphoreGAP.take("poll");
+	Link* pDue = nullptr;
+	m_semaphoreLinks.take("poll");
+	for (auto &pLink : m_links) {
+		if (!pLink->connected && (int32_t) (now - pLink->retryTime) >= 0 &&
+			(pDue == nullptr || (int32_t) (pLink->retryTime - pDue->retryTime) < 0)) {
+			pDue = pLink;
+		}
+	}
+	m_semaphoreLinks.give();
+	BLEClient* pClient = nullptr;
+	if (pDue != nullptr && connect(pDue)) {
+		pClient = pDue->pClient;   // Clients outlive their links so this stays valid once the GAP is given.
+	}
+	m_semaphoreGAP.give();
+
+	if (pClient != nullptr && m_pCallbacks != nullptr) {
+		m_pCallbacks->onConnect(pClient);
+	}
+} // poll
+
+
+/**
+ * @brief Stop keeping a link to a server and disconnect from it.
+ * @param [in] address The address of the server.
+ */
+void BLEConnectionManager::removePeer(BLEAddress address) {
+	ESP_LOGD(LOG_TAG, ">> removePeer(%s)", address.toString().c_str());
+	m_semaphoreGAP.take("removePeer");   // Wait for a connect in progress.
+	m_semaphoreLinks.take("removePeer");
+	Link* pLink = findLink(address);
+	if (pLink != nullptr) {
+		m_links.erase(std::find(m_links.begin(), m_links.end(), pLink));
+	}
+	m_semaphoreLinks.give();
+	if (pLink != nullptr) {
+		if (pLink->pClient->isConnected()) {
+			pLink->pClient->disconnect();
+		}
+		m_semaphoreLinks.take("removePeer");
+		m_idleClients.push_back(pLink->pClient);
+		m_semaphoreLinks.give();
+		delete pLink;
+	}
+	m_semaphoreGAP.give();
+	ESP_LOGD(LOG_TAG, "<< removePeer");
+} // removePeer
+
+
+/**
+ * @brief The body of the task of the manager.
+ * @param [in] pData The manager.
+ */
+void BLEConnectionManager::runTask(void* pData) {
+	BLEConnectionManager* pManager = (BLEConnectionManager*) pData;
+	while (pManager->m_running) {
+		pManager->poll();
+		FreeRTOS::sleep(POLL_PERIOD);
+	}
+	pManager->m_semaphoreTask.give();
+	FreeRTOS::deleteTask();
+} // runTask
+
+
+/**
+ * @brief Scan for devices, without a connect being made at the same time.
+ *
+ * Waits for a connect in progress to finish, and the task waits for the scan to finish before it
+ * makes another.
+ *
+ * @param [in] duration The duration of the scan in seconds.
+ * @return The devices that were found.
+ */
+BLEScanResults BLEConnectionManager::scan(uint32_t duration) {
+	m_semaphoreGAP.take("scan");
+	BLEScanResults results = BLEDevice::getScan()->start(duration);
+	m_semaphoreGAP.give();
+	return results;
+} // scan
+
+
+/**
+ * @brief Set the callbacks to tell of links that come up and go down.
+ *
+ * The callbacks are called on the task of the manager, so they may make blocking calls such as
+ * BLEClient::getServices() or BLERemoteCharacteristic::registerForNotify(), but no other link is
+ * connected until they return.
+ *
+ * @param [in] pCallbacks The callbacks.
+ */
+void BLEConnectionManager::setCallbacks(BLEClientCallbacks* pCallbacks) {
+	m_pCallbacks = pCallbacks;
+} // setCallbacks
+
+
+/**
+ * @brief Set the time that each link needs in every connection interval.
+ *
+ * Applies to the links that are made from now on.
+ *
+ * @param [in] eventLength The length of a connection event in units of 1.25ms.
+ */
+void BLEConnectionManager::setEventLength(uint16_t eventLength) {
+	m_eventLength = eventLength;
+} // setEventLength
+
+
+/**
+ * @brief Set how long to wait before connecting again.
+ *
+ * The wait starts at the minimum and doubles after each failure up to the maximum.
+ *
+ * @param [in] minDelay The first wait, in milliseconds.
+ * @param [in] maxDelay The longest wait, in milliseconds.
+ */
+void BLEConnectionManager::setReconnectDelay(uint32_t minDelay, uint32_t maxDelay) {
+	m_minDelay = minDelay;
+	m_maxDelay = std::max(minDelay, maxDelay);
+} // setReconnectDelay
+
+
+/**
+ * @brief Start the task that keeps the links up.
+ */
+void BLEConnectionManager::start() {
+	if (m_running) {
+		return;
+	}
+	m_semaphoreTask.take("start");
+	m_running = true;
+	FreeRTOS::startTask(runTask, "BLEConnectionManager", this, 8192);
+} // start
+
+
+/**
+ * @brief Stop the task that keeps the links up.
+ *
+ * Waits for a connect in progress to finish.  The links that are up stay up.
+ */
+void BLEConnectionManager::stop() {
+	if (!m_running) {
+		return;
+	}
+	m_running = false;
+	m_semaphoreTask.wait("stop");
+} // stop
+
+#endif /* CONFIG_BT_ENABLED */
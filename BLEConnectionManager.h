@@ -0,0 +1,97 @@
+/*
+ * BLEConnectionManager.h
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_BLECONNECTIONMANAGER_H_
+#define COMPONENTS_CPP_UTILS_BLECONNECTIONMANAGER_H_
+#include "sdkconfig.h"
+#if defined(CONFIG_BT_ENABLED)
+#include <stdint.h>
+#include <vector>
+
+#include "BLEAddress.h"
+#include "BLEClient.h"
+#include "BLEScan.h"
+#include "FreeRTOS.h"
+
+/**
+ * @brief Keeps a set of clients connected to their servers.
+ *
+ * The manager owns one BLEClient per server that it is given and runs a task that connects to each of
+ * them in turn.  When a link is lost the manager connects again, waiting longer after each attempt that
+ * fails, up to a limit, with a little randomness so that servers that went away together don't all come
+ * back at the same moment.
+ *
+ * Only one GAP operation is in progress at a time.  The manager connects to one server at a time and
+ * scan() waits for a connect in progress to finish, and the other way around, so that scanning and
+ * initiating don't compete for the radio.
+ *
+ * Every link is asked for the same connection interval, long enough for one connection event of every
+ * link that the manager may hold.  With links of equal intervals the controller can place their events
+ * side by side rather than on top of each other, so that each server is served once per interval.
+ *
+ * @code{.cpp}
+ * BLEConnectionManager* pManager = new BLEConnectionManager(8);
+ * pManager->setCallbacks(new MyCallbacks());   // onConnect() subscribes to the notifications.
+ * pManager->addPeer(BLEAddress("24:0a:c4:00:00:01"));
+ * pManager->addPeer(BLEAddress("24:0a:c4:00:00:02"));
+ * pManager->start();
+ * @endcode
+ *
+ * The controller holds CONFIG_BTDM_CONTROLLER_BLE_MAX_CONN links at most, which must be configured
+ * for at least as many links as the manager is to hold.
+ */
+class BLEConnectionManager {
+public:
+	BLEConnectionManager(uint8_t maxLinks = 8);
+	~BLEConnectionManager();
+
+	BLEClient*     addPeer(BLEAddress address);
+	BLEClient*     getClient(BLEAddress address);
+	uint16_t       getConnectionInterval();
+	uint8_t        getConnectedCount();
+	void           removePeer(BLEAddress address);
+	BLEScanResults scan(uint32_t duration);
+	void           setCallbacks(BLEClientCallbacks* pCallbacks);
+	void           setEventLength(uint16_t eventLength);
+	void           setReconnectDelay(uint32_t minDelay, uint32_t maxDelay);
+	void           start();
+	void           stop();
+
+private:
+	/**
+	 * @brief A server that the manager keeps a link to.
+	 */
+	struct Link {
+		BLEAddress address;
+		BLEClient* pClient;
+		bool       connected;       // Was the link up when the task last looked?
+		uint32_t   retryDelay;      // How long to wait after the next failure, in milliseconds.
+		uint32_t   retryTime;       // When to next try to connect, as FreeRTOS::getTimeSinceStart().
+		uint32_t   connectTime;     // When the link last came up.
+	};
+
+	uint8_t                 m_maxLinks;
+	uint16_t                m_eventLength;   // The time each link needs per interval, in units of 1.25ms.
+	uint32_t                m_minDelay;      // The first wait before reconnecting, in milliseconds.
+	uint32_t                m_maxDelay;      // The longest wait before reconnecting, in milliseconds.
+	bool                    m_running;       // Should the task keep running?
+	std::vector<Link*>      m_links;
+	std::vector<BLEClient*> m_idleClients;   // Clients of removed peers, kept for the next peer added once closed.
+	BLEClientCallbacks*     m_pCallbacks;
+	FreeRTOS::Semaphore     m_semaphoreLinks = FreeRTOS::Semaphore("Links");   // Guards the links.
+	FreeRTOS::Semaphore     m_semaphoreGAP   = FreeRTOS::Semaphore("GAP");     // Held for a connect or a scan.
+	FreeRTOS::Semaphore     m_semaphoreTask  = FreeRTOS::Semaphore("Task");    // Given when the task ends.
+
+	bool        connect(Link* pLink);
+	void        failed(Link* pLink);
+	Link*       findLink(BLEAddress address);
+	void        poll();
+	static void runTask(void* pData);
+}; // BLEConnectionManager
+
+#endif /* CONFIG_BT_ENABLED */
+#endif /* COMPONENTS_CPP_UTILS_BLECONNECTIONMANAGER_H_ */
@@ -31,12 +31,12 @@ BLEDescriptor* BLEDescriptorMap::getByUUID(const char* uuid) {
  * @return The descriptor.  If not present, then nullptr is returned.
  */
 BLEDescriptor* BLEDescriptorMap::getByUUID(BLEUUID uuid) {
-	for (auto &myPair : m_uuidMap) {
-		if (myPair.second->getUUID().equals(uuid)) {
-			return myPair.second;
+	auto range = m_uuidIndex.equal_range(uuid.hash());
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second->getUUID().equals(uuid)) {
+			return it->second;
 		}
 	}
-	//return m_uuidMap.at(uuid.toString());
 	return nullptr;
 } // getByUUID
 
@@ -59,6 +59,7 @@ BLEDescriptor* BLEDescriptorMap::getByHandle(uint16_t handle) {
  */
 void BLEDescriptorMap::setByUUID(const char* uuid, BLEDescriptor *pDescriptor){
 	m_uuidMap.insert(std::pair<std::string, BLEDescriptor *>(uuid, pDescriptor));
+	m_uuidIndex.insert(std::pair<uint32_t, BLEDescriptor *>(BLEUUID(uuid).hash(), pDescriptor));
 } // setByUUID
 
 
@@ -71,6 +72,7 @@ void BLEDescriptorMap::setByUUID(const char* uuid, BLEDescriptor *pDescriptor){
  */
 void BLEDescriptorMap::setByUUID(BLEUUID uuid, BLEDescriptor *pDescriptor) {
 	m_uuidMap.insert(std::pair<std::string, BLEDescriptor *>(uuid.toString(), pDescriptor));
+	m_uuidIndex.insert(std::pair<uint32_t, BLEDescriptor *>(uuid.hash(), pDescriptor));
 } // setByUUID
 
 
@@ -40,7 +40,10 @@ static const char* LOG_TAG = "BLEDevice";
  */
 BLEServer* BLEDevice::m_pServer = nullptr;
 BLEScan*   BLEDevice::m_pScan   = nullptr;
-BLEClient* BLEDevice::m_pClient = nullptr;
+std::map<uint16_t, BLEClient*> BLEDevice::m_clients;
+uint16_t   BLEDevice::m_nextAppId = 0;
+FreeRTOS::Semaphore BLEDevice::m_semaphoreClients = FreeRTOS::Semaphore("Clients");
+TaskHandle_t BLEDevice::m_clientsTask = nullptr;
 bool       initialized          = false;   // Have we been initialized?
 esp_ble_sec_act_t 	BLEDevice::m_securityLevel = (esp_ble_sec_act_t)0;
 BLESecurityCallbacks* BLEDevice::m_securityCallbacks = nullptr;
@@ -48,6 +51,11 @@ uint16_t   BLEDevice::m_localMTU = 23;
 
 /**
  * @brief Create a new instance of a client.
+ *
+ * Each client registers its own GATT client application, with an id of its own, and is handed the events
+ * of that application.  Any number of clients may be connected at once, up to the number of connections
+ * that the controller has been configured for.
+ *
  * @return A new instance of the client.
  */
 /* STATIC */ BLEClient* BLEDevice::createClient() {
@@ -56,12 +64,51 @@ uint16_t   BLEDevice::m_localMTU = 23;
 	ESP_LOGE(LOG_TAG, "BLE GATTC is not enabled - CONFIG_GATTC_ENABLE not defined");
 	abort();
 #endif  // CONFIG_GATTC_ENABLE
-	m_pClient = new BLEClient();
+	BLEClient* pClient = new BLEClient();
+	addClient(pClient);
 	ESP_LOGD(LOG_TAG, "<< createClient");
-	return m_pClient;
+	return pClient;
 } // createClient
 
 
+/**
+ * @brief Give a new client its application id and start handing it events.
+ *
+ * The clients are changed under m_semaphoreClients, which the %BLE event task holds while it hands an
+ * event to them.  A client's callbacks run in that task with the semaphore held, so a client created or
+ * deleted from them doesn't take it again.
+ *
+ * @param [in] pClient The new client.
+ */
+/* STATIC */ void BLEDevice::addClient(BLEClient* pClient) {
+	bool dispatching = m_clientsTask == ::xTaskGetCurrentTaskHandle();   // We already hold the semaphore.
+	if (!dispatching) {
+		m_semaphoreClients.take("addClient");
+	}
+	pClient->m_appId = m_nextAppId++;
+	m_clients.insert(std::pair<uint16_t, BLEClient*>(pClient->m_appId, pClient));
+	if (!dispatching) {
+		m_semaphoreClients.give();
+	}
+} // addClient
+
+
+/**
+ * @brief Stop handing events to a client that is being deleted.
+ * @param [in] pClient The client.
+ */
+/* STATIC */ void BLEDevice::removeClient(BLEClient* pClient) {
+	bool dispatching = m_clientsTask == ::xTaskGetCurrentTaskHandle();   // We already hold the semaphore.
+	if (!dispatching) {
+		m_semaphoreClients.take("removeClient");
+	}
+	m_clients.erase(pClient->m_appId);
+	if (!dispatching) {
+		m_semaphoreClients.give();
+	}
+} // removeClient
+
+
 /**
  * @brief Create a new instance of a server.
  * @return A new instance of the server.
@@ -99,7 +146,6 @@ uint16_t   BLEDevice::m_localMTU = 23;
 
 	switch(event) {
 		case ESP_GATTS_CONNECT_EVT: {
-			BLEDevice::m_localMTU = 23;
 #ifdef CONFIG_BLE_SMP_ENABLE   // Check that BLE SMP (security) is configured in make menuconfig
 			if(BLEDevice::m_securityLevel){
 				esp_ble_set_encryption(param->connect.remote_bda, BLEDevice::m_securityLevel);
@@ -108,10 +154,9 @@ uint16_t   BLEDevice::m_localMTU = 23;
 			break;
 		} // ESP_GATTS_CONNECT_EVT
 
-		case ESP_GATTS_MTU_EVT: {
-			BLEDevice::m_localMTU = param->mtu.mtu;
-	        ESP_LOGI(LOG_TAG, "ESP_GATTS_MTU_EVT, MTU %d", BLEDevice::m_localMTU);
-	        break;
+		case ESP_GATTS_MTU_EVT: {   // The MTU agreed with each client is kept in its BLEServerSession.
+			ESP_LOGI(LOG_TAG, "ESP_GATTS_MTU_EVT, conn_id: %d, MTU %d", param->mtu.conn_id, param->mtu.mtu);
+			break;
 		}
 		default: {
 			break;
@@ -144,13 +189,7 @@ uint16_t   BLEDevice::m_localMTU = 23;
 	BLEUtils::dumpGattClientEvent(event, gattc_if, param);
 
 	switch(event) {
-		case ESP_GATTC_CONNECT_EVT: {
-			if(BLEDevice::getMTU() != 23){
-				esp_err_t errRc = esp_ble_gattc_send_mtu_req(gattc_if, param->connect.conn_id);
-				if (errRc != ESP_OK) {
-					ESP_LOGE(LOG_TAG, "esp_ble_gattc_send_mtu_req: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-				}
-			}
+		case ESP_GATTC_CONNECT_EVT: {   // BLEClient asks for the MTU once the connection is open.
 #ifdef CONFIG_BLE_SMP_ENABLE   // Check that BLE SMP (security) is configured in make menuconfig
 			if(BLEDevice::m_securityLevel){
 				esp_ble_set_encryption(param->connect.remote_bda, BLEDevice::m_securityLevel);
@@ -165,10 +204,18 @@ uint16_t   BLEDevice::m_localMTU = 23;
 	} // switch
 
 
-	// If we have a client registered, call it.
-	if (BLEDevice::m_pClient != nullptr) {
-		BLEDevice::m_pClient->gattClientEventHandler(event, gattc_if, param);
+	// Pass the event to the clients.  Each one ignores the events that aren't for it.  A client may be
+	// created or deleted by the callbacks of another, so each step looks up the next client afresh.
+	m_semaphoreClients.take("gattClientEventHandler");
+	m_clientsTask = ::xTaskGetCurrentTaskHandle();
+	auto it = m_clients.begin();
+	while (it != m_clients.end()) {
+		uint16_t appId = it->first;
+		it->second->gattClientEventHandler(event, gattc_if, param);
+		it = m_clients.upper_bound(appId);
 	}
+	m_clientsTask = nullptr;
+	m_semaphoreClients.give();
 
 } // gattClientEventHandler
 
@@ -263,9 +310,16 @@ uint16_t   BLEDevice::m_localMTU = 23;
 		BLEDevice::m_pServer->handleGAPEvent(event, param);
 	}
 
-	if (BLEDevice::m_pClient != nullptr) {
-		BLEDevice::m_pClient->handleGAPEvent(event, param);
+	m_semaphoreClients.take("gapEventHandler");
+	m_clientsTask = ::xTaskGetCurrentTaskHandle();
+	auto it = m_clients.begin();
+	while (it != m_clients.end()) {   // As in gattClientEventHandler.
+		uint16_t appId = it->first;
+		it->second->handleGAPEvent(event, param);
+		it = m_clients.upper_bound(appId);
 	}
+	m_clientsTask = nullptr;
+	m_semaphoreClients.give();
 
 	if (BLEDevice::m_pScan != nullptr) {
 		BLEDevice::getScan()->handleGAPEvent(event, param);
@@ -319,6 +373,7 @@ uint16_t   BLEDevice::m_localMTU = 23;
 	pClient->connect(bdAddress);
 	std::string ret = pClient->getValue(serviceUUID, characteristicUUID);
 	pClient->disconnect();
+	delete pClient;   // Unregisters its application.
 	ESP_LOGD(LOG_TAG, "<< getValue");
 	return ret;
 } // getValue
@@ -462,6 +517,7 @@ uint16_t   BLEDevice::m_localMTU = 23;
 	pClient->connect(bdAddress);
 	pClient->setValue(serviceUUID, characteristicUUID, value);
 	pClient->disconnect();
+	delete pClient;   // Unregisters its application.
 } // setValue
 
 
@@ -521,6 +577,11 @@ void BLEDevice::setSecurityCallbacks(BLESecurityCallbacks* callbacks) {
 
 /*
  * @brief Setup local mtu that will be used to negotiate mtu during request from client peer
+ *
+ * This is the target MTU of every connection.  A BLEClient asks for it as soon as it has connected and a
+ * BLEServer offers it when a client asks.  The MTU that is agreed for a connection is the smaller of the two
+ * sides' and is given by BLEClient::getMTU() and BLEServerSession::getMTU().
+ *
  * @param [in] mtu Value to set local mtu, should be larger than 23 and lower or equal to 517
  */
 esp_err_t BLEDevice::setMTU(uint16_t mtu) {
@@ -536,7 +597,7 @@ esp_err_t BLEDevice::setMTU(uint16_t mtu) {
 }
 
 /*
- * @brief Get local MTU value set during mtu request or default value
+ * @brief Get the local MTU, the MTU that is asked for on each connection.
  */
 uint16_t BLEDevice::getMTU() {
 	return m_localMTU;
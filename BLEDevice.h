@@ -20,6 +20,7 @@
 #include "BLEUtils.h"
 #include "BLEScan.h"
 #include "BLEAddress.h"
+#include "FreeRTOS.h"
 
 /**
  * @brief %BLE functions.
@@ -45,14 +46,21 @@ public:
 	static bool        getInitialized(); // Returns the state of the device, is it initialized or not?
 
 private:
+	friend class BLEClient;
+
 	static BLEServer *m_pServer;
 	static BLEScan   *m_pScan;
-	static BLEClient *m_pClient;
+	static std::map<uint16_t, BLEClient*> m_clients;   // The clients, by the id of their GATT client application.
+	static uint16_t  m_nextAppId;
+	static FreeRTOS::Semaphore m_semaphoreClients;      // Guards the clients; held while an event is handed to them.
+	static TaskHandle_t m_clientsTask;                  // The task handing an event to the clients, if any.
 	static esp_ble_sec_act_t 	m_securityLevel;
 	static BLESecurityCallbacks* m_securityCallbacks;
 	static uint16_t		m_localMTU;
 
+	static void          addClient(BLEClient* pClient);
 	static esp_gatt_if_t getGattcIF();
+	static void          removeClient(BLEClient* pClient);
 
 	static void gattClientEventHandler(
 		esp_gattc_cb_event_t      event,
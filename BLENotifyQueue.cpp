@@ -0,0 +1,114 @@
+/*
+ * BLENotifyQueue.cpp
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+#include "BLENotifyQueue.h"
+
+#include <algorithm>
+
+
+BLENotifyQueue::BLENotifyQueue() {
+	m_inFlight  = 0;
+	m_congested = false;
+} // BLENotifyQueue
+
+
+/**
+ * @brief May a notification be sent now?
+ * @param [in] credits The notifications that may be in flight at once.
+ * @return True if a notification waits, a credit is free and the connection isn't congested.
+ */
+bool BLENotifyQueue::canSend(uint8_t credits) {
+	return !m_pending.empty() && !m_congested && m_inFlight < credits;
+} // canSend
+
+
+/**
+ * @brief Note that the stack has sent a notification, returning its credit.
+ */
+void BLENotifyQueue::confirmed() {
+	if (m_inFlight > 0) {
+		m_inFlight--;
+	}
+} // confirmed
+
+
+/**
+ * @brief Get the number of notifications sent but not yet confirmed.
+ * @return The number of notifications in flight.
+ */
+uint8_t BLENotifyQueue::getInFlight() {
+	return m_inFlight;
+} // getInFlight
+
+
+/**
+ * @brief Get the number of notifications waiting to be sent.
+ * @return The number of notifications waiting.
+ */
+size_t BLENotifyQueue::getPendingCount() {
+	return m_pending.size();
+} // getPendingCount
+
+
+/**
+ * @brief Has the stack reported that the connection is congested?
+ * @return True if the connection is congested.
+ */
+bool BLENotifyQueue::isCongested() {
+	return m_congested;
+} // isCongested
+
+
+/**
+ * @brief Take the oldest waiting notification from the queue.
+ * The caller calls sent() if the stack accepts it.
+ * @return The handle of the characteristic to send.
+ */
+uint16_t BLENotifyQueue::pop() {
+	uint16_t handle = m_pending.front();
+	m_pending.erase(m_pending.begin());
+	return handle;
+} // pop
+
+
+/**
+ * @brief Queue a notification of the value of a characteristic.
+ * @param [in] handle The handle of the characteristic.
+ * @return False if a notification of the characteristic was already waiting and has been replaced.
+ */
+bool BLENotifyQueue::push(uint16_t handle) {
+	if (std::find(m_pending.begin(), m_pending.end(), handle) != m_pending.end()) {
+		return false;
+	}
+	m_pending.push_back(handle);
+	return true;
+} // push
+
+
+/**
+ * @brief Remove a waiting notification of a characteristic, if there is one.
+ * @param [in] handle The handle of the characteristic.
+ */
+void BLENotifyQueue::remove(uint16_t handle) {
+	m_pending.erase(std::remove(m_pending.begin(), m_pending.end(), handle), m_pending.end());
+} // remove
+
+
+/**
+ * @brief Note that the stack has accepted a notification, taking a credit.
+ */
+void BLENotifyQueue::sent() {
+	m_inFlight++;
+} // sent
+
+
+/**
+ * @brief Note whether the stack has reported the connection congested.
+ * @param [in] congested True if the connection is congested.
+ */
+void BLENotifyQueue::setCongested(bool congested) {
+	m_congested = congested;
+} // setCongested
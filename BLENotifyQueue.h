@@ -0,0 +1,57 @@
+/*
+ * BLENotifyQueue.h
+ *
+ *  Created on: Feb 18, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_BLENOTIFYQUEUE_H_
+#define COMPONENTS_CPP_UTILS_BLENOTIFYQUEUE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief The flow control of the notifications to one client.
+ *
+ * The queue holds the handles of the characteristics whose value waits to be sent to the client, oldest
+ * first, and counts the notifications that the stack has been given but not yet sent.  A notification
+ * may be sent while fewer than the given number of credits are in flight and the connection isn't
+ * congested.  A characteristic is queued at most once; a newer value of a characteristic that is already
+ * waiting takes the place of the older one when its turn comes.
+ *
+ * The class knows nothing of %BLE, so that its accounting can be driven from a host test with a
+ * simulated stack:
+ *
+ * @code{.cpp}
+ * BLENotifyQueue queue;
+ * queue.push(0x2a);
+ * while (queue.canSend(credits)) {
+ *    uint16_t handle = queue.pop();
+ *    if (send(handle)) queue.sent();
+ * }
+ * // ... and queue.confirmed() when the stack reports a notification sent.
+ * @endcode
+ */
+class BLENotifyQueue {
+public:
+	BLENotifyQueue();
+
+	bool     canSend(uint8_t credits);
+	void     confirmed();
+	uint8_t  getInFlight();
+	size_t   getPendingCount();
+	bool     isCongested();
+	uint16_t pop();
+	bool     push(uint16_t handle);
+	void     remove(uint16_t handle);
+	void     sent();
+	void     setCongested(bool congested);
+
+private:
+	std::vector<uint16_t> m_pending;    // Handles of the characteristics whose value waits, oldest first.
+	uint8_t               m_inFlight;   // Notifications sent but not yet confirmed by the stack.
+	bool                  m_congested;  // Has the stack reported that the connection is congested?
+}; // BLENotifyQueue
+
+#endif /* COMPONENTS_CPP_UTILS_BLENOTIFYQUEUE_H_ */
@@ -14,6 +14,7 @@
 #include <esp_log.h>
 #include <esp_err.h>
 
+#include <algorithm>
 #include <sstream>
 #include "BLEExceptions.h"
 #include "BLEUtils.h"
@@ -44,8 +45,7 @@ BLERemoteCharacteristic::BLERemoteCharacteristic(
 	m_charProp       = charProp;
 	m_pRemoteService = pRemoteService;
 	m_notifyCallback = nullptr;
-
-	retrieveDescriptors(); // Get the descriptors for this characteristic
+	m_readStatus     = ESP_GATT_OK;
 	ESP_LOGD(LOG_TAG, "<< BLERemoteCharacteristic");
 } // BLERemoteCharacteristic
 
@@ -183,36 +183,6 @@ void BLERemoteCharacteristic::gattClientEventHandler(
 		} // ESP_GATTC_NOTIFY_EVT
 
 
-		//
-		// ESP_GATTC_READ_CHAR_EVT
-		// This event indicates that the server has responded to the read request.
-		//
-		// read:
-		// - esp_gatt_status_t  status
-		// - uint16_t           conn_id
-		// - uint16_t           handle
-		// - uint8_t*           value
-		// - uint16_t           value_len
-	  //
-		case ESP_GATTC_READ_CHAR_EVT: {
-			// If this event is not for us, then nothing further to do.
-			if (evtParam->read.handle != getHandle()) {
-				break;
-			}
-
-			// At this point, we have determined that the event is for us, so now we save the value
-			// and unlock the semaphore to ensure that the requestor of the data can continue.
-			if (evtParam->read.status == ESP_GATT_OK) {
-				m_value = std::string((char*)evtParam->read.value, evtParam->read.value_len);
-			} else {
-				m_value = "";
-			}
-
-			m_semaphoreReadCharEvt.give();
-			break;
-		} // ESP_GATTC_READ_CHAR_EVT
-
-
 		//
 		// ESP_GATTC_REG_FOR_NOTIFY_EVT
 		//
@@ -249,27 +219,6 @@ void BLERemoteCharacteristic::gattClientEventHandler(
 		} // ESP_GATTC_UNREG_FOR_NOTIFY_EVT:
 
 
-		//
-		// ESP_GATTC_WRITE_CHAR_EVT
-		//
-		// write:
-		// - esp_gatt_status_t status
-		// - uint16_t          conn_id
-		// - uint16_t          handle
-		//
-		case ESP_GATTC_WRITE_CHAR_EVT: {
-			// Determine if this event is for us and, if not, pass onwards.
-			if (evtParam->write.handle != getHandle()) {
-				break;
-			}
-
-			// There is nothing further we need to do here.  This is merely an indication
-			// that the write has completed and we can unlock the caller.
-			m_semaphoreWriteCharEvt.give();
-			break;
-		} // ESP_GATTC_WRITE_CHAR_EVT
-
-
 		default: {
 			break;
 		}
@@ -350,6 +299,15 @@ uint16_t BLERemoteCharacteristic::getHandle() {
 } // getHandle
 
 
+/**
+ * @brief Get the outcome of the last readValue().
+ * @return The status of the read, ESP_GATT_OK if it succeeded.
+ */
+esp_gatt_status_t BLERemoteCharacteristic::getReadStatus() {
+	return m_readStatus;
+} // getReadStatus
+
+
 /**
  * @brief Get the descriptor instance with the given UUID that belongs to this characteristic.
  * @param [in] uuid The UUID of the descriptor to find.
@@ -428,39 +386,53 @@ uint8_t BLERemoteCharacteristic::readUInt8(void) {
 
 /**
  * @brief Read the value of the remote characteristic.
+ *
+ * A value longer than fits in one response is read by the stack with read blob requests, up to
+ * ESP_GATT_MAX_ATTR_LEN bytes.  The read waits its turn in the queue of the client.  A failed read
+ * returns an empty value; getReadStatus() tells it apart from an empty value that was read.
+ *
  * @return The value of the remote characteristic.
  */
 std::string BLERemoteCharacteristic::readValue() {
 	ESP_LOGD(LOG_TAG, ">> readValue(): uuid: %s, handle: %d 0x%.2x", getUUID().toString().c_str(), getHandle(), getHandle());
 
-	// Check to see that we are connected.
-	if (!getRemoteService()->getClient()->isConnected()) {
-		ESP_LOGE(LOG_TAG, "Disconnected");
-		throw BLEDisconnectedException();
+	BLEOperationFuture future;
+	readValue(&future);
+	m_readStatus = future.wait();   // Block waiting for the event that indicates that the read has completed.
+	m_value      = future.getValue();
+	if (m_readStatus != ESP_GATT_OK) {
+		ESP_LOGE(LOG_TAG, "readValue: %s", BLEUtils::gattStatusToString(m_readStatus).c_str());
 	}
 
-	m_semaphoreReadCharEvt.take("readValue");
+	ESP_LOGD(LOG_TAG, "<< readValue(): length: %d", m_value.length());
+	return m_value;
+} // readValue
 
-	// Ask the BLE subsystem to retrieve the value for the remote hosted characteristic.
-	// This is an asynchronous request which means that we must block waiting for the response
-	// to become available.
-	esp_err_t errRc = ::esp_ble_gattc_read_char(
-		m_pRemoteService->getClient()->getGattcIf(),
-		m_pRemoteService->getClient()->getConnId(),    // The connection ID to the BLE server
-		getHandle(),                                   // The handle of this characteristic
-		ESP_GATT_AUTH_REQ_NONE);                       // Security
 
-	if (errRc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "esp_ble_gattc_read_char: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-		return "";
+/**
+ * @brief Queue a read of the value of the remote characteristic and return without waiting for it.
+ *
+ * Reads and writes queued on a client are sent one after another, each as soon as the one before it has
+ * completed, so a task can queue the reads of many characteristics at once rather than waiting for each.
+ *
+ * @param [in] pCallbacks Told of the value with onRead(), from the %BLE event task.
+ * @throws BLEDisconnectedException
+ */
+void BLERemoteCharacteristic::readValue(BLEOperationCallbacks* pCallbacks) {
+	// Check to see that we are connected.
+	if (!getRemoteService()->getClient()->isConnected()) {
+		ESP_LOGE(LOG_TAG, "Disconnected");
+		throw BLEDisconnectedException();
 	}
 
-	// Block waiting for the event that indicates that the read has completed.  When it has, the std::string found
-	// in m_value will contain our data.
-	m_semaphoreReadCharEvt.wait("readValue");
-
-	ESP_LOGD(LOG_TAG, "<< readValue(): length: %d", m_value.length());
-	return m_value;
+	BLEClient::Operation* pOperation = new BLEClient::Operation();
+	pOperation->type            = BLEClient::OPERATION_READ;
+	pOperation->pCharacteristic = this;
+	pOperation->pData           = nullptr;
+	pOperation->length          = 0;
+	pOperation->next            = 0;
+	pOperation->pCallbacks      = pCallbacks;
+	m_pRemoteService->getClient()->queueOperation(pOperation);
 } // readValue
 
 
@@ -521,10 +493,9 @@ void BLERemoteCharacteristic::registerForNotify(
 void BLERemoteCharacteristic::removeDescriptors() {
 	// Iterate through all the descriptors releasing their storage and erasing them from the map.
 	for (auto &myPair : m_descriptorMap) {
-	   m_descriptorMap.erase(myPair.first);
 	   delete myPair.second;
 	}
-	m_descriptorMap.clear();   // Technically not neeeded, but just to be sure.
+	m_descriptorMap.clear();
 } // removeCharacteristics
 
 
@@ -548,35 +519,7 @@ std::string BLERemoteCharacteristic::toString() {
  * @return N/A.
  */
 void BLERemoteCharacteristic::writeValue(std::string newValue, bool response) {
-	ESP_LOGD(LOG_TAG, ">> writeValue(), length: %d", newValue.length());
-
-	// Check to see that we are connected.
-	if (!getRemoteService()->getClient()->isConnected()) {
-		ESP_LOGE(LOG_TAG, "Disconnected");
-		throw BLEDisconnectedException();
-	}
-
-	m_semaphoreWriteCharEvt.take("writeValue");
-
-	// Invoke the ESP-IDF API to perform the write.
-	esp_err_t errRc = ::esp_ble_gattc_write_char(
-		m_pRemoteService->getClient()->getGattcIf(),
-		m_pRemoteService->getClient()->getConnId(),
-		getHandle(),
-		newValue.length(),
-		(uint8_t*)newValue.data(),
-		response?ESP_GATT_WRITE_TYPE_RSP:ESP_GATT_WRITE_TYPE_NO_RSP,
-		ESP_GATT_AUTH_REQ_NONE
-	);
-
-	if (errRc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "esp_ble_gattc_write_char: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
-		return;
-	}
-
-	m_semaphoreWriteCharEvt.wait("writeValue");
-
-	ESP_LOGD(LOG_TAG, "<< writeValue");
+	writeValue((uint8_t*) newValue.data(), newValue.length(), response);
 } // writeValue
 
 
@@ -595,12 +538,115 @@ void BLERemoteCharacteristic::writeValue(uint8_t newValue, bool response) {
 
 /**
  * @brief Write the new value for the characteristic from a data buffer.
+ *
+ * The write waits its turn in the queue of the client.  A value too long for one request is sent by the
+ * stack as a long write.
+ *
  * @param [in] data A pointer to a data buffer.
  * @param [in] length The length of the data in the data buffer.
  * @param [in] response Whether we require a response from the write.
  */
 void BLERemoteCharacteristic::writeValue(uint8_t* data, size_t length, bool response) {
-	writeValue(std::string((char *)data, length), response);
+	ESP_LOGD(LOG_TAG, ">> writeValue(), length: %d", length);
+
+	// Check to see that we are connected.
+	if (!getRemoteService()->getClient()->isConnected()) {
+		ESP_LOGE(LOG_TAG, "Disconnected");
+		throw BLEDisconnectedException();
+	}
+
+	// The data is sent straight from the caller's buffer, which stays valid while we wait.
+	BLEOperationFuture future;
+	BLEClient::Operation* pOperation = new BLEClient::Operation();
+	pOperation->type            = response ? BLEClient::OPERATION_WRITE : BLEClient::OPERATION_WRITE_NO_RSP;
+	pOperation->pCharacteristic = this;
+	pOperation->pData           = data;
+	pOperation->length          = length;
+	pOperation->next            = 0;
+	pOperation->pCallbacks      = &future;
+	m_pRemoteService->getClient()->queueOperation(pOperation);
+	future.wait();
+
+	ESP_LOGD(LOG_TAG, "<< writeValue");
+} // writeValue
+
+
+/**
+ * @brief Queue a write of the value of the characteristic and return without waiting for it.
+ *
+ * The value is copied so the caller's buffer may be reused at once.  A write without response is finished as
+ * soon as the stack has handed it to the link layer, without a round trip to the server, so a run of them
+ * queued together goes out back to back, as many per connection event as the link allows.  They are held
+ * back while the stack reports that the connection is congested.
+ *
+ * @param [in] data A pointer to a data buffer.
+ * @param [in] length The length of the data in the data buffer.
+ * @param [in] response Whether we require a response from the write.
+ * @param [in] pCallbacks Told of the outcome with onWrite(), from the %BLE event task.  May be nullptr.
+ * @throws BLEDisconnectedException
+ */
+void BLERemoteCharacteristic::writeValue(uint8_t* data, size_t length, bool response, BLEOperationCallbacks* pCallbacks) {
+	// Check to see that we are connected.
+	if (!getRemoteService()->getClient()->isConnected()) {
+		ESP_LOGE(LOG_TAG, "Disconnected");
+		throw BLEDisconnectedException();
+	}
+
+	BLEClient::Operation* pOperation = new BLEClient::Operation();
+	pOperation->type            = response ? BLEClient::OPERATION_WRITE : BLEClient::OPERATION_WRITE_NO_RSP;
+	pOperation->pCharacteristic = this;
+	pOperation->value.assign((char*) data, length);
+	pOperation->pData           = (const uint8_t*) pOperation->value.data();
+	pOperation->length          = length;
+	pOperation->next            = 0;
+	pOperation->pCallbacks      = pCallbacks;
+	m_pRemoteService->getClient()->queueOperation(pOperation);
 } // writeValue
 
+
+/**
+ * @brief Write a value of up to 64KB with a long write.
+ *
+ * The value is sent straight from the caller's buffer as a series of prepare write requests, each as
+ * large as the MTU allows, which the server queues until they are executed together.  The write waits
+ * its turn in the queue of the client and holds it until the parts have been executed.  If the server
+ * refuses a part, the queued parts are cancelled.  Use this for values, such as configuration blobs or
+ * small images, that are too long for writeValue(); the server end is a BLECharacteristic with a
+ * BLEBulkValue.
+ *
+ * @param [in] data The value.
+ * @param [in] length The length of the value.
+ * @return True if the server accepted the whole value.
+ */
+bool BLERemoteCharacteristic::writeBulkValue(uint8_t* data, size_t length) {
+	ESP_LOGD(LOG_TAG, ">> writeBulkValue(), length: %d", length);
+
+	// Check to see that we are connected.
+	if (!getRemoteService()->getClient()->isConnected()) {
+		ESP_LOGE(LOG_TAG, "Disconnected");
+		throw BLEDisconnectedException();
+	}
+
+	if (length > 0xffff) {   // The offset of each part is 16 bits.
+		ESP_LOGE(LOG_TAG, "writeBulkValue: %d bytes is too long", length);
+		return false;
+	}
+
+	// The parts are sent straight from the caller's buffer, which stays valid while we wait.
+	BLEOperationFuture future;
+	BLEClient::Operation* pOperation = new BLEClient::Operation();
+	pOperation->type            = length > 0 ? BLEClient::OPERATION_PREPARE_WRITE : BLEClient::OPERATION_EXECUTE_WRITE;
+	pOperation->pCharacteristic = this;
+	pOperation->pData           = data;
+	pOperation->length          = length;
+	pOperation->next            = 0;
+	pOperation->status          = ESP_GATT_OK;
+	pOperation->pCallbacks      = &future;
+	m_pRemoteService->getClient()->queueOperation(pOperation);
+	bool accepted = future.wait() == ESP_GATT_OK;
+
+	ESP_LOGD(LOG_TAG, "<< writeBulkValue: %d", accepted);
+	return accepted;
+} // writeBulkValue
+
 #endif /* CONFIG_BT_ENABLED */
@@ -21,6 +21,7 @@
 
 class BLERemoteService;
 class BLERemoteDescriptor;
+class BLEOperationCallbacks;
 
 /**
  * @brief A model of a remote %BLE characteristic.
@@ -39,15 +40,19 @@ public:
 	BLERemoteDescriptor* getDescriptor(BLEUUID uuid);
 	std::map<std::string, BLERemoteDescriptor *>* getDescriptors();
 	uint16_t    getHandle();
+	esp_gatt_status_t getReadStatus();
 	BLEUUID     getUUID();
 	std::string readValue(void);
+	void        readValue(BLEOperationCallbacks* pCallbacks);
 	uint8_t     readUInt8(void);
 	uint16_t    readUInt16(void);
 	uint32_t    readUInt32(void);
 	void        registerForNotify(void (*notifyCallback)(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify));
+	bool        writeBulkValue(uint8_t* data, size_t length);
 	void        writeValue(uint8_t* data, size_t length, bool response = false);
 	void        writeValue(std::string newValue, bool response = false);
 	void        writeValue(uint8_t newValue, bool response = false);
+	void        writeValue(uint8_t* data, size_t length, bool response, BLEOperationCallbacks* pCallbacks);
 	std::string toString(void);
 
 private:
@@ -72,10 +77,9 @@ private:
 	esp_gatt_char_prop_t m_charProp;
 	uint16_t             m_handle;
 	BLERemoteService*    m_pRemoteService;
-	FreeRTOS::Semaphore  m_semaphoreReadCharEvt      = FreeRTOS::Semaphore("ReadCharEvt");
 	FreeRTOS::Semaphore  m_semaphoreRegForNotifyEvt  = FreeRTOS::Semaphore("RegForNotifyEvt");
-	FreeRTOS::Semaphore  m_semaphoreWriteCharEvt     = FreeRTOS::Semaphore("WriteCharEvt");
-	std::string          m_value;
+	std::string          m_value;            // The value last read by readValue().
+	esp_gatt_status_t    m_readStatus;       // The outcome of the last readValue().
   void (*m_notifyCallback)(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
 
 	// We maintain a map of descriptors owned by this characteristic keyed by a string representation of the UUID.
@@ -37,6 +37,7 @@ public:
 
 
 private:
+	friend class BLEClient;
 	friend class BLERemoteCharacteristic;
 	BLERemoteDescriptor(
 		uint16_t                 handle,
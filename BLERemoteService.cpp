@@ -204,6 +204,7 @@ void BLERemoteService::retrieveCharacteristics() {
 			result.properties,
 			this
 		);
+		pNewRemoteCharacteristic->retrieveDescriptors(); // Get the descriptors for this characteristic
 
 		m_characteristicMap.insert(std::pair<std::string, BLERemoteCharacteristic*>(pNewRemoteCharacteristic->getUUID().toString(), pNewRemoteCharacteristic));
 
@@ -11,9 +11,13 @@
 #include <esp_log.h>
 #include <esp_err.h>
 
+#include <algorithm>
+#include <climits>
 #include <map>
+#include <string.h>
 
 #include "BLEAdvertisedDevice.h"
+#include "BLEDevice.h"
 #include "BLEScan.h"
 #include "BLEUtils.h"
 #include "GeneralUtils.h"
@@ -34,11 +38,23 @@ BLEScan::BLEScan() {
 	m_pAdvertisedDeviceCallbacks     = nullptr;
 	m_stopped                        = true;
 	m_wantDuplicates                 = false;
+	clearFilters();
 	setInterval(100);
 	setWindow(100);
 } // BLEScan
 
 
+/**
+ * @brief Remove all the filters so that every device is recorded.
+ */
+void BLEScan::clearFilters() {
+	m_filterManufacturer   = false;
+	m_filterManufacturerId = 0;
+	m_filterRSSI           = INT_MIN;
+	m_filterServiceUUID    = BLEUUID();
+} // clearFilters
+
+
 /**
  * @brief Handle GAP events related to scans.
  * @param [in] event The event type for this event.
@@ -90,37 +106,27 @@ void BLEScan::handleGAPEvent(
 						break;
 					}
 
-// Examine our list of previously scanned addresses and, if we found this one already,
-// ignore it.
-					BLEAddress advertisedAddress(param->scan_rst.bda);
-					bool found = false;
-
-					for (int i=0; i<m_scanResults.getCount(); i++) {
-						if (m_scanResults.getDevice(i).getAddress().equals(advertisedAddress)) {
-							found = true;
-							break;
-						}
-					}
-					if (found && !m_wantDuplicates) {  // If we found a previous entry AND we don't want duplicates, then we are done.
-						ESP_LOGD(LOG_TAG, "Ignoring %s, already seen it.", advertisedAddress.toString().c_str());
+// Check the filters against the raw report before anything is copied.  A scan response carries
+// little of what the filters look at, so one is kept if its advertisement was.
+					BLEAdvertisementView view(param->scan_rst.bda, param->scan_rst.ble_adv,
+						param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len, param->scan_rst.rssi);
+					if (!isWanted(view) &&
+							(param->scan_rst.ble_evt_type != ESP_BLE_EVT_SCAN_RSP || m_scanResults.find(view.getAddress()) == nullptr)) {
 						break;
 					}
 
-					// We now construct a model of the advertised device that we have just found for the first
-					// time.
-					BLEAdvertisedDevice advertisedDevice;
-					advertisedDevice.setAddress(advertisedAddress);
-					advertisedDevice.setRSSI(param->scan_rst.rssi);
-					advertisedDevice.setAdFlag(param->scan_rst.flag);
-					advertisedDevice.parseAdvertisement((uint8_t*)param->scan_rst.ble_adv);
-					advertisedDevice.setScan(this);
+// Find the record of this device, making one if we haven't heard from it before.  The record
+// holds the raw advertisement; it is only decoded if a BLEAdvertisedDevice is asked for.
+					bool isNew;
+					BLEScanRecord* pRecord = m_scanResults.update(param, &isNew);
 
-					if (m_pAdvertisedDeviceCallbacks) {
-						m_pAdvertisedDeviceCallbacks->onResult(advertisedDevice);
+					if (!isNew && !m_wantDuplicates) {  // If we found a previous entry AND we don't want duplicates, then we are done.
+						ESP_LOGD(LOG_TAG, "Ignoring %s, already seen it.", pRecord->getAddress().toString().c_str());
+						break;
 					}
 
-					if (!found) {   // If we have previously seen this device, don't record it again.
-						m_scanResults.m_vectorAdvertisedDevices.push_back(advertisedDevice);
+					if (m_pAdvertisedDeviceCallbacks) {
+						m_pAdvertisedDeviceCallbacks->onRecord(*pRecord);
 					}
 
 					break;
@@ -142,6 +148,25 @@ void BLEScan::handleGAPEvent(
 } // gapEventHandler
 
 
+/**
+ * @brief Does an advertisement pass all of the filters?
+ * @param [in] view The advertisement.
+ * @return True if the advertisement is wanted.
+ */
+bool BLEScan::isWanted(const BLEAdvertisementView& view) {
+	if (view.getRSSI() < m_filterRSSI) {
+		return false;
+	}
+	if (m_filterManufacturer && view.getManufacturerId() != m_filterManufacturerId) {
+		return false;
+	}
+	if (m_filterServiceUUID.bitSize() != 0 && !view.isAdvertisingService(m_filterServiceUUID)) {
+		return false;
+	}
+	return true;
+} // isWanted
+
+
 /**
  * @brief Should we perform an active or passive scan?
  * The default is a passive scan.  An active scan means that we will wish a scan response.
@@ -168,6 +193,34 @@ void BLEScan::setAdvertisedDeviceCallbacks(BLEAdvertisedDeviceCallbacks* pAdvert
 } // setAdvertisedDeviceCallbacks
 
 
+/**
+ * @brief Only record devices whose manufacturer data starts with a given company identifier.
+ * @param [in] manufacturerId The company identifier.
+ */
+void BLEScan::setFilterManufacturerId(uint16_t manufacturerId) {
+	m_filterManufacturer   = true;
+	m_filterManufacturerId = manufacturerId;
+} // setFilterManufacturerId
+
+
+/**
+ * @brief Only record devices that are heard at least as strongly as a given signal strength.
+ * @param [in] minRSSI The weakest RSSI that is wanted.
+ */
+void BLEScan::setFilterRSSI(int minRSSI) {
+	m_filterRSSI = minRSSI;
+} // setFilterRSSI
+
+
+/**
+ * @brief Only record devices that advertise a given service.
+ * @param [in] serviceUUID The UUID of the service.
+ */
+void BLEScan::setFilterServiceUUID(BLEUUID serviceUUID) {
+	m_filterServiceUUID = serviceUUID;
+} // setFilterServiceUUID
+
+
 /**
  * @brief Set the interval to scan.
  * @param [in] The interval in msecs.
@@ -177,6 +230,19 @@ void BLEScan::setInterval(uint16_t intervalMSecs) {
 } // setInterval
 
 
+/**
+ * @brief Set the number of devices that a scan remembers.
+ *
+ * When more devices than this are found, the device that was heard from least recently is forgotten.
+ * The results of the previous scan are discarded so this should not be called during a scan.
+ *
+ * @param [in] maxResults The number of devices to remember.  The default is BLE_SCAN_MAX_RESULTS.
+ */
+void BLEScan::setMaxResults(uint16_t maxResults) {
+	m_scanResults.setMaxCount(maxResults);
+} // setMaxResults
+
+
 /**
  * @brief Set the window to actively scan.
  * @param [in] windowMSecs How long to actively scan.
@@ -198,7 +264,7 @@ bool BLEScan::start(uint32_t duration, void (*scanCompleteCB)(BLEScanResults)) {
 	m_semaphoreScanEnd.take(std::string("start"));
 	m_scanCompleteCB = scanCompleteCB;                  // Save the callback to be invoked when the scan completes.
 
-	m_scanResults.m_vectorAdvertisedDevices.clear();
+	m_scanResults.clear();
 
 	esp_err_t errRc = ::esp_ble_gap_set_scan_params(&m_scan_params);
 
@@ -258,6 +324,107 @@ void BLEScan::stop() {
 } // stop
 
 
+/**
+ * @brief Hash a device address.
+ * @param [in] address The six bytes of the address.
+ * @return The FNV-1a hash of the address.
+ */
+static uint32_t hashAddress(const uint8_t* address) {
+	uint32_t hash = 2166136261U;
+	for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+		hash = (hash ^ address[i]) * 16777619U;
+	}
+	return hash;
+} // hashAddress
+
+
+/**
+ * @brief Get the address of the device.
+ * @return The address of the device.
+ */
+BLEAddress BLEScanRecord::getAddress() {
+	return BLEAddress(m_address);
+} // getAddress
+
+
+/**
+ * @brief Decode the record into a BLEAdvertisedDevice.
+ * @return The advertised device.
+ */
+BLEAdvertisedDevice BLEScanRecord::getAdvertisedDevice() {
+	BLEAdvertisedDevice advertisedDevice;
+	advertisedDevice.setAddress(BLEAddress(m_address));
+	advertisedDevice.setRSSI(m_rssi);
+	advertisedDevice.setAdFlag(m_adFlag);
+	advertisedDevice.setPayload(m_payload, getPayloadLength());
+	advertisedDevice.setScan(BLEDevice::getScan());
+	return advertisedDevice;
+} // getAdvertisedDevice
+
+
+/**
+ * @brief Get a view of the record that decodes its fields.
+ * The view is only valid for as long as the record is.
+ * @return The view.
+ */
+BLEAdvertisementView BLEScanRecord::getView() {
+	return BLEAdvertisementView(m_address, m_payload, getPayloadLength(), m_rssi);
+} // getView
+
+
+/**
+ * @brief Get the raw advertisement followed by the raw scan response, if one was received.
+ * @return The payload.
+ */
+uint8_t* BLEScanRecord::getPayload() {
+	return m_payload;
+} // getPayload
+
+
+/**
+ * @brief Get the length of the payload.
+ * @return The length of the payload.
+ */
+size_t BLEScanRecord::getPayloadLength() {
+	return m_advLength + m_scanRspLength;
+} // getPayloadLength
+
+
+/**
+ * @brief Get the RSSI of the latest report from the device.
+ * @return The RSSI.
+ */
+int BLEScanRecord::getRSSI() {
+	return m_rssi;
+} // getRSSI
+
+
+/**
+ * @brief Get the number of reports that have been received from the device.
+ * @return The number of reports.
+ */
+uint32_t BLEScanRecord::getSeenCount() {
+	return m_seenCount;
+} // getSeenCount
+
+
+BLEScanResults::BLEScanResults() {
+	m_maxCount = 0;
+	setMaxCount(BLE_SCAN_MAX_RESULTS);
+} // BLEScanResults
+
+
+/**
+ * @brief Forget all the devices.
+ */
+void BLEScanResults::clear() {
+	m_records.clear();
+	std::fill(m_table.begin(), m_table.end(), 0);
+	m_newest = NONE;
+	m_oldest = NONE;
+} // clear
+
+
 /**
  * @brief Dump the scan results to the log.
  */
@@ -269,12 +436,42 @@ void BLEScanResults::dump() {
 } // dump
 
 
+/**
+ * @brief Find the record of a device.
+ * @param [in] address The address of the device.
+ * @return The record of the device or nullptr if the device hasn't been seen.
+ */
+BLEScanRecord* BLEScanResults::find(BLEAddress address) {
+	uint32_t slot = findSlot(*address.getNative());
+	if (m_table[slot] == 0) {
+		return nullptr;
+	}
+	return &m_records[m_table[slot] - 1];
+} // find
+
+
+/**
+ * @brief Find the slot of the hash table that holds an address or, if the address isn't held, the free
+ * slot where it would go.
+ * @param [in] address The address to find.
+ * @return The index of the slot.
+ */
+uint32_t BLEScanResults::findSlot(const uint8_t* address) {
+	uint32_t mask = m_table.size() - 1;
+	uint32_t slot = hashAddress(address) & mask;
+	while (m_table[slot] != 0 && memcmp(m_records[m_table[slot] - 1].m_address, address, ESP_BD_ADDR_LEN) != 0) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+} // findSlot
+
+
 /**
  * @brief Return the count of devices found in the last scan.
  * @return The number of devices found in the last scan.
  */
 int BLEScanResults::getCount() {
-	return m_vectorAdvertisedDevices.size();
+	return m_records.size();
 } // getCount
 
 
@@ -285,8 +482,186 @@ int BLEScanResults::getCount() {
  * @return The device at the specified index.
  */
 BLEAdvertisedDevice BLEScanResults::getDevice(uint32_t i) {
-	return m_vectorAdvertisedDevices.at(i);
-}
+	return m_records.at(i).getAdvertisedDevice();
+} // getDevice
+
+
+/**
+ * @brief Get the largest number of devices that are remembered.
+ * @return The largest number of devices.
+ */
+uint16_t BLEScanResults::getMaxCount() {
+	return m_maxCount;
+} // getMaxCount
+
+
+/**
+ * @brief Return the record of the device at the given index without decoding it.
+ * The index should be between 0 and getCount()-1.
+ * @param [in] i The index of the device.
+ * @return The record of the device or nullptr if the index is out of range.
+ */
+BLEScanRecord* BLEScanResults::getRecord(uint32_t i) {
+	if (i >= m_records.size()) {
+		return nullptr;
+	}
+	return &m_records[i];
+} // getRecord
+
+
+/**
+ * @brief Set the largest number of devices that are remembered.
+ * Any devices already found are forgotten.
+ * @param [in] maxCount The largest number of devices.
+ */
+void BLEScanResults::setMaxCount(uint16_t maxCount) {
+	if (maxCount == 0 || maxCount >= NONE) {
+		ESP_LOGE(LOG_TAG, "setMaxCount: %d is out of range", maxCount);
+		return;
+	}
+	m_maxCount = maxCount;
+	uint32_t tableSize = 1;
+	while (tableSize < 2 * (uint32_t) maxCount) {   // Keep the table at most half full so that probes stay short.
+		tableSize <<= 1;
+	}
+	m_table.assign(tableSize, 0);
+	clear();
+	m_records.reserve(maxCount);   // Records are added in place during the scan, never moved.
+} // setMaxCount
+
+
+/**
+ * @brief Make a record the one heard from most recently.
+ * @param [in] index The index of the record.
+ */
+void BLEScanResults::touch(uint16_t index) {
+	if (index == m_newest) {
+		return;
+	}
+	if (m_records[index].m_newer != NONE) {   // Only the newest record of the list has no newer record.
+		unlink(index);
+	}
+	m_records[index].m_older = m_newest;
+	m_records[index].m_newer = NONE;
+	if (m_newest != NONE) {
+		m_records[m_newest].m_newer = index;
+	} else {
+		m_oldest = index;
+	}
+	m_newest = index;
+} // touch
+
+
+/**
+ * @brief Remove a record from the list of records ordered by when they were heard from.
+ * @param [in] index The index of the record.
+ */
+void BLEScanResults::unlink(uint16_t index) {
+	BLEScanRecord* pRecord = &m_records[index];
+	if (pRecord->m_newer != NONE) {
+		m_records[pRecord->m_newer].m_older = pRecord->m_older;
+	} else {
+		m_newest = pRecord->m_older;
+	}
+	if (pRecord->m_older != NONE) {
+		m_records[pRecord->m_older].m_newer = pRecord->m_newer;
+	} else {
+		m_oldest = pRecord->m_newer;
+	}
+	pRecord->m_newer = NONE;
+	pRecord->m_older = NONE;
+} // unlink
+
+
+/**
+ * @brief Remove the address of a record from the hash table.
+ *
+ * The entries that follow in the same probe sequence are shifted back into the freed slot so that
+ * no tombstones are needed.
+ *
+ * @param [in] index The index of the record.
+ */
+void BLEScanResults::unindex(uint16_t index) {
+	uint32_t mask = m_table.size() - 1;
+	uint32_t hole = findSlot(m_records[index].m_address);
+	m_table[hole] = 0;
+	for (uint32_t slot = (hole + 1) & mask; m_table[slot] != 0; slot = (slot + 1) & mask) {
+		uint32_t home = hashAddress(m_records[m_table[slot] - 1].m_address) & mask;
+		// The entry may move back to the hole unless its home slot lies after the hole.
+		if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+			m_table[hole] = m_table[slot];
+			m_table[slot] = 0;
+			hole = slot;
+		}
+	}
+} // unindex
+
+
+/**
+ * @brief Record a scan result.
+ *
+ * If the device has been seen before, its record is updated in place: an advertisement replaces the one
+ * held, and a scan response is kept after the advertisement that it answers.  Otherwise a new record is
+ * made, reusing the record of the device heard from least recently if all the records are in use.
+ *
+ * @param [in] param The ESP_GAP_SEARCH_INQ_RES_EVT parameters.
+ * @param [out] pIsNew Set to true if the device hadn't been seen before.
+ * @return The record of the device.
+ */
+BLEScanRecord* BLEScanResults::update(esp_ble_gap_cb_param_t* param, bool* pIsNew) {
+	// The report holds the advertisement followed, in a scan response, by the response.
+	size_t advLength = std::min((size_t) ESP_BLE_ADV_DATA_LEN_MAX, (size_t) param->scan_rst.adv_data_len);
+	size_t rspLength = std::min((size_t) ESP_BLE_SCAN_RSP_DATA_LEN_MAX, (size_t) param->scan_rst.scan_rsp_len);
+	uint8_t* pResponse = param->scan_rst.ble_adv + param->scan_rst.adv_data_len;
+
+	BLEScanRecord* pRecord;
+	uint32_t slot = findSlot(param->scan_rst.bda);
+	if (m_table[slot] != 0) {
+		uint16_t index = m_table[slot] - 1;
+		pRecord = &m_records[index];
+		if (param->scan_rst.ble_evt_type == ESP_BLE_EVT_SCAN_RSP) {
+			// Keep the response after the advertisement that it answers.
+			memcpy(pRecord->m_payload + pRecord->m_advLength, pResponse, rspLength);
+			pRecord->m_scanRspLength = rspLength;
+		} else {
+			// A new advertisement replaces the old one, whose data may have changed, and its response.
+			pRecord->m_adFlag        = param->scan_rst.flag;
+			pRecord->m_advLength     = advLength;
+			pRecord->m_scanRspLength = 0;
+			memcpy(pRecord->m_payload, param->scan_rst.ble_adv, advLength);
+		}
+		touch(index);
+		*pIsNew = false;
+	} else {
+		uint16_t index;
+		if (m_records.size() < m_maxCount) {
+			index = m_records.size();
+			m_records.emplace_back();
+		} else {
+			index = m_oldest;    // Forget the device heard from least recently.
+			ESP_LOGD(LOG_TAG, "Forgetting %s", m_records[index].getAddress().toString().c_str());
+			unindex(index);
+			unlink(index);
+			slot = findSlot(param->scan_rst.bda);   // Removing the old address may have moved the free slot.
+		}
+		m_table[slot] = index + 1;
+		pRecord = &m_records[index];
+		memcpy(pRecord->m_address, param->scan_rst.bda, ESP_BD_ADDR_LEN);
+		pRecord->m_adFlag        = param->scan_rst.flag;
+		pRecord->m_advLength     = advLength;
+		pRecord->m_scanRspLength = rspLength;
+		memcpy(pRecord->m_payload, param->scan_rst.ble_adv, advLength);
+		memcpy(pRecord->m_payload + advLength, pResponse, rspLength);
+		pRecord->m_seenCount     = 0;
+		pRecord->m_newer         = NONE;
+		pRecord->m_older         = NONE;
+		touch(index);
+		*pIsNew = true;
+	}
+	pRecord->m_rssi = param->scan_rst.rssi;
+	pRecord->m_seenCount++;
+	return pRecord;
+} // update
 
 
 #endif /* CONFIG_BT_ENABLED */
@@ -12,46 +12,112 @@
 #include <esp_gap_ble_api.h>
 
 #include <vector>
+#include "BLEAddress.h"
 #include "BLEAdvertisedDevice.h"
+#include "BLEAdvertisementView.h"
 #include "BLEClient.h"
 #include "FreeRTOS.h"
 
+#define BLE_SCAN_MAX_RESULTS (128)  // Default number of devices that a scan remembers.
+
 class BLEAdvertisedDevice;
 class BLEAdvertisedDeviceCallbacks;
 class BLEClient;
 class BLEScan;
 
 
+/**
+ * @brief A compact record of a device found by a scan.
+ *
+ * The record keeps the advertisement (and any scan response) as the raw bytes that were received.
+ * Nothing is decoded until a field is asked for through getView(), or a BLEAdvertisedDevice is made
+ * from the record with getAdvertisedDevice().
+ */
+class BLEScanRecord {
+public:
+	BLEAddress          getAddress();
+	BLEAdvertisedDevice getAdvertisedDevice();
+	uint8_t*            getPayload();
+	size_t              getPayloadLength();
+	int                 getRSSI();
+	uint32_t            getSeenCount();
+	BLEAdvertisementView getView();
+
+private:
+	friend class BLEScanResults;
+
+	esp_bd_addr_t m_address;
+	uint8_t       m_adFlag;
+	int8_t        m_rssi;
+	uint8_t       m_advLength;      // Bytes of advertisement at the start of the payload.
+	uint8_t       m_scanRspLength;  // Bytes of scan response that follow the advertisement.
+	uint8_t       m_payload[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+	uint32_t      m_seenCount;      // The number of reports received for this device.
+	uint16_t      m_newer;          // The index of the record seen next after this one.
+	uint16_t      m_older;          // The index of the record seen last before this one.
+}; // BLEScanRecord
+
+
 /**
  * @brief The result of having performed a scan.
  * When a scan completes, we have a set of found devices.  Each device is described
  * by a BLEAdvertisedDevice object.  The number of items in the set is given by
  * getCount().  We can retrieve a device by calling getDevice() passing in the
  * index (starting at 0) of the desired device.
+ *
+ * The devices are held as BLEScanRecord entries in a slab of at most getMaxCount() records.  An
+ * open addressing hash of the device addresses finds the record of a device that has been seen before.
+ * When the slab is full, the record of the device that was heard from least recently is reused.
  */
 class BLEScanResults {
 public:
+	BLEScanResults();
 	void                dump();
+	BLEScanRecord*      find(BLEAddress address);
 	int                 getCount();
 	BLEAdvertisedDevice getDevice(uint32_t i);
+	uint16_t            getMaxCount();
+	BLEScanRecord*      getRecord(uint32_t i);
 
 private:
 	friend BLEScan;
-	std::vector<BLEAdvertisedDevice> m_vectorAdvertisedDevices;
-};
+	static const uint16_t NONE = 0xffff;
+
+	std::vector<BLEScanRecord> m_records;  // The slab.
+	std::vector<uint16_t>      m_table;    // Address hash to the index of a record plus one, 0 if the slot is free.
+	uint16_t                   m_maxCount;
+	uint16_t                   m_newest;   // The index of the record heard from most recently.
+	uint16_t                   m_oldest;   // The index of the record heard from least recently.
+
+	void           clear();
+	uint32_t       findSlot(const uint8_t* address);
+	void           setMaxCount(uint16_t maxCount);
+	void           touch(uint16_t index);
+	void           unlink(uint16_t index);
+	void           unindex(uint16_t index);
+	BLEScanRecord* update(esp_ble_gap_cb_param_t* param, bool* pIsNew);
+}; // BLEScanResults
 
 /**
  * @brief Perform and manage %BLE scans.
  *
  * Scanning is associated with a %BLE client that is attempting to locate BLE servers.
+ *
+ * Filters can be set so that only the devices of interest are recorded and reported.  A filter is
+ * checked against the raw advertisement as soon as it arrives, before anything is copied or decoded.
  */
 class BLEScan {
 public:
+	void           clearFilters();
 	void           setActiveScan(bool active);
 	void           setAdvertisedDeviceCallbacks(
 			              BLEAdvertisedDeviceCallbacks* pAdvertisedDeviceCallbacks,
 										bool wantDuplicates = false);
+	void           setFilterManufacturerId(uint16_t manufacturerId);
+	void           setFilterRSSI(int minRSSI);
+	void           setFilterServiceUUID(BLEUUID serviceUUID);
 	void           setInterval(uint16_t intervalMSecs);
+	void           setMaxResults(uint16_t maxResults);
 	void           setWindow(uint16_t windowMSecs);
 	bool           start(uint32_t duration, void (*scanCompleteCB)(BLEScanResults));
 	BLEScanResults start(uint32_t duration);
@@ -63,12 +129,17 @@ private:
 	void         handleGAPEvent(
 		esp_gap_ble_cb_event_t  event,
 		esp_ble_gap_cb_param_t* param);
+	bool         isWanted(const BLEAdvertisementView& view);
 	void parseAdvertisement(BLEClient* pRemoteDevice, uint8_t *payload);
 
 
 	esp_ble_scan_params_t         m_scan_params;
 	BLEAdvertisedDeviceCallbacks* m_pAdvertisedDeviceCallbacks;
 	bool                          m_stopped;
+	bool                          m_filterManufacturer;    // Is there a manufacturer filter?
+	uint16_t                      m_filterManufacturerId;
+	int                           m_filterRSSI;            // The weakest signal that is wanted.
+	BLEUUID                       m_filterServiceUUID;     // No value if there is no service filter.
 	FreeRTOS::Semaphore           m_semaphoreScanEnd = FreeRTOS::Semaphore("ScanEnd");
 	BLEScanResults                m_scanResults;
 	bool                          m_wantDuplicates;
@@ -16,6 +16,8 @@
 #include "BLEServer.h"
 #include "BLEService.h"
 #include "BLEUtils.h"
+#include "GeneralUtils.h"
+#include <stdio.h>
 #include <string.h>
 #include <string>
 #include <unordered_set>
@@ -37,6 +39,7 @@ BLEServer::BLEServer() {
 	m_gatts_if         = -1;
 	m_connectedCount   = 0;
 	m_connId           = -1;
+	m_notifyCredits    = BLE_NOTIFY_CREDITS;
 	m_pServerCallbacks = nullptr;
 
 	//createApp(0);
@@ -105,6 +108,39 @@ BLEAdvertising* BLEServer::getAdvertising() {
 	return &m_bleAdvertising;
 }
 
+/**
+ * @brief Add the attributes of a service to the attribute table.
+ * The table is only used by the task that handles the GATT server events, which calls this when the service
+ * starts, so it needs no lock.
+ * @param [in] pService The service.
+ */
+void BLEServer::addAttributes(BLEService* pService) {
+	BLECharacteristic* pCharacteristic = pService->m_characteristicMap.getFirst();
+	while (pCharacteristic != nullptr) {
+		setAttributeOwner(pCharacteristic->getHandle(), pCharacteristic);
+		BLEDescriptor* pDescriptor = pCharacteristic->m_descriptorMap.getFirst();
+		while (pDescriptor != nullptr) {
+			setAttributeOwner(pDescriptor->getHandle(), pCharacteristic);
+			pDescriptor = pCharacteristic->m_descriptorMap.getNext();
+		}
+		pCharacteristic = pService->m_characteristicMap.getNext();
+	}
+} // addAttributes
+
+
+/**
+ * @brief Get the characteristic that owns an attribute.
+ * @param [in] handle The handle of a characteristic's value or of one of its descriptors.
+ * @return The characteristic or nullptr if the handle isn't in the attribute table.
+ */
+BLECharacteristic* BLEServer::getAttributeOwner(uint16_t handle) {
+	if (handle >= m_attributeTable.size()) {
+		return nullptr;
+	}
+	return m_attributeTable[handle];
+} // getAttributeOwner
+
+
 uint16_t BLEServer::getConnId() {
 	return m_connId;
 }
@@ -123,6 +159,52 @@ uint16_t BLEServer::getGattsIf() {
 	return m_gatts_if;
 }
 
+
+/**
+ * @brief Get the session of a connected client.
+ * The session remains valid until the client disconnects.
+ * @param [in] connId The connection id of the client.
+ * @return The session or nullptr if no client is connected with that id.
+ */
+BLEServerSession* BLEServer::getSession(uint16_t connId) {
+	m_semaphoreSessions.take("getSession");
+	auto it = m_sessions.find(connId);
+	BLEServerSession* pSession = it == m_sessions.end() ? nullptr : it->second;
+	m_semaphoreSessions.give();
+	return pSession;
+} // getSession
+
+
+/**
+ * @brief Get the connection ids of the connected clients.
+ * @return The connection ids.
+ */
+std::vector<uint16_t> BLEServer::getSessionIds() {
+	std::vector<uint16_t> ids;
+	m_semaphoreSessions.take("getSessionIds");
+	for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+		ids.push_back(it->first);
+	}
+	m_semaphoreSessions.give();
+	return ids;
+} // getSessionIds
+
+
+/**
+ * @brief Get the value that a client has written to the 0x2902 descriptor of a characteristic.
+ * @param [in] connId The connection id of the client.
+ * @param [in] handle The handle of the characteristic.
+ * @return The value of the descriptor for the client.
+ */
+uint16_t BLEServer::getSubscription(uint16_t connId, uint16_t handle) {
+	m_semaphoreSessions.take("getSubscription");
+	auto it = m_sessions.find(connId);
+	uint16_t value = it == m_sessions.end() ? 0 : it->second->getSubscription(handle);
+	m_semaphoreSessions.give();
+	return value;
+} // getSubscription
+
+
 /**
  * @brief Handle a received GAP event.
  *
@@ -134,6 +216,20 @@ void BLEServer::handleGAPEvent(
 		esp_ble_gap_cb_param_t* param) {
 	ESP_LOGD(LOG_TAG, "BLEServer ... handling GAP event!");
 	switch(event) {
+		// ESP_GAP_BLE_AUTH_CMPL_EVT
+		// The link to a client has been encrypted, or failed to be.
+		//
+		case ESP_GAP_BLE_AUTH_CMPL_EVT: {
+			m_semaphoreSessions.take("authCmpl");
+			for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+				if (memcmp(it->second->m_address, param->ble_security.auth_cmpl.bd_addr, ESP_BD_ADDR_LEN) == 0) {
+					it->second->m_encrypted = param->ble_security.auth_cmpl.success;
+				}
+			}
+			m_semaphoreSessions.give();
+			break;
+		} // ESP_GAP_BLE_AUTH_CMPL_EVT
+
 		case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT: {
 			/*
 			esp_ble_adv_params_t adv_params;
@@ -176,8 +272,21 @@ void BLEServer::handleGATTServerEvent(
 	ESP_LOGD(LOG_TAG, ">> handleGATTServerEvent: %s",
 		BLEUtils::gattServerEventTypeToString(event).c_str());
 
-	// Invoke the handler for every Service we have.
-	m_serviceMap.handleGATTServerEvent(event, gatts_if, param);
+	// An event about one attribute goes straight to the characteristic that owns it.  Any other event goes
+	// to every service we have.
+	uint16_t handle = 0;
+	switch(event) {
+		case ESP_GATTS_READ_EVT:  handle = param->read.handle;  break;
+		case ESP_GATTS_WRITE_EVT: handle = param->write.handle; break;
+		case ESP_GATTS_CONF_EVT:  handle = param->conf.handle;  break;
+		default: break;
+	}
+	BLECharacteristic* pOwner = getAttributeOwner(handle);
+	if (pOwner != nullptr) {
+		pOwner->handleGATTServerEvent(event, gatts_if, param);
+	} else {
+		m_serviceMap.handleGATTServerEvent(event, gatts_if, param);
+	}
 
 	switch(event) {
 		// ESP_GATTS_ADD_CHAR_EVT - Indicate that a characteristic was added to the service.
@@ -200,6 +309,10 @@ void BLEServer::handleGATTServerEvent(
 		//
 		case ESP_GATTS_CONNECT_EVT: {
 			m_connId = param->connect.conn_id; // Save the connection id.
+			m_semaphoreSessions.take("connect");
+			delete m_sessions[param->connect.conn_id];   // Left over if we missed the disconnect.
+			m_sessions[param->connect.conn_id] = new BLEServerSession(param->connect.conn_id, param->connect.remote_bda);
+			m_semaphoreSessions.give();
 			if (m_pServerCallbacks != nullptr) {
 				m_pServerCallbacks->onConnect(this);
 			}
@@ -216,6 +329,33 @@ void BLEServer::handleGATTServerEvent(
 		// * uint16_t           service_handle
 		// * esp_gatt_srvc_id_t service_id
 		//
+		// ESP_GATTS_CONGEST_EVT
+		// Notifications to a client are held back while its connection is congested.
+		//
+		// congest:
+		// - uint16_t conn_id
+		// - bool     congested
+		//
+		case ESP_GATTS_CONGEST_EVT: {
+			m_semaphoreSessions.take("congest");
+			auto it = m_sessions.find(param->congest.conn_id);
+			if (it != m_sessions.end()) {
+				it->second->m_notifyQueue.setCongested(param->congest.congested);
+				sendPending(it->second);
+			}
+			m_semaphoreSessions.give();
+			break;
+		} // ESP_GATTS_CONGEST_EVT
+
+
+		case ESP_GATTS_DELETE_EVT: {
+			m_semaphoreSessions.take("delete");
+			removeAttributes(param->del.service_handle);
+			m_semaphoreSessions.give();
+			break;
+		} // ESP_GATTS_DELETE_EVT
+
+
 		case ESP_GATTS_CREATE_EVT: {
 			BLEService* pService = m_serviceMap.getByUUID(param->create.service_id.id.uuid);
 			m_serviceMap.setByHandle(param->create.service_handle, pService);
@@ -235,6 +375,13 @@ void BLEServer::handleGATTServerEvent(
 		// we also want to start advertising again.
 		case ESP_GATTS_DISCONNECT_EVT: {
 			m_connectedCount--;                          // Decrement the number of connected devices count.
+			m_semaphoreSessions.take("disconnect");
+			auto it = m_sessions.find(param->disconnect.conn_id);
+			if (it != m_sessions.end()) {
+				delete it->second;
+				m_sessions.erase(it);
+			}
+			m_semaphoreSessions.give();
 			if (m_pServerCallbacks != nullptr) {         // If we have callbacks, call now.
 				m_pServerCallbacks->onDisconnect(this);
 			}
@@ -243,6 +390,23 @@ void BLEServer::handleGATTServerEvent(
 		} // ESP_GATTS_DISCONNECT_EVT
 
 
+		// ESP_GATTS_MTU_EVT
+		//
+		// mtu:
+		// - uint16_t conn_id
+		// - uint16_t mtu
+		//
+		case ESP_GATTS_MTU_EVT: {
+			m_semaphoreSessions.take("mtu");
+			auto it = m_sessions.find(param->mtu.conn_id);
+			if (it != m_sessions.end()) {
+				it->second->m_mtu = param->mtu.mtu;
+			}
+			m_semaphoreSessions.give();
+			break;
+		} // ESP_GATTS_MTU_EVT
+
+
 		// ESP_GATTS_READ_EVT - A request to read the value of a characteristic has arrived.
 		//
 		// read:
@@ -271,6 +435,21 @@ void BLEServer::handleGATTServerEvent(
 		} // ESP_GATTS_REG_EVT
 
 
+		// ESP_GATTS_START_EVT
+		// The handles of the service's attributes are all known now.
+		//
+		// start:
+		// - esp_gatt_status_t status
+		// - uint16_t          service_handle
+		//
+		case ESP_GATTS_START_EVT: {
+			if (param->start.status == ESP_GATT_OK) {
+				addAttributes(m_serviceMap.getByHandle(param->start.service_handle));
+			}
+			break;
+		} // ESP_GATTS_START_EVT
+
+
 		// ESP_GATTS_WRITE_EVT - A request to write the value of a characteristic has arrived.
 		//
 		// write:
@@ -288,6 +467,27 @@ void BLEServer::handleGATTServerEvent(
 			break;
 		}
 
+
+		// ESP_GATTS_EXEC_WRITE_EVT - The parts of a long write are to be written or dropped.  The characteristic
+		// that received the parts has acted on it; the client expects a single response.
+		//
+		// exec_write:
+		// - uint16_t      conn_id
+		// - uint32_t      trans_id
+		// - esp_bd_addr_t bda
+		// - uint8_t       exec_write_flag
+		//
+		case ESP_GATTS_EXEC_WRITE_EVT: {
+			esp_err_t errRc = ::esp_ble_gatts_send_response(
+					gatts_if,
+					param->exec_write.conn_id,
+					param->exec_write.trans_id, ESP_GATT_OK, nullptr);
+			if (errRc != ESP_OK) {
+				ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_response: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+			}
+			break;
+		} // ESP_GATTS_EXEC_WRITE_EVT
+
 		default: {
 			break;
 		}
@@ -296,6 +496,76 @@ void BLEServer::handleGATTServerEvent(
 } // handleGATTServerEvent
 
 
+/**
+ * @brief Send an indication of the value of a characteristic to each client that wants it.
+ * @param [in] pCharacteristic The characteristic.
+ * @return The number of clients that the indication was sent to.  Each will confirm it.
+ */
+uint32_t BLEServer::indicate(BLECharacteristic* pCharacteristic) {
+	uint32_t count = 0;
+	m_semaphoreSessions.take("indicate");
+	pCharacteristic->m_semaphoreNotify.take("indicate");
+	for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+		BLEServerSession* pSession = it->second;
+		if (!pSession->isSubscribed(pCharacteristic, true)) {
+			continue;
+		}
+		size_t length = pCharacteristic->m_value.getLength();
+		if (length > (size_t) (pSession->m_mtu - 3)) {
+			ESP_LOGI(LOG_TAG, "- Truncating to %d bytes (maximum indicate size)", pSession->m_mtu - 3);
+			length = pSession->m_mtu - 3;
+		}
+		esp_err_t errRc = ::esp_ble_gatts_send_indicate(
+				m_gatts_if, pSession->m_connId, pCharacteristic->getHandle(),
+				length, pCharacteristic->m_value.getData(), true); // The need_confirm = true makes this an indication.
+		if (errRc != ESP_OK) {
+			ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_indicate: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+			continue;
+		}
+		pCharacteristic->m_indicateWaiting.push_back(pSession->m_connId);
+		count++;
+	}
+	pCharacteristic->m_semaphoreNotify.give();
+	m_semaphoreSessions.give();
+	return count;
+} // indicate
+
+
+/**
+ * @brief Send a notification of the value of a characteristic to each client that wants it.
+ * Each client is sent the notification as soon as it has a credit free.
+ * @param [in] pCharacteristic The characteristic.
+ */
+void BLEServer::notify(BLECharacteristic* pCharacteristic) {
+	m_semaphoreSessions.take("notify");
+	for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+		BLEServerSession* pSession = it->second;
+		if (pSession->isSubscribed(pCharacteristic)) {
+			if (!pSession->m_notifyQueue.push(pCharacteristic->getHandle())) {
+				pCharacteristic->m_notifyDroppedCount++;   // The waiting notification sends the latest value.
+			}
+			sendPending(pSession);
+		}
+	}
+	m_semaphoreSessions.give();
+} // notify
+
+
+/**
+ * @brief Note that the stack has sent a notification to a client, returning its credit.
+ * @param [in] connId The connection id of the client.
+ */
+void BLEServer::notifySent(uint16_t connId) {
+	m_semaphoreSessions.take("notifySent");
+	auto it = m_sessions.find(connId);
+	if (it != m_sessions.end()) {
+		it->second->m_notifyQueue.confirmed();
+		sendPending(it->second);
+	}
+	m_semaphoreSessions.give();
+} // notifySent
+
+
 /**
  * @brief Register the app.
  *
@@ -323,10 +593,110 @@ void BLEServer::setCallbacks(BLEServerCallbacks* pCallbacks) {
 	m_pServerCallbacks = pCallbacks;
 } // setCallbacks
 
+/**
+ * @brief Remove the attributes of a deleted service from the attribute table.
+ * Must be called with the sessions semaphore taken, as the table is read when notifications are sent.
+ * @param [in] serviceHandle The handle of the service.
+ */
+void BLEServer::removeAttributes(uint16_t serviceHandle) {
+	for (auto it = m_attributeTable.begin(); it != m_attributeTable.end(); ++it) {
+		if (*it != nullptr && (*it)->getService()->getHandle() == serviceHandle) {
+			*it = nullptr;
+		}
+	}
+} // removeAttributes
+
+
+/**
+ * @brief Send the notifications waiting for a client while credits are free and the connection isn't congested.
+ * Must be called with the sessions semaphore taken.
+ * @param [in] pSession The session of the client.
+ */
+void BLEServer::sendPending(BLEServerSession* pSession) {
+	while (pSession->m_notifyQueue.canSend(m_notifyCredits)) {
+		BLECharacteristic* pCharacteristic = getAttributeOwner(pSession->m_notifyQueue.pop());
+		if (pCharacteristic == nullptr) {   // Its service has been removed.
+			continue;
+		}
+
+		pCharacteristic->m_semaphoreNotify.take("sendPending");
+		size_t length = pCharacteristic->m_value.getLength();
+		if (length > (size_t) (pSession->m_mtu - 3)) {
+			length = pSession->m_mtu - 3;
+		}
+		esp_err_t errRc = ::esp_ble_gatts_send_indicate(
+				m_gatts_if, pSession->m_connId, pCharacteristic->getHandle(),
+				length, pCharacteristic->m_value.getData(), false); // The need_confirm = false makes this a notify.
+		pCharacteristic->m_semaphoreNotify.give();
+
+		if (errRc != ESP_OK) {
+			ESP_LOGE(LOG_TAG, "esp_ble_gatts_send_indicate: rc=%d %s", errRc, GeneralUtils::errorToString(errRc));
+			continue;
+		}
+		pSession->m_notifyQueue.sent();
+		pCharacteristic->m_notifySentCount++;
+	}
+} // sendPending
+
+
+/**
+ * @brief Record the characteristic that owns an attribute.
+ * @param [in] handle The handle of the attribute.
+ * @param [in] pCharacteristic The characteristic.
+ */
+void BLEServer::setAttributeOwner(uint16_t handle, BLECharacteristic* pCharacteristic) {
+	if (handle == 0 || handle == 0xffff) {   // Not yet known.
+		return;
+	}
+	if (handle >= m_attributeTable.size()) {
+		m_attributeTable.resize(handle + 1, nullptr);
+	}
+	m_attributeTable[handle] = pCharacteristic;
+} // setAttributeOwner
+
+
+/**
+ * @brief Set the number of notifications that may be in flight to one client at once.
+ * More credits let several notifications go out in one connection interval at the cost of more of the
+ * stack's buffers.
+ * @param [in] credits The number of notifications.
+ */
+void BLEServer::setNotifyCredits(uint8_t credits) {
+	m_notifyCredits = credits;
+} // setNotifyCredits
+
+
+/**
+ * @brief Record the value that a client has written to the 0x2902 descriptor of a characteristic.
+ * @param [in] connId The connection id of the client.
+ * @param [in] handle The handle of the characteristic.
+ * @param [in] value The value written.
+ */
+void BLEServer::setSubscription(uint16_t connId, uint16_t handle, uint16_t value) {
+	m_semaphoreSessions.take("setSubscription");
+	auto it = m_sessions.find(connId);
+	if (it != m_sessions.end()) {
+		it->second->m_subscriptions[handle] = value;
+	}
+	m_semaphoreSessions.give();
+} // setSubscription
+
 /*
  * Remove service
  */
 void BLEServer::removeService(BLEService *service) {
+	// Forget the characteristics of the service before they go, so that no session sends one of them again.
+	m_semaphoreSessions.take("removeService");
+	BLECharacteristic* pCharacteristic = service->m_characteristicMap.getFirst();
+	while (pCharacteristic != nullptr) {
+		for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
+			it->second->m_notifyQueue.remove(pCharacteristic->getHandle());
+		}
+		pCharacteristic = service->m_characteristicMap.getNext();
+	}
+	removeAttributes(service->getHandle());
+	m_semaphoreSessions.give();
+
 	service->stop();
 	service->executeDelete();	
 	m_serviceMap.removeService(service);
@@ -345,6 +715,88 @@ void BLEServer::startAdvertising() {
 } // startAdvertising
 
 
+BLEServerSession::BLEServerSession(uint16_t connId, esp_bd_addr_t address) {
+	memcpy(m_address, address, ESP_BD_ADDR_LEN);
+	m_connId         = connId;
+	m_mtu            = 23;        // The default until the client asks for more.
+	m_encrypted      = false;
+} // BLEServerSession
+
+
+/**
+ * @brief Get the address of the client.
+ * @return The address of the client.
+ */
+BLEAddress BLEServerSession::getAddress() {
+	return BLEAddress(m_address);
+} // getAddress
+
+
+/**
+ * @brief Get the connection id of the client.
+ * @return The connection id of the client.
+ */
+uint16_t BLEServerSession::getConnId() {
+	return m_connId;
+} // getConnId
+
+
+/**
+ * @brief Get the MTU agreed with the client.
+ * @return The MTU agreed with the client.
+ */
+uint16_t BLEServerSession::getMTU() {
+	return m_mtu;
+} // getMTU
+
+
+/**
+ * @brief Get the value that the client has written to the 0x2902 descriptor of a characteristic.
+ * @param [in] handle The handle of the characteristic.
+ * @return The value of the descriptor for this client, 0 if it has never written it.
+ */
+uint16_t BLEServerSession::getSubscription(uint16_t handle) {
+	auto it = m_subscriptions.find(handle);
+	return it == m_subscriptions.end() ? 0 : it->second;
+} // getSubscription
+
+
+/**
+ * @brief Is the link to the client encrypted?
+ * @return True if the client has been paired and the link encrypted.
+ */
+bool BLEServerSession::isEncrypted() {
+	return m_encrypted;
+} // isEncrypted
+
+
+/**
+ * @brief Does the client want notifications or indications of a characteristic?
+ * A characteristic without a 0x2902 descriptor is sent to every client.
+ * @param [in] pCharacteristic The characteristic.
+ * @param [in] indications True to ask about indications rather than notifications.
+ * @return True if the client wants them.
+ */
+bool BLEServerSession::isSubscribed(BLECharacteristic* pCharacteristic, bool indications) {
+	if (pCharacteristic->m_pCCCD == nullptr) {
+		return true;
+	}
+	return (getSubscription(pCharacteristic->getHandle()) & (indications ? CCCD_INDICATE : CCCD_NOTIFY)) != 0;
+} // isSubscribed
+
+
+/**
+ * @brief Return a string representation of the session.
+ * @return A string representation of the session.
+ */
+std::string BLEServerSession::toString() {
+	char text[80];
+	snprintf(text, sizeof(text), "connId: %d, address: %s, mtu: %d, encrypted: %d, notifications in flight: %d",
+		m_connId, getAddress().toString().c_str(), m_mtu, m_encrypted, m_notifyQueue.getInFlight());
+	return std::string(text);
+} // toString
+
+
 void BLEServerCallbacks::onConnect(BLEServer* pServer) {
 	ESP_LOGD("BLEServerCallbacks", ">> onConnect(): Default");
 	ESP_LOGD("BLEServerCallbacks", "Device: %s", BLEDevice::toString().c_str());
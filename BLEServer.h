@@ -11,16 +11,23 @@
 #if defined(CONFIG_BT_ENABLED)
 #include <esp_gatts_api.h>
 
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <string.h>
+#include <vector>
 
+#include "BLENotifyQueue.h"
 #include "BLEUUID.h"
+#include "BLEAddress.h"
 #include "BLEAdvertising.h"
 #include "BLECharacteristic.h"
 #include "BLEService.h"
 #include "BLESecurity.h"
 #include "FreeRTOS.h"
 
+#define BLE_NOTIFY_CREDITS (4)  // Default notifications that may be in flight to one client at once.
+
 class BLEServerCallbacks;
 
 
@@ -47,10 +54,45 @@ public:
 private:
 	std::map<uint16_t, BLEService*>    m_handleMap;
 	std::map<BLEService*, std::string> m_uuidMap;
+	std::unordered_multimap<uint32_t, BLEService*> m_uuidIndex;  // Hash of the UUID to the service.
 	std::map<BLEService*, std::string>::iterator m_iterator;
 };
 
 
+/**
+ * @brief The state that a %BLE server keeps for one connected client.
+ *
+ * Each client has its own subscriptions (the values it has written to the 0x2902 Client Characteristic
+ * Configuration descriptors), MTU and security.  Notifications are sent to each client with their own
+ * flow control so that a slow client doesn't hold back the others.
+ */
+class BLEServerSession {
+public:
+	BLEAddress  getAddress();
+	uint16_t    getConnId();
+	uint16_t    getMTU();
+	uint16_t    getSubscription(uint16_t handle);
+	bool        isEncrypted();
+	bool        isSubscribed(BLECharacteristic* pCharacteristic, bool indications = false);
+	std::string toString();
+
+	static const uint16_t CCCD_NOTIFY   = 1<<0;
+	static const uint16_t CCCD_INDICATE = 1<<1;
+
+private:
+	friend class BLEServer;
+	friend class BLECharacteristic;
+	BLEServerSession(uint16_t connId, esp_bd_addr_t address);
+
+	esp_bd_addr_t                   m_address;
+	uint16_t                        m_connId;
+	uint16_t                        m_mtu;
+	bool                            m_encrypted;
+	std::map<uint16_t, uint16_t>    m_subscriptions;   // Characteristic handle to the value of its 0x2902 descriptor.
+	BLENotifyQueue                  m_notifyQueue;     // Notifications waiting to be sent and in flight.
+}; // BLEServerSession
+
+
 /**
  * @brief The model of a %BLE server.
  */
@@ -60,7 +102,10 @@ public:
 	BLEService*     createService(const char* uuid);	
 	BLEService*     createService(BLEUUID uuid, uint32_t numHandles=15, uint8_t inst_id=0);
 	BLEAdvertising* getAdvertising();
+	BLEServerSession* getSession(uint16_t connId);
+	std::vector<uint16_t> getSessionIds();
 	void            setCallbacks(BLEServerCallbacks* pCallbacks);
+	void            setNotifyCredits(uint8_t credits);
 	void            startAdvertising();
 	void 			removeService(BLEService *service);
 
@@ -76,17 +121,31 @@ private:
   uint16_t						m_connId;
   uint32_t            m_connectedCount;
   uint16_t            m_gatts_if;
+	uint8_t             m_notifyCredits;
 	FreeRTOS::Semaphore m_semaphoreRegisterAppEvt = FreeRTOS::Semaphore("RegisterAppEvt");
 	FreeRTOS::Semaphore m_semaphoreCreateEvt = FreeRTOS::Semaphore("CreateEvt");
+	FreeRTOS::Semaphore m_semaphoreSessions = FreeRTOS::Semaphore("Sessions");  // Guards the sessions; take before any characteristic's.
 	BLEServiceMap       m_serviceMap;
 	BLEServerCallbacks* m_pServerCallbacks;
+	std::map<uint16_t, BLEServerSession*> m_sessions;  // Connection id to session.
+	std::vector<BLECharacteristic*> m_attributeTable;  // Attribute handle to the characteristic that owns it.
 
+	void            addAttributes(BLEService* pService);
 	void            createApp(uint16_t appId);
+	BLECharacteristic* getAttributeOwner(uint16_t handle);
 	uint16_t        getConnId();
 	uint16_t        getGattsIf();
+	uint16_t        getSubscription(uint16_t connId, uint16_t handle);
 	void            handleGAPEvent(esp_gap_ble_cb_event_t event,	esp_ble_gap_cb_param_t *param);
 	void            handleGATTServerEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+	uint32_t        indicate(BLECharacteristic* pCharacteristic);
+	void            notify(BLECharacteristic* pCharacteristic);
+	void            notifySent(uint16_t connId);
 	void            registerApp();
+	void            removeAttributes(uint16_t serviceHandle);
+	void            sendPending(BLEServerSession* pSession);
+	void            setAttributeOwner(uint16_t handle, BLECharacteristic* pCharacteristic);
+	void            setSubscription(uint16_t connId, uint16_t handle, uint16_t value);
 }; // BLEServer
 
 
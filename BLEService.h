@@ -11,6 +11,7 @@
 #if defined(CONFIG_BT_ENABLED)
 
 #include <esp_gatts_api.h>
+#include <unordered_map>
 
 #include "BLECharacteristic.h"
 #include "BLEServer.h"
@@ -42,6 +43,7 @@ public:
 private:
 	std::map<BLECharacteristic*, std::string> m_uuidMap;
 	std::map<uint16_t, BLECharacteristic*> m_handleMap;
+	std::unordered_multimap<uint32_t, BLECharacteristic*> m_uuidIndex;  // Hash of the UUID to the characteristic.
 	std::map<BLECharacteristic*, std::string>::iterator m_iterator;
 };
 
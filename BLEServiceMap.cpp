@@ -26,12 +26,12 @@ BLEService* BLEServiceMap::getByUUID(const char* uuid) {
  * @return The characteristic.
  */
 BLEService* BLEServiceMap::getByUUID(BLEUUID uuid) {
-	for (auto &myPair : m_uuidMap) {
-		if (myPair.first->getUUID().equals(uuid)) {
-			return myPair.first;
+	auto range = m_uuidIndex.equal_range(uuid.hash());
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second->getUUID().equals(uuid)) {
+			return it->second;
 		}
 	}
-	//return m_uuidMap.at(uuid.toString());
 	return nullptr;
 } // getByUUID
 
@@ -55,6 +55,7 @@ BLEService* BLEServiceMap::getByHandle(uint16_t handle) {
 void BLEServiceMap::setByUUID(BLEUUID uuid,
 		BLEService *service) {
 	m_uuidMap.insert(std::pair<BLEService *, std::string>(service, uuid.toString()));
+	m_uuidIndex.insert(std::pair<uint32_t, BLEService *>(uuid.hash(), service));
 } // setByUUID
 
 
@@ -127,6 +128,13 @@ BLEService* BLEServiceMap::getNext() {
 void BLEServiceMap::removeService(BLEService *service){
 	m_handleMap.erase(service->getHandle());
 	m_uuidMap.erase(service);
+	auto range = m_uuidIndex.equal_range(service->getUUID().hash());
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == service) {
+			m_uuidIndex.erase(it);
+			break;
+		}
+	}
 } // removeService
 
 #endif /* CONFIG_BT_ENABLED */
@@ -8,8 +8,6 @@
 #if defined(CONFIG_BT_ENABLED)
 #include <esp_log.h>
 #include <string.h>
-#include <sstream>
-#include <iomanip>
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -51,6 +49,65 @@ static void memrcpy(uint8_t* target, uint8_t* source, uint32_t size) {
 } // memrcpy
 
 
+/**
+ * @brief Read a 64 bit word from 8 bytes, least significant byte first.
+ * @param [in] pData The bytes.
+ * @return The word.
+ */
+static uint64_t readWord(const uint8_t* pData) {
+	uint64_t word = 0;
+	for (int i = 7; i >= 0; i--) {
+		word = (word << 8) | pData[i];
+	}
+	return word;
+} // readWord
+
+
+/**
+ * @brief Write a 64 bit word as 8 bytes, least significant byte first.
+ * @param [out] pData The bytes.
+ * @param [in] word The word.
+ */
+static void writeWord(uint8_t* pData, uint64_t word) {
+	for (int i = 0; i < 8; i++) {
+		pData[i] = word & 0xff;
+		word >>= 8;
+	}
+} // writeWord
+
+
+/**
+ * @brief Read hex digits, skipping dashes.
+ * @param [in] pText The text to parse.
+ * @param [in] count The number of digits to parse.
+ * @param [out] pValue The value of the digits.
+ * @return The text after the digits or nullptr if a character was neither a hex digit nor a dash.
+ */
+static const char* readHex(const char* pText, int count, uint64_t* pValue) {
+	uint64_t value = 0;
+	while (count > 0) {
+		char c = *pText++;
+		if (c == '-') {
+			continue;
+		}
+		uint8_t digit;
+		if (c >= '0' && c <= '9') {
+			digit = c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else {
+			return nullptr;
+		}
+		value = (value << 4) | digit;
+		count--;
+	}
+	*pValue = value;
+	return pText;
+} // readHex
+
+
 /**
  * @brief Create a UUID from a string.
  *
@@ -68,52 +125,29 @@ static void memrcpy(uint8_t* target, uint8_t* source, uint32_t size) {
  *
  * @param [in] value The string to build a UUID from.
  */
-BLEUUID::BLEUUID(std::string value) {
-	m_valueSet = true;
+BLEUUID::BLEUUID(std::string value) : BLEUUID() {
+	const uint8_t* pData = (const uint8_t*) value.data();
 	if (value.length() == 2) {
-		m_uuid.len         = ESP_UUID_LEN_16;
-		m_uuid.uuid.uuid16 = value[0] | (value[1] << 8);
+		*this = BLEUUID((uint16_t) (pData[0] | (pData[1] << 8)));
 	}
 	else if (value.length() == 4) {
-		m_uuid.len         = ESP_UUID_LEN_32;
-		m_uuid.uuid.uuid32 = value[0] | (value[1] << 8) | (value[2] << 16) | (value[3] << 24);
+		*this = BLEUUID((uint32_t) (pData[0] | (pData[1] << 8) | (pData[2] << 16) | ((uint32_t) pData[3] << 24)));
 	}
 	else if (value.length() == 16) {
-		m_uuid.len = ESP_UUID_LEN_128;
-		memrcpy(m_uuid.uuid.uuid128, (uint8_t*)value.data(), 16);
+		*this = BLEUUID((uint8_t*) pData, 16, true);
 	}
 	else if (value.length() == 36) {
 // If the length of the string is 36 bytes then we will assume it is a long hex string in
 // UUID format.
-		m_uuid.len = ESP_UUID_LEN_128;
-		int vals[16];
-		sscanf(value.c_str(), "%2x%2x%2x%2x-%2x%2x-%2x%2x-%2x%2x-%2x%2x%2x%2x%2x%2x",
-			&vals[15],
-			&vals[14],
-			&vals[13],
-			&vals[12],
-			&vals[11],
-			&vals[10],
-			&vals[9],
-			&vals[8],
-			&vals[7],
-			&vals[6],
-			&vals[5],
-			&vals[4],
-			&vals[3],
-			&vals[2],
-			&vals[1],
-			&vals[0]
-		);
-
-		int i;
-		for (i=0; i<16; i++) {
-			m_uuid.uuid.uuid128[i] = vals[i];
+		const char* pText = readHex(value.c_str(), 16, &m_high);
+		if (pText == nullptr || readHex(pText, 16, &m_low) == nullptr) {
+			ESP_LOGE(LOG_TAG, "ERROR: UUID value not hex: %s", value.c_str());
+			return;
 		}
+		m_size = ESP_UUID_LEN_128;
 	}
 	else {
 		ESP_LOGE(LOG_TAG, "ERROR: UUID value not 2, 4, 16 or 36 bytes");
-		m_valueSet = false;
 	}
 } //BLEUUID(std::string)
 
@@ -125,43 +159,20 @@ BLEUUID::BLEUUID(std::string value) {
  * @param [in] size The size of the data.
  * @param [in] msbFirst Is the MSB first in pData memory?
  */
-BLEUUID::BLEUUID(uint8_t* pData, size_t size, bool msbFirst) {
+BLEUUID::BLEUUID(uint8_t* pData, size_t size, bool msbFirst) : BLEUUID() {
 	if (size != 16) {
 		ESP_LOGE(LOG_TAG, "ERROR: UUID length not 16 bytes");
 		return;
 	}
-	m_uuid.len = ESP_UUID_LEN_128;
+	uint8_t data[16];
 	if (msbFirst) {
-		memrcpy(m_uuid.uuid.uuid128, pData, 16);
+		memrcpy(data, pData, 16);
 	} else {
-		memcpy(m_uuid.uuid.uuid128, pData, 16);
+		memcpy(data, pData, 16);
 	}
-	m_valueSet         = true;
-} // BLEUUID
-
-
-/**
- * @brief Create a UUID from the 16bit value.
- *
- * @param [in] uuid The 16bit short form UUID.
- */
-BLEUUID::BLEUUID(uint16_t uuid) {
-	m_uuid.len         = ESP_UUID_LEN_16;
-	m_uuid.uuid.uuid16 = uuid;
-	m_valueSet         = true;
-
-} // BLEUUID
-
-
-/**
- * @brief Create a UUID from the 32bit value.
- *
- * @param [in] uuid The 32bit short form UUID.
- */
-BLEUUID::BLEUUID(uint32_t uuid) {
-	m_uuid.len         = ESP_UUID_LEN_32;
-	m_uuid.uuid.uuid32 = uuid;
-	m_valueSet         = true;
+	m_low  = readWord(data);
+	m_high = readWord(data + 8);
+	m_size = ESP_UUID_LEN_128;
 } // BLEUUID
 
 
@@ -170,9 +181,16 @@ BLEUUID::BLEUUID(uint32_t uuid) {
  *
  * @param [in] uuid The native UUID.
  */
-BLEUUID::BLEUUID(esp_bt_uuid_t uuid) {
-	m_uuid     = uuid;
-	m_valueSet = true;
+BLEUUID::BLEUUID(esp_bt_uuid_t uuid) : BLEUUID() {
+	if (uuid.len == ESP_UUID_LEN_16) {
+		*this = BLEUUID(uuid.uuid.uuid16);
+	} else if (uuid.len == ESP_UUID_LEN_32) {
+		*this = BLEUUID(uuid.uuid.uuid32);
+	} else if (uuid.len == ESP_UUID_LEN_128) {
+		*this = BLEUUID(uuid.uuid.uuid128, 16, false);
+	} else {
+		ESP_LOGE(LOG_TAG, "Unknown UUID length: %d", uuid.len);
+	}
 } // BLEUUID
 
 
@@ -185,62 +203,23 @@ BLEUUID::BLEUUID(esp_gatt_id_t gattId) : BLEUUID(gattId.uuid) {
 } // BLEUUID
 
 
-BLEUUID::BLEUUID() {
-	m_valueSet = false;
-} // BLEUUID
-
-
 /**
  * @brief Get the number of bits in this uuid.
  * @return The number of bits in the UUID.  One of 16, 32 or 128.
  */
-int BLEUUID::bitSize() {
-	if (m_valueSet == false) {
-		return 0;
-	}
-	switch(m_uuid.len) {
-		case ESP_UUID_LEN_16: {
-			return 16;
-		}
-		case ESP_UUID_LEN_32: {
-			return 32;
-		}
-		case ESP_UUID_LEN_128: {
-			return 128;
-		}
-		default: {
-			ESP_LOGE(LOG_TAG, "Unknown UUID length: %d", m_uuid.len);
-			return 0;
-		}
-	} // End of switch
+int BLEUUID::bitSize() const {
+	return m_size * 8;
 } // bitSize
 
 
 /**
  * @brief Compare a UUID against this UUID.
- *
+ * UUIDs of different sizes are equal if their 128 bit forms are.  A UUID without a value equals nothing.
  * @param [in] uuid The UUID to compare against.
  * @return True if the UUIDs are equal and false otherwise.
  */
-bool BLEUUID::equals(BLEUUID uuid) {
-	//ESP_LOGD(TAG, "Comparing: %s to %s", toString().c_str(), uuid.toString().c_str());
-	if (m_valueSet == false || uuid.m_valueSet == false) {
-		return false;
-	}
-
-	if (uuid.m_uuid.len != m_uuid.len) {
-		return uuid.toString() == toString();
-	}
-
-	if (uuid.m_uuid.len == ESP_UUID_LEN_16) {
-		return uuid.m_uuid.uuid.uuid16 == m_uuid.uuid.uuid16;
-	}
-
-	if (uuid.m_uuid.len == ESP_UUID_LEN_32) {
-		return uuid.m_uuid.uuid.uuid32 == m_uuid.uuid.uuid32;
-	}
-
-	return memcmp(uuid.m_uuid.uuid.uuid128, m_uuid.uuid.uuid128, 16) == 0;
+bool BLEUUID::equals(const BLEUUID& uuid) const {
+	return m_size != 0 && uuid.m_size != 0 && m_high == uuid.m_high && m_low == uuid.m_low;
 } // equals
 
 
@@ -254,20 +233,19 @@ bool BLEUUID::equals(BLEUUID uuid) {
  * <UUID>
  */
 BLEUUID BLEUUID::fromString(std::string _uuid){
-	uint8_t start = 0;
-	if (strstr(_uuid.c_str(), "0x") != nullptr) { // If the string starts with 0x, skip those characters.
-		start = 2;
+	const char* pText = _uuid.c_str();
+	if (strstr(pText, "0x") != nullptr) { // If the string starts with 0x, skip those characters.
+		pText += 2;
 	}
-	uint8_t len = _uuid.length() - start; // Calculate the length of the string we are going to use.
-
-	if( len == 4) {
-		uint16_t x = strtoul(_uuid.substr(start, len).c_str(), NULL, 16);
-		return BLEUUID(x);
-	} else if (len == 8) {
-		uint32_t x = strtoul(_uuid.substr(start, len).c_str(), NULL, 16);
-		return BLEUUID(x);
+	size_t len = strlen(pText); // Calculate the length of the string we are going to use.
+
+	uint64_t value;
+	if (len == 4 && readHex(pText, 4, &value) != nullptr) {
+		return BLEUUID((uint16_t) value);
+	} else if (len == 8 && readHex(pText, 8, &value) != nullptr) {
+		return BLEUUID((uint32_t) value);
 	} else if (len == 36) {
-		return BLEUUID(_uuid);
+		return BLEUUID(std::string(pText, len));
 	}
 	return BLEUUID();
 } // fromString
@@ -279,16 +257,34 @@ BLEUUID BLEUUID::fromString(std::string _uuid){
  * @return The native UUID value or NULL if not set.
  */
 esp_bt_uuid_t* BLEUUID::getNative() {
-	//ESP_LOGD(TAG, ">> getNative()")
-	if (m_valueSet == false) {
-		ESP_LOGD(LOG_TAG, "<< Return of un-initialized UUID!");
+	if (m_size == 0) {
+		ESP_LOGE(LOG_TAG, "Call to getNative with no value set!");
 		return nullptr;
 	}
-	//ESP_LOGD(TAG, "<< getNative()");
-	return &m_uuid;
+	m_native.len = m_size;
+	if (m_size == ESP_UUID_LEN_16) {
+		m_native.uuid.uuid16 = m_high >> 32;
+	} else if (m_size == ESP_UUID_LEN_32) {
+		m_native.uuid.uuid32 = m_high >> 32;
+	} else {
+		writeWord(m_native.uuid.uuid128, m_low);
+		writeWord(m_native.uuid.uuid128 + 8, m_high);
+	}
+	return &m_native;
 } // getNative
 
 
+/**
+ * @brief Get a hash of the UUID.
+ * The hash is of the 128 bit form so UUIDs that are equal have the same hash whatever their size.
+ * @return The hash of the UUID.
+ */
+uint32_t BLEUUID::hash() const {
+	uint64_t hash = (m_high ^ (m_low * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+	return (uint32_t) (hash ^ (hash >> 32));
+} // hash
+
+
 /**
  * @brief Convert a UUID to its 128 bit representation.
  *
@@ -296,55 +292,14 @@ esp_bt_uuid_t* BLEUUID::getNative() {
  * will convert 16 or 32 bit representations to the full 128bit.
  */
 BLEUUID BLEUUID::to128() {
-	//ESP_LOGD(LOG_TAG, ">> toFull() - %s", toString().c_str());
-
 	// If we either don't have a value or are already a 128 bit UUID, nothing further to do.
-	if (m_valueSet == false || m_uuid.len == ESP_UUID_LEN_128) {
-		return *this;
+	if (m_size != 0) {
+		m_size = ESP_UUID_LEN_128;   // The 128 bit form is always held.
 	}
-
-	// If we are 16 bit or 32 bit, then set the 4 bytes of the variable part of the UUID.
-	if (m_uuid.len == ESP_UUID_LEN_16) {
-		uint16_t temp = m_uuid.uuid.uuid16;
-		m_uuid.uuid.uuid128[15] = 0;
-		m_uuid.uuid.uuid128[14] = 0;
-		m_uuid.uuid.uuid128[13] = (temp >> 8) & 0xff;
-		m_uuid.uuid.uuid128[12] = temp & 0xff;
-
-	}
-	else if (m_uuid.len == ESP_UUID_LEN_32) {
-		uint32_t temp = m_uuid.uuid.uuid32;
-		m_uuid.uuid.uuid128[15] = (temp >> 24) & 0xff;
-		m_uuid.uuid.uuid128[14] = (temp >> 16) & 0xff;
-		m_uuid.uuid.uuid128[13] = (temp >> 8) & 0xff;
-		m_uuid.uuid.uuid128[12] = temp & 0xff;
-	}
-
-	// Set the fixed parts of the UUID.
-	m_uuid.uuid.uuid128[11] = 0x00;
-	m_uuid.uuid.uuid128[10] = 0x00;
-
-	m_uuid.uuid.uuid128[9]  = 0x10;
-	m_uuid.uuid.uuid128[8]  = 0x00;
-
-	m_uuid.uuid.uuid128[7]  = 0x80;
-	m_uuid.uuid.uuid128[6]  = 0x00;
-
-	m_uuid.uuid.uuid128[5]  = 0x00;
-	m_uuid.uuid.uuid128[4]  = 0x80;
-	m_uuid.uuid.uuid128[3]  = 0x5f;
-	m_uuid.uuid.uuid128[2]  = 0x9b;
-	m_uuid.uuid.uuid128[1]  = 0x34;
-	m_uuid.uuid.uuid128[0]  = 0xfb;
-
-	m_uuid.len = ESP_UUID_LEN_128;
-	//ESP_LOGD(TAG, "<< toFull <-  %s", toString().c_str());
 	return *this;
 } // to128
 
 
-
-
 /**
  * @brief Get a string representation of the UUID.
  *
@@ -355,56 +310,39 @@ BLEUUID BLEUUID::to128() {
  *
  * @return A string representation of the UUID.
  */
-std::string BLEUUID::toString() {
-	if (m_valueSet == false) {   // If we have no value, nothing to format.
-		return "<NULL>";
-	}
+std::string BLEUUID::toString() const {
+	char buffer[BLE_UUID_STRING_LENGTH];
+	return std::string(toString(buffer));
+} // toString
+
 
-	// If the UUIDs are 16 or 32 bit, pad correctly.
-	std::stringstream ss;
-
-	if (m_uuid.len == ESP_UUID_LEN_16) {  // If the UUID is 16bit, pad correctly.
-		ss << "0000" <<
-			std::hex <<
-			std::setfill('0') <<
-			std::setw(4) <<
-			m_uuid.uuid.uuid16 <<
-			"-0000-1000-8000-00805f9b34fb";
-		return ss.str();                    // Return the string
-	} // End 16bit UUID
-
-	if (m_uuid.len == ESP_UUID_LEN_32) {  // If the UUID is 32bit, pad correctly.
-		ss << std::hex <<
-			std::setfill('0') <<
-			std::setw(8) <<
-			m_uuid.uuid.uuid32 <<
-			"-0000-1000-8000-00805f9b34fb";
-		return ss.str();                    // return the string
-	} // End 32bit UUID
-
-	// The UUID is not 16bit or 32bit which means that it is 128bit.
-	//
-	// UUID string format:
-	// AABBCCDD-EEFF-GGHH-IIJJ-KKLLMMNNOOPP
-	//
-	ss << std::hex << std::setfill('0') <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[15] <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[14] <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[13] <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[12] << "-" <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[11] <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[10] << "-" <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[9]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[8]  << "-" <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[7]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[6]  << "-" <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[5]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[4]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[3]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[2]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[1]  <<
-		std::setw(2) << (int)m_uuid.uuid.uuid128[0];
-	return ss.str();
+/**
+ * @brief Write the string representation of the UUID into a buffer.
+ * @param [out] buffer A buffer of at least BLE_UUID_STRING_LENGTH bytes.
+ * @return The buffer.
+ */
+char* BLEUUID::toString(char* buffer) const {
+	if (m_size == 0) {   // If we have no value, nothing to format.
+		strcpy(buffer, "<NULL>");
+		return buffer;
+	}
+	static const char digits[] = "0123456789abcdef";
+	char* p = buffer;
+	for (int i = 15; i >= 0; i--) {
+		*p++ = digits[(m_high >> (i * 4)) & 0xf];
+		if (i == 8 || i == 4) {
+			*p++ = '-';
+		}
+	}
+	*p++ = '-';
+	for (int i = 15; i >= 0; i--) {
+		*p++ = digits[(m_low >> (i * 4)) & 0xf];
+		if (i == 12) {
+			*p++ = '-';
+		}
+	}
+	*p = '\0';
+	return buffer;
 } // toString
 
 #endif /* CONFIG_BT_ENABLED */
@@ -10,30 +10,85 @@
 #include "sdkconfig.h"
 #if defined(CONFIG_BT_ENABLED)
 #include <esp_gatt_defs.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
 #include <string>
+#include <type_traits>
+
+#define BLE_UUID_STRING_LENGTH (37)  // The size of the buffer for toString(char*), including the terminator.
 
 /**
  * @brief A model of a %BLE UUID.
+ *
+ * Whatever its size, a UUID is held in its 128 bit form, as two 64 bit words, alongside its size.  Comparing
+ * and hashing UUIDs works on the words so that a 16 bit UUID equals its 128 bit equivalent without any
+ * conversion.  The native esp_bt_uuid_t is built when it's asked for.
+ *
+ * UUIDs from 16 and 32 bit values and from string literals of the form
+ * "beb5483e-36e1-4688-b7f5-ea07361b26a8" can be made at compile time:
+ *
+ * @code{.cpp}
+ * constexpr BLEUUID SERVICE_UUID("4fafc201-1fb5-459e-8fcc-c5c9c331914b");
+ * constexpr BLEUUID HEART_RATE((uint16_t) 0x180d);
+ * @endcode
  */
 class BLEUUID {
 public:
 	BLEUUID(std::string uuid);
-	BLEUUID(uint16_t uuid);
-	BLEUUID(uint32_t uuid);
+	constexpr BLEUUID(uint16_t uuid)
+		: m_high(((uint64_t) uuid << 32) | BASE_HIGH), m_low(BASE_LOW), m_size(ESP_UUID_LEN_16), m_native() {}
+	constexpr BLEUUID(uint32_t uuid)
+		: m_high(((uint64_t) uuid << 32) | BASE_HIGH), m_low(BASE_LOW), m_size(ESP_UUID_LEN_32), m_native() {}
+	template<size_t N, typename std::enable_if<N == BLE_UUID_STRING_LENGTH, int>::type = 0>
+	constexpr BLEUUID(const char (&uuid)[N])
+		: m_high(parseHex(uuid, 16)), m_low(parseHex(uuid + 18, 16)), m_size(ESP_UUID_LEN_128), m_native() {}
 	BLEUUID(esp_bt_uuid_t uuid);
 	BLEUUID(uint8_t* pData, size_t size, bool msbFirst);
 	BLEUUID(esp_gatt_id_t gattId);
-	BLEUUID();
-	int            bitSize();   // Get the number of bits in this uuid.
-	bool           equals(BLEUUID uuid);
+	constexpr BLEUUID() : m_high(0), m_low(0), m_size(0), m_native() {}
+	int            bitSize() const;   // Get the number of bits in this uuid.
+	bool           equals(const BLEUUID& uuid) const;
 	esp_bt_uuid_t* getNative();
+	uint32_t       hash() const;
 	BLEUUID        to128();
-	std::string    toString();
+	std::string    toString() const;
+	char*          toString(char* buffer) const;
 	static BLEUUID fromString(std::string uuid);  // Create a BLEUUID from a string
 
+	bool operator==(const BLEUUID& uuid) const { return equals(uuid); }
+	bool operator!=(const BLEUUID& uuid) const { return !equals(uuid); }
+
 private:
-	esp_bt_uuid_t m_uuid;       // The underlying UUID structure that this class wraps.
-	bool          m_valueSet;   // Is there a value set for this instance.
+	// The words of the Bluetooth base UUID, 00000000-0000-1000-8000-00805f9b34fb.
+	static const uint64_t BASE_HIGH = 0x0000000000001000ULL;
+	static const uint64_t BASE_LOW  = 0x800000805f9b34fbULL;
+
+	uint64_t      m_high;       // The first 16 hex digits of the 128 bit form.
+	uint64_t      m_low;        // The last 16 hex digits of the 128 bit form.
+	uint8_t       m_size;       // ESP_UUID_LEN_16, _32 or _128, or 0 if there is no value.
+	esp_bt_uuid_t m_native;     // Built by getNative().
+
+	static constexpr uint64_t hexDigit(char c) {
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0;
+	}
+	// Parse count hex digits, skipping dashes.
+	static constexpr uint64_t parseHex(const char* p, int count, uint64_t value = 0) {
+		return count == 0 ? value : *p == '-' ? parseHex(p + 1, count, value) : parseHex(p + 1, count - 1, (value << 4) | hexDigit(*p));
+	}
 }; // BLEUUID
+
+
+namespace std {
+/**
+ * @brief Hash a BLEUUID so that it can be the key of an unordered container.
+ */
+template<> struct hash<BLEUUID> {
+	size_t operator()(const BLEUUID& uuid) const {
+		return uuid.hash();
+	}
+};
+} // namespace std
+
 #endif /* CONFIG_BT_ENABLED */
 #endif /* COMPONENTS_CPP_UTILS_BLEUUID_H_ */
@@ -7,7 +7,9 @@
 #include "sdkconfig.h"
 #if defined(CONFIG_BT_ENABLED)
 
+#include <esp_gatt_defs.h>
 #include <esp_log.h>
+#include <string.h>
 
 #include "BLEValue.h"
 #ifdef ARDUINO_ARCH_ESP32
@@ -42,7 +44,29 @@ void BLEValue::addPart(std::string part) {
  */
 void BLEValue::addPart(uint8_t* pData, size_t length) {
 	ESP_LOGD(LOG_TAG, ">> addPart: length=%d", length);
-	m_accumulation += std::string((char *)pData, length);
+	m_accumulation.append((char*) pData, length);
+} // addPart
+
+
+/**
+ * @brief Add a message part to the accumulation at a given offset.
+ * The parts of a long write each say where they belong in the value.  A part may overwrite data that
+ * was already accumulated but may not leave a gap.
+ * @param [in] pData A message part being added.
+ * @param [in] length The number of bytes being added.
+ * @param [in] offset The offset of the part in the value.
+ * @return False if the offset leaves a gap or the value would become too long.
+ */
+bool BLEValue::addPart(uint8_t* pData, size_t length, size_t offset) {
+	ESP_LOGD(LOG_TAG, ">> addPart: offset=%d, length=%d", offset, length);
+	if (offset > m_accumulation.length() || offset + length > ESP_GATT_MAX_ATTR_LEN) {
+		return false;
+	}
+	if (offset + length > m_accumulation.length()) {
+		m_accumulation.resize(offset + length);
+	}
+	memcpy(&m_accumulation[offset], pData, length);
+	return true;
 } // addPart
 
 
@@ -51,7 +75,7 @@ void BLEValue::addPart(uint8_t* pData, size_t length) {
  */
 void BLEValue::cancel() {
 	ESP_LOGD(LOG_TAG, ">> cancel");
-	m_accumulation = "";
+	std::string().swap(m_accumulation);
 	m_readOffset   = 0;
 } // cancel
 
@@ -68,8 +92,8 @@ void BLEValue::commit() {
 	if (m_accumulation.length() == 0) {
 		return;
 	}
-	setValue(m_accumulation);
-	m_accumulation = "";
+	m_value.swap(m_accumulation);    // Take the accumulation as the value without copying it.
+	std::string().swap(m_accumulation);
 	m_readOffset   = 0;
 } // commit
 
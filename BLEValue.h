@@ -9,8 +9,52 @@
 #define COMPONENTS_CPP_UTILS_BLEVALUE_H_
 #include "sdkconfig.h"
 #if defined(CONFIG_BT_ENABLED)
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 
+/**
+ * @brief A large value that is read and written in parts, straight from and to where the application keeps it.
+ *
+ * A characteristic given a bulk value answers each read with the part of the value at the offset that
+ * was asked for, and hands each part of a long (prepared) write over as it arrives.  The value is never
+ * held whole in memory by the characteristic, so it may be as large as the 16 bit offsets of ATT allow.
+ */
+class BLEBulkValue {
+public:
+	virtual ~BLEBulkValue() {}
+	/**
+	 * @brief Get the length of the value.
+	 * @return The length of the value.
+	 */
+	virtual size_t getLength() = 0;
+	/**
+	 * @brief Read part of the value.
+	 * @param [in] offset The offset of the part.
+	 * @param [out] pData Where to put the part.
+	 * @param [in] length The length of the part.
+	 * @return The number of bytes read.
+	 */
+	virtual size_t read(size_t offset, uint8_t* pData, size_t length) = 0;
+	/**
+	 * @brief Write part of a new value.
+	 * @param [in] offset The offset of the part.
+	 * @param [in] pData The part.
+	 * @param [in] length The length of the part.
+	 * @return False to refuse the part.
+	 */
+	virtual bool write(size_t offset, uint8_t* pData, size_t length) = 0;
+	/**
+	 * @brief All the parts of the new value have been written.
+	 */
+	virtual void commit() {}
+	/**
+	 * @brief The parts written since the last commit are to be dropped.
+	 */
+	virtual void cancel() {}
+}; // BLEBulkValue
+
+
 /**
  * @brief The model of a %BLE value.
  */
@@ -19,6 +63,7 @@ public:
 	BLEValue();
 	void        addPart(std::string part);
 	void        addPart(uint8_t* pData, size_t length);
+	bool        addPart(uint8_t* pData, size_t length, size_t offset);
 	void        cancel();
 	void        commit();
 	uint8_t*    getData();
@@ -33,6 +78,6 @@ private:
 	std::string m_accumulation;
 	uint16_t    m_readOffset;
 	std::string m_value;
-};
+}; // BLEValue
 #endif // CONFIG_BT_ENABLED
 #endif /* COMPONENTS_CPP_UTILS_BLEVALUE_H_ */
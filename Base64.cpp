@@ -0,0 +1,257 @@
+/*
+ * Base64.cpp
+ *
+ *  Created on: Feb 12, 2018
+ *      Author: kolban
+ */
+
+#include "Base64.h"
+
+static const char encodeTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	"abcdefghijklmnopqrstuvwxyz"
+	"0123456789+/";
+
+static const uint8_t DECODE_INVALID    = 0xff;
+static const uint8_t DECODE_WHITESPACE = 0xfe;
+static const uint8_t DECODE_PAD        = 0xfd;
+
+// The value of each base64 character or one of the DECODE_* markers.  Every marker has its top bit set
+// so four characters can be checked at once by OR'ing their values together.
+static const uint8_t decodeTable[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe, 0xfe, 0xff, 0xff, 0xfe, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfd, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+
+Base64Encoder::Base64Encoder() {
+	reset();
+} // Base64Encoder
+
+
+/**
+ * @brief Encode the next piece of data.
+ * @param [in] pData The data to encode.
+ * @param [in] length The length of the data.
+ * @param [out] pOut The string to which the encoded text is appended.
+ */
+void Base64Encoder::encode(const uint8_t* pData, size_t length, std::string* pOut) {
+	size_t groups = (m_pendingLength + length) / 3;
+	if (groups == 0) {                      // Not enough for a group, keep it for next time.
+		while (length-- > 0) {
+			m_pending[m_pendingLength++] = *pData++;
+		}
+		return;
+	}
+	size_t start = pOut->size();
+	pOut->resize(start + groups * 4);
+	char* pText = &(*pOut)[start];
+
+	uint32_t value;
+	if (m_pendingLength > 0) {              // Complete the group carried over from last time.
+		value = m_pending[0] << 16;
+		if (m_pendingLength == 2) {
+			value |= (m_pending[1] << 8) | pData[0];
+			pData++;
+			length--;
+		} else {
+			value |= (pData[0] << 8) | pData[1];
+			pData += 2;
+			length -= 2;
+		}
+		pText[0] = encodeTable[value >> 18];
+		pText[1] = encodeTable[(value >> 12) & 0x3f];
+		pText[2] = encodeTable[(value >> 6) & 0x3f];
+		pText[3] = encodeTable[value & 0x3f];
+		pText += 4;
+		m_pendingLength = 0;
+	}
+
+	while (length >= 3) {                   // Each group of three bytes is one 24 bit word.
+		value = (pData[0] << 16) | (pData[1] << 8) | pData[2];
+		pText[0] = encodeTable[value >> 18];
+		pText[1] = encodeTable[(value >> 12) & 0x3f];
+		pText[2] = encodeTable[(value >> 6) & 0x3f];
+		pText[3] = encodeTable[value & 0x3f];
+		pText += 4;
+		pData += 3;
+		length -= 3;
+	}
+
+	while (length-- > 0) {
+		m_pending[m_pendingLength++] = *pData++;
+	}
+} // encode
+
+
+/**
+ * @brief Get the length of the encoding of some data.
+ * @param [in] length The length of the data.
+ * @return The length of the base64 text, including padding.
+ */
+size_t Base64Encoder::encodedLength(size_t length) {
+	return (length + 2) / 3 * 4;
+} // encodedLength
+
+
+/**
+ * @brief Encode the last of the data, with padding.
+ * The encoder is then ready to encode new data.
+ * @param [out] pOut The string to which the encoded text is appended.
+ */
+void Base64Encoder::finish(std::string* pOut) {
+	if (m_pendingLength == 0) {
+		return;
+	}
+	uint32_t value = m_pending[0] << 16;
+	if (m_pendingLength == 2) {
+		value |= m_pending[1] << 8;
+	}
+	char text[4];
+	text[0] = encodeTable[value >> 18];
+	text[1] = encodeTable[(value >> 12) & 0x3f];
+	text[2] = m_pendingLength == 2 ? encodeTable[(value >> 6) & 0x3f] : '=';
+	text[3] = '=';
+	pOut->append(text, 4);
+	reset();
+} // finish
+
+
+/**
+ * @brief Forget any data carried over so that new data can be encoded.
+ */
+void Base64Encoder::reset() {
+	m_pendingLength = 0;
+} // reset
+
+
+Base64Decoder::Base64Decoder() {
+	reset();
+} // Base64Decoder
+
+
+/**
+ * @brief Decode the next piece of text.
+ * @param [in] pData The text to decode.
+ * @param [in] length The length of the text.
+ * @param [out] pOut The string to which the decoded data is appended.
+ * @return False if the text isn't valid base64.
+ */
+bool Base64Decoder::decode(const char* pData, size_t length, std::string* pOut) {
+	if (m_error) {
+		return false;
+	}
+	size_t start = pOut->size();
+	pOut->resize(start + (m_count + length) / 4 * 3);
+	uint8_t* pStart = (uint8_t*) &(*pOut)[start];
+	uint8_t* pBytes = pStart;
+	const uint8_t* pText = (const uint8_t*) pData;
+	const uint8_t* pEnd  = pText + length;
+
+	while (pText < pEnd) {
+		// Decode whole groups of four characters directly until something unusual is seen.
+		if (m_count == 0 && !m_padded) {
+			while (pEnd - pText >= 4) {
+				uint8_t a = decodeTable[pText[0]];
+				uint8_t b = decodeTable[pText[1]];
+				uint8_t c = decodeTable[pText[2]];
+				uint8_t d = decodeTable[pText[3]];
+				if ((a | b | c | d) & 0x80) {
+					break;
+				}
+				uint32_t value = (a << 18) | (b << 12) | (c << 6) | d;
+				pBytes[0] = value >> 16;
+				pBytes[1] = value >> 8;
+				pBytes[2] = value;
+				pBytes += 3;
+				pText  += 4;
+			}
+			if (pText == pEnd) {
+				break;
+			}
+		}
+
+		uint8_t value = decodeTable[*pText++];
+		if (value < 64) {
+			if (m_padded) {              // Nothing but padding may follow padding.
+				m_error = true;
+				break;
+			}
+			m_bits = (m_bits << 6) | value;
+			if (++m_count == 4) {
+				pBytes[0] = m_bits >> 16;
+				pBytes[1] = m_bits >> 8;
+				pBytes[2] = m_bits;
+				pBytes += 3;
+				m_bits  = 0;
+				m_count = 0;
+			}
+		} else if (value == DECODE_PAD) {
+			if (!m_padded && m_count < 2) { // Padding can only complete a group of two or three characters.
+				m_error = true;
+				break;
+			}
+			m_padded = true;
+		} else if (value != DECODE_WHITESPACE) {
+			m_error = true;
+			break;
+		}
+	}
+	pOut->resize(start + (pBytes - pStart));
+	return !m_error;
+} // decode
+
+
+/**
+ * @brief Get the largest length of the data that some base64 text can decode to.
+ * @param [in] length The length of the text.
+ * @return The largest length of the data.
+ */
+size_t Base64Decoder::decodedLength(size_t length) {
+	return (length + 3) / 4 * 3;
+} // decodedLength
+
+
+/**
+ * @brief Decode the last group of the text.
+ * The decoder is then ready to decode new text.
+ * @param [out] pOut The string to which the decoded data is appended.
+ * @return False if the text wasn't valid base64.
+ */
+bool Base64Decoder::finish(std::string* pOut) {
+	bool ok = !m_error;
+	if (m_count == 1) {                // A single character can't make a byte.
+		ok = false;
+	} else if (ok && m_count == 2) {   // 12 bits make one byte.
+		pOut->push_back((char) (m_bits >> 4));
+	} else if (ok && m_count == 3) {   // 18 bits make two bytes.
+		pOut->push_back((char) (m_bits >> 10));
+		pOut->push_back((char) (m_bits >> 2));
+	}
+	reset();
+	return ok;
+} // finish
+
+
+/**
+ * @brief Forget any text carried over so that new text can be decoded.
+ */
+void Base64Decoder::reset() {
+	m_bits   = 0;
+	m_count  = 0;
+	m_padded = false;
+	m_error  = false;
+} // reset
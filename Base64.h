@@ -0,0 +1,69 @@
+/*
+ * Base64.h
+ *
+ *  Created on: Feb 12, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_BASE64_H_
+#define COMPONENTS_CPP_UTILS_BASE64_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**
+ * @brief Encode data as base64 a chunk at a time.
+ *
+ * Data can be passed to encode() in pieces of any size.  Whole groups of three bytes are encoded
+ * straight away and appended to the output while up to two bytes are carried over to the next call.
+ * When all the data has been passed, finish() encodes what is left and adds the padding.
+ *
+ * The encoder and decoder are portable C++ that works a word at a time.  The Xtensa cores of the ESP32
+ * have no SIMD unit, so there are no SSE or AVX2 variants: they would only run on a host build.
+ *
+ * @code{.cpp}
+ * Base64Encoder encoder;
+ * std::string encoded;
+ * while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+ *    encoder.encode(buffer, length, &encoded);
+ * }
+ * encoder.finish(&encoded);
+ * @endcode
+ */
+class Base64Encoder {
+public:
+	Base64Encoder();
+	void          encode(const uint8_t* pData, size_t length, std::string* pOut);
+	void          finish(std::string* pOut);
+	void          reset();
+	static size_t encodedLength(size_t length);
+
+private:
+	uint8_t m_pending[2];    // Bytes that didn't make up a whole group.
+	uint8_t m_pendingLength;
+}; // Base64Encoder
+
+
+/**
+ * @brief Decode base64 text a chunk at a time.
+ *
+ * Text can be passed to decode() in pieces of any size.  Whitespace, such as the line breaks of MIME
+ * encoded text, is skipped.  Padding is optional.  Any other character outside the base64 alphabet, or
+ * anything other than padding after padding, is an error after which all further calls fail.
+ */
+class Base64Decoder {
+public:
+	Base64Decoder();
+	bool          decode(const char* pData, size_t length, std::string* pOut);
+	bool          finish(std::string* pOut);
+	void          reset();
+	static size_t decodedLength(size_t length);
+
+private:
+	uint32_t m_bits;        // The sextets of the group so far.
+	uint8_t  m_count;       // The number of sextets in m_bits.
+	bool     m_padded;      // Has padding been seen?
+	bool     m_error;       // Has invalid input been seen?
+}; // Base64Decoder
+
+#endif /* COMPONENTS_CPP_UTILS_BASE64_H_ */
@@ -40,17 +40,19 @@ NVS::~NVS() {
 
 /**
  * @brief Commit any work performed in the namespace.
+ * @return ESP_OK or the error from nvs_commit().
  */
-void NVS::commit() {
-	::nvs_commit(m_handle);
+int NVS::commit() {
+	return ::nvs_commit(m_handle);
 } // commit
 
 
 /**
  * @brief Erase ALL the keys in the namespace.
+ * @return ESP_OK or the error from nvs_erase_all().
  */
-void NVS::erase() {
-	::nvs_erase_all(m_handle);
+int NVS::erase() {
+	return ::nvs_erase_all(m_handle);
 } // erase
 
 
@@ -58,9 +60,10 @@ void NVS::erase() {
  * @brief Erase a specific key in the namespace.
  *
  * @param [in] key The key to erase from the namespace.
+ * @return ESP_OK or the error from nvs_erase_key().
  */
-void NVS::erase(std::string key) {
-	::nvs_erase_key(m_handle, key.c_str());
+int NVS::erase(std::string key) {
+	return ::nvs_erase_key(m_handle, key.c_str());
 } // erase
 
 
@@ -119,30 +122,35 @@ int NVS::get(std::string key, uint8_t* result, size_t& length) {
  *
  * @param [in] key The key to set from the namespace.
  * @param [in] data The value to set for the key.
+ * @return ESP_OK or the error from NVS.
  */
-void NVS::set(std::string key, std::string data, bool isBlob) {
+int NVS::set(std::string key, std::string data, bool isBlob) {
 	ESP_LOGD(LOG_TAG, ">> set: key: %s, string: value=%s", key.c_str(), data.c_str());
+	esp_err_t rc;
 	if (isBlob) {
-		::nvs_set_blob(m_handle, key.c_str(), data.data(), data.length());
+		rc = ::nvs_set_blob(m_handle, key.c_str(), data.data(), data.length());
 	} else {
-		::nvs_set_str(m_handle, key.c_str(), data.c_str());
+		rc = ::nvs_set_str(m_handle, key.c_str(), data.c_str());
 	}
 	ESP_LOGD(LOG_TAG, "<< set");
+	return rc;
 } // set
 
 
-void NVS::set(std::string key, uint32_t value) {
+int NVS::set(std::string key, uint32_t value) {
 	ESP_LOGD(LOG_TAG, ">> set: key: %s, u32: value=%d", key.c_str(), value);
-	::nvs_set_u32(m_handle, key.c_str(), value);
+	esp_err_t rc = ::nvs_set_u32(m_handle, key.c_str(), value);
 	ESP_LOGD(LOG_TAG, "<< set");
+	return rc;
 } // set - uint32_t
 
 
-void NVS::set(std::string key, uint8_t* data, size_t length) {
+int NVS::set(std::string key, uint8_t* data, size_t length) {
 	ESP_LOGD(LOG_TAG, ">> set: key: %s, blob: length=%d", key.c_str(), length);
 	esp_err_t rc = ::nvs_set_blob(m_handle, key.c_str(), data, length);
 	if (rc != ESP_OK) {
-		ESP_LOGD(LOG_TAG, "nvs_get_blob: %d", rc);
+		ESP_LOGD(LOG_TAG, "nvs_set_blob: %d", rc);
 	}
 	ESP_LOGD(LOG_TAG, "<< set");
+	return rc;
 } // set (BLOB)
@@ -17,16 +17,16 @@ class NVS {
 public:
 	NVS(std::string name, nvs_open_mode openMode = NVS_READWRITE);
 	virtual ~NVS();
-	void commit();
+	int commit();
 
-	void erase();
-	void erase(std::string key);
+	int erase();
+	int erase(std::string key);
 	int get(std::string key, std::string* result, bool isBlob=false);
 	int get(std::string key, uint8_t* result, size_t &length);
 	int get(std::string key, uint32_t& value);
-	void set(std::string key, std::string data, bool isBlob=false);
-	void set(std::string key, uint32_t value);
-	void set(std::string key, uint8_t* data, size_t length);
+	int set(std::string key, std::string data, bool isBlob=false);
+	int set(std::string key, uint32_t value);
+	int set(std::string key, uint8_t* data, size_t length);
 private:
 	std::string m_name;
 	nvs_handle m_handle;
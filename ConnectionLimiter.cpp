@@ -0,0 +1,161 @@
+/*
+ * ConnectionLimiter.cpp
+ *
+ *  Created on: Feb 3, 2018
+ *      Author: kolban
+ */
+
+#include <string.h>
+#include "ConnectionLimiter.h"
+
+#include <esp_log.h>
+
+static const char* LOG_TAG = "ConnectionLimiter";
+
+
+/**
+ * @brief Construct a limiter.
+ * @param [in] maxConnections The number of connections that may be open at once.
+ * @param [in] rate The connections per second that one address may open.
+ * @param [in] burst The connections that one address may open in a burst.
+ */
+ConnectionLimiter::ConnectionLimiter(uint8_t maxConnections, float rate, uint8_t burst) {
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_maxConnections = maxConnections;
+	m_activeCount    = 0;
+	m_rate           = rate;
+	m_burst          = burst;
+	m_rejectedBusy   = 0;
+	m_rejectedRate   = 0;
+} // ConnectionLimiter
+
+
+/**
+ * @brief Decide whether to accept a new connection.
+ * If the connection is admitted it counts as open until release() is called.
+ * @param [in] address The IPv4 address of the remote end.
+ * @return True if the connection may proceed, false if it should be closed.
+ */
+bool ConnectionLimiter::admit(uint32_t address) {
+	uint32_t now = FreeRTOS::getTimeSinceStart();
+	m_lock.take("admit");
+	Bucket* pBucket = findBucket(address, now);
+	pBucket->tokens += (now - pBucket->lastTime) * m_rate / 1000;
+	if (pBucket->tokens > m_burst) {
+		pBucket->tokens = m_burst;
+	}
+	pBucket->lastTime = now;
+
+	bool admitted = false;
+	if (pBucket->tokens < 1) {
+		m_rejectedRate++;
+	} else if (m_activeCount >= m_maxConnections) {
+		m_rejectedBusy++;
+	} else {
+		pBucket->tokens -= 1;
+		m_activeCount++;
+		admitted = true;
+	}
+	m_lock.give();
+	if (!admitted) {
+		ESP_LOGD(LOG_TAG, "Rejected connection from %d.%d.%d.%d", address & 0xff, (address >> 8) & 0xff, (address >> 16) & 0xff, address >> 24);
+	}
+	return admitted;
+} // admit
+
+
+/**
+ * @brief Find the bucket of an address.
+ * An address that isn't known takes over an unused bucket or the least recently used one, with a full
+ * set of tokens.
+ * @param [in] address The address.
+ * @param [in] now The current time.
+ * @return The bucket of the address.
+ */
+ConnectionLimiter::Bucket* ConnectionLimiter::findBucket(uint32_t address, uint32_t now) {
+	Bucket* pVictim = nullptr;
+	for (int i = 0; i < CONNECTION_LIMITER_ADDRESSES; i++) {
+		Bucket* pBucket = &m_buckets[i];
+		if (pBucket->address == address) {
+			return pBucket;
+		}
+		if (pVictim == nullptr) {
+			pVictim = pBucket;
+		} else if (pVictim->address != 0 &&
+				(pBucket->address == 0 || now - pBucket->lastTime > now - pVictim->lastTime)) {
+			pVictim = pBucket;
+		}
+	}
+	pVictim->address  = address;
+	pVictim->tokens   = m_burst;
+	pVictim->lastTime = now;
+	return pVictim;
+} // findBucket
+
+
+/**
+ * @brief Get the number of admitted connections that have not yet been released.
+ * @return The number of open connections.
+ */
+uint8_t ConnectionLimiter::getActiveCount() {
+	return m_activeCount;
+} // getActiveCount
+
+
+/**
+ * @brief Get the number of connections rejected because too many connections were open.
+ * @return The number of connections rejected.
+ */
+uint32_t ConnectionLimiter::getRejectedBusyCount() {
+	return m_rejectedBusy;
+} // getRejectedBusyCount
+
+
+/**
+ * @brief Get the number of connections rejected for any reason.
+ * @return The number of connections rejected.
+ */
+uint32_t ConnectionLimiter::getRejectedCount() {
+	return m_rejectedBusy + m_rejectedRate;
+} // getRejectedCount
+
+
+/**
+ * @brief Get the number of connections rejected because their address was opening connections too quickly.
+ * @return The number of connections rejected.
+ */
+uint32_t ConnectionLimiter::getRejectedRateCount() {
+	return m_rejectedRate;
+} // getRejectedRateCount
+
+
+/**
+ * @brief Note that an admitted connection has ended.
+ */
+void ConnectionLimiter::release() {
+	m_lock.take("release");
+	if (m_activeCount > 0) {
+		m_activeCount--;
+	}
+	m_lock.give();
+} // release
+
+
+/**
+ * @brief Set the number of connections that may be open at once.
+ * @param [in] maxConnections The number of connections.
+ */
+void ConnectionLimiter::setMaxConnections(uint8_t maxConnections) {
+	m_maxConnections = maxConnections;
+} // setMaxConnections
+
+
+/**
+ * @brief Set the rate at which one address may open connections.
+ * @param [in] rate The connections per second.
+ * @param [in] burst The connections that may be opened in a burst.
+ */
+void ConnectionLimiter::setRate(float rate, uint8_t burst) {
+	m_rate  = rate;
+	m_burst = burst;
+} // setRate
@@ -0,0 +1,67 @@
+/*
+ * ConnectionLimiter.h
+ *
+ *  Created on: Feb 3, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_CONNECTIONLIMITER_H_
+#define COMPONENTS_CPP_UTILS_CONNECTIONLIMITER_H_
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+#define CONNECTION_LIMITER_MAX_CONNECTIONS (8)   // Default number of connections that may be open at once.
+#define CONNECTION_LIMITER_RATE            (5.0) // Default connections per second allowed from one address.
+#define CONNECTION_LIMITER_BURST           (10)  // Default connections allowed from one address in a burst.
+#define CONNECTION_LIMITER_ADDRESSES       (16)  // Addresses whose buckets are remembered; the least recently seen is forgotten.
+
+/**
+ * @brief Admission control for incoming connections.
+ *
+ * A limiter applies two limits.  Each remote address has a token bucket: it may open up to "burst"
+ * connections at once after which it may open "rate" connections per second.  Across all addresses,
+ * no more than "max connections" may be open at the same time.  A connection that would exceed
+ * either limit is rejected and counted.
+ *
+ * A limiter can be given to a listening Socket, in which case connections are rejected straight after
+ * they are accepted and before any TLS handshake is spent on them.  HttpServer and SockServ accept
+ * a limiter for their listeners and HttpServer also accepts limiters for groups of paths.
+ *
+ * @code{.cpp}
+ * ConnectionLimiter limiter(4, 2.0, 5);  // 4 open at once, 2 per second per address, bursts of 5.
+ * httpServer.setConnectionLimiter(&limiter);
+ * ...
+ * ESP_LOGD(tag, "Rejected %d connections", limiter.getRejectedCount());
+ * @endcode
+ */
+class ConnectionLimiter {
+public:
+	ConnectionLimiter(uint8_t maxConnections = CONNECTION_LIMITER_MAX_CONNECTIONS, float rate = CONNECTION_LIMITER_RATE, uint8_t burst = CONNECTION_LIMITER_BURST);
+	bool     admit(uint32_t address);
+	uint8_t  getActiveCount();
+	uint32_t getRejectedBusyCount();
+	uint32_t getRejectedCount();
+	uint32_t getRejectedRateCount();
+	void     release();
+	void     setMaxConnections(uint8_t maxConnections);
+	void     setRate(float rate, uint8_t burst);
+
+private:
+	struct Bucket {
+		uint32_t address;   // The remote IPv4 address, 0 for an unused bucket.
+		float    tokens;    // Connections that may be opened now.
+		uint32_t lastTime;  // When the tokens were last topped up (ms).
+	};
+	Bucket* findBucket(uint32_t address, uint32_t now);
+
+	Bucket              m_buckets[CONNECTION_LIMITER_ADDRESSES];
+	uint8_t             m_maxConnections;
+	uint8_t             m_activeCount;
+	float               m_rate;
+	uint8_t             m_burst;
+	uint32_t            m_rejectedBusy;   // Rejected because too many connections were open.
+	uint32_t            m_rejectedRate;   // Rejected because the address was opening connections too quickly.
+	FreeRTOS::Semaphore m_lock = FreeRTOS::Semaphore("ConnectionLimiter");
+}; // ConnectionLimiter
+
+#endif /* COMPONENTS_CPP_UTILS_CONNECTIONLIMITER_H_ */
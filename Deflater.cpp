@@ -0,0 +1,367 @@
+/*
+ * Deflater.cpp
+ *
+ *  Created on: Jan 27, 2018
+ *      Author: kolban
+ */
+
+#include <string.h>
+#include "Deflater.h"
+
+#include <esp_log.h>
+
+static const char* LOG_TAG = "Deflater";
+
+static const uint16_t MIN_MATCH = 3;
+static const uint16_t MAX_MATCH = 258;
+static const uint32_t HASH_SIZE = 1 << DEFLATER_HASH_BITS;
+
+// RFC 1951 3.2.5: the base and number of extra bits of the length codes (257..285) and distance codes (0..29).
+static const uint16_t lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+	4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// CRC-32 (as used by gzip) a nibble at a time.
+static const uint32_t crcTable[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+
+/**
+ * @brief Reverse the low order bits of a value.
+ * Huffman codes are defined most significant bit first but deflate packs bits least significant first.
+ * @param [in] value The value.
+ * @param [in] count The number of bits.
+ * @return The reversed bits.
+ */
+static uint32_t reverseBits(uint32_t value, uint8_t count) {
+	uint32_t result = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		result = (result << 1) | (value & 1);
+		value >>= 1;
+	}
+	return result;
+} // reverseBits
+
+
+DeflaterCallbacks::~DeflaterCallbacks() {}
+void DeflaterCallbacks::onOutput(const uint8_t* pData, size_t length) {}
+
+
+/**
+ * @brief Construct a compressor.
+ * @param [in] pCallbacks The receiver of the compressed data.
+ * @param [in] format The wrapping of the compressed data.
+ * @param [in] windowSize How far back matches are searched for.  A power of two between
+ * DEFLATER_MIN_WINDOW_SIZE and DEFLATER_MAX_WINDOW_SIZE.
+ */
+Deflater::Deflater(DeflaterCallbacks* pCallbacks, Format format, uint16_t windowSize) {
+	if (windowSize < DEFLATER_MIN_WINDOW_SIZE || windowSize > DEFLATER_MAX_WINDOW_SIZE || (windowSize & (windowSize - 1)) != 0) {
+		ESP_LOGE(LOG_TAG, "Invalid window size %d, using %d", windowSize, DEFLATER_WINDOW_SIZE);
+		windowSize = DEFLATER_WINDOW_SIZE;
+	}
+	m_pCallbacks   = pCallbacks;
+	m_format       = format;
+	m_windowSize   = windowSize;
+	m_window       = new uint8_t[2 * windowSize];
+	m_head         = new uint16_t[HASH_SIZE];
+	m_prev         = new uint16_t[windowSize];
+	memset(m_head, 0, HASH_SIZE * sizeof(uint16_t));
+	memset(m_prev, 0, windowSize * sizeof(uint16_t));
+	m_length       = 0;
+	m_pos          = 0;
+	m_bitBuffer    = 0;
+	m_bitCount     = 0;
+	m_outputLength = 0;
+	m_inputSize    = 0;
+	m_finished     = false;
+
+	if (format == FORMAT_GZIP) {
+		// ID1, ID2, CM=deflate, FLG=0, MTIME=0 (4 bytes), XFL=0, OS=unknown.
+		static const uint8_t header[] = { 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff };
+		for (size_t i = 0; i < sizeof(header); i++) {
+			putByte(header[i]);
+		}
+		m_checksum = 0xFFFFFFFF;
+	} else if (format == FORMAT_ZLIB) {
+		putByte(0x78); // CM=deflate, CINFO=32K window (the most a decoder need allow for).
+		putByte(0x01); // No dictionary, fastest compression, check bits.
+		m_checksum = 1;
+	} else {
+		m_checksum = 0;
+	}
+	// Everything is sent in one fixed Huffman block: BFINAL=0, BTYPE=01.
+	putBits(0, 1);
+	putBits(1, 2);
+} // Deflater
+
+
+Deflater::~Deflater() {
+	delete[] m_window;
+	delete[] m_head;
+	delete[] m_prev;
+} // ~Deflater
+
+
+/**
+ * @brief Encode the data in the window.
+ * Unless this is the end of the input, enough data is left unencoded to allow for the longest match.
+ * @param [in] isFinal True if no more input will follow.
+ */
+void Deflater::compress(bool isFinal) {
+	uint32_t limit = isFinal ? m_length : (m_length > MAX_MATCH ? m_length - MAX_MATCH : 0);
+	while (m_pos < limit) {
+		uint32_t distance;
+		uint16_t length = findMatch(m_pos, &distance);
+		if (length >= MIN_MATCH) {
+			putMatch(length, distance);
+			for (uint16_t i = 0; i < length; i++) {
+				insertHash(m_pos++);
+			}
+		} else {
+			putLiteral(m_window[m_pos]);
+			insertHash(m_pos++);
+		}
+	}
+} // compress
+
+
+/**
+ * @brief Find the longest earlier match for the data at a position.
+ * @param [in] pos The position in the window.
+ * @param [out] pDistance How far back the match is.
+ * @return The length of the match, less than MIN_MATCH if there is none.
+ */
+uint16_t Deflater::findMatch(uint32_t pos, uint32_t* pDistance) {
+	uint32_t available = m_length - pos;
+	if (available < MIN_MATCH) {
+		return 0;
+	}
+	uint16_t maxLength = available < MAX_MATCH ? available : MAX_MATCH;
+	uint16_t bestLength = 0;
+	uint16_t candidate = m_head[hash(pos)];
+	for (int chain = 0; candidate != 0 && chain < DEFLATER_MAX_CHAIN; chain++) {
+		uint32_t candidatePos = candidate - 1;
+		if (candidatePos >= pos || pos - candidatePos > m_windowSize) {
+			break; // The chain has left the window.
+		}
+		if (m_window[candidatePos + bestLength] == m_window[pos + bestLength]) {
+			uint16_t length = 0;
+			while (length < maxLength && m_window[candidatePos + length] == m_window[pos + length]) {
+				length++;
+			}
+			if (length > bestLength) {
+				bestLength = length;
+				*pDistance = pos - candidatePos;
+				if (length == maxLength) {
+					break;
+				}
+			}
+		}
+		uint16_t next = m_prev[candidatePos & (m_windowSize - 1)];
+		if (next >= candidate) {
+			break; // The entry has been reused by a newer position.
+		}
+		candidate = next;
+	}
+	return bestLength;
+} // findMatch
+
+
+/**
+ * @brief Finish the compressed stream.
+ * The remaining input is encoded, the block is ended and the trailer of the format is added.
+ */
+void Deflater::finish() {
+	if (m_finished) {
+		return;
+	}
+	compress(true);
+	putLiteral(256);  // End of block.
+	// An empty final block: BFINAL=1, BTYPE=01, end of block.
+	putBits(1, 1);
+	putBits(1, 2);
+	putLiteral(256);
+	if (m_bitCount > 0) {
+		putBits(0, 8 - m_bitCount); // Pad to a byte boundary.
+	}
+	if (m_format == FORMAT_GZIP) {
+		uint32_t crc = ~m_checksum;
+		for (int i = 0; i < 4; i++) {
+			putByte(crc >> (8 * i));
+		}
+		for (int i = 0; i < 4; i++) {
+			putByte(m_inputSize >> (8 * i));
+		}
+	} else if (m_format == FORMAT_ZLIB) {
+		for (int i = 3; i >= 0; i--) {
+			putByte(m_checksum >> (8 * i));
+		}
+	}
+	flushOutput();
+	m_finished = true;
+} // finish
+
+
+/**
+ * @brief Pass the buffered output to the callbacks.
+ */
+void Deflater::flushOutput() {
+	if (m_outputLength > 0) {
+		m_pCallbacks->onOutput(m_output, m_outputLength);
+		m_outputLength = 0;
+	}
+} // flushOutput
+
+
+uint32_t Deflater::hash(uint32_t pos) {
+	return ((m_window[pos] << 10) ^ (m_window[pos + 1] << 5) ^ m_window[pos + 2]) & (HASH_SIZE - 1);
+} // hash
+
+
+/**
+ * @brief Record a position in the hash chains.
+ * @param [in] pos The position in the window.
+ */
+void Deflater::insertHash(uint32_t pos) {
+	if (pos + MIN_MATCH > m_length) {
+		return;
+	}
+	uint32_t h = hash(pos);
+	m_prev[pos & (m_windowSize - 1)] = m_head[h];
+	m_head[h] = pos + 1;
+} // insertHash
+
+
+void Deflater::putBits(uint32_t bits, uint8_t count) {
+	m_bitBuffer |= bits << m_bitCount;
+	m_bitCount += count;
+	while (m_bitCount >= 8) {
+		putByte(m_bitBuffer & 0xFF);
+		m_bitBuffer >>= 8;
+		m_bitCount -= 8;
+	}
+} // putBits
+
+
+void Deflater::putByte(uint8_t value) {
+	m_output[m_outputLength++] = value;
+	if (m_outputLength == sizeof(m_output)) {
+		flushOutput();
+	}
+} // putByte
+
+
+/**
+ * @brief Write a literal/length symbol with the fixed Huffman code (RFC 1951 3.2.6).
+ * @param [in] symbol The symbol, 0-285.
+ */
+void Deflater::putLiteral(uint16_t symbol) {
+	if (symbol < 144) {
+		putBits(reverseBits(0x30 + symbol, 8), 8);
+	} else if (symbol < 256) {
+		putBits(reverseBits(0x190 + symbol - 144, 9), 9);
+	} else if (symbol < 280) {
+		putBits(reverseBits(symbol - 256, 7), 7);
+	} else {
+		putBits(reverseBits(0xC0 + symbol - 280, 8), 8);
+	}
+} // putLiteral
+
+
+/**
+ * @brief Write a length/distance pair.
+ * @param [in] length The length of the match, 3-258.
+ * @param [in] distance How far back the match is.
+ */
+void Deflater::putMatch(uint16_t length, uint32_t distance) {
+	int code = 28;
+	while (lengthBase[code] > length) {
+		code--;
+	}
+	putLiteral(257 + code);
+	putBits(length - lengthBase[code], lengthExtra[code]);
+
+	code = 29;
+	while (distanceBase[code] > distance) {
+		code--;
+	}
+	putBits(reverseBits(code, 5), 5);
+	putBits(distance - distanceBase[code], distanceExtra[code]);
+} // putMatch
+
+
+/**
+ * @brief Discard the oldest window of data to make room for more input.
+ */
+void Deflater::slide() {
+	memmove(m_window, m_window + m_windowSize, m_windowSize);
+	m_length -= m_windowSize;
+	m_pos    -= m_windowSize;
+	for (uint32_t i = 0; i < HASH_SIZE; i++) {
+		m_head[i] = m_head[i] > m_windowSize ? m_head[i] - m_windowSize : 0;
+	}
+	for (uint32_t i = 0; i < m_windowSize; i++) {
+		m_prev[i] = m_prev[i] > m_windowSize ? m_prev[i] - m_windowSize : 0;
+	}
+} // slide
+
+
+/**
+ * @brief Compress data.
+ * Compressed output is passed to the callbacks as it becomes available.
+ * @param [in] pData The data.
+ * @param [in] length The length of the data.
+ */
+void Deflater::write(const uint8_t* pData, size_t length) {
+	if (m_finished) {
+		ESP_LOGE(LOG_TAG, "write: Already finished");
+		return;
+	}
+	m_inputSize += length;
+	if (m_format == FORMAT_GZIP) {
+		uint32_t crc = m_checksum;
+		for (size_t i = 0; i < length; i++) {
+			crc ^= pData[i];
+			crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+			crc = (crc >> 4) ^ crcTable[crc & 0x0F];
+		}
+		m_checksum = crc;
+	} else if (m_format == FORMAT_ZLIB) {
+		uint32_t a = m_checksum & 0xFFFF;
+		uint32_t b = m_checksum >> 16;
+		for (size_t i = 0; i < length; i++) {
+			a = (a + pData[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		m_checksum = (b << 16) | a;
+	}
+
+	while (length > 0) {
+		if (m_length == 2 * m_windowSize) {
+			slide();
+		}
+		size_t count = 2 * m_windowSize - m_length;
+		if (count > length) {
+			count = length;
+		}
+		memcpy(m_window + m_length, pData, count);
+		m_length += count;
+		pData    += count;
+		length   -= count;
+		if (m_length == 2 * m_windowSize) {
+			compress(false);
+		}
+	}
+} // write
@@ -0,0 +1,89 @@
+/*
+ * Deflater.h
+ *
+ *  Created on: Jan 27, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_DEFLATER_H_
+#define COMPONENTS_CPP_UTILS_DEFLATER_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEFLATER_WINDOW_SIZE     (2048)  // Default distance back that matches are searched for.
+#define DEFLATER_MIN_WINDOW_SIZE (1024)
+#define DEFLATER_MAX_WINDOW_SIZE (16384)
+#define DEFLATER_HASH_BITS       (11)    // 2^bits hash chain heads.
+#define DEFLATER_MAX_CHAIN       (32)    // Most candidates examined when looking for a match.
+#define DEFLATER_OUTPUT_SIZE     (256)   // Compressed bytes buffered before being passed on.
+
+/**
+ * @brief Receiver of the output of a Deflater.
+ */
+class DeflaterCallbacks {
+public:
+	virtual ~DeflaterCallbacks();
+	virtual void onOutput(const uint8_t* pData, size_t length);
+}; // DeflaterCallbacks
+
+
+/**
+ * @brief A streaming deflate (RFC 1951) compressor with a small, bounded window.
+ *
+ * A general purpose deflate implementation uses a 32K window and a few hundred KB of working memory.
+ * This one is meant for compressing generated text such as JSON on the fly: it searches a configurable
+ * window of a few KB with hash chains and emits fixed Huffman codes.  Its working memory is four times
+ * the window size (the window is 2048 bytes by default, for 8KB plus 4KB of hash heads).  The output is
+ * wrapped as gzip (RFC 1952), zlib (RFC 1950) or left as raw deflate data.
+ *
+ * @code{.cpp}
+ * class MyOutput : public DeflaterCallbacks {
+ *    void onOutput(const uint8_t* pData, size_t length) { ... }
+ * } output;
+ * Deflater deflater(&output, Deflater::FORMAT_GZIP);
+ * deflater.write(pData, length);  // As many times as needed.
+ * deflater.finish();
+ * @endcode
+ */
+class Deflater {
+public:
+	enum Format {
+		FORMAT_RAW,  // Deflate data only.
+		FORMAT_ZLIB, // The "deflate" HTTP content coding.
+		FORMAT_GZIP  // The "gzip" HTTP content coding.
+	};
+	Deflater(DeflaterCallbacks* pCallbacks, Format format = FORMAT_GZIP, uint16_t windowSize = DEFLATER_WINDOW_SIZE);
+	~Deflater();
+	void finish();
+	void write(const uint8_t* pData, size_t length);
+
+private:
+	void     compress(bool isFinal);
+	uint16_t findMatch(uint32_t pos, uint32_t* pDistance);
+	uint32_t hash(uint32_t pos);
+	void     insertHash(uint32_t pos);
+	void     putBits(uint32_t bits, uint8_t count);
+	void     putByte(uint8_t value);
+	void     putLiteral(uint16_t symbol);
+	void     putMatch(uint16_t length, uint32_t distance);
+	void     flushOutput();
+	void     slide();
+
+	DeflaterCallbacks* m_pCallbacks;
+	Format    m_format;
+	uint32_t  m_windowSize;
+	uint8_t*  m_window;      // Two windows worth of data: the history and the lookahead.
+	uint16_t* m_head;        // Most recent position+1 for each hash, 0 for none.
+	uint16_t* m_prev;        // Previous position+1 with the same hash, indexed by position within the window.
+	uint32_t  m_length;      // Bytes in m_window.
+	uint32_t  m_pos;         // Next byte of m_window to be encoded.
+	uint32_t  m_bitBuffer;
+	uint8_t   m_bitCount;
+	uint8_t   m_output[DEFLATER_OUTPUT_SIZE];
+	size_t    m_outputLength;
+	uint32_t  m_checksum;    // CRC-32 for gzip, Adler-32 for zlib.
+	uint32_t  m_inputSize;   // Total uncompressed bytes (mod 2^32).
+	bool      m_finished;
+}; // Deflater
+
+#endif /* COMPONENTS_CPP_UTILS_DEFLATER_H_ */
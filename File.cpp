@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <GeneralUtils.h>
+#include "Base64.h"
 
 static const char* LOG_TAG = "File";
 /**
@@ -27,6 +28,8 @@ File::File(std::string path, uint8_t type) {
 
 /**
  * @brief Retrieve the content of the file.
+ * When base64 encoding, the file is read and encoded a piece at a time so only the encoded content is
+ * held in memory.
  * @param [in] base64Encode Should we base64 encode the content?
  * @return The content of the file.
  */
@@ -36,6 +39,24 @@ std::string File::getContent(bool base64Encode) {
 	if (size == 0) {
 		return "";
 	}
+	if (base64Encode) {
+		FILE *file = fopen(m_path.c_str(), "r");
+		if (file == nullptr) {
+			ESP_LOGE(LOG_TAG, "getContent: Failed to open %s", m_path.c_str());
+			return "";
+		}
+		std::string encoded;
+		encoded.reserve(Base64Encoder::encodedLength(size));
+		Base64Encoder encoder;
+		uint8_t buffer[192];
+		size_t bytesRead;
+		while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+			encoder.encode(buffer, bytesRead, &encoded);
+		}
+		encoder.finish(&encoded);
+		fclose(file);
+		return encoded;
+	}
 	uint8_t *pData = (uint8_t *)malloc(size);
 	if (pData == nullptr) {
 		ESP_LOGE(LOG_TAG, "getContent: Failed to allocate memory");
@@ -46,11 +67,6 @@ std::string File::getContent(bool base64Encode) {
 	fclose(file);
 	std::string ret((char *)pData, size);
 	free(pData);
-	if (base64Encode) {
-		std::string encoded;
-		GeneralUtils::base64Decode(ret, &encoded);
-		return encoded;
-	}
 	return ret;
 } // getContent
 
@@ -17,6 +17,7 @@
 #include <esp_log.h>
 
 #include "FileSystem.h"
+#include "GeneralUtils.h"
 
 static const char* LOG_TAG = "FileSystem";
 
@@ -125,16 +126,11 @@ int FileSystem::mkdir(std::string path) {
  *
  * @return A vector of the constituent parts of the path.
  */
-std::vector<std::string> FileSystem::pathSplit(std::string path) {
-	std::istringstream stream(path);
+std::vector<std::string> FileSystem::pathSplit(const std::string& path) {
 	std::vector<std::string> ret;
-	std::string pathPart;
-	while(std::getline(stream, pathPart, '/')) {
-		ret.push_back(pathPart);
-	}
-	// Debug
-	for (int i=0; i<ret.size(); i++) {
-		ESP_LOGD(LOG_TAG, "part[%d]: %s", i, ret[i].c_str());
+	StringSplitter parts(path, '/');
+	while (parts.next()) {
+		ret.push_back(parts.toString());
 	}
 	return ret;
 } // pathSplit
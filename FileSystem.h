@@ -19,7 +19,7 @@ public:
 	static void                     dumpDirectory(std::string path);
 	static bool                     isDirectory(std::string path);
 	static int                      mkdir(std::string path);
-	static std::vector<std::string> pathSplit(std::string path);
+	static std::vector<std::string> pathSplit(const std::string& path);
 	static int                      remove(std::string path);
 };
 
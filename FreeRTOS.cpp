@@ -248,10 +248,21 @@ Ringbuffer::Ringbuffer(size_t length, ringbuf_type_t type) {
 
 
 Ringbuffer::~Ringbuffer() {
-	::vRingbufferDelete(m_handle);
+	if (m_handle != nullptr) {
+		::vRingbufferDelete(m_handle);
+	}
 } // ~Ringbuffer
 
 
+/**
+ * @brief Was the storage for the ring buffer allocated?
+ * @return True if the ring buffer can be used.
+ */
+bool Ringbuffer::isValid() {
+	return m_handle != nullptr;
+} // isValid
+
+
 /**
  * @brief Receive data from the buffer.
  * @param [out] size On return, the size of data returned.
@@ -60,6 +60,7 @@ public:
 	Ringbuffer(size_t length, ringbuf_type_t type = RINGBUF_TYPE_NOSPLIT);
 	~Ringbuffer();
 
+	bool     isValid();
 	void*    receive(size_t* size, TickType_t wait = portMAX_DELAY);
 	void     returnItem(void* item);
 	uint32_t send(void* data, size_t length, TickType_t wait = portMAX_DELAY);
@@ -6,6 +6,7 @@
  */
 
 #include "GeneralUtils.h"
+#include "Base64.h"
 #include <esp_log.h>
 #include <esp_system.h>
 #include <string.h>
@@ -22,81 +23,31 @@
 
 static const char* LOG_TAG = "GeneralUtils";
 
-static const char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
-
-static int base64EncodedLength(size_t length) {
-	return (length + 2 - ((length + 2) % 3)) / 3 * 4;
-} // base64EncodedLength
-
-
-static int base64EncodedLength(const std::string &in) {
-	return base64EncodedLength(in.length());
-} // base64EncodedLength
-
-
-static void a3_to_a4(unsigned char * a4, unsigned char * a3) {
-	a4[0] = (a3[0] & 0xfc) >> 2;
-	a4[1] = ((a3[0] & 0x03) << 4) + ((a3[1] & 0xf0) >> 4);
-	a4[2] = ((a3[1] & 0x0f) << 2) + ((a3[2] & 0xc0) >> 6);
-	a4[3] = (a3[2] & 0x3f);
-} // a3_to_a4
-
-
-static void a4_to_a3(unsigned char * a3, unsigned char * a4) {
-	a3[0] = (a4[0] << 2) + ((a4[1] & 0x30) >> 4);
-	a3[1] = ((a4[1] & 0xf) << 4) + ((a4[2] & 0x3c) >> 2);
-	a3[2] = ((a4[2] & 0x3) << 6) + a4[3];
-} // a4_to_a3
-
-
 /**
  * @brief Encode a string into base 64.
- * @param [in] in
- * @param [out] out
+ * @param [in] in The data to be encoded.
+ * @param [out] out The resulting base64 text.
+ * @return True if the data was encoded.
  */
 bool GeneralUtils::base64Encode(const std::string &in, std::string *out) {
-	int i = 0, j = 0;
-	size_t enc_len = 0;
-	unsigned char a3[3];
-	unsigned char a4[4];
-
-	out->resize(base64EncodedLength(in));
-
-	int input_len = in.size();
-	std::string::const_iterator input = in.begin();
-
-	while (input_len--) {
-		a3[i++] = *(input++);
-		if (i == 3) {
-			a3_to_a4(a4, a3);
-
-			for (i = 0; i < 4; i++) {
-				(*out)[enc_len++] = kBase64Alphabet[a4[i]];
-			}
-
-			i = 0;
-		}
-	}
-
-	if (i) {
-		for (j = i; j < 3; j++) {
-			a3[j] = '\0';
-		}
-
-		a3_to_a4(a4, a3);
-
-		for (j = 0; j < i + 1; j++) {
-			(*out)[enc_len++] = kBase64Alphabet[a4[j]];
-		}
+	return base64Encode((const uint8_t*) in.data(), in.length(), out);
+} // base64Encode
 
-		while ((i++ < 3)) {
-			(*out)[enc_len++] = '=';
-		}
-	}
 
-	return (enc_len == out->size());
+/**
+ * @brief Encode data into base 64.
+ * @param [in] pData The data to be encoded.
+ * @param [in] length The length of the data.
+ * @param [out] out The resulting base64 text.
+ * @return True if the data was encoded.
+ */
+bool GeneralUtils::base64Encode(const uint8_t* pData, size_t length, std::string *out) {
+	Base64Encoder encoder;
+	out->clear();
+	out->reserve(Base64Encoder::encodedLength(length));
+	encoder.encode(pData, length, out);
+	encoder.finish(out);
+	return true;
 } // base64Encode
 
 
@@ -123,93 +74,36 @@ void GeneralUtils::dumpInfo() {
  * @param [in] c The character to look form.
  * @return True if the string ends with the given character.
  */
-bool GeneralUtils::endsWith(std::string str, char c) {
-	if (str.empty()) {
-		return false;
-	}
-	if (str.at(str.length()-1) == c) {
-		return true;
-	}
-	return false;
-} // endsWidth
+bool GeneralUtils::endsWith(const std::string& str, char c) {
+	return !str.empty() && str[str.length() - 1] == c;
+} // endsWith
 
 
-static int DecodedLength(const std::string &in) {
-	int numEq = 0;
-	int n = in.size();
-
-	for (std::string::const_reverse_iterator it = in.rbegin(); *it == '='; ++it) {
-		++numEq;
-	}
-	return ((6 * n) / 8) - numEq;
-} // DecodedLength
-
-
-static unsigned char b64_lookup(unsigned char c) {
-	if(c >='A' && c <='Z') return c - 'A';
-	if(c >='a' && c <='z') return c - 71;
-	if(c >='0' && c <='9') return c + 4;
-	if(c == '+') return 62;
-	if(c == '/') return 63;
-	return 255;
-}; // b64_lookup
+/**
+ * @brief Compare a string with a value, ignoring case.
+ * @param [in] str The string to compare.
+ * @param [in] value The value to compare it with.
+ * @return True if the string and value are the same but for case.
+ */
+bool GeneralUtils::equalsIgnoreCase(const std::string& str, const char* value) {
+	size_t length = strlen(value);
+	return str.length() == length && strncasecmp(str.data(), value, length) == 0;
+} // equalsIgnoreCase
 
 
 /**
  * @brief Decode a chunk of data that is base64 encoded.
+ * Whitespace in the text is skipped and the padding is optional.
  * @param [in] in The string to be decoded.
  * @param [out] out The resulting data.
+ * @return False if the text isn't valid base64.
  */
 bool GeneralUtils::base64Decode(const std::string &in, std::string *out) {
-	int i = 0, j = 0;
-	size_t dec_len = 0;
-	unsigned char a3[3];
-	unsigned char a4[4];
-
-	int input_len = in.size();
-	std::string::const_iterator input = in.begin();
-
-	out->resize(DecodedLength(in));
-
-	while (input_len--) {
-		if (*input == '=') {
-			break;
-		}
-
-		a4[i++] = *(input++);
-		if (i == 4) {
-			for (i = 0; i <4; i++) {
-				a4[i] = b64_lookup(a4[i]);
-			}
-
-			a4_to_a3(a3,a4);
-
-			for (i = 0; i < 3; i++) {
-				(*out)[dec_len++] = a3[i];
-			}
-
-			i = 0;
-		}
-	}
-
-	if (i) {
-		for (j = i; j < 4; j++) {
-			a4[j] = '\0';
-		}
-
-		for (j = 0; j < 4; j++) {
-			a4[j] = b64_lookup(a4[j]);
-		}
-
-		a4_to_a3(a3,a4);
-
-		for (j = 0; j < i - 1; j++) {
-			(*out)[dec_len++] = a3[j];
-		}
-	}
-
-	return (dec_len == out->size());
- } // base64Decode
+	Base64Decoder decoder;
+	out->clear();
+	bool ok = decoder.decode(in.data(), in.length(), out);
+	return decoder.finish(out) && ok;
+} // base64Decode
 
 /*
 void GeneralUtils::hexDump(uint8_t* pData, uint32_t length) {
@@ -291,38 +185,32 @@ void GeneralUtils::hexDump(uint8_t* pData, uint32_t length) {
  * @return N/A.
  */
 void GeneralUtils::hexDump(const uint8_t* pData, uint32_t length) {
-	char ascii[80];
-	char hex[80];
-	char tempBuf[80];
-	uint32_t lineNumber = 0;
+	static const char hexDigits[] = "0123456789abcdef";
+	// Each line is "oooo xx xx ... xx  aaaaaaaaaaaaaaaa", built in place rather than with sprintf/strcat.
+	char line[4 + 1 + 16 * 3 + 1 + 16 + 1];
 
 	ESP_LOGD(LOG_TAG, "     00 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f  ----------------");
-	strcpy(ascii, "");
-	strcpy(hex, "");
-	uint32_t index=0;
-	while(index < length) {
-		sprintf(tempBuf, "%.2x ", pData[index]);
-		strcat(hex, tempBuf);
-		if (isprint(pData[index])) {
-			sprintf(tempBuf, "%c", pData[index]);
-		} else {
-			sprintf(tempBuf, ".");
-		}
-		strcat(ascii, tempBuf);
-		index++;
-		if (index % 16 == 0) {
-			ESP_LOGD(LOG_TAG, "%.4x %s %s", lineNumber*16, hex, ascii);
-			strcpy(ascii, "");
-			strcpy(hex, "");
-			lineNumber++;
+	for (uint32_t offset = 0; offset < length; offset += 16) {
+		char* pHex   = line;
+		char* pAscii = line + 4 + 1 + 16 * 3 + 1;
+		for (int shift = 12; shift >= 0; shift -= 4) {
+			*pHex++ = hexDigits[(offset >> shift) & 0xf];
 		}
-	}
-	if (index %16 != 0) {
-		while(index % 16 != 0) {
-			strcat(hex, "   ");
-			index++;
+		*pHex++ = ' ';
+		for (uint32_t i = offset; i < offset + 16; i++) {
+			if (i < length) {
+				*pHex++   = hexDigits[pData[i] >> 4];
+				*pHex++   = hexDigits[pData[i] & 0xf];
+				*pAscii++ = isprint(pData[i]) ? pData[i] : '.';
+			} else {
+				*pHex++ = ' ';
+				*pHex++ = ' ';
+			}
+			*pHex++ = ' ';
 		}
-		ESP_LOGD(LOG_TAG, "%.4x %s %s", lineNumber*16, hex, ascii);
+		*pHex   = ' ';
+		*pAscii = '\0';
+		ESP_LOGD(LOG_TAG, "%s", line);
 	}
 } // hexDump
 
@@ -345,13 +233,11 @@ std::string GeneralUtils::ipToString(uint8_t *ip) {
  * @param [in] delimiter The delimiter characters.
  * @return A vector of strings that are the split of the input.
  */
-std::vector<std::string> GeneralUtils::split(std::string source, char delimiter) {
-	// See also: https://stackoverflow.com/questions/5167625/splitting-a-c-stdstring-using-tokens-e-g
+std::vector<std::string> GeneralUtils::split(const std::string& source, char delimiter) {
 	std::vector<std::string> strings;
-	std::istringstream iss(source);
-	std::string s;
-	while(std::getline(iss, s, delimiter)) {
-		strings.push_back(trim(s));
+	StringSplitter parts(source, delimiter);
+	while (parts.next()) {
+		strings.push_back(parts.trim().toString());
 	}
 	return strings;
 } // split
@@ -513,29 +399,142 @@ const char* GeneralUtils::wifiErrorToString(uint8_t errCode) {
 
 /**
  * @brief Convert a string to lower case.
+ * The string is converted in place.
  * @param [in] value The string to convert to lower case.
- * @return A lower case representation of the string.
+ * @return The string, now in lower case.
  */
-std::string GeneralUtils::toLower(std::string& value) {
-	// Question: Could this be improved with a signature of:
-	// std::string& GeneralUtils::toLower(std::string& value)
+std::string& GeneralUtils::toLower(std::string& value) {
 	std::transform(value.begin(), value.end(), value.begin(), ::tolower);
 	return value;
 } // toLower
 
 
 /**
- * @brief Remove white space from a string.
+ * @brief Remove leading and trailing spaces and tabs from a string.
+ * @param [in] str The string to trim.
+ * @return A copy of the string without the white space.
+ */
+std::string GeneralUtils::trim(const std::string& str) {
+	size_t first = str.find_first_not_of(" \t");
+	if (std::string::npos == first) {
+		return "";
+	}
+	size_t last = str.find_last_not_of(" \t");
+	return str.substr(first, (last - first + 1));
+} // trim
+
+
+/**
+ * @brief Remove leading and trailing spaces and tabs from a string without copying it.
+ * @param [in] str The string to trim.
+ */
+void GeneralUtils::trimInPlace(std::string& str) {
+	size_t last = str.find_last_not_of(" \t");
+	if (last == std::string::npos) {
+		str.clear();
+		return;
+	}
+	str.erase(last + 1);
+	str.erase(0, str.find_first_not_of(" \t"));
+} // trimInPlace
+
+
+/**
+ * @brief Construct a splitter positioned before the first part.
+ * @param [in] source The string to split.  It must outlive the splitter.
+ * @param [in] delimiter The character between parts.
+ */
+StringSplitter::StringSplitter(const std::string& source, char delimiter) : m_source(source) {
+	m_delimiter = delimiter;
+	m_start     = 0;
+	m_end       = 0;
+	m_next      = 0;
+} // StringSplitter
+
+
+/**
+ * @brief Get the characters of the current part.
+ * The part is not null terminated; use length() to find its end.
+ * @return The first character of the part.
+ */
+const char* StringSplitter::data() {
+	return m_source.data() + m_start;
+} // data
+
+
+/**
+ * @brief Compare the current part with a value.
+ * @param [in] value The value to compare with.
+ * @return True if the part equals the value.
+ */
+bool StringSplitter::equals(const char* value) {
+	size_t length = strlen(value);
+	return length == m_end - m_start && strncmp(data(), value, length) == 0;
+} // equals
+
+
+/**
+ * @brief Compare the current part with a value, ignoring case.
+ * @param [in] value The value to compare with.
+ * @return True if the part equals the value but for case.
+ */
+bool StringSplitter::equalsIgnoreCase(const char* value) {
+	size_t length = strlen(value);
+	return length == m_end - m_start && strncasecmp(data(), value, length) == 0;
+} // equalsIgnoreCase
+
+
+/**
+ * @brief Get the length of the current part.
+ * @return The length of the part.
+ */
+size_t StringSplitter::length() {
+	return m_end - m_start;
+} // length
+
+
+/**
+ * @brief Move on to the next part.
+ * As with std::getline(), a delimiter at the very end of the source doesn't start another part.
+ * @return False if there are no more parts.
+ */
+bool StringSplitter::next() {
+	if (m_next >= m_source.length()) {
+		return false;
+	}
+	m_start = m_next;
+	m_end   = m_source.find(m_delimiter, m_start);
+	if (m_end == std::string::npos) {
+		m_end  = m_source.length();
+		m_next = m_end;
+	} else {
+		m_next = m_end + 1;
+	}
+	return true;
+} // next
+
+
+/**
+ * @brief Get a copy of the current part.
+ * @return The part.
  */
-std::string GeneralUtils::trim(const std::string& str)
-{
-    size_t first = str.find_first_not_of(' ');
-    if (std::string::npos == first)
-    {
-        return str;
-    }
-    size_t last = str.find_last_not_of(' ');
-    return str.substr(first, (last - first + 1));
+std::string StringSplitter::toString() {
+	return m_source.substr(m_start, m_end - m_start);
+} // toString
+
+
+/**
+ * @brief Remove leading and trailing spaces and tabs from the current part.
+ * @return The splitter.
+ */
+StringSplitter& StringSplitter::trim() {
+	while (m_start < m_end && (m_source[m_start] == ' ' || m_source[m_start] == '\t')) {
+		m_start++;
+	}
+	while (m_end > m_start && (m_source[m_end - 1] == ' ' || m_source[m_end - 1] == '\t')) {
+		m_end--;
+	}
+	return *this;
 } // trim
 
 
@@ -20,16 +20,52 @@ class GeneralUtils {
 public:
 	static bool        base64Decode(const std::string& in, std::string* out);
 	static bool        base64Encode(const std::string& in, std::string* out);
+	static bool        base64Encode(const uint8_t* pData, size_t length, std::string* out);
 	static void        dumpInfo();
-	static bool        endsWith(std::string str, char c);
+	static bool        endsWith(const std::string& str, char c);
+	static bool        equalsIgnoreCase(const std::string& str, const char* value);
 	static const char* errorToString(esp_err_t errCode);
   static const char* wifiErrorToString(uint8_t value);
 	static void        hexDump(const uint8_t* pData, uint32_t length);
 	static std::string ipToString(uint8_t* ip);
-	static std::vector<std::string> split(std::string source, char delimiter);
-	static std::string toLower(std::string& value);
+	static std::vector<std::string> split(const std::string& source, char delimiter);
+	static std::string& toLower(std::string& value);
 	static std::string trim(const std::string& str);
+	static void        trimInPlace(std::string& str);
 
 };
 
+
+/**
+ * @brief Step through the parts of a string separated by a delimiter without copying them.
+ *
+ * Each call to next() moves on to the next part which can then be examined in place.  This is the
+ * allocation free alternative to GeneralUtils::split().  The source string must outlive the splitter.
+ *
+ * @code{.cpp}
+ * StringSplitter parts(connection, ',');
+ * while (parts.next()) {
+ *    if (parts.trim().equalsIgnoreCase("Upgrade")) { ... }
+ * }
+ * @endcode
+ */
+class StringSplitter {
+public:
+	StringSplitter(const std::string& source, char delimiter);
+	const char*     data();
+	bool            equals(const char* value);
+	bool            equalsIgnoreCase(const char* value);
+	size_t          length();
+	bool            next();
+	std::string     toString();
+	StringSplitter& trim();
+
+private:
+	const std::string& m_source;
+	char               m_delimiter;
+	size_t             m_start;  // Start of the current part.
+	size_t             m_end;    // End of the current part (exclusive).
+	size_t             m_next;   // Where the next part starts.
+};
+
 #endif /* COMPONENTS_CPP_UTILS_GENERALUTILS_H_ */
@@ -0,0 +1,334 @@
+/*
+ * HttpBodyParser.cpp
+ *
+ *  Created on: Jan 14, 2018
+ *      Author: kolban
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include "HttpBodyParser.h"
+#include "GeneralUtils.h"
+
+#include <esp_log.h>
+
+static const char* LOG_TAG = "HttpBodyParser";
+
+
+HttpBodyHandler::~HttpBodyHandler() {}
+void HttpBodyHandler::onPartStart(const std::string& name, const std::string& fileName, const std::map<std::string, std::string>& headers) {}
+void HttpBodyHandler::onPartData(const uint8_t* pData, size_t length) {}
+void HttpBodyHandler::onPartEnd() {}
+
+
+/**
+ * @brief Construct a multipart parser.
+ * @param [in] pHandler The handler to receive the parts.
+ * @param [in] boundary The boundary from the Content-Type header (see getBoundary()).
+ */
+HttpMultipartParser::HttpMultipartParser(HttpBodyHandler* pHandler, std::string boundary) {
+	m_pHandler  = pHandler;
+	m_delimiter = "\r\n--" + boundary;
+	m_state     = boundary.empty() ? STATE_ERROR : STATE_PREAMBLE;
+	m_lastChar  = 0;
+	// The first boundary need not be preceded by a CRLF.  Pretend that one has been seen.
+	m_matched   = 2;
+} // HttpMultipartParser
+
+
+/**
+ * @brief Process the end of a header line within a part.
+ * An empty line ends the headers and starts the data of the part.
+ */
+void HttpMultipartParser::endHeaderLine() {
+	if (!m_line.empty()) {
+		size_t colon = m_line.find(':');
+		if (colon != std::string::npos) {
+			std::string name = m_line.substr(0, colon);
+			std::string& value = m_headers[GeneralUtils::toLower(name)];
+			value.assign(m_line, colon + 1, std::string::npos);
+			GeneralUtils::trimInPlace(value);
+		}
+		m_line.clear();
+		return;
+	}
+	std::string disposition = m_headers["content-disposition"];
+	m_pHandler->onPartStart(getParameter(disposition, "name"), getParameter(disposition, "filename"), m_headers);
+	m_headers.clear();
+	m_state   = STATE_DATA;
+	m_matched = 0;
+} // endHeaderLine
+
+
+/**
+ * @brief Feed the next chunk of the body to the parser.
+ * @param [in] pData The data.
+ * @param [in] length The length of the data.
+ * @return False if the body is not valid multipart data.
+ */
+bool HttpMultipartParser::feed(const uint8_t* pData, size_t length) {
+	size_t runStart = 0; // Start of the part data in this chunk not yet passed to the handler.
+	for (size_t i = 0; i < length; i++) {
+		char c = pData[i];
+		switch(m_state) {
+			case STATE_PREAMBLE:
+			case STATE_DATA: {
+				if (c == m_delimiter[m_matched]) {
+					if (m_matched == 0 && m_state == STATE_DATA && i > runStart) {
+						m_pHandler->onPartData(pData + runStart, i - runStart);
+					}
+					m_matched++;
+					if (m_matched == m_delimiter.length()) {
+						if (m_state == STATE_DATA) {
+							m_pHandler->onPartEnd();
+						}
+						m_state    = STATE_AFTER_BOUNDARY;
+						m_lastChar = 0;
+					}
+					break;
+				}
+				if (m_matched == 0) {
+					break; // Ordinary data.
+				}
+				// A mismatch.  The bytes matched so far were data after all.  The delimiter contains
+				// a CR only as its first byte so a new match can only start at this byte.
+				if (m_state == STATE_DATA) {
+					m_pHandler->onPartData((const uint8_t*) m_delimiter.data(), m_matched);
+				}
+				if (c == m_delimiter[0]) {
+					m_matched = 1;
+					runStart  = i + 1;
+				} else {
+					m_matched = 0;
+					runStart  = i;
+				}
+				break;
+			}
+
+			case STATE_AFTER_BOUNDARY: {
+				if (m_lastChar == '-') {
+					if (c != '-') {
+						m_state = STATE_ERROR;
+						break;
+					}
+					m_state = STATE_EPILOGUE;
+				} else if (m_lastChar == '\r') {
+					if (c != '\n') {
+						m_state = STATE_ERROR;
+						break;
+					}
+					m_state = STATE_HEADERS;
+					m_line.clear();
+					m_lastChar = 0;
+				} else if (c == '-' || c == '\r') {
+					m_lastChar = c;
+				} else if (c != ' ' && c != '\t') { // Transport padding may follow the boundary.
+					m_state = STATE_ERROR;
+				}
+				break;
+			}
+
+			case STATE_HEADERS: {
+				if (c == '\n' && m_lastChar == '\r') {
+					m_line.erase(m_line.length() - 1);
+					endHeaderLine();
+					runStart = i + 1;
+				} else if (m_line.length() >= HTTP_MULTIPART_MAX_HEADER_LINE) {
+					ESP_LOGE(LOG_TAG, "Multipart header line too long");
+					m_state = STATE_ERROR;
+				} else {
+					m_line += c;
+				}
+				m_lastChar = c;
+				break;
+			}
+
+			case STATE_EPILOGUE: {
+				return true; // Anything after the final boundary is ignored.
+			}
+
+			case STATE_ERROR: {
+				return false;
+			}
+		} // switch
+	} // for
+	if (m_state == STATE_DATA && m_matched == 0 && length > runStart) {
+		m_pHandler->onPartData(pData + runStart, length - runStart);
+	}
+	return m_state != STATE_ERROR;
+} // feed
+
+
+/**
+ * @brief Signal the end of the body.
+ * @return True if the final boundary was seen.
+ */
+bool HttpMultipartParser::finish() {
+	if (m_state != STATE_EPILOGUE) {
+		ESP_LOGE(LOG_TAG, "Multipart body ended before its final boundary");
+		return false;
+	}
+	return true;
+} // finish
+
+
+/**
+ * @brief Get the boundary from the value of a multipart Content-Type header.
+ * @param [in] contentType The value of the Content-Type header.
+ * @return The boundary or an empty string if this is not a multipart content type.
+ */
+std::string HttpMultipartParser::getBoundary(std::string contentType) {
+	// The boundary is case sensitive so only the media type is compared without regard to case.
+	if (strncasecmp(contentType.c_str(), "multipart/", 10) != 0) {
+		return "";
+	}
+	return getParameter(contentType, "boundary");
+} // getBoundary
+
+
+/**
+ * @brief Get a parameter from a header value.
+ * For example, the parameter "name" of `form-data; name="file"; filename="a.bin"` is `file`.
+ * @param [in] headerValue The value of the header.
+ * @param [in] name The name of the parameter.
+ * @return The value of the parameter with any quotes removed or an empty string if not present.
+ */
+std::string HttpMultipartParser::getParameter(const std::string& headerValue, const std::string& name) {
+	size_t pos = headerValue.find(';');
+	while (pos != std::string::npos) {
+		pos++;
+		while (pos < headerValue.length() && isspace((uint8_t) headerValue[pos])) {
+			pos++;
+		}
+		if (strncasecmp(headerValue.c_str() + pos, name.c_str(), name.length()) == 0 &&
+				headerValue[pos + name.length()] == '=') {
+			pos += name.length() + 1;
+			if (headerValue[pos] == '"') {
+				size_t end = headerValue.find('"', pos + 1);
+				return headerValue.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+			}
+			size_t end = headerValue.find(';', pos);
+			return GeneralUtils::trim(headerValue.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+		}
+		pos = headerValue.find(';', pos);
+	}
+	return "";
+} // getParameter
+
+
+/**
+ * @brief Construct a urlencoded form parser.
+ * @param [in] pHandler The handler to receive the fields.
+ */
+HttpUrlEncodedParser::HttpUrlEncodedParser(HttpBodyHandler* pHandler) {
+	m_pHandler    = pHandler;
+	m_inValue     = false;
+	m_hexCount    = 0;
+	m_hexValue    = 0;
+	m_valueLength = 0;
+} // HttpUrlEncodedParser
+
+
+/**
+ * @brief Decode one character of a name or value.
+ * A '+' is a space and a '%' is followed by two hex digits.  Escapes may span chunks.
+ * @param [in] c The encoded character.
+ * @param [out] pDecoded The decoded character.
+ * @return True if a decoded character was produced.
+ */
+bool HttpUrlEncodedParser::decode(uint8_t c, uint8_t* pDecoded) {
+	if (m_hexCount > 0) {
+		if (!isxdigit(c)) {
+			m_hexCount = 0; // Not a valid escape, drop it.
+			return false;
+		}
+		m_hexValue = (m_hexValue << 4) | (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+		if (++m_hexCount < 3) {
+			return false;
+		}
+		m_hexCount = 0;
+		*pDecoded  = m_hexValue;
+		return true;
+	}
+	if (c == '%') {
+		m_hexCount = 1;
+		m_hexValue = 0;
+		return false;
+	}
+	*pDecoded = c == '+' ? ' ' : c;
+	return true;
+} // decode
+
+
+/**
+ * @brief End the current name=value pair.
+ */
+void HttpUrlEncodedParser::endField() {
+	if (!m_inValue) {
+		if (m_name.empty()) {
+			return; // An empty pair, as in "a=1&&b=2".
+		}
+		m_pHandler->onPartStart(m_name, "", std::map<std::string, std::string>());
+	}
+	flushValue();
+	m_pHandler->onPartEnd();
+	m_name.clear();
+	m_inValue  = false;
+	m_hexCount = 0;
+} // endField
+
+
+/**
+ * @brief Feed the next chunk of the body to the parser.
+ * @param [in] pData The data.
+ * @param [in] length The length of the data.
+ */
+void HttpUrlEncodedParser::feed(const uint8_t* pData, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = pData[i];
+		if (c == '&') {
+			endField();
+			continue;
+		}
+		if (c == '=' && !m_inValue) {
+			m_pHandler->onPartStart(m_name, "", std::map<std::string, std::string>());
+			m_inValue  = true;
+			m_hexCount = 0;
+			continue;
+		}
+		uint8_t decoded;
+		if (!decode(c, &decoded)) {
+			continue;
+		}
+		if (!m_inValue) {
+			m_name += (char) decoded;
+			continue;
+		}
+		m_value[m_valueLength++] = decoded;
+		if (m_valueLength == sizeof(m_value)) {
+			flushValue();
+		}
+	}
+	if (m_inValue) {
+		flushValue();
+	}
+} // feed
+
+
+/**
+ * @brief Signal the end of the body.
+ */
+void HttpUrlEncodedParser::finish() {
+	endField();
+} // finish
+
+
+/**
+ * @brief Pass the decoded value bytes collected so far to the handler.
+ */
+void HttpUrlEncodedParser::flushValue() {
+	if (m_valueLength > 0) {
+		m_pHandler->onPartData(m_value, m_valueLength);
+		m_valueLength = 0;
+	}
+} // flushValue
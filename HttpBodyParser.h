@@ -0,0 +1,95 @@
+/*
+ * HttpBodyParser.h
+ *
+ *  Created on: Jan 14, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_HTTPBODYPARSER_H_
+#define COMPONENTS_CPP_UTILS_HTTPBODYPARSER_H_
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#define HTTP_BODY_CHUNK_SIZE           (512) // Size of the stack buffer used to read a body from the socket.
+#define HTTP_MULTIPART_MAX_HEADER_LINE (512) // Longest header line accepted within a multipart part.
+
+/**
+ * @brief Receiver of the parts of a request body.
+ *
+ * For a multipart/form-data body each part is reported in turn.  For an
+ * application/x-www-form-urlencoded body each name=value pair is reported as a part whose data is the
+ * decoded value.  Any other body is reported as a single unnamed part.  The data of a part is delivered
+ * in as many onPartData() calls as it takes, so a part can be far larger than the available RAM.
+ * Override the methods of interest; the default implementations do nothing.
+ */
+class HttpBodyHandler {
+public:
+	virtual ~HttpBodyHandler();
+	virtual void onPartStart(const std::string& name, const std::string& fileName, const std::map<std::string, std::string>& headers);
+	virtual void onPartData(const uint8_t* pData, size_t length);
+	virtual void onPartEnd();
+}; // HttpBodyHandler
+
+
+/**
+ * @brief An incremental multipart/form-data (RFC 7578) parser.
+ *
+ * The body is fed in chunks of any size.  Part headers are buffered one line at a time; part data is
+ * passed straight through to the handler.
+ */
+class HttpMultipartParser {
+public:
+	HttpMultipartParser(HttpBodyHandler* pHandler, std::string boundary);
+	bool               feed(const uint8_t* pData, size_t length);
+	bool               finish();
+	static std::string getBoundary(std::string contentType);
+	static std::string getParameter(const std::string& headerValue, const std::string& name);
+
+private:
+	enum State {
+		STATE_PREAMBLE,       // Before the first boundary.
+		STATE_AFTER_BOUNDARY, // After a boundary, expecting CRLF or "--".
+		STATE_HEADERS,        // Within the headers of a part.
+		STATE_DATA,           // Within the data of a part.
+		STATE_EPILOGUE,       // After the final boundary.
+		STATE_ERROR
+	};
+	void endHeaderLine();
+
+	HttpBodyHandler*                   m_pHandler;
+	std::string                        m_delimiter; // CRLF "--" boundary.
+	size_t                             m_matched;   // Bytes of the delimiter matched so far.
+	State                              m_state;
+	char                               m_lastChar;  // Previous character after a boundary or in a header.
+	std::string                        m_line;      // The header line being accumulated.
+	std::map<std::string, std::string> m_headers;   // The headers of the current part.
+}; // HttpMultipartParser
+
+
+/**
+ * @brief An incremental application/x-www-form-urlencoded parser.
+ *
+ * Names are decoded into memory, values are decoded and passed to the handler as they arrive.
+ */
+class HttpUrlEncodedParser {
+public:
+	HttpUrlEncodedParser(HttpBodyHandler* pHandler);
+	void feed(const uint8_t* pData, size_t length);
+	void finish();
+
+private:
+	bool decode(uint8_t c, uint8_t* pDecoded);
+	void endField();
+	void flushValue();
+
+	HttpBodyHandler* m_pHandler;
+	std::string      m_name;       // The name being decoded.
+	bool             m_inValue;    // Have we seen the '=' of the current field?
+	uint8_t          m_hexCount;   // Hex digits seen of a '%' escape, 0 if not in an escape.
+	uint8_t          m_hexValue;
+	uint8_t          m_value[64];  // Decoded value bytes waiting to be passed to the handler.
+	size_t           m_valueLength;
+}; // HttpUrlEncodedParser
+
+#endif /* COMPONENTS_CPP_UTILS_HTTPBODYPARSER_H_ */
@@ -0,0 +1,275 @@
+/*
+ * HttpEventStream.cpp
+ *
+ *  Created on: Jan 20, 2018
+ *      Author: kolban
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <lwip/sockets.h>
+#include "HttpEventStream.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "Task.h"
+
+#include <esp_log.h>
+
+static const char* LOG_TAG = "HttpEventStream";
+
+#undef close
+
+
+/**
+ * @brief The task that sends heartbeats and retries queued data for the clients of a stream.
+ */
+class HttpEventStreamTask: public Task {
+public:
+	HttpEventStreamTask(): Task("HttpEventStreamTask", 4096) {
+	};
+
+private:
+	void run(void* data) {
+		HttpEventStream* pEventStream = (HttpEventStream*) data;
+		while(1) {
+			delay(HTTP_EVENT_STREAM_FLUSH_MS);
+			pEventStream->service();
+		}
+	} // run
+}; // HttpEventStreamTask
+
+
+/**
+ * @brief Construct an event stream.
+ * @param [in] maxPending The most data that may be queued for a client before it is disconnected.
+ * @param [in] historySize The number of recent events kept for replay to reconnecting clients.
+ */
+HttpEventStream::HttpEventStream(size_t maxPending, size_t historySize) {
+	m_maxPending        = maxPending;
+	m_historySize       = historySize;
+	m_maxClients        = HTTP_EVENT_STREAM_MAX_CLIENTS;
+	m_nextId            = 1;
+	m_heartbeatInterval = HTTP_EVENT_STREAM_HEARTBEAT;
+	m_lastHeartbeat     = 0;
+	m_pTask             = nullptr;
+} // HttpEventStream
+
+
+/**
+ * @brief Destroy the event stream, disconnecting all its clients.
+ */
+HttpEventStream::~HttpEventStream() {
+	m_lock.take("~HttpEventStream");
+	if (m_pTask != nullptr) {
+		m_pTask->stop(); // Safe as the task can't be within service() while we hold the lock.
+		delete m_pTask;
+		m_pTask = nullptr;
+	}
+	while (!m_clients.empty()) {
+		removeClient(m_clients.size() - 1);
+	}
+	m_lock.give();
+} // ~HttpEventStream
+
+
+/**
+ * @brief Accept a new client for the stream.
+ * The response header is sent and the connection is kept open.  If the client sent a Last-Event-ID
+ * header then the events it missed that are still held are sent to it.
+ * @param [in] pRequest The request from the client.
+ * @return True if the client was accepted and its connection must be kept open.
+ */
+bool HttpEventStream::addClient(HttpRequest* pRequest) {
+	HttpResponse response(pRequest);
+	m_lock.take("addClient");
+	if (m_clients.size() >= m_maxClients) {
+		m_lock.give();
+		ESP_LOGE(LOG_TAG, "Too many event stream clients, refusing a new one");
+		response.setStatus(HttpResponse::HTTP_STATUS_SERVICE_UNAVAILABLE, "Service Unavailable");
+		response.sendData("Too many clients");
+		return false;
+	}
+
+	response.setStatus(HttpResponse::HTTP_STATUS_OK, "OK");
+	response.addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "text/event-stream");
+	response.addHeader("Cache-Control", "no-cache");
+	response.sendData("");  // Commit the header, the body is the stream of events.
+
+	Client client;
+	client.socket = pRequest->getSocket();
+	std::string lastEventId = pRequest->getHeader("Last-Event-ID");
+	if (!lastEventId.empty()) {
+		uint32_t lastId = strtoul(lastEventId.c_str(), nullptr, 10);
+		for (auto it = m_history.begin(); it != m_history.end(); ++it) {
+			if (it->id > lastId && !queue(client, it->text)) {
+				break; // More than we may queue, the client gets what fits.
+			}
+		}
+	}
+	m_clients.push_back(client);
+	if (!flush(m_clients.back())) {
+		// Leave the socket open, the server closes the connection of a request that isn't kept.
+		m_clients.pop_back();
+		m_lock.give();
+		ESP_LOGE(LOG_TAG, "Event stream client lost before its first events were sent");
+		return false;
+	}
+
+	if (m_pTask == nullptr) {
+		m_lastHeartbeat = FreeRTOS::getTimeSinceStart();
+		m_pTask = new HttpEventStreamTask();
+		m_pTask->start(this);
+	}
+	ESP_LOGD(LOG_TAG, "New event stream client, now %d", m_clients.size());
+	m_lock.give();
+	return true;
+} // addClient
+
+
+/**
+ * @brief Send an event to every client.
+ * Multi-line data is sent as multiple data fields, which the browser joins again with newlines.
+ * @param [in] data The data of the event.
+ * @param [in] event The type of the event.  An empty type is received by the EventSource onmessage handler.
+ * @return The id of the event.
+ */
+uint32_t HttpEventStream::broadcast(std::string data, std::string event) {
+	m_lock.take("broadcast");
+	uint32_t id = m_nextId++;
+	std::string text = "id: " + std::to_string(id) + "\n";
+	if (!event.empty()) {
+		text += "event: " + event + "\n";
+	}
+	size_t start = 0;
+	size_t end;
+	do {
+		end = data.find('\n', start);
+		text += "data: " + data.substr(start, end == std::string::npos ? std::string::npos : end - start) + "\n";
+		start = end + 1;
+	} while (end != std::string::npos);
+	text += "\n";
+
+	Event entry;
+	entry.id   = id;
+	entry.text = text;
+	m_history.push_back(entry);
+	if (m_history.size() > m_historySize) {
+		m_history.pop_front();
+	}
+
+	for (size_t i = 0; i < m_clients.size();) {
+		if (queue(m_clients[i], text) && flush(m_clients[i])) {
+			i++;
+		} else {
+			removeClient(i);
+		}
+	}
+	m_lock.give();
+	return id;
+} // broadcast
+
+
+/**
+ * @brief Send as much of the data queued for a client as it will accept without blocking.
+ * @param [in] client The client.
+ * @return False if the connection to the client has failed.
+ */
+bool HttpEventStream::flush(Client& client) {
+	if (client.pending.empty()) {
+		return true;
+	}
+	if (client.socket.getSSL()) {
+		// A TLS record can't be partially written without blocking so the whole queue is sent.
+		if (client.socket.send(client.pending) < 0) {
+			return false;
+		}
+		client.pending.clear();
+		return true;
+	}
+	int rc = ::lwip_send_r(client.socket.getFD(), client.pending.data(), client.pending.length(), MSG_DONTWAIT);
+	if (rc < 0) {
+		return errno == EAGAIN || errno == EWOULDBLOCK; // The client is busy, try again later.
+	}
+	client.pending.erase(0, rc);
+	return true;
+} // flush
+
+
+/**
+ * @brief Get the number of connected clients.
+ * @return The number of connected clients.
+ */
+size_t HttpEventStream::getClientCount() {
+	m_lock.take("getClientCount");
+	size_t count = m_clients.size();
+	m_lock.give();
+	return count;
+} // getClientCount
+
+
+/**
+ * @brief Add data to the queue of a client.
+ * @param [in] client The client.
+ * @param [in] text The data to add.
+ * @return False if the queue would grow beyond its bound.
+ */
+bool HttpEventStream::queue(Client& client, const std::string& text) {
+	if (client.pending.length() + text.length() > m_maxPending) {
+		ESP_LOGE(LOG_TAG, "Event stream client on fd %d is too slow", client.socket.getFD());
+		return false;
+	}
+	client.pending += text;
+	return true;
+} // queue
+
+
+/**
+ * @brief Disconnect a client.
+ * @param [in] index The index of the client.
+ */
+void HttpEventStream::removeClient(size_t index) {
+	m_clients[index].socket.close();
+	m_clients.erase(m_clients.begin() + index);
+	ESP_LOGD(LOG_TAG, "Event stream client removed, now %d", m_clients.size());
+} // removeClient
+
+
+/**
+ * @brief Periodic work of the stream's task.
+ * Queued data is retried and, when the interval has passed, a heartbeat comment is sent to every client.
+ */
+void HttpEventStream::service() {
+	m_lock.take("service");
+	bool heartbeat = FreeRTOS::getTimeSinceStart() - m_lastHeartbeat >= m_heartbeatInterval;
+	if (heartbeat) {
+		m_lastHeartbeat = FreeRTOS::getTimeSinceStart();
+	}
+	for (size_t i = 0; i < m_clients.size();) {
+		// A line starting with a colon is a comment, which the browser ignores.
+		if ((!heartbeat || queue(m_clients[i], ":\n\n")) && flush(m_clients[i])) {
+			i++;
+		} else {
+			removeClient(i);
+		}
+	}
+	m_lock.give();
+} // service
+
+
+/**
+ * @brief Set the interval between heartbeat comments.
+ * @param [in] intervalMs The interval in milliseconds.
+ */
+void HttpEventStream::setHeartbeatInterval(uint32_t intervalMs) {
+	m_heartbeatInterval = intervalMs;
+} // setHeartbeatInterval
+
+
+/**
+ * @brief Set the number of clients that may be connected at once.
+ * Further clients are refused with 503 Service Unavailable.
+ * @param [in] maxClients The number of clients.
+ */
+void HttpEventStream::setMaxClients(uint8_t maxClients) {
+	m_maxClients = maxClients;
+} // setMaxClients
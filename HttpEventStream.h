@@ -0,0 +1,88 @@
+/*
+ * HttpEventStream.h
+ *
+ *  Created on: Jan 20, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_HTTPEVENTSTREAM_H_
+#define COMPONENTS_CPP_UTILS_HTTPEVENTSTREAM_H_
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "FreeRTOS.h"
+#include "Socket.h"
+
+#define HTTP_EVENT_STREAM_MAX_CLIENTS (4)     // Default number of clients that may be connected at once.
+#define HTTP_EVENT_STREAM_MAX_PENDING (4096)  // Default bytes queued for a client before it is dropped as too slow.
+#define HTTP_EVENT_STREAM_HISTORY     (16)    // Default number of events kept for Last-Event-ID replay.
+#define HTTP_EVENT_STREAM_HEARTBEAT   (15000) // Default milliseconds between heartbeat comments.
+#define HTTP_EVENT_STREAM_FLUSH_MS    (250)   // How often queued data is retried for clients that were busy.
+
+class HttpEventStreamTask;
+class HttpRequest;
+
+/**
+ * @brief A Server-Sent Events (text/event-stream) channel.
+ *
+ * An event stream is a one-way push channel from the server to any number of browsers, which receive
+ * the events with the JavaScript EventSource API.  Unlike a WebSocket there is no reader task per client:
+ * the connection of each client is kept open and events are written to it when they are broadcast.
+ * A single task per stream sends periodic heartbeat comments, which keep proxies from closing idle
+ * connections and reveal clients that have gone away.
+ *
+ * Each client has a bounded queue of data that it has not yet accepted.  A client that falls so far
+ * behind that its queue would overflow is disconnected; its browser reconnects and sends the id of the
+ * last event it saw in a Last-Event-ID header, and the events it missed are replayed from a ring of
+ * recent events.
+ *
+ * @code{.cpp}
+ * HttpEventStream sensorStream;
+ * httpServer.addPathHandler(HttpRequest::HTTP_METHOD_GET, "/events", &sensorStream);
+ * httpServer.start(80);
+ * ...
+ * sensorStream.broadcast("{\"temperature\": 21.5}", "reading");
+ * @endcode
+ *
+ * The stream must outlive the server it is registered with.
+ */
+class HttpEventStream {
+public:
+	HttpEventStream(size_t maxPending = HTTP_EVENT_STREAM_MAX_PENDING, size_t historySize = HTTP_EVENT_STREAM_HISTORY);
+	virtual ~HttpEventStream();
+	uint32_t broadcast(std::string data, std::string event = "");
+	size_t   getClientCount();
+	void     setHeartbeatInterval(uint32_t intervalMs);
+	void     setMaxClients(uint8_t maxClients);
+
+private:
+	friend class HttpServerTask;
+	friend class HttpEventStreamTask;
+	struct Client {
+		Socket      socket;
+		std::string pending; // Data not yet accepted by the client.
+	};
+	struct Event {
+		uint32_t    id;
+		std::string text;    // The event formatted for the wire.
+	};
+	bool addClient(HttpRequest* pRequest);
+	bool flush(Client& client);
+	bool queue(Client& client, const std::string& text);
+	void removeClient(size_t index);
+	void service();
+
+	std::vector<Client>  m_clients;
+	std::deque<Event>    m_history;
+	size_t               m_historySize;
+	size_t               m_maxPending;
+	uint8_t              m_maxClients;
+	uint32_t             m_nextId;
+	uint32_t             m_heartbeatInterval;
+	uint32_t             m_lastHeartbeat;    // When the last heartbeat was sent.
+	HttpEventStreamTask* m_pTask;            // Sends heartbeats and retries queued data.
+	FreeRTOS::Semaphore  m_lock = FreeRTOS::Semaphore("HttpEventStream");
+}; // HttpEventStream
+
+#endif /* COMPONENTS_CPP_UTILS_HTTPEVENTSTREAM_H_ */
@@ -0,0 +1,241 @@
+/*
+ * HttpMetrics.cpp
+ *
+ *  Created on: Feb 10, 2018
+ *      Author: kolban
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <esp_timer.h>
+#include "HttpMetrics.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+
+// The upper bounds of the histogram buckets in microseconds.  The last bucket, +Inf, is implied.
+static const int64_t bucketBounds[HTTP_METRICS_BUCKETS] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000
+};
+static const char* bucketLabels[HTTP_METRICS_BUCKETS] = {
+	"0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5"
+};
+static const char* spanNames[] = { "handshake", "parse", "handler", "total" };
+
+static const char* METRIC_NAME = "http_request_duration_seconds";
+
+
+HttpTimings::HttpTimings() {
+	reset();
+} // HttpTimings
+
+
+/**
+ * @brief Get the time at which a phase was reached.
+ * @param [in] phase The phase.
+ * @return The time in microseconds since boot or 0 if the phase wasn't reached.
+ */
+int64_t HttpTimings::get(Phase phase) {
+	return m_times[phase];
+} // get
+
+
+/**
+ * @brief Record that a phase has been reached now.
+ * @param [in] phase The phase.
+ */
+void HttpTimings::mark(Phase phase) {
+	m_times[phase] = esp_timer_get_time();
+} // mark
+
+
+/**
+ * @brief Forget all the times.
+ */
+void HttpTimings::reset() {
+	memset(m_times, 0, sizeof(m_times));
+} // reset
+
+
+/**
+ * @brief Record the time at which a phase was reached.
+ * @param [in] phase The phase.
+ * @param [in] time The time in microseconds since boot.
+ */
+void HttpTimings::set(Phase phase, int64_t time) {
+	m_times[phase] = time;
+} // set
+
+
+/**
+ * @brief Return the timings as a string.
+ * Each phase is shown in milliseconds since the connection was accepted.
+ * @return The timings.
+ */
+std::string HttpTimings::toString() {
+	static const char* names[] = { "Accept", "Handshake done", "Headers parsed", "Handler start", "Handler end", "Last byte sent" };
+	std::string ret;
+	char line[48];
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		if (m_times[i] == 0) {
+			continue;
+		}
+		snprintf(line, sizeof(line), "%s%s: %.3f", ret.empty() ? "" : "\n", names[i], (m_times[i] - m_times[ACCEPT]) / 1000.0);
+		ret += line;
+	}
+	return ret;
+} // toString
+
+
+HttpMetrics::HttpMetrics() {
+	m_routes.reserve(HTTP_METRICS_MAX_ROUTES + 1);
+} // HttpMetrics
+
+
+/**
+ * @brief Add a duration to a histogram.
+ * Nothing is added if either end of the span wasn't reached.
+ * @param [in] histogram The histogram.
+ * @param [in] start The start of the span.
+ * @param [in] end The end of the span.
+ */
+void HttpMetrics::observe(Histogram& histogram, int64_t start, int64_t end) {
+	if (start == 0 || end == 0 || end < start) {
+		return;
+	}
+	int64_t duration = end - start;
+	for (int i = 0; i < HTTP_METRICS_BUCKETS; i++) {
+		if (duration <= bucketBounds[i]) {
+			histogram.buckets[i]++;
+			break;
+		}
+	}
+	histogram.count++;
+	histogram.sumUs += duration;
+} // observe
+
+
+/**
+ * @brief Add the timings of a request to the histograms of its route.
+ * @param [in] route The name of the route that the request took.
+ * @param [in] timings The timings of the request.
+ */
+void HttpMetrics::record(const std::string& route, HttpTimings& timings) {
+	Route* pRoute = nullptr;
+	for (auto it = m_routes.begin(); it != m_routes.end(); ++it) {
+		if (it->name == route) {
+			pRoute = &(*it);
+			break;
+		}
+	}
+	if (pRoute == nullptr) {
+		if (m_routes.size() >= HTTP_METRICS_MAX_ROUTES && route != "other") { // The "other" route may go over the limit.
+			record("other", timings);
+			return;
+		}
+		m_routes.push_back(Route());
+		pRoute = &m_routes.back();
+		pRoute->name = route;
+		memset(pRoute->spans, 0, sizeof(pRoute->spans));
+	}
+	observe(pRoute->spans[SPAN_HANDSHAKE], timings.get(HttpTimings::ACCEPT), timings.get(HttpTimings::HANDSHAKE_DONE));
+	observe(pRoute->spans[SPAN_PARSE], timings.get(HttpTimings::HANDSHAKE_DONE), timings.get(HttpTimings::HEADERS_PARSED));
+	observe(pRoute->spans[SPAN_HANDLER], timings.get(HttpTimings::HANDLER_START), timings.get(HttpTimings::HANDLER_END));
+	observe(pRoute->spans[SPAN_TOTAL], timings.get(HttpTimings::ACCEPT), timings.get(HttpTimings::LAST_BYTE_SENT));
+} // record
+
+
+/**
+ * @brief Append the histograms of a route in the Prometheus text format.
+ * @param [out] text The text to append to.
+ * @param [in] route The route.
+ */
+void HttpMetrics::render(std::string& text, const Route& route) {
+	// Label values escape backslash, double quote and newline.
+	std::string name;
+	for (size_t i = 0; i < route.name.length(); i++) {
+		char c = route.name[i];
+		if (c == '\\' || c == '"') {
+			name += '\\';
+		} else if (c == '\n') {
+			name += "\\n";
+			continue;
+		}
+		name += c;
+	}
+	char line[160];
+	for (int span = 0; span < SPAN_COUNT; span++) {
+		const Histogram& histogram = route.spans[span];
+		uint32_t cumulative = 0;
+		for (int i = 0; i < HTTP_METRICS_BUCKETS; i++) {
+			cumulative += histogram.buckets[i];
+			snprintf(line, sizeof(line), "%s_bucket{route=\"", METRIC_NAME);
+			text += line;
+			text += name;
+			snprintf(line, sizeof(line), "\",phase=\"%s\",le=\"%s\"} %u\n", spanNames[span], bucketLabels[i], cumulative);
+			text += line;
+		}
+		snprintf(line, sizeof(line), "%s_bucket{route=\"", METRIC_NAME);
+		text += line;
+		text += name;
+		snprintf(line, sizeof(line), "\",phase=\"%s\",le=\"+Inf\"} %u\n", spanNames[span], histogram.count);
+		text += line;
+		snprintf(line, sizeof(line), "%s_sum{route=\"", METRIC_NAME);
+		text += line;
+		text += name;
+		snprintf(line, sizeof(line), "\",phase=\"%s\"} %.6f\n", spanNames[span], histogram.sumUs / 1000000.0);
+		text += line;
+		snprintf(line, sizeof(line), "%s_count{route=\"", METRIC_NAME);
+		text += line;
+		text += name;
+		snprintf(line, sizeof(line), "\",phase=\"%s\"} %u\n", spanNames[span], histogram.count);
+		text += line;
+	}
+} // render
+
+
+/**
+ * @brief Append the HELP and TYPE lines that start the metrics in the Prometheus text format.
+ * @param [out] text The text to append to.
+ */
+void HttpMetrics::renderHeader(std::string& text) {
+	text += "# HELP ";
+	text += METRIC_NAME;
+	text += " Time spent in each phase of handling inbound HTTP requests.\n# TYPE ";
+	text += METRIC_NAME;
+	text += " histogram\n";
+} // renderHeader
+
+
+/**
+ * @brief Send the metrics as the response to a request.
+ * The metrics of one route at a time are formatted and sent so that the whole document is never
+ * held in memory.
+ * @param [in] pResponse The response.
+ */
+void HttpMetrics::send(HttpResponse* pResponse) {
+	pResponse->setStatus(HttpResponse::HTTP_STATUS_OK, "OK");
+	pResponse->addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+	std::string text;
+	renderHeader(text);
+	pResponse->sendData(text);
+	for (auto it = m_routes.begin(); it != m_routes.end(); ++it) {
+		text.clear();
+		render(text, *it);
+		pResponse->sendData(text);
+	}
+	pResponse->close();
+} // send
+
+
+/**
+ * @brief Get the metrics in the Prometheus text exposition format.
+ * @return The metrics.
+ */
+std::string HttpMetrics::toPrometheus() {
+	std::string text;
+	renderHeader(text);
+	for (auto it = m_routes.begin(); it != m_routes.end(); ++it) {
+		render(text, *it);
+	}
+	return text;
+} // toPrometheus
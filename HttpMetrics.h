@@ -0,0 +1,94 @@
+/*
+ * HttpMetrics.h
+ *
+ *  Created on: Feb 10, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_HTTPMETRICS_H_
+#define COMPONENTS_CPP_UTILS_HTTPMETRICS_H_
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define HTTP_METRICS_MAX_ROUTES (16)  // Routes with their own histograms; any more are counted as "other".
+#define HTTP_METRICS_BUCKETS    (11)  // Finite histogram buckets, see the bucket bounds in HttpMetrics.cpp.
+
+class HttpResponse;
+
+/**
+ * @brief The times at which an inbound HTTP request passed through each phase of its handling.
+ *
+ * This is the inbound equivalent of RESTTimings.  The times are those of esp_timer_get_time() in
+ * microseconds, 0 for a phase that wasn't reached.  They are only recorded when the server has
+ * metrics enabled.
+ */
+class HttpTimings {
+public:
+	enum Phase {
+		ACCEPT,          // The connection was accepted.
+		HANDSHAKE_DONE,  // The TLS handshake (if any) is complete.
+		HEADERS_PARSED,  // The request line and headers have been read.
+		HANDLER_START,   // The handler was called.
+		HANDLER_END,     // The handler returned.
+		LAST_BYTE_SENT,  // The response has been sent and the connection closed.
+		PHASE_COUNT
+	};
+	HttpTimings();
+	int64_t     get(Phase phase);
+	void        mark(Phase phase);
+	void        reset();
+	void        set(Phase phase, int64_t time);
+	std::string toString();
+
+private:
+	int64_t m_times[PHASE_COUNT];
+}; // HttpTimings
+
+
+/**
+ * @brief Latency histograms of inbound HTTP requests, per route.
+ *
+ * Each request that is recorded adds the duration of four spans to the histograms of its route:
+ *
+ * * handshake - from accept to the end of the TLS handshake.
+ * * parse - from the end of the handshake to the end of the headers.
+ * * handler - from the start to the end of the handler.
+ * * total - from accept until the last byte was sent.
+ *
+ * The histograms are rendered in the Prometheus text exposition format by toPrometheus(), which is
+ * what the /metrics handler of HttpServer sends.  All updates are made by the server task so no
+ * locking is needed.
+ */
+class HttpMetrics {
+public:
+	HttpMetrics();
+	void        record(const std::string& route, HttpTimings& timings);
+	void        send(HttpResponse* pResponse);
+	std::string toPrometheus();
+
+private:
+	enum Span {
+		SPAN_HANDSHAKE,
+		SPAN_PARSE,
+		SPAN_HANDLER,
+		SPAN_TOTAL,
+		SPAN_COUNT
+	};
+	struct Histogram {
+		uint32_t buckets[HTTP_METRICS_BUCKETS]; // Observations no greater than each bound (not cumulative).
+		uint32_t count;
+		uint64_t sumUs;
+	};
+	struct Route {
+		std::string name;
+		Histogram   spans[SPAN_COUNT];
+	};
+	void observe(Histogram& histogram, int64_t start, int64_t end);
+	void render(std::string& text, const Route& route);
+	void renderHeader(std::string& text);
+
+	std::vector<Route> m_routes;
+}; // HttpMetrics
+
+#endif /* COMPONENTS_CPP_UTILS_HTTPMETRICS_H_ */
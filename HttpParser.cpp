@@ -8,8 +8,13 @@
 #include <string>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <ctype.h>
+#include <strings.h>
+#include <algorithm>
 #include "HttpParser.h"
 #include "HttpRequest.h"
+#include "HttpResponse.h"
 #include "GeneralUtils.h"
 
 #include <esp_log.h>
@@ -87,50 +92,125 @@ static std::string toCharToken(std::string::iterator &it, std::string &str, char
 } // toCharToken
 
 
+HttpParser::HttpParser() {
+	m_headerCount = 0;
+	reset();
+}
+
+HttpParser::~HttpParser() {
+}
+
+
 /**
- * @brief Parse a header line.
+ * @brief Parse a header line and add it to the headers.
  * An HTTP Header is of the form:
  *
  * Name":" Value
  *
- * We parse this and return a pair.
+ * The name is normalized to lower case.  If the header is already present the first value is kept.
  * @param [in] line The line of text to parse.
- * @return A pair of the form name/value.
  */
-std::pair<std::string, std::string> parseHeader(std::string &line) {
-	auto it    = line.begin();
-	std::string name  = toCharToken(it, line, ':'); // Parse the line until we find a ':'
-	// We normalize the header name to be lower case.
-	GeneralUtils::toLower(name);
-	auto value = GeneralUtils::trim(toStringToken(it, line, lineTerminator));
-	return std::pair<std::string, std::string>(name, value);
-} // parseHeader
-
-
-HttpParser::HttpParser() {
-}
-
-HttpParser::~HttpParser() {
-}
+void HttpParser::addHeader(const std::string& line) {
+	size_t colon = line.find(':');
+	if (colon == std::string::npos) {
+		colon = line.length();
+	}
+	uint32_t hash = hashHeaderName(line.data(), colon);
+	for (size_t i = 0; i < m_headerCount; i++) {
+		if (m_headers[i].hash == hash && m_headers[i].name.length() == colon &&
+				strncasecmp(m_headers[i].name.data(), line.data(), colon) == 0) {
+			return;
+		}
+	}
+	if (m_headerCount == m_headers.size()) {
+		m_headers.push_back(HttpHeader());
+	}
+	HttpHeader& header = m_headers[m_headerCount++];
+	header.hash = hash;
+	header.name.assign(line, 0, colon);
+	for (size_t i = 0; i < header.name.length(); i++) {
+		header.name[i] = tolower((uint8_t) header.name[i]);
+	}
+	size_t start = line.find_first_not_of(" \t", colon + 1);
+	if (start == std::string::npos) {
+		header.value.clear();
+	} else {
+		header.value.assign(line, start, line.find_last_not_of(" \t") - start + 1);
+	}
+} // addHeader
 
 
 /**
  * @brief Dump the outcome of the parse.
- *
  */
 void HttpParser::dump() {
 	ESP_LOGD(LOG_TAG, "Method: %s, URL: \"%s\", Version: %s", m_method.c_str(), m_url.c_str(), m_version.c_str());
-	auto it2 = m_headers.begin();
-	for (; it2 != m_headers.end(); ++it2) {
-		ESP_LOGD(LOG_TAG, "name=\"%s\", value=\"%s\"", it2->first.c_str(), it2->second.c_str());
+	for (size_t i = 0; i < m_headerCount; i++) {
+		ESP_LOGD(LOG_TAG, "name=\"%s\", value=\"%s\"", m_headers[i].name.c_str(), m_headers[i].value.c_str());
 	}
-	ESP_LOGD(LOG_TAG, "Body: \"%s\"", m_body.c_str());
+	// The body is not read here as that would pull it all into RAM before a handler can stream it.
+	ESP_LOGD(LOG_TAG, "Body: %d bytes unread", getBodyRemaining());
 } // dump
 
 
+/**
+ * @brief Get the outcome of parsing the head of the message.
+ * @return 0 if the message was parsed, otherwise the HTTP status to reject it with.
+ */
+int HttpParser::getError() {
+	return m_error;
+} // getError
+
+
+/**
+ * @brief Find the value of a header.
+ * @param [in] name The name of the header, in any case.
+ * @return The value or nullptr if there is no such header.
+ */
+const std::string* HttpParser::findHeader(const char* name) {
+	size_t length = strlen(name);
+	uint32_t hash = hashHeaderName(name, length);
+	for (size_t i = 0; i < m_headerCount; i++) {
+		if (m_headers[i].hash == hash && m_headers[i].name.length() == length &&
+				strncasecmp(m_headers[i].name.data(), name, length) == 0) {
+			return &m_headers[i].value;
+		}
+	}
+	return nullptr;
+} // findHeader
+
+
+/**
+ * @brief Get the body of the message.
+ * A request body is not read from the socket until it is asked for.  Calling this method reads
+ * whatever has not already been consumed by readBody() into memory.  Large bodies should instead be
+ * consumed with readBody() so that they never need to be held in RAM.
+ * @return The (remaining) body.
+ */
 std::string HttpParser::getBody() {
+	if (!m_bodyLoaded) {
+		uint8_t data[512];
+		size_t length;
+		while ((length = readBody(data, sizeof(data))) > 0) {
+			m_body.append((char*) data, length);
+		}
+		m_bodyLoaded = true;
+		m_bodyOffset = 0;
+	}
 	return m_body;
-}
+} // getBody
+
+
+/**
+ * @brief Get the number of bytes of the body that have not yet been read.
+ * @return The number of bytes still to be read, or 0 if the length of the body is not known.
+ */
+size_t HttpParser::getBodyRemaining() {
+	if (m_bodyLoaded) {
+		return m_body.length() - m_bodyOffset;
+	}
+	return m_bodyIsBounded ? m_bodyRemaining : 0;
+} // getBodyRemaining
 
 
 /**
@@ -139,32 +219,39 @@ std::string HttpParser::getBody() {
  * @return The value of the named header or null if not present.
  */
 std::string HttpParser::getHeader(const std::string& name) {
-	// We normalize the header name to be lower case.
-	std::string localName = name;
-	GeneralUtils::toLower(localName);
-	if (!hasHeader(localName)) {
+	const std::string* pValue = findHeader(name.c_str());
+	if (pValue == nullptr) {
 		return "";
 	}
-	return m_headers.at(localName);
+	return *pValue;
 } // getHeader
 
 
+/**
+ * @brief Get all the headers.
+ * The map is built on each call; prefer getHeader() for individual headers.
+ * @return A map of the lower case header names to their values.
+ */
 std::map<std::string, std::string> HttpParser::getHeaders() {
-	return m_headers;
+	std::map<std::string, std::string> headers;
+	for (size_t i = 0; i < m_headerCount; i++) {
+		headers[m_headers[i].name] = m_headers[i].value;
+	}
+	return headers;
 } // getHeaders
 
 
-std::string HttpParser::getMethod() {
+const std::string& HttpParser::getMethod() {
 	return m_method;
 } // getMethod
 
 
-std::string HttpParser::getURL() {
+const std::string& HttpParser::getURL() {
 	return m_url;
 } // getURL
 
 
-std::string HttpParser::getVersion() {
+const std::string& HttpParser::getVersion() {
 	return m_version;
 } // getVersion
 
@@ -182,49 +269,73 @@ std::string HttpParser::getReason() {
  * @return True if the header is present and false otherwise.
  */
 bool HttpParser::hasHeader(const std::string& name) {
-	// We normalize the header name to be lower case.
-	std::string localName = name;
-	return m_headers.find(GeneralUtils::toLower(localName)) != m_headers.end();
+	return findHeader(name.c_str()) != nullptr;
 } // hasHeader
 
 
+/**
+ * @brief Hash a header name without regard to case.
+ * @param [in] name The name.
+ * @param [in] length The length of the name.
+ * @return The FNV-1a hash of the lower case name.
+ */
+uint32_t HttpParser::hashHeaderName(const char* name, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t) tolower((uint8_t) name[i])) * 16777619u;
+	}
+	return hash;
+} // hashHeaderName
+
+
 /**
  * @brief Parse socket data.
  * @param [in] s The socket from which to retrieve data.
  */
 void HttpParser::parse(Socket s) {
 	ESP_LOGD(LOG_TAG, ">> parse: socket: %s", s.toString().c_str());
-	std::string line;
-	line = s.readToDelim(lineTerminator);
-	parseRequestLine(line);
-	line = s.readToDelim(lineTerminator);
-	while(!line.empty()) {
-		m_headers.insert(parseHeader(line));
-		line = s.readToDelim(lineTerminator);
+	m_socket = s;
+	if (!readLine()) {
+		ESP_LOGE(LOG_TAG, "Request line longer than %d bytes", HTTP_PARSER_MAX_LINE);
+		m_error = HttpResponse::HTTP_STATUS_BAD_REQUEST;
+		return;
+	}
+	parseRequestLine(m_line);
+	while(true) {
+		if (!readLine()) {
+			ESP_LOGE(LOG_TAG, "Header line longer than %d bytes", HTTP_PARSER_MAX_LINE);
+			m_error = HttpResponse::HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE;
+			return;
+		}
+		if (m_line.empty()) {
+			break;
+		}
+		addHeader(m_line);
 	}
 	// Only PUT and POST requests have a body
-	if (getMethod() != "POST" && getMethod() != "PUT") {
+	if (m_method != HttpRequest::HTTP_METHOD_POST && m_method != HttpRequest::HTTP_METHOD_PUT) {
 		ESP_LOGD(LOG_TAG, "<< parse");
 		return;
 	}
 
-	// We have now parsed up to and including the separator ... we are now at the point where we
-	// want to read the body.  There are two stories here.  The first is that we know the exact length
-	// of the body or we read until we can't read anymore.
-	if (hasHeader(HttpRequest::HTTP_HEADER_CONTENT_LENGTH)) {
-		std::string val = getHeader(HttpRequest::HTTP_HEADER_CONTENT_LENGTH);
-		int length = std::atoi(val.c_str());
-		uint8_t data[length];
-		s.receive(data, length, true);
-		m_body = std::string((char *)data, length);
+	// We have now parsed up to and including the separator ... we are now at the point where the
+	// body starts.  We don't read it here as it may be far larger than the RAM we have; it is read
+	// on demand by readBody() or getBody().  There are three stories here.  The body may be sent in
+	// chunks, we may know the exact length of the body or we take what a single read gives us.
+	const std::string* pTransferEncoding = findHeader(HttpRequest::HTTP_HEADER_TRANSFER_ENCODING);
+	const std::string* pContentLength    = findHeader(HttpRequest::HTTP_HEADER_CONTENT_LENGTH);
+	if (pTransferEncoding != nullptr && strcasestr(pTransferEncoding->c_str(), "chunked") != nullptr) {
+		m_bodyRemaining = 0; // No chunk has been started.
+		m_bodyIsBounded = false;
+		m_bodyIsChunked = true;
+	} else if (pContentLength != nullptr) {
+		m_bodyRemaining = std::strtoul(pContentLength->c_str(), nullptr, 10);
+		m_bodyIsBounded = true;
 	} else {
-		uint8_t data[512];
-		int rc = s.receive(data, sizeof(data));
-        if (rc > 0) {
-		    m_body = std::string((char *)data, rc);
-        }
+		m_bodyRemaining = 512;
+		m_bodyIsBounded = false;
 	}
-	ESP_LOGD(LOG_TAG, "<< parse: Size of body: %d", m_body.length());
+	ESP_LOGD(LOG_TAG, "<< parse: Size of body: %d", m_bodyRemaining);
 } // parse
 
 
@@ -249,6 +360,143 @@ void HttpParser::parse(std::string message) {
 } // parse
 */
 
+/**
+ * @brief Read the next part of the body.
+ * @param [out] pData The buffer to receive the data.
+ * @param [in] length The size of the buffer.
+ * @return The number of bytes read, 0 once the whole body has been read.
+ */
+size_t HttpParser::readBody(uint8_t* pData, size_t length) {
+	if (m_bodyLoaded) {
+		// The body has already been read into memory by getBody(), serve it from there.
+		if (length > m_body.length() - m_bodyOffset) {
+			length = m_body.length() - m_bodyOffset;
+		}
+		memcpy(pData, m_body.data() + m_bodyOffset, length);
+		m_bodyOffset += length;
+		return length;
+	}
+	if (m_bodyIsChunked && m_bodyRemaining == 0 && !readChunkHeader()) {
+		return 0;
+	}
+	if (m_bodyRemaining == 0) {
+		return 0;
+	}
+	if (length > m_bodyRemaining) {
+		length = m_bodyRemaining;
+	}
+	int rc;
+	if (m_bufferStart < m_bufferEnd) {
+		// Serve what was read with the head of the message first.
+		rc = (int) std::min(length, m_bufferEnd - m_bufferStart);
+		memcpy(pData, m_buffer + m_bufferStart, rc);
+		m_bufferStart += rc;
+	} else {
+		rc = (int) m_socket.receive(pData, length);
+	}
+	if (rc <= 0) {
+		m_bodyRemaining = 0; // The peer closed the connection or there was an error.
+		m_bodyEnded     = true;
+		return 0;
+	}
+	// Without a Content-Length we only take what a single read gives us.
+	m_bodyRemaining = (m_bodyIsBounded || m_bodyIsChunked) ? m_bodyRemaining - rc : 0;
+	if (m_bodyIsChunked && m_bodyRemaining == 0) {
+		readLine(); // The CRLF that ends the chunk data.
+	}
+	return rc;
+} // readBody
+
+
+/**
+ * @brief Read the size line that starts a chunk of a chunked body.
+ * The size is hex and may be followed by chunk extensions, which we ignore.  The last chunk has a
+ * size of zero and is followed by optional trailer fields, which are added to the headers.
+ * @return True if a chunk with data follows, false at the end of the body.
+ */
+bool HttpParser::readChunkHeader() {
+	if (m_bodyEnded) {
+		return false;
+	}
+	if (!readLine()) {
+		ESP_LOGE(LOG_TAG, "Chunk size line longer than %d bytes", HTTP_PARSER_MAX_LINE);
+		m_bodyEnded = true;
+		return false;
+	}
+	m_bodyRemaining = std::strtoul(m_line.c_str(), nullptr, 16);
+	if (m_bodyRemaining > 0) {
+		return true;
+	}
+	while(readLine() && !m_line.empty()) {
+		addHeader(m_line);
+	}
+	m_bodyEnded = true;
+	return false;
+} // readChunkHeader
+
+
+/**
+ * @brief Read a line from the socket into m_line.
+ * The socket is read HTTP_PARSER_BUFFER_SIZE bytes at a time and what follows the line is kept for the
+ * next line or for readBody().  The CRLF that ends the line is not included.  At the end of the stream
+ * the line holds what was read.
+ * @return False if the line is longer than HTTP_PARSER_MAX_LINE bytes.
+ */
+bool HttpParser::readLine() {
+	m_line.clear();
+	while (true) {
+		if (m_bufferStart == m_bufferEnd) {
+			int rc = (int) m_socket.receive(m_buffer, sizeof(m_buffer));
+			if (rc <= 0) {
+				return true;
+			}
+			m_bufferStart = 0;
+			m_bufferEnd   = rc;
+		}
+		uint8_t* pStart   = m_buffer + m_bufferStart;
+		uint8_t* pNewline = (uint8_t*) memchr(pStart, '\n', m_bufferEnd - m_bufferStart);
+		size_t   length   = (pNewline == nullptr ? m_buffer + m_bufferEnd : pNewline) - pStart;
+		if (m_line.length() + length > HTTP_PARSER_MAX_LINE) {
+			return false;
+		}
+		m_line.append((char*) pStart, length);
+		m_bufferStart += length;
+		if (pNewline != nullptr) {
+			m_bufferStart++;
+			if (!m_line.empty() && m_line[m_line.length() - 1] == '\r') {
+				m_line.erase(m_line.length() - 1);
+				return true;
+			}
+			m_line += '\n';   // A bare LF doesn't end the line.
+		}
+	}
+} // readLine
+
+
+/**
+ * @brief Forget the current message so that the parser can be used for the next.
+ * The storage of the strings and headers is kept for reuse.
+ */
+void HttpParser::reset() {
+	m_method.clear();
+	m_url.clear();
+	m_version.clear();
+	m_body.clear();
+	m_status.clear();
+	m_reason.clear();
+	m_headerCount   = 0;
+	m_bodyRemaining = 0;
+	m_bodyIsBounded = true;
+	m_bodyIsChunked = false;
+	m_bodyEnded     = false;
+	m_bodyLoaded    = false;
+	m_bodyOffset    = 0;
+	m_bufferStart   = 0;
+	m_bufferEnd     = 0;
+	m_error         = 0;
+} // reset
+
+
 /**
  * @brief Parse A request line.
  * @param [in] line The request line to parse.
@@ -258,16 +506,19 @@ void HttpParser::parse(std::string message) {
 //
 void HttpParser::parseRequestLine(std::string &line) {
 	ESP_LOGD(LOG_TAG, ">> parseRequestLine: \"%s\" [%d]", line.c_str(), line.length());
-	std::string::iterator it = line.begin();
+	// The parts are assigned in place so that the strings keep their storage.
+	size_t urlStart     = std::min(line.find(' '), line.length());
+	size_t versionStart = std::min(line.find(' ', urlStart + 1), line.length());
+	size_t versionEnd   = std::min(line.find(' ', versionStart + 1), line.length());
 
 	// Get the method
-	m_method = toCharToken(it, line, ' ');
+	m_method.assign(line, 0, urlStart);
 
 	// Get the url
-	m_url = toCharToken(it, line, ' ');
+	m_url.assign(line, std::min(urlStart + 1, line.length()), versionStart - std::min(urlStart + 1, versionStart));
 
 	// Get the version
-	m_version = toCharToken(it, line, ' ');
+	m_version.assign(line, std::min(versionStart + 1, line.length()), versionEnd - std::min(versionStart + 1, versionEnd));
 	ESP_LOGD(LOG_TAG, "<< parseRequestLine: method: %s, url: %s, version: %s", m_method.c_str(), m_url.c_str(), m_version.c_str());
 } // parseRequestLine
 
@@ -287,11 +538,12 @@ void HttpParser::parseResponse(std::string message)
 	line = toStringToken(it, message, lineTerminator);
 	while(!line.empty()) {
 		ESP_LOGD(LOG_TAG, "Header: \"%s\"", line.c_str());
-		m_headers.insert(parseHeader(line));
+		addHeader(line);
 		line = toStringToken(it, message, lineTerminator);
 	}
 
 	m_body = message.substr(std::distance(message.begin(), it));
+	m_bodyLoaded = true;
 } // parse
 
 /**
@@ -7,37 +7,82 @@
 
 #ifndef CPP_UTILS_HTTPPARSER_H_
 #define CPP_UTILS_HTTPPARSER_H_
+#include <stdint.h>
 #include <string>
 #include <map>
+#include <vector>
 #include "Socket.h"
 
+#define HTTP_PARSER_BUFFER_SIZE (128)  // Bytes read from the socket at a time while reading the head of a message.
+#define HTTP_PARSER_MAX_LINE    (2048) // Longest request line or header line that is accepted.
+
+/**
+ * @brief A header of a parsed message.
+ * The name is held in lower case together with a hash of it, so that finding a header needs
+ * neither a copy of the name being looked for nor a string comparison against every header.
+ */
+struct HttpHeader {
+	uint32_t    hash;
+	std::string name;
+	std::string value;
+};
+
+/**
+ * @brief Parse an HTTP message.
+ *
+ * A parser may be reused for message after message with reset().  The strings it holds keep their
+ * storage from one message to the next so, once it has seen a few messages, parsing a typical request
+ * allocates nothing.
+ */
 class HttpParser {
 private:
 	std::string m_method;
 	std::string m_url;
 	std::string m_version;
 	std::string m_body;
+	std::string m_line;           // The line being read from the socket.
+	uint8_t     m_buffer[HTTP_PARSER_BUFFER_SIZE];  // Data read from the socket but not yet consumed.
+	size_t      m_bufferStart;    // The first unconsumed byte of m_buffer.
+	size_t      m_bufferEnd;      // The end of the data in m_buffer.
+	int         m_error;          // The status to reject the message with, or 0 if it was parsed.
+	Socket      m_socket;         // The socket from which the body is read.
+	size_t      m_bodyRemaining;  // Bytes of the body (or of the current chunk) not yet read from the socket.
+	bool        m_bodyIsBounded;  // Is the body length known from the Content-Length header?
+	bool        m_bodyIsChunked;  // Is the body sent with chunked transfer encoding?
+	bool        m_bodyEnded;      // Has the last chunk of a chunked body been read?
+	bool        m_bodyLoaded;     // Has the rest of the body been read into m_body?
+	size_t      m_bodyOffset;     // Bytes of m_body already returned by readBody().
     std::string m_status;
     std::string m_reason;
-	std::map<std::string, std::string> m_headers;
-	void dump();
+	std::vector<HttpHeader> m_headers;      // Entries beyond m_headerCount are spares kept for reuse.
+	size_t                  m_headerCount;  // Headers of the current message.
+	void               addHeader(const std::string& line);
+	const std::string* findHeader(const char* name);
+	bool readChunkHeader();
+	bool readLine();
 	void parseRequestLine(std::string &line);
     void parseStatusLine(std::string &line);
 public:
 	HttpParser();
 	virtual ~HttpParser();
+	void        dump();
 	std::string getBody();
+	int         getError();
+	size_t      getBodyRemaining();
 	std::string getHeader(const std::string& name);
 	std::map<std::string, std::string> getHeaders();
-	std::string getMethod();
-	std::string getURL();
-	std::string getVersion();
+	const std::string& getMethod();
+	const std::string& getURL();
+	const std::string& getVersion();
     std::string getStatus();
     std::string getReason();
 	bool hasHeader(const std::string& name);
+	static uint32_t hashHeaderName(const char* name, size_t length);
 	void parse(std::string message);
 	void parse(Socket s);
     void parseResponse(std::string message);
+	size_t readBody(uint8_t* pData, size_t length);
+	void reset();
 };
 
 #endif /* CPP_UTILS_HTTPPARSER_H_ */
@@ -34,9 +34,11 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include "HttpBodyParser.h"
 #include "HttpResponse.h"
 #include "HttpRequest.h"
 #include "GeneralUtils.h"
+#include "FileSystem.h"
 
 #include <esp_log.h>
 #include <hwcrypto/sha.h>
@@ -47,8 +49,10 @@ static const char* LOG_TAG="HttpRequest";
 //static std::string lineTerminator = "\r\n";
 
 const char HttpRequest::HTTP_HEADER_ACCEPT[]         = "Accept";
+const char HttpRequest::HTTP_HEADER_ACCEPT_ENCODING[] = "Accept-Encoding";
 const char HttpRequest::HTTP_HEADER_ALLOW[]          = "Allow";
 const char HttpRequest::HTTP_HEADER_CONNECTION[]     = "Connection";
+const char HttpRequest::HTTP_HEADER_CONTENT_ENCODING[] = "Content-Encoding";
 const char HttpRequest::HTTP_HEADER_CONTENT_LENGTH[] = "Content-Length";
 const char HttpRequest::HTTP_HEADER_CONTENT_TYPE[]   = "Content-Type";
 const char HttpRequest::HTTP_HEADER_COOKIE[]         = "Cookie";
@@ -59,8 +63,11 @@ const char HttpRequest::HTTP_HEADER_SEC_WEBSOCKET_ACCEPT[]   = "Sec-WebSocket-Ac
 const char HttpRequest::HTTP_HEADER_SEC_WEBSOCKET_PROTOCOL[] = "Sec-WebSocket-Protocol";
 const char HttpRequest::HTTP_HEADER_SEC_WEBSOCKET_KEY[]      = "Sec-WebSocket-Key";
 const char HttpRequest::HTTP_HEADER_SEC_WEBSOCKET_VERSION[]  = "Sec-WebSocket-Version";
+const char HttpRequest::HTTP_HEADER_TRAILER[]           = "Trailer";
+const char HttpRequest::HTTP_HEADER_TRANSFER_ENCODING[] = "Transfer-Encoding";
 const char HttpRequest::HTTP_HEADER_UPGRADE[]        = "Upgrade";
 const char HttpRequest::HTTP_HEADER_USER_AGENT[]     = "User-Agent";
+const char HttpRequest::HTTP_HEADER_VARY[]           = "Vary";
 
 const char HttpRequest::HTTP_METHOD_CONNECT[] = "CONNECT";
 const char HttpRequest::HTTP_METHOD_DELETE[]  = "DELETE";
@@ -82,31 +89,66 @@ std::string buildWebsocketKeyResponseHash(std::string requestKey) {
 	esp_sha(SHA1, (uint8_t*)newKey.data(), newKey.length(), shaData);
 	//GeneralUtils::hexDump(shaData, 20);
 	std::string retStr;
-	GeneralUtils::base64Encode(std::string((char*)shaData, sizeof(shaData)), &retStr);
+	GeneralUtils::base64Encode(shaData, sizeof(shaData), &retStr);
 	return retStr;
 } // buildWebsocketKeyResponseHash
 
 
+/**
+ * @brief Create an HTTP Request instance that has no connection.
+ * The instance is given a connection with reset().
+ */
+HttpRequest::HttpRequest() {
+	m_pWebSocket = nullptr;
+	m_isClosed   = true;
+} // HttpRequest
+
+
 /**
  * @brief Create an HTTP Request instance.
  */
 HttpRequest::HttpRequest(Socket clientSocket) {
+	reset(clientSocket);
+} // HttpRequest
+
+
+/**
+ * @brief Reuse the request for a new connection.
+ * The request from the socket is parsed, replacing that of any previous connection.  Reusing a request
+ * instance rather than constructing a new one lets the parser keep the storage it has already allocated.
+ * @param [in] clientSocket The socket connected to the client.
+ */
+void HttpRequest::reset(Socket clientSocket) {
 	m_clientSocket = clientSocket;
 	m_pWebSocket   = nullptr;
 	m_isClosed     = false;
+	m_timings.reset();
 
+	m_parser.reset();
 	m_parser.parse(clientSocket); // Parse the socket stream to build the HTTP data.
+	if (m_parser.getError() != 0) {
+		return;
+	}
+
+	// Only a GET with an Upgrade header can be a Web Socket, so the rest of the checks are skipped for
+	// ordinary requests.
+	if (getMethod() != HTTP_METHOD_GET || !m_parser.hasHeader(HTTP_HEADER_UPGRADE)) {
+		return;
+	}
 
 	// We have to take some special action on the Connection header.  We want to know if it contains "Upgrade"
 	// however it has come to light that the Connection header can contain multiple parts.  For example, it has
 	// been reported that it can contain "keep-alive,Upgrade".  Because of this we can't simply examine the string
 	// to see if it equals "Upgrade".  Our solution is to get the value of Connection string, split it by "," as
 	// a delimiter and then examine each of the parts to see if any of those are "Upgrade".
-	std::vector<std::string> parts = GeneralUtils::split(getHeader(HTTP_HEADER_CONNECTION), ',');
+	std::string connection = getHeader(HTTP_HEADER_CONNECTION);
+	StringSplitter parts(connection, ',');
 	bool upgradeFound = false;
-	if (std::find(parts.begin(), parts.end(), "Upgrade") != parts.end())
-	{
-	  upgradeFound = true;
+	while (parts.next()) {
+		if (parts.trim().equalsIgnoreCase("Upgrade")) {
+			upgradeFound = true;
+			break;
+		}
 	}
 
 	// Is this a Web Socket?
@@ -134,7 +176,7 @@ HttpRequest::HttpRequest(Socket clientSocket) {
 		// Now that we have converted the request into a WebSocket, create the new WebSocket entry.
 		m_pWebSocket = new WebSocket(clientSocket);
 	} // if this is a web socket ...
-} // HttpRequest
+} // reset
 
 
 HttpRequest::~HttpRequest() {
@@ -160,24 +202,28 @@ void HttpRequest::close() {
  * @brief Dump the HttpRequest for debugging purposes.
  */
 void HttpRequest::dump() {
-	ESP_LOGD(LOG_TAG, "Method: %s, URL: \"%s\", Version: %s", getMethod().c_str(), getPath().c_str(), getVersion().c_str());
-	auto headers = getHeaders();
-	auto it2 = headers.begin();
-	for (; it2 != headers.end(); ++it2) {
-		ESP_LOGD(LOG_TAG, "name=\"%s\", value=\"%s\"", it2->first.c_str(), it2->second.c_str());
-	}
-	ESP_LOGD(LOG_TAG, "Body: \"%s\"", getBody().c_str());
+	m_parser.dump();
 } // dump
 
 
 /**
  * @brief Get the body of the HttpRequest.
+ * The whole body is read into memory.  Use readBody() or parseBody() for bodies that may be large.
  */
 std::string HttpRequest::getBody() {
 	return m_parser.getBody();
 } // getBody
 
 
+/**
+ * @brief Get the outcome of parsing the request.
+ * @return 0 if the request was parsed, otherwise the HTTP status to reject it with.
+ */
+int HttpRequest::getError() {
+	return m_parser.getError();
+} // getError
+
+
 /**
  * @brief Get the named header.
  * @param [in] name The name of the header field to retrieve.
@@ -193,12 +239,12 @@ std::map<std::string, std::string> HttpRequest::getHeaders() {
 } // getHeaders
 
 
-std::string HttpRequest::getMethod() {
+const std::string& HttpRequest::getMethod() {
 	return m_parser.getMethod();
 } // getMethod
 
 
-std::string HttpRequest::getPath() {
+const std::string& HttpRequest::getPath() {
 	return m_parser.getURL();
 } // getPath
 
@@ -274,7 +320,17 @@ Socket HttpRequest::getSocket() {
 } // getSocket
 
 
-std::string HttpRequest::getVersion() {
+/**
+ * @brief Get the times at which the request passed through each phase of its handling.
+ * The times are only recorded when the server has metrics enabled.
+ * @return The timings of the request.
+ */
+HttpTimings* HttpRequest::getTimings() {
+	return &m_timings;
+} // getTimings
+
+
+const std::string& HttpRequest::getVersion() {
 	return m_parser.getVersion();
 } // getVersion
 
@@ -303,30 +359,113 @@ bool HttpRequest::isWebsocket() {
 
 
 /**
- * @brief Parse the request message as a form.
- * @return A map containing the names/values of the form elements that were found.
+ * @brief Stream the body of the request to a handler.
+ * A multipart/form-data body is delivered part by part, an application/x-www-form-urlencoded body
+ * field by field and any other body as a single unnamed part.  The body is read from the socket in
+ * chunks of HTTP_BODY_CHUNK_SIZE bytes, so uploads of any size can be handled.
+ *
+ * @code{.cpp}
+ * class UploadHandler : public HttpBodyHandler {
+ *    void onPartStart(const std::string& name, const std::string& fileName, const std::map<std::string, std::string>& headers) {
+ *       if (!fileName.empty()) { m_file = fopen(...); }
+ *    }
+ *    void onPartData(const uint8_t* pData, size_t length) { fwrite(pData, 1, length, m_file); }
+ *    void onPartEnd() { fclose(m_file); }
+ * };
+ * @endcode
+ *
+ * @param [in] pHandler The handler to receive the parts.
+ * @return False if the body is not valid for its content type.
+ */
+bool HttpRequest::parseBody(HttpBodyHandler* pHandler) {
+	ESP_LOGD(LOG_TAG, ">> parseBody");
+	std::string contentType = getHeader(HTTP_HEADER_CONTENT_TYPE);
+	std::string boundary    = HttpMultipartParser::getBoundary(contentType);
+	GeneralUtils::toLower(contentType);
+	uint8_t data[HTTP_BODY_CHUNK_SIZE];
+	size_t  length;
+	bool    rc = true;
+
+	if (!boundary.empty()) {
+		HttpMultipartParser parser(pHandler, boundary);
+		while (rc && (length = readBody(data, sizeof(data))) > 0) {
+			rc = parser.feed(data, length);
+		}
+		rc = rc && parser.finish();
+	} else if (contentType.compare(0, 33, "application/x-www-form-urlencoded") == 0) {
+		HttpUrlEncodedParser parser(pHandler);
+		while ((length = readBody(data, sizeof(data))) > 0) {
+			parser.feed(data, length);
+		}
+		parser.finish();
+	} else {
+		std::map<std::string, std::string> headers;
+		headers["content-type"] = contentType;
+		pHandler->onPartStart("", "", headers);
+		while ((length = readBody(data, sizeof(data))) > 0) {
+			pHandler->onPartData(data, length);
+		}
+		pHandler->onPartEnd();
+	}
+	ESP_LOGD(LOG_TAG, "<< parseBody: %d", rc);
+	return rc;
+} // parseBody
+
+
+/**
+ * @brief Collects the fields of a form into a map.
+ * File parts of a multipart form are skipped so that they are never held in memory.
+ */
+class HttpFormCollector : public HttpBodyHandler {
+public:
+	HttpFormCollector(std::map<std::string, std::string>* pMap) {
+		m_pMap    = pMap;
+		m_pValue  = nullptr;
+	}
+
+	void onPartStart(const std::string& name, const std::string& fileName, const std::map<std::string, std::string>& headers) {
+		m_pValue = fileName.empty() ? &(*m_pMap)[name] : nullptr;
+		if (m_pValue != nullptr) {
+			m_pValue->clear();
+		}
+	}
+
+	void onPartData(const uint8_t* pData, size_t length) {
+		if (m_pValue != nullptr) {
+			m_pValue->append((const char*) pData, length);
+		}
+	}
+
+private:
+	std::map<std::string, std::string>* m_pMap;
+	std::string*                        m_pValue; // The value being collected or nullptr to skip.
+}; // HttpFormCollector
+
+
+/**
+ * @brief Parse the body as a form.
+ * A form is composed of name=value pairs where each pair is separated with an "&" character.  A
+ * multipart/form-data form is also accepted, in which case any file parts are skipped.
+ * @return A map of the form fields keyed by name.
  */
 std::map<std::string, std::string> HttpRequest::parseForm() {
 	ESP_LOGD(LOG_TAG, ">> parseForm");
 	std::map<std::string, std::string> map;
-	// A form is composed of name=value pairs where each pair is separated with an "&" character.
-	// Our algorithm is to split all the pairs by "&" and then split all the name/value pairs by "=".
-	std::istringstream ss(getBody());         // Get the body of the request.
-	std::string currentEntry;
-	while (std::getline(ss, currentEntry, '&')) {   // For each form entry.
-		ESP_LOGD(LOG_TAG, "Processing: %s", currentEntry.c_str());   // Debug
-		std::istringstream currentPair(currentEntry);   // Prepare to parse the name=value string.
-		std::string name;                               // Declare the name variable.
-		std::string value;                              // Declare the value variable.
-
-		std::getline(currentPair, name, '=');           // Parse the current form entry into name/value.
-		currentPair >> value;                           // The value is what remains.
-		map[name] = urlDecode(value);                   // Decode the field which may have been encoded.
-		ESP_LOGD(LOG_TAG, " %s = \"%s\"", name.c_str(), map[name].c_str());   // Debug
-                              // Add the form entry into the map.
-	} // Processed all form entries.
-	ESP_LOGD(LOG_TAG, "<< parseForm");                // Debug
-	return map;                                       // Return the map of form entries.
+	HttpFormCollector collector(&map);
+	if (!HttpMultipartParser::getBoundary(getHeader(HTTP_HEADER_CONTENT_TYPE)).empty()) {
+		parseBody(&collector);
+	} else {
+		// Whatever the content type, the body is taken to be urlencoded as it always has been.
+		HttpUrlEncodedParser parser(&collector);
+		uint8_t data[HTTP_BODY_CHUNK_SIZE];
+		size_t  length;
+		while ((length = readBody(data, sizeof(data))) > 0) {
+			parser.feed(data, length);
+		}
+		parser.finish();
+	}
+	ESP_LOGD(LOG_TAG, "<< parseForm");
+	return map;
 } // parseForm
 
 
@@ -350,20 +489,22 @@ std::map<std::string, std::string> HttpRequest::parseForm() {
  * @return A vector of the constituent parts of the path.
  */
 std::vector<std::string> HttpRequest::pathSplit() {
-	std::istringstream stream(getPath());
-	std::vector<std::string> ret;
-	std::string pathPart;
-	while(std::getline(stream, pathPart, '/')) {
-		ret.push_back(pathPart);
-	}
-	// Debug
-	for (int i=0; i<ret.size(); i++) {
-		ESP_LOGD(LOG_TAG, "part[%d]: %s", i, ret[i].c_str());
-	}
-	return ret;
+	return FileSystem::pathSplit(getPath());
 } // pathSplit
 
 
+/**
+ * @brief Read the next part of the body of the request.
+ * The body is read directly from the socket, it is never held in memory as a whole.
+ * @param [out] pData The buffer to receive the data.
+ * @param [in] length The size of the buffer.
+ * @return The number of bytes read, 0 once the whole body has been read.
+ */
+size_t HttpRequest::readBody(uint8_t* pData, size_t length) {
+	return m_parser.readBody(pData, length);
+} // readBody
+
+
 /**
  * @brief Decode a URL/form
  * @param [in] str
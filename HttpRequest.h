@@ -13,23 +13,30 @@
 #include "Socket.h"
 #include "WebSocket.h"
 #include "HttpParser.h"
+#include "HttpMetrics.h"
 
 #undef close
 
+class HttpBodyHandler;
+
 class HttpRequest {
 private:
 	Socket      m_clientSocket; // The socket connected to the client.
 	bool        m_isClosed;     // Is the client connection closed?
 	HttpParser  m_parser;       // The parse to parse HTTP data.
 	WebSocket*  m_pWebSocket;   // A possible reference to a WebSocket object instance.
+	HttpTimings m_timings;      // When the request passed through each phase of its handling.
 
 public:
 
+	HttpRequest();
 	HttpRequest(Socket s);
 	virtual ~HttpRequest();
 	static const char HTTP_HEADER_ACCEPT[];
+	static const char HTTP_HEADER_ACCEPT_ENCODING[];
 	static const char HTTP_HEADER_ALLOW[];
 	static const char HTTP_HEADER_CONNECTION[];
+	static const char HTTP_HEADER_CONTENT_ENCODING[];
 	static const char HTTP_HEADER_CONTENT_LENGTH[];
 	static const char HTTP_HEADER_CONTENT_TYPE[];
 	static const char HTTP_HEADER_COOKIE[];
@@ -40,8 +47,11 @@ public:
 	static const char HTTP_HEADER_SEC_WEBSOCKET_PROTOCOL[];
 	static const char HTTP_HEADER_SEC_WEBSOCKET_KEY[];
 	static const char HTTP_HEADER_SEC_WEBSOCKET_VERSION[];
+	static const char HTTP_HEADER_TRAILER[];
+	static const char HTTP_HEADER_TRANSFER_ENCODING[];
 	static const char HTTP_HEADER_UPGRADE[];
 	static const char HTTP_HEADER_USER_AGENT[];
+	static const char HTTP_HEADER_VARY[];
 
 	static const char HTTP_METHOD_CONNECT[];
 	static const char HTTP_METHOD_DELETE[];
@@ -55,18 +65,23 @@ public:
 	void                               close();                      // Close the connection to the client.
 	void                               dump();                       // Diagnostic dump of the Http request.
 	std::string                        getBody();                    // Get the body of the request.
+	int                                getError();                   // Get the status to reject a malformed request with.
 	std::string                        getHeader(std::string name);  // Get the value of a named header.
 	std::map<std::string, std::string> getHeaders();                 // Get all the headers.
-	std::string                        getMethod();                  // Get the request method.
-	std::string                        getPath();                    // Get the request path.
+	const std::string&                 getMethod();                  // Get the request method.
+	const std::string&                 getPath();                    // Get the request path.
 	std::map<std::string, std::string> getQuery();                   // Get the query part of the request.
 	Socket                             getSocket();                  // Get the underlying TCP/IP socket.
-	std::string                        getVersion();                 // Get the HTTP version.
+	HttpTimings*                       getTimings();                 // Get the timings of the request.
+	const std::string&                 getVersion();                 // Get the HTTP version.
 	WebSocket*                         getWebSocket();               // Get the WebSocket reference if this is a web socket.
 	bool                               isClosed();                   // Has the connection been closed?
 	bool                               isWebsocket();                // Is this request to create a web socket?
+	bool                               parseBody(HttpBodyHandler* pHandler); // Stream the body to a handler part by part.
 	std::map<std::string, std::string> parseForm();                  // Parse the body as a form.
 	std::vector<std::string>           pathSplit();
+	size_t                             readBody(uint8_t* pData, size_t length); // Read the next part of the body.
+	void                               reset(Socket s);              // Reuse the request for a new connection.
 	std::string                        urlDecode(std::string str);   // Decode a URL.
 };
 
@@ -4,8 +4,13 @@
  *  Created on: Sep 2, 2017
  *      Author: kolban
  */
-#include <sstream>
 #include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "Deflater.h"
+#include "GeneralUtils.h"
 #include "HttpRequest.h"
 #include "HttpResponse.h"
 #include <esp_log.h>
@@ -21,18 +26,101 @@ const int HttpResponse::HTTP_STATUS_UNAUTHORIZED          = 401;
 const int HttpResponse::HTTP_STATUS_FORBIDDEN             = 403;
 const int HttpResponse::HTTP_STATUS_NOT_FOUND             = 404;
 const int HttpResponse::HTTP_STATUS_METHOD_NOT_ALLOWED    = 405;
+const int HttpResponse::HTTP_STATUS_TOO_MANY_REQUESTS     = 429;
+const int HttpResponse::HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE = 431;
 const int HttpResponse::HTTP_STATUS_INTERNAL_SERVER_ERROR = 500;
 const int HttpResponse::HTTP_STATUS_NOT_IMPLEMENTED       = 501;
 const int HttpResponse::HTTP_STATUS_SERVICE_UNAVAILABLE   = 503;
 
 static std::string lineTerminator = "\r\n";
+
+
+/**
+ * @brief Pass the output of the compressor to the client.
+ */
+class HttpResponseCompressor : public DeflaterCallbacks {
+public:
+	HttpResponseCompressor(HttpResponse* pResponse) {
+		m_pResponse = pResponse;
+	}
+	void onOutput(const uint8_t* pData, size_t length) override {
+		m_pResponse->sendBody((uint8_t*) pData, length);
+	}
+private:
+	HttpResponse* m_pResponse;
+}; // HttpResponseCompressor
+
+
+/**
+ * @brief Does a content coding from an Accept-Encoding header have the given name?
+ * @param [in] pCoding The coding, which need not be null terminated.
+ * @param [in] length The length of the coding.
+ * @param [in] name The name in lower case.
+ * @return True if the coding has the name, ignoring case.
+ */
+static bool isCoding(const char* pCoding, size_t length, const char* name) {
+	return strlen(name) == length && strncasecmp(pCoding, name, length) == 0;
+} // isCoding
+
+
+/**
+ * @brief Choose the content coding to use from the value of an Accept-Encoding header.
+ * gzip is preferred over deflate.  A coding with a quality value of 0 is not acceptable and "*"
+ * stands for any coding not otherwise listed.
+ * @param [in] acceptEncoding The value of the Accept-Encoding header.
+ * @return "gzip", "deflate" or an empty string if neither is acceptable.
+ */
+static std::string chooseEncoding(const std::string& acceptEncoding) {
+	int gzip    = -1;  // -1 not listed, 0 refused, 1 accepted.
+	int deflate = -1;
+	int any     = -1;
+	StringSplitter codings(acceptEncoding, ',');
+	while (codings.next()) {
+		const char* pCoding = codings.trim().data();
+		size_t      length  = codings.length();
+		int accepted = 1;
+		const char* pSemicolon = (const char*) memchr(pCoding, ';', length);
+		if (pSemicolon != nullptr) {
+			// The source is null terminated so atof() stops at the end of it at the latest.
+			for (const char* p = pSemicolon; p + 1 < pCoding + length; p++) {
+				if (p[0] == 'q' && p[1] == '=' && atof(p + 2) <= 0) {
+					accepted = 0;
+					break;
+				}
+			}
+			length = pSemicolon - pCoding;
+			while (length > 0 && (pCoding[length - 1] == ' ' || pCoding[length - 1] == '\t')) {
+				length--;
+			}
+		}
+		if (isCoding(pCoding, length, "gzip") || isCoding(pCoding, length, "x-gzip")) {
+			gzip = accepted;
+		} else if (isCoding(pCoding, length, "deflate")) {
+			deflate = accepted;
+		} else if (isCoding(pCoding, length, "*")) {
+			any = accepted;
+		}
+	}
+	if (gzip == 1 || (gzip == -1 && any == 1)) {
+		return "gzip";
+	}
+	if (deflate == 1 || (deflate == -1 && any == 1)) {
+		return "deflate";
+	}
+	return "";
+} // chooseEncoding
+
+
 HttpResponse::HttpResponse(HttpRequest *request) {
-	m_request = request;
-	m_status  = 200;
-	m_headerCommitted = false; // We have not yet sent a header.
+	m_request     = nullptr;
+	m_headerCount = 0;
+	m_pDeflater   = nullptr;
+	m_pCompressor = nullptr;
+	reset(request);
 }
 
 HttpResponse::~HttpResponse() {
+	release();
 }
 
 
@@ -42,46 +130,216 @@ HttpResponse::~HttpResponse() {
  * @param [in] name The name of the header.
  * @param [in] value The value of the header.
  */
-void HttpResponse::addHeader(const std::string name, const std::string value) {
-	if (m_headerCommitted) {
+void HttpResponse::addHeader(const std::string& name, const std::string& value) {
+	if (m_headerCommitted || findHeader(name) != -1) {
 		return;
 	}
-	m_responseHeaders.insert(std::pair<std::string, std::string>(name, value));
+	if (m_headerCount == m_responseHeaders.size()) {
+		m_responseHeaders.push_back(std::pair<std::string, std::string>());
+	}
+	m_responseHeaders[m_headerCount].first  = name;
+	m_responseHeaders[m_headerCount].second = value;
+	m_headerCount++;
 } // addHeader
 
 
+/**
+ * @brief Start a response body whose length is not known in advance.
+ * The header is sent with "Transfer-Encoding: chunked" and from then on each sendChunk() or sendData()
+ * is sent as one chunk.  The body is ended by endChunked() (or close()), so the end of the response
+ * is known to the client without the connection having to be closed.  An HTTP/1.0 client doesn't
+ * understand chunks; it is sent the data as is and the end of the response is the close of the connection.
+ *
+ * @code{.cpp}
+ * pResponse->addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "text/csv");
+ * pResponse->beginChunked();
+ * while (readSample(&sample)) {
+ *    pResponse->sendChunk(formatCsvLine(sample));
+ * }
+ * pResponse->endChunked();
+ * @endcode
+ */
+void HttpResponse::beginChunked() {
+	if (m_headerCommitted) {
+		ESP_LOGE(LOG_TAG, "beginChunked: The header has already been sent");
+		return;
+	}
+	if (m_compress) { // A body of unknown length is assumed to be worth compressing.
+		startCompression();
+	}
+	if (m_request->getVersion() != "HTTP/1.0") {
+		removeHeader(HttpRequest::HTTP_HEADER_CONTENT_LENGTH);
+		addHeader(HttpRequest::HTTP_HEADER_TRANSFER_ENCODING, "chunked");
+		m_chunked = true;
+	}
+	sendHeader();
+	if (!m_compressBuffer.empty()) {
+		std::string buffered;
+		buffered.swap(m_compressBuffer);
+		sendData((uint8_t*) buffered.data(), buffered.length());
+	}
+} // beginChunked
+
+
 /**
  * @brief Close the response.
  * We close the response.  If we haven't yet sent the header, we send that now and then close
- * the socket.
+ * the socket.  A chunked body that has not been ended is ended first.
  */
 void HttpResponse::close() {
+	if (!m_request->isClosed()) {
+		finishCompression();
+	}
 	// If we haven't yet sent the header of the data, send that now.
 	if (m_headerCommitted == false) {
 		sendHeader();
 	}
+	if (m_chunked && !m_request->isClosed()) {
+		endChunked();
+	}
 	m_request->close();
 } // close
 
 
+/**
+ * @brief End a chunked body.
+ * The last (zero length) chunk is sent followed by the trailer fields, if any.  Trailer fields
+ * should be announced by adding a "Trailer" header listing their names before calling beginChunked().
+ * @param [in] trailers The trailer fields to send after the body.
+ */
+void HttpResponse::endChunked(const std::map<std::string, std::string>& trailers) {
+	if (m_pDeflater != nullptr) { // The end of the compressed data goes before the last chunk.
+		finishCompression();
+	}
+	if (!m_chunked) {
+		return;
+	}
+	m_chunked = false;
+	m_headerBuffer = "0";
+	m_headerBuffer += lineTerminator;
+	for (auto it = trailers.begin(); it != trailers.end(); ++it) {
+		m_headerBuffer += it->first;
+		m_headerBuffer += ": ";
+		m_headerBuffer += it->second;
+		m_headerBuffer += lineTerminator;
+	}
+	m_headerBuffer += lineTerminator;
+	m_request->getSocket().send((uint8_t*) m_headerBuffer.data(), m_headerBuffer.length());
+} // endChunked
+
+
+/**
+ * @brief Find a header by name.
+ * Header names are compared without regard to case.
+ * @param [in] name The name of the header.
+ * @return The index of the header in m_responseHeaders or -1 if there is no such header.
+ */
+int HttpResponse::findHeader(const std::string& name) {
+	for (size_t i = 0; i < m_headerCount; i++) {
+		if (strcasecmp(m_responseHeaders[i].first.c_str(), name.c_str()) == 0) {
+			return i;
+		}
+	}
+	return -1;
+} // findHeader
+
+
+/**
+ * @brief Flush any data held by the compression stage.
+ * A body that never reached the minimum size is sent uncompressed, otherwise the end of the
+ * compressed stream is sent.
+ */
+void HttpResponse::finishCompression() {
+	if (m_compress) {
+		m_compress = false;
+		addHeader(HttpRequest::HTTP_HEADER_VARY, HttpRequest::HTTP_HEADER_ACCEPT_ENCODING);
+		sendHeader();
+		sendBody((uint8_t*) m_compressBuffer.data(), m_compressBuffer.length());
+		m_compressBuffer.clear();
+	}
+	if (m_pDeflater != nullptr) {
+		m_pDeflater->finish();
+		delete m_pDeflater;
+		m_pDeflater = nullptr;
+	}
+} // finishCompression
+
+
 /**
  * @brief Get the value of the named header.
  * @param [in] name The name of the header for which the value is to be returned.
  * @return The value of the named header.
  */
 std::string HttpResponse::getHeader(std::string name) {
-	if (m_responseHeaders.find(name) == m_responseHeaders.end()) {
+	int index = findHeader(name);
+	if (index == -1) {
 		return "";
 	}
-	return m_responseHeaders.at(name);
+	return m_responseHeaders[index].second;
 } // getHeader
 
 
 std::map<std::string, std::string> HttpResponse::getHeaders() {
-	return m_responseHeaders;
+	std::map<std::string, std::string> headers;
+	for (size_t i = 0; i < m_headerCount; i++) {
+		headers[m_responseHeaders[i].first] = m_responseHeaders[i].second;
+	}
+	return headers;
 } // getHeaders
 
 
+/**
+ * @brief Flush the compression stage and free the compressor.
+ * A handler that doesn't close the response must still get the data held by the compression stage.
+ */
+void HttpResponse::release() {
+	if (m_request != nullptr && !m_request->isClosed() && (m_pDeflater != nullptr || !m_compressBuffer.empty())) {
+		finishCompression();
+		endChunked();
+	}
+	delete m_pDeflater;
+	delete m_pCompressor;
+	m_pDeflater   = nullptr;
+	m_pCompressor = nullptr;
+} // release
+
+
+/**
+ * @brief Remove a header.
+ * @param [in] name The name of the header.
+ */
+void HttpResponse::removeHeader(const std::string& name) {
+	int index = findHeader(name);
+	if (index == -1) {
+		return;
+	}
+	m_headerCount--;
+	for (size_t i = index; i < m_headerCount; i++) {
+		m_responseHeaders[i].swap(m_responseHeaders[i + 1]); // Swapping keeps the storage of the strings.
+	}
+} // removeHeader
+
+
+/**
+ * @brief Reuse the response for another request.
+ * The response is returned to the state of a newly constructed one.  The storage of the headers is
+ * kept so that a server that reuses one response for request after request need not allocate it again.
+ * @param [in] request The request that this is the response to.
+ */
+void HttpResponse::reset(HttpRequest* request) {
+	release();
+	m_request         = request;
+	m_status          = 200;
+	m_statusMessage.clear();
+	m_headerCount     = 0;
+	m_headerCommitted = false; // We have not yet sent a header.
+	m_chunked         = false;
+	m_compress        = false;
+	m_compressMinSize = HTTP_COMPRESSION_MIN_SIZE;
+	m_compressBuffer.clear();
+} // reset
+
+
 /**
  * @brief Send data to the partner.
  * Send some data to the partner.  If we haven't yet sent the HTTP header then send that now.  We can call this function
@@ -89,40 +347,101 @@ std::map<std::string, std::string> HttpResponse::getHeaders() {
  * @param [in] data The data to send to the partner.
  */
 void HttpResponse::sendData(std::string data) {
-	ESP_LOGD(LOG_TAG, ">> sendData");
+	sendData((uint8_t*) data.data(), data.length());
+} // sendData
+
+void HttpResponse::sendData(uint8_t* pData, size_t size) {
+	ESP_LOGD(LOG_TAG, ">> sendData: 0x%x, size: %d", (uint32_t) pData, size);
 	// If the request is already closed, nothing further to do.
 	if (m_request->isClosed()) {
 		ESP_LOGE(LOG_TAG, "<< sendData: Request to send more data but the request/response is already closed");
 		return;
 	}
 
+	// While compression is being decided, hold on to the data until there is enough of it to be worth compressing.
+	if (m_compress) {
+		m_compressBuffer.append((char*) pData, size);
+		if (m_compressBuffer.length() >= m_compressMinSize) {
+			startCompression();
+			if (m_pDeflater != nullptr) {
+				beginChunked(); // The compressed length isn't known in advance.
+			} else {
+				std::string buffered;
+				buffered.swap(m_compressBuffer);
+				sendData((uint8_t*) buffered.data(), buffered.length());
+			}
+		}
+		ESP_LOGD(LOG_TAG, "<< sendData");
+		return;
+	}
+
 	// If we haven't yet sent the header of the data, send that now.
 	if (m_headerCommitted == false) {
 		sendHeader();
 	}
 
 	// Send the payload data.
-	m_request->getSocket().send(data);
+	if (m_pDeflater != nullptr) {
+		m_pDeflater->write(pData, size);
+	} else {
+		sendBody(pData, size);
+	}
 	ESP_LOGD(LOG_TAG, "<< sendData");
 } // sendData
 
-void HttpResponse::sendData(uint8_t* pData, size_t size) {
-	ESP_LOGD(LOG_TAG, ">> sendData: 0x%x, size: %d", (uint32_t) pData, size);
-	// If the request is already closed, nothing further to do.
-	if (m_request->isClosed()) {
-		ESP_LOGE(LOG_TAG, "<< sendData: Request to send more data but the request/response is already closed");
+
+/**
+ * @brief Send body data to the client, framed as a chunk if the body is chunked.
+ * @param [in] pData The data to send.
+ * @param [in] size The size of the data.
+ */
+void HttpResponse::sendBody(uint8_t* pData, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	if (!m_chunked) { // An HTTP/1.0 client or a body that isn't chunked.
+		m_request->getSocket().send(pData, size);
 		return;
 	}
+	char sizeLine[12];
+	snprintf(sizeLine, sizeof(sizeLine), "%x\r\n", (unsigned int) size);
+	m_request->getSocket().send(std::string(sizeLine));
+	m_request->getSocket().send(pData, size);
+	m_request->getSocket().send(lineTerminator);
+} // sendBody
 
-	// If we haven't yet sent the header of the data, send that now.
+
+/**
+ * @brief Send a chunk of a chunked body.
+ * @param [in] data The data of the chunk.
+ */
+void HttpResponse::sendChunk(std::string data) {
+	sendChunk((uint8_t*) data.data(), data.length());
+} // sendChunk
+
+
+/**
+ * @brief Send a chunk of a chunked body.
+ * If the header has not yet been sent then beginChunked() is called first.  An empty chunk is not
+ * sent as it would end the body; use endChunked() for that.  When the body is compressed the data
+ * goes through the compressor and the chunks sent are those of the compressed data.
+ * @param [in] pData The data of the chunk.
+ * @param [in] size The size of the chunk.
+ */
+void HttpResponse::sendChunk(uint8_t* pData, size_t size) {
+	if (m_request->isClosed()) {
+		ESP_LOGE(LOG_TAG, "sendChunk: Request to send more data but the request/response is already closed");
+		return;
+	}
 	if (m_headerCommitted == false) {
-		sendHeader();
+		beginChunked();
 	}
-
-	// Send the payload data.
-	m_request->getSocket().send(pData, size);
-	ESP_LOGD(LOG_TAG, "<< sendData");
-} // sendData
+	if (m_pDeflater != nullptr) {
+		m_pDeflater->write(pData, size);
+		return;
+	}
+	sendBody(pData, size);
+} // sendChunk
 
 void HttpResponse::sendFile(std::string fileName, size_t bufSize)
 {
@@ -161,18 +480,63 @@ void HttpResponse::sendFile(std::string fileName, size_t bufSize)
 void HttpResponse::sendHeader() {
 	// If we haven't yet sent the header of the data, send that now.
 	if (m_headerCommitted == false) {
-		std::ostringstream oss;
-		oss << m_request->getVersion() << " " << m_status << " " << m_statusMessage << lineTerminator;
-		for (auto it = m_responseHeaders.begin(); it != m_responseHeaders.end(); ++it) {
-			oss << it->first.c_str() << ": " << it->second.c_str() << lineTerminator;
+		// The header is formatted into a buffer that keeps its storage from one response to the next.
+		char status[16];
+		snprintf(status, sizeof(status), " %d ", m_status);
+		m_headerBuffer  = m_request->getVersion();
+		m_headerBuffer += status;
+		m_headerBuffer += m_statusMessage;
+		m_headerBuffer += lineTerminator;
+		for (size_t i = 0; i < m_headerCount; i++) {
+			m_headerBuffer += m_responseHeaders[i].first;
+			m_headerBuffer += ": ";
+			m_headerBuffer += m_responseHeaders[i].second;
+			m_headerBuffer += lineTerminator;
 		}
-		oss << lineTerminator;
+		m_headerBuffer += lineTerminator;
 		m_headerCommitted = true;
-		m_request->getSocket().send(oss.str());
+		m_request->getSocket().send((uint8_t*) m_headerBuffer.data(), m_headerBuffer.length());
 	}
 } // sendHeader
 
 
+/**
+ * @brief Enable compression of the response body.
+ * If the client accepts the gzip or deflate content coding (Accept-Encoding) the body is compressed as it
+ * is sent.  The start of the body is held back until it reaches the minimum size: a body that is closed
+ * before reaching it is sent uncompressed, as compressing it would gain little.  A compressed body has
+ * no Content-Length and is sent with chunked transfer encoding.  Either way the response carries
+ * "Vary: Accept-Encoding" so that caches keep the two forms apart.  A response whose Content-Encoding
+ * has been set by the handler, such as a file that is already compressed, is not compressed again.
+ *
+ * The compressor holds about 12KB of RAM while the body is being sent.  Compression pays off for text
+ * such as JSON and HTML; it should not be enabled for images or other data that is already compressed.
+ *
+ * @code{.cpp}
+ * pResponse->addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "application/json");
+ * pResponse->setCompression(true);
+ * pResponse->sendData(pJson->toString());
+ * pResponse->close();
+ * @endcode
+ *
+ * @param [in] enabled Whether the body is to be compressed.  Must be set before the header is sent.
+ * @param [in] minSize The smallest body that is compressed.
+ */
+void HttpResponse::setCompression(bool enabled, size_t minSize) {
+	if (m_headerCommitted) {
+		ESP_LOGW(LOG_TAG, "setCompression: The header has already been sent");
+		return;
+	}
+	m_compress        = enabled;
+	m_compressMinSize = minSize;
+	if (!enabled && !m_compressBuffer.empty()) {
+		std::string buffered;
+		buffered.swap(m_compressBuffer);
+		sendData((uint8_t*) buffered.data(), buffered.length());
+	}
+} // setCompression
+
+
 /**
  * @brief Set the status code that is to be sent back to the client.
  * When a client makes a request, the response contains a status.  This call sets the status that
@@ -190,3 +554,23 @@ void HttpResponse::setStatus(const int status, const std::string message) {
 } // setStatus
 
 
+/**
+ * @brief Decide whether the body is to be compressed and, if so, create the compressor.
+ * Called once, just before the header is sent.
+ */
+void HttpResponse::startCompression() {
+	m_compress = false;
+	addHeader(HttpRequest::HTTP_HEADER_VARY, HttpRequest::HTTP_HEADER_ACCEPT_ENCODING);
+	if (findHeader(HttpRequest::HTTP_HEADER_CONTENT_ENCODING) != -1) {
+		return; // Already encoded by the handler.
+	}
+	std::string encoding = chooseEncoding(m_request->getHeader(HttpRequest::HTTP_HEADER_ACCEPT_ENCODING));
+	if (encoding.empty()) {
+		return;
+	}
+	ESP_LOGD(LOG_TAG, "Compressing the response with %s", encoding.c_str());
+	addHeader(HttpRequest::HTTP_HEADER_CONTENT_ENCODING, encoding);
+	removeHeader(HttpRequest::HTTP_HEADER_CONTENT_LENGTH);
+	m_pCompressor = new HttpResponseCompressor(this);
+	m_pDeflater   = new Deflater(m_pCompressor, encoding == "gzip" ? Deflater::FORMAT_GZIP : Deflater::FORMAT_ZLIB);
+} // startCompression
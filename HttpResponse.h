@@ -11,17 +11,38 @@
 #define COMPONENTS_CPP_UTILS_HTTPRESPONSE_H_
 #include <string>
 #include <map>
+#include <vector>
 #include "HttpRequest.h"
 
+#define HTTP_COMPRESSION_MIN_SIZE (512) // Default size below which a body is not worth compressing.
+
+class Deflater;
+class HttpResponseCompressor;
+
 class HttpResponse {
 private:
+	friend class HttpResponseCompressor;
 	bool                               m_headerCommitted;  // Has the header been sent?
+	bool                               m_chunked;          // Is the body being sent with chunked transfer encoding?
+	bool                               m_compress;         // Is compression enabled but not yet negotiated?
+	size_t                             m_compressMinSize;  // Smallest body that is compressed.
+	std::string                        m_compressBuffer;   // The start of the body while deciding whether to compress.
+	Deflater*                          m_pDeflater;        // The compressor when the body is being compressed.
+	HttpResponseCompressor*            m_pCompressor;      // Passes the output of the compressor to the client.
 	HttpRequest*                       m_request;          // The request associated with this response.
-	std::map<std::string, std::string> m_responseHeaders;  // The headers to be sent with the response.
+	std::vector<std::pair<std::string, std::string>> m_responseHeaders; // The headers to be sent.  Entries beyond m_headerCount are spares kept for reuse.
+	size_t                             m_headerCount;      // The number of headers to be sent.
+	std::string                        m_headerBuffer;     // The header (or trailer) being formatted for sending.
 	int                                m_status;           // The status to be sent with the response.
 	std::string                        m_statusMessage;    // The status message to be sent with the response.
 
+	int  findHeader(const std::string& name);              // Find the index of a named header.
+	void finishCompression();                              // Flush any data held by the compression stage.
+	void release();                                        // Flush the compression stage and free the compressor.
+	void removeHeader(const std::string& name);            // Remove a named header.
+	void sendBody(uint8_t* pData, size_t size);            // Send body data as is or as a chunk.
 	void sendHeader();                                     // Send the header to the client.
+	void startCompression();                               // Decide on and start the compression of the body.
 
 public:
 	static const int HTTP_STATUS_CONTINUE;
@@ -33,6 +54,8 @@ public:
 	static const int HTTP_STATUS_FORBIDDEN;
 	static const int HTTP_STATUS_NOT_FOUND;
 	static const int HTTP_STATUS_METHOD_NOT_ALLOWED;
+	static const int HTTP_STATUS_TOO_MANY_REQUESTS;
+	static const int HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE;
 	static const int HTTP_STATUS_INTERNAL_SERVER_ERROR;
 	static const int HTTP_STATUS_NOT_IMPLEMENTED;
 	static const int HTTP_STATUS_SERVICE_UNAVAILABLE;
@@ -40,13 +63,19 @@ public:
 	HttpResponse(HttpRequest* httpRequest);
 	virtual ~HttpResponse();
 
-	void                               addHeader(std::string name, std::string value);  // Add a header to be sent to the client.
+	void                               addHeader(const std::string& name, const std::string& value); // Add a header to be sent to the client.
+	void                               beginChunked();                                  // Start a body of unknown length.
 	void                               close();                                         // Close the request/response.
+	void                               endChunked(const std::map<std::string, std::string>& trailers = std::map<std::string, std::string>()); // End a chunked body.
 	std::string                        getHeader(std::string name);                     // Get a named header.
 	std::map<std::string, std::string> getHeaders();                                    // Get all headers.
 	void                               sendData(std::string data);                      // Send data to the client.
 	void                               sendData(uint8_t* pData, size_t size);           // Send data to the client.
+	void                               sendChunk(std::string data);                     // Send a chunk of a chunked body.
+	void                               reset(HttpRequest* httpRequest);                 // Reuse the response for another request.
+	void                               sendChunk(uint8_t* pData, size_t size);          // Send a chunk of a chunked body.
 	void 							   sendFile(std::string fileName, size_t bufSize=4*1024);	// Send file contents if exists.
+	void                               setCompression(bool enabled, size_t minSize = HTTP_COMPRESSION_MIN_SIZE); // Compress the body if the client accepts it.
 	void                               setStatus(int status, std::string message);      // Set the response status.
 };
 
@@ -21,6 +21,7 @@
 #include "WebSocket.h"
 #include "GeneralUtils.h"
 #include "Memory.h"
+#include <esp_timer.h>
 static const char* LOG_TAG = "HttpServer";
 
 #undef close
@@ -36,12 +37,15 @@ HttpServer::HttpServer() {
 	m_clientTimeout = 5;            // The default timeout 5 seconds.
 	m_rootPath   = "";            // The default path.
 	m_useSSL     = false;         // Default SSL is no.
+	m_pConnectionLimiter = nullptr; // Default no admission control.
+	m_pMetrics   = nullptr;       // Default no request metrics.
 	setDirectoryListing(false);   // Default directory listing is disabled.
 } // HttpServer
 
 
 HttpServer::~HttpServer() {
 	ESP_LOGD(LOG_TAG, "~HttpServer");
+	delete m_pMetrics;
 }
 
 /**
@@ -52,12 +56,40 @@ HttpServer::~HttpServer() {
  */
 class HttpServerTask: public Task {
 public:
-	HttpServerTask(std::string name): Task(name, 16*1024) {
+	HttpServerTask(std::string name): Task(name, 16*1024), m_response(nullptr) {
 		m_pHttpServer = nullptr;
 	};
 
 private:
-	HttpServer* m_pHttpServer; // Reference to the HTTP Server
+	HttpServer*  m_pHttpServer; // Reference to the HTTP Server
+	// Connections are handled one at a time so a single request and response are reused for each of
+	// them.  The storage that they allocate for the first few requests is reused from then on.
+	HttpRequest  m_request;
+	HttpResponse m_response;
+	std::string  m_route;       // The route of the current request, for metrics.
+
+	/**
+	 * @brief Record that the current request has reached a phase, if metrics are enabled.
+	 * @param [in] phase The phase reached.
+	 */
+	void mark(HttpTimings::Phase phase) {
+		if (m_pHttpServer->m_pMetrics != nullptr) {
+			m_request.getTimings()->mark(phase);
+		}
+	} // mark
+
+	/**
+	 * @brief Note the route taken by the current request, if metrics are enabled.
+	 * @param [in] method The method of the request.
+	 * @param [in] name The name of the route.
+	 */
+	void setRoute(const std::string& method, const std::string& name) {
+		if (m_pHttpServer->m_pMetrics != nullptr) {
+			m_route = method;
+			m_route += ' ';
+			m_route += name;
+		}
+	} // setRoute
 
 	/**
 	 * @brief Process an incoming HTTP Request
@@ -69,11 +101,23 @@ private:
 	 * content from the file on the "file system".
 	 *
 	 * @param [in] request The HTTP request to process.
+	 * @return True if the connection has been handed to an event stream and must be kept open.
 	 */
-	void processRequest(HttpRequest &request) {
+	bool processRequest(HttpRequest &request) {
 		ESP_LOGD("HttpServerTask", ">> processRequest: Method: %s, Path: %s",
 			request.getMethod().c_str(), request.getPath().c_str());
 
+		if (m_pHttpServer->m_pMetrics != nullptr &&
+				request.getPath() == m_pHttpServer->m_metricsPath &&
+				request.getMethod() == HttpRequest::HTTP_METHOD_GET) {           // Is this a request for the metrics?
+			setRoute(request.getMethod(), m_pHttpServer->m_metricsPath);
+			mark(HttpTimings::HANDLER_START);
+			m_response.reset(&request);
+			m_pHttpServer->m_pMetrics->send(&m_response);
+			mark(HttpTimings::HANDLER_END);
+			return false;
+		}
+
 		// Loop over all the path handlers we have looking for the first one that matches.  Note that none of them
 		// need to match.  If we find one that does, then invoke the handler and that is the end of processing.
 		for (auto pathHandlerIterartor = m_pHttpServer->m_pathHandlers.begin();
@@ -81,24 +125,31 @@ private:
 				++pathHandlerIterartor) {
 			if (pathHandlerIterartor->match(request.getMethod(), request.getPath())) { // Did we match the handler?
 				ESP_LOGD("HttpServerTask", "Found a path handler match!!");
+				setRoute(request.getMethod(), pathHandlerIterartor->getPattern());
+				if (pathHandlerIterartor->getEventStream() != nullptr) {          // Is this an event stream?
+					return pathHandlerIterartor->getEventStream()->addClient(&request);
+				}
+				mark(HttpTimings::HANDLER_START);
 				if (request.isWebsocket()) {                                     // Is this handler to be invoked for a web socket?
 					pathHandlerIterartor->invokePathHandler(&request, nullptr);    // Invoke the handler.
 					request.getWebSocket()->startReader();
 				} else {
-					HttpResponse response(&request);
-					pathHandlerIterartor->invokePathHandler(&request, &response); // Invoke the handler.
+					m_response.reset(&request);
+					pathHandlerIterartor->invokePathHandler(&request, &m_response); // Invoke the handler.
 				}
-				return;                                                         // End of processing the request
+				mark(HttpTimings::HANDLER_END);
+				return false;                                                   // End of processing the request
 			} // Path handler match
 		} // For each path handler
 
 		ESP_LOGD("HttpServerTask", "No Path handler found");
 		// If we reach here, then we did not find a handler for the request.
+		setRoute(request.getMethod(), "static");
 
 
 		if (request.isWebsocket()) { 		       // Check to see if we have an un-handled WebSocket
 			request.getWebSocket()->close();     // If we do, close the socket as there is nothing further to do.
-			return;
+			return false;
 		}
 
 		// Serve up the content from the file on the file system ... if found ...
@@ -110,18 +161,57 @@ private:
 			fileName = fileName.substr(0, fileName.length()-1);
 		}
 		
-		HttpResponse response(&request);
+		m_response.reset(&request);
+		mark(HttpTimings::HANDLER_START);
 		// Test if the path is a directory.
 		if (FileSystem::isDirectory(fileName)) {
 			ESP_LOGD(LOG_TAG, "Path %s is a directory", fileName.c_str());
-			m_pHttpServer->listDirectory(fileName, response);   // List the contents of the directory.
-			return;
+			m_pHttpServer->listDirectory(fileName, m_response);   // List the contents of the directory.
+			mark(HttpTimings::HANDLER_END);
+			return false;
 		} // Path was a directory.
 
-		response.sendFile(fileName, m_pHttpServer->getFileBufferSize());
+		m_response.sendFile(fileName, m_pHttpServer->getFileBufferSize());
+		mark(HttpTimings::HANDLER_END);
+		return false;
 	} // processRequest
 
 
+	/**
+	 * @brief Reject a request that could not be parsed.
+	 * @param [in] request The HTTP request to reject.
+	 */
+	void rejectMalformedRequest(HttpRequest &request) {
+		m_response.reset(&request);
+		if (request.getError() == HttpResponse::HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE) {
+			m_response.setStatus(request.getError(), "Request Header Fields Too Large");
+		} else {
+			m_response.setStatus(request.getError(), "Bad Request");
+		}
+		m_response.addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "text/plain");
+		m_response.sendData("Malformed request");
+		m_response.close();
+	} // rejectMalformedRequest
+
+
+	/**
+	 * @brief Reject a request that exceeds the rate limit of its path.
+	 * @param [in] request The HTTP request to reject.
+	 */
+	void rejectRequest(HttpRequest &request) {
+		if (request.isWebsocket()) {           // The upgrade has already been sent, all we can do is close.
+			request.getWebSocket()->close();
+			return;
+		}
+		m_response.reset(&request);
+		m_response.setStatus(HttpResponse::HTTP_STATUS_TOO_MANY_REQUESTS, "Too Many Requests");
+		m_response.addHeader("Retry-After", "1");
+		m_response.addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "text/plain");
+		m_response.sendData("Too Many Requests");
+		m_response.close();
+	} // rejectRequest
+
+
 	/**
 	 * @brief Perform the task handling for server.
 	 * We loop forever waiting for new client connections to arrive.  When they do, we parse the
@@ -134,30 +224,65 @@ private:
 		m_pHttpServer->m_socket.listen(m_pHttpServer->m_portNumber, false /* is datagram */, true /* Allow address reuse */);
 		ESP_LOGD("HttpServerTask", "Listening on port %d", m_pHttpServer->getPort());
 		Socket clientSocket;
+		int64_t acceptTime = 0;
 		while(1) {   // Loop forever.
 
 			ESP_LOGD("HttpServerTask", "Waiting for new peer client");
 
 			try {
-				clientSocket = m_pHttpServer->m_socket.accept();   // Block waiting for a new external client connection.
-				clientSocket.setTimeout(m_pHttpServer->getClientTimeout());
+				clientSocket = m_pHttpServer->m_socket.accept(m_pHttpServer->m_pConnectionLimiter, &acceptTime);   // Block waiting for a new external client connection.
 			}
 			catch(std::exception &e) {
 				ESP_LOGE("HttpServerTask", "Caught an exception waiting for new client!");
 				m_pHttpServer->m_semaphoreServerStarted.give();  // Release the semaphore .. we are now no longer running.
 				return;
 			}
+			if (!clientSocket.isValid()) {     // The connection was rejected by the connection limiter.
+				continue;
+			}
+			int64_t handshakeTime = esp_timer_get_time();
+			clientSocket.setTimeout(m_pHttpServer->getClientTimeout());
 
 			ESP_LOGD("HttpServerTask", "HttpServer that was listening on port %d has received a new client connection; sockFd=%d", m_pHttpServer->getPort(), clientSocket.getFD());
 
-			HttpRequest request(clientSocket);   // Build the HTTP Request from the socket.
-			if (request.isWebsocket()) {        // If this is a WebSocket
+			m_request.reset(clientSocket);       // Build the HTTP Request from the socket.
+			if (m_pHttpServer->m_pMetrics != nullptr) {
+				m_request.getTimings()->set(HttpTimings::ACCEPT, acceptTime);
+				m_request.getTimings()->set(HttpTimings::HANDSHAKE_DONE, handshakeTime);
+				m_request.getTimings()->mark(HttpTimings::HEADERS_PARSED);
+				m_route.clear();
+			}
+			if (m_request.isWebsocket()) {      // If this is a WebSocket
 				clientSocket.setTimeout(0);     //   Clear the timeout.
 			}
-			request.dump();                      // debug.
-			processRequest(request);             // Process the request.
-			if (!request.isWebsocket()) {        // If this is NOT a WebSocket, then close it as the request
-				request.close();                   //   has been completed.
+			m_request.dump();                    // debug.
+			bool isEventStream = false;
+			ConnectionLimiter* pRateLimit = m_pHttpServer->findRateLimit(m_request.getPath());
+			if (m_request.getError() != 0) {
+				rejectMalformedRequest(m_request);   // A line of the head of the request was too long.
+			} else if (pRateLimit != nullptr && !pRateLimit->admit(clientSocket.getPeerAddress())) {
+				rejectRequest(m_request);        // Too many requests to this group of paths.
+			} else {
+				isEventStream = processRequest(m_request); // Process the request.
+				if (pRateLimit != nullptr) {
+					pRateLimit->release();
+				}
+			}
+			m_response.reset(nullptr);           // Flush anything the handler left in the response.
+			if (!m_request.isWebsocket() && !isEventStream) { // If this is NOT a WebSocket or event stream, then close it
+				m_request.close();                 //   as the request has been completed.
+				mark(HttpTimings::LAST_BYTE_SENT);
+			}
+			if (m_pHttpServer->m_pMetrics != nullptr) {
+				if (m_route.empty()) {           // Rejected before a route was chosen.
+					setRoute(m_request.getMethod(), "rejected");
+				}
+				m_pHttpServer->m_pMetrics->record(m_route, *m_request.getTimings());
+			}
+			// WebSockets and event streams are handed off to their own limits so only the time spent
+			// here counts against the connection limiter.
+			if (m_pHttpServer->m_pConnectionLimiter != nullptr) {
+				m_pHttpServer->m_pConnectionLimiter->release();
 			}
 		} // while
 	} // run
@@ -224,6 +349,64 @@ void HttpServer::addPathHandler(
 } // addPathHandler
 
 
+/**
+ * @brief Register an event stream for a path.
+ *
+ * A request that matches the method and path becomes a client of the Server-Sent Events stream.  Its
+ * connection is kept open and receives every event subsequently broadcast on the stream.
+ *
+ * Example:
+ * @code{.cpp}
+ * HttpEventStream sensorStream;
+ * httpServer.addPathHandler("GET", "/events", &sensorStream);
+ * @endcode
+ *
+ * @param [in] method The method being used for access ("GET" for an EventSource).
+ * @param [in] path The plain path being accessed.
+ * @param [in] pEventStream The event stream to which matching clients are added.
+ */
+void HttpServer::addPathHandler(
+		std::string      method,
+		std::string      path,
+		HttpEventStream* pEventStream) {
+	m_pathHandlers.push_back(PathHandler(method, path, pEventStream));
+} // addPathHandler
+
+
+/**
+ * @brief Limit the rate of requests to a group of paths.
+ * Requests whose path starts with the prefix are admitted by the limiter, by the address of the client,
+ * before they are passed to their handler.  A request that isn't admitted is answered with
+ * "429 Too Many Requests".  Where prefixes overlap, the first one added that matches is used.
+ *
+ * @code{.cpp}
+ * ConnectionLimiter apiLimiter(1, 1.0, 3);  // 1 request per second per client, bursts of 3.
+ * httpServer.addRateLimit("/api/", &apiLimiter);
+ * @endcode
+ *
+ * @param [in] pathPrefix The start of the paths to be limited.
+ * @param [in] pLimiter The limiter for the group of paths.
+ */
+void HttpServer::addRateLimit(std::string pathPrefix, ConnectionLimiter* pLimiter) {
+	m_rateLimits.push_back(std::pair<std::string, ConnectionLimiter*>(pathPrefix, pLimiter));
+} // addRateLimit
+
+
+/**
+ * @brief Find the limiter of the group of paths that a path belongs to.
+ * @param [in] path The path of a request.
+ * @return The limiter or nullptr if the path isn't limited.
+ */
+ConnectionLimiter* HttpServer::findRateLimit(const std::string& path) {
+	for (auto it = m_rateLimits.begin(); it != m_rateLimits.end(); ++it) {
+		if (path.compare(0, it->first.length(), it->first) == 0) {
+			return it->second;
+		}
+	}
+	return nullptr;
+} // findRateLimit
+
+
 /**
  * @brief Get the size of the file buffer.
  * When serving up a file from the file system, we can't afford to read the whole file into RAM before
@@ -236,6 +419,15 @@ size_t HttpServer::getFileBufferSize() {
 } // getFileBufferSize
 
 
+/**
+ * @brief Get the request metrics.
+ * @return The metrics or nullptr if they aren't enabled.
+ */
+HttpMetrics* HttpServer::getMetrics() {
+	return m_pMetrics;
+} // getMetrics
+
+
 /**
  * @brief Get the port number on which the HTTP Server is listening.
  * @return The port number on which the HTTP server is listening.
@@ -322,6 +514,16 @@ void HttpServer::setClientTimeout(uint32_t timeout) {
 	m_clientTimeout = timeout;
 }
 
+/**
+ * @brief Limit the connections accepted by the server.
+ * Connections that the limiter doesn't admit are closed as soon as they are accepted, before the
+ * TLS handshake of an HTTPS server.  Must be called before start().
+ * @param [in] pLimiter The limiter or nullptr for no limit.
+ */
+void HttpServer::setConnectionLimiter(ConnectionLimiter* pLimiter) {
+	m_pConnectionLimiter = pLimiter;
+} // setConnectionLimiter
+
 /**
  * @brief Get current socket's timeout for new connections.
  * @param [in] use Set to true to enable directory listing.
@@ -351,6 +553,26 @@ void HttpServer::setFileBufferSize(size_t fileBufferSize) {
 } // setFileBufferSize
 
 
+/**
+ * @brief Record how long requests spend in each phase and serve the results.
+ * When enabled, the timings of every request are added to per-route latency histograms which are
+ * served in the Prometheus text format to a GET of the given path.  When disabled, no timings are
+ * taken.  Must be called before start().
+ *
+ * @code{.cpp}
+ * httpServer.setMetrics(true);   // Scrape http://<esp32>/metrics
+ * @endcode
+ *
+ * @param [in] enabled True to record metrics.
+ * @param [in] path The path at which the metrics are served.
+ */
+void HttpServer::setMetrics(bool enabled, std::string path) {
+	delete m_pMetrics;
+	m_pMetrics    = enabled ? new HttpMetrics() : nullptr;
+	m_metricsPath = path;
+} // setMetrics
+
+
 /**
  * @brief Set the root path for URL file mapping.
  *
@@ -434,6 +656,7 @@ PathHandler::PathHandler(std::string method, std::regex *pRegex,
 			HttpRequest*  pHttpRequest,
 			HttpResponse* pHttpResponse)
 		) {
+	m_pEventStream    = nullptr;
 	m_method          = method;                  // Save the method we are looking for.
 	m_pRegex          = pRegex;                  // Save the Regex
 	m_textPattern     = "<Regex>";               // The plain text of the regex pattern.
@@ -455,6 +678,7 @@ PathHandler::PathHandler(std::string method, std::string matchPath,
 			HttpRequest*  pHttpRequest,
 			HttpResponse* pHttpResponse)
 		) {
+	m_pEventStream    = nullptr;
 	m_method          = method;                  // Save the method we are looking for.
 	m_textPattern     = matchPath;
 	m_isRegex         = false;
@@ -463,6 +687,41 @@ PathHandler::PathHandler(std::string method, std::string matchPath,
 } // PathHandler
 
 
+/**
+ * @brief Construct an instance of a PathHandler for an event stream.
+ *
+ * @param [in] method The method to be matched.
+ * @param [in] matchPath The path to be matched.  Must be an exact match.
+ * @param [in] pEventStream The event stream that matching requests are added to.
+ */
+PathHandler::PathHandler(std::string method, std::string matchPath, HttpEventStream* pEventStream) {
+	m_pEventStream    = pEventStream;
+	m_method          = method;
+	m_textPattern     = matchPath;
+	m_isRegex         = false;
+	m_pRegex          = nullptr;
+	m_pRequestHandler = nullptr;
+} // PathHandler
+
+
+/**
+ * @brief Get the event stream of the handler.
+ * @return The event stream or nullptr if this handler invokes a function.
+ */
+HttpEventStream* PathHandler::getEventStream() {
+	return m_pEventStream;
+} // getEventStream
+
+
+/**
+ * @brief Get the text of the pattern that the handler matches.
+ * @return The path or "<Regex>" for a regular expression.
+ */
+const std::string& PathHandler::getPattern() {
+	return m_textPattern;
+} // getPattern
+
+
 /**
  * @brief Determine if the path matches.
  *
@@ -470,7 +729,7 @@ PathHandler::PathHandler(std::string method, std::string matchPath,
  * @param [in] path The path to be matched.
  * @return True if the path matches.
  */
-bool PathHandler::match(std::string method, std::string path) {
+bool PathHandler::match(const std::string& method, const std::string& path) {
 	if (method != m_method) {
 		return false;
 	}
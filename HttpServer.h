@@ -16,6 +16,9 @@
 #include "SockServ.h"
 #include "HttpRequest.h"
 #include "HttpResponse.h"
+#include "HttpEventStream.h"
+#include "ConnectionLimiter.h"
+#include "HttpMetrics.h"
 #include "FreeRTOS.h"
 #include <regex>
 
@@ -42,9 +45,17 @@ class PathHandler {
 				HttpRequest*  pHttpRequest,
 				HttpResponse* pHttpResponse)
 			);
-		bool match(std::string method, std::string path);   // Does the request method and pattern match?
+		PathHandler(
+			std::string method,                // The method in the request to be matched.
+			std::string pathPattern,           // The pattern in the request to be matched
+			HttpEventStream* pEventStream      // The event stream that requests are added to.
+			);
+		HttpEventStream* getEventStream();                  // Get the event stream, if any, of this handler.
+		const std::string& getPattern();                    // Get the text of the pattern.
+		bool match(const std::string& method, const std::string& path); // Does the request method and pattern match?
 		void invokePathHandler(HttpRequest* request, HttpResponse* response);
 	private:
+		HttpEventStream* m_pEventStream;
 		std::string m_method;
 		std::regex* m_pRegex;
 		bool        m_isRegex;
@@ -74,14 +85,23 @@ public:
 			HttpRequest*  pHttpRequest,
 			HttpResponse* pHttpResponse)
 		);
+	void        addPathHandler(
+		std::string      method,
+		std::string      pathExpr,
+		HttpEventStream* pEventStream
+		);
+	void        addRateLimit(std::string pathPrefix, ConnectionLimiter* pLimiter); // Limit requests to paths starting with a prefix.
 	uint32_t    getClientTimeout();							// Get client's socket timeout
 	size_t      getFileBufferSize();  // Get the current size of the file buffer.
+	HttpMetrics* getMetrics();        // Get the request metrics, if enabled.
 	uint16_t    getPort();            // Get the port on which the Http server is listening.
 	std::string getRootPath();        // Get the root of the file system path.
 	bool        getSSL();             // Are we using SSL?
 	void        setClientTimeout(uint32_t timeout);			   // Set client's socket timeout
+	void        setConnectionLimiter(ConnectionLimiter* pLimiter); // Limit the connections accepted.
 	void        setDirectoryListing(bool use);             // Should we list the content of directories?
 	void        setFileBufferSize(size_t fileBufferSize);  // Set the size of the file buffer
+	void        setMetrics(bool enabled, std::string path = "/metrics"); // Record request timings and serve them.
 	void        setRootPath(std::string path);             // Set the root of the file system path.
 	void        start(uint16_t portNumber, bool useSSL=false);
 	void        stop();          // Stop a previously started server.
@@ -89,6 +109,7 @@ public:
 private:
 	friend class HttpServerTask;
 	friend class WebSocket;
+	ConnectionLimiter*       findRateLimit(const std::string& path);
 	void                     listDirectory(std::string path, HttpResponse& response);
 	size_t                   m_fileBufferSize;     // Size of the file buffer.
 	bool                     m_directoryListing;   // Should we list directory content?
@@ -98,6 +119,10 @@ private:
 	Socket                   m_socket;
 	bool                     m_useSSL;             // Is this server listening on an HTTPS port?
 	uint32_t                 m_clientTimeout;      // Default Timeout
+	ConnectionLimiter*       m_pConnectionLimiter; // Admission control for new connections, if any.
+	std::vector<std::pair<std::string, ConnectionLimiter*>> m_rateLimits; // Limiters for groups of paths.
+	HttpMetrics*             m_pMetrics;           // Request timings, if enabled.
+	std::string              m_metricsPath;        // The path at which the metrics are served.
 	FreeRTOS::Semaphore      m_semaphoreServerStarted = FreeRTOS::Semaphore("ServerStarted");
 }; // HttpServer
 
@@ -10,7 +10,16 @@
 
 #include <string>
 #include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
 #include "JSON.h"
+#include "HttpRequest.h"
+#include "HttpResponse.h"
+#include "Socket.h"
+#include "WebSocket.h"
 
 /**
  * @brief Create an empty JSON array.
@@ -21,6 +30,16 @@ JsonArray JSON::createArray() {
 } // createArray
 
 
+/**
+ * @brief Create an empty JSON array held in an arena.
+ * @param [in] pArena The arena that holds the array and everything added to it.
+ * @return An empty JSON array.
+ */
+JsonArray JSON::createArray(JsonArena* pArena) {
+	return JsonArray(pArena->createNode(cJSON_Array), pArena);
+} // createArray
+
+
 /**
  * @brief Create an empty JSON object.
  * @return An empty JSON object.
@@ -30,12 +49,25 @@ JsonObject JSON::createObject() {
 } // createObject
 
 
+/**
+ * @brief Create an empty JSON object held in an arena.
+ * @param [in] pArena The arena that holds the object and everything added to it.
+ * @return An empty JSON object.
+ */
+JsonObject JSON::createObject(JsonArena* pArena) {
+	return JsonObject(pArena->createNode(cJSON_Object), pArena);
+} // createObject
+
+
 /**
  * @brief Delete a JSON array.
  * @param [in] jsonArray The array to be deleted.
  * @return N/A.
  */
 void JSON::deleteArray(JsonArray jsonArray) {
+	if (jsonArray.m_pArena != nullptr) {
+		return; // Released with the arena.
+	}
 	cJSON_Delete(jsonArray.m_node);
 } // deleteArray
 
@@ -45,6 +77,9 @@ void JSON::deleteArray(JsonArray jsonArray) {
  * @param [in] jsonObject The object to be deleted.
  */
 void JSON::deleteObject(JsonObject jsonObject) {
+	if (jsonObject.m_pArena != nullptr) {
+		return; // Released with the arena.
+	}
 	cJSON_Delete(jsonObject.m_node);
 } // deleteObject
 
@@ -59,6 +94,17 @@ JsonArray JSON::parseArray(std::string text) {
 } // parseArray
 
 
+/**
+ * @brief Parse a string that contains a JSON array into an arena.
+ * @param [in] text The JSON text string.
+ * @param [in] pArena The arena that holds the resulting array.
+ * @return A JSON array.
+ */
+JsonArray JSON::parseArray(std::string text, JsonArena* pArena) {
+	return JsonArray(pArena->parse(text), pArena);
+} // parseArray
+
+
 /**
  * @brief Parse a string that contains a JSON object.
  * @param [in] text The JSON text string.
@@ -69,8 +115,20 @@ JsonObject JSON::parseObject(std::string text) {
 } // parseObject
 
 
-JsonArray::JsonArray(cJSON* node) {
-	m_node = node;
+/**
+ * @brief Parse a string that contains a JSON object into an arena.
+ * @param [in] text The JSON text string.
+ * @param [in] pArena The arena that holds the resulting object.
+ * @return a JSON object.  The object is not valid if the text could not be parsed.
+ */
+JsonObject JSON::parseObject(std::string text, JsonArena* pArena) {
+	return JsonObject(pArena->parse(text), pArena);
+} // parseObject
+
+
+JsonArray::JsonArray(cJSON* node, JsonArena* pArena) {
+	m_node   = node;
+	m_pArena = pArena;
 }
 
 
@@ -79,7 +137,7 @@ JsonArray::JsonArray(cJSON* node) {
  * @param [in] value The boolean value to add to the array.
  */
 void JsonArray::addBoolean(bool value) {
-	cJSON_AddItemToArray(m_node, cJSON_CreateBool(value));
+	cJSON_AddItemToArray(m_node, m_pArena != nullptr ? m_pArena->createBoolean(value) : cJSON_CreateBool(value));
 } // addBoolean
 
 
@@ -88,7 +146,7 @@ void JsonArray::addBoolean(bool value) {
  * @param [in] value The double value to add to the array.
  */
 void JsonArray::addDouble(double value) {
-	cJSON_AddItemToArray(m_node, cJSON_CreateNumber(value));
+	cJSON_AddItemToArray(m_node, m_pArena != nullptr ? m_pArena->createNumber(value) : cJSON_CreateNumber(value));
 } // addDouble
 
 
@@ -97,7 +155,7 @@ void JsonArray::addDouble(double value) {
  * @param [in] value The int value to add to the array.
  */
 void JsonArray::addInt(int value) {
-	cJSON_AddItemToArray(m_node, cJSON_CreateNumber((double)value));
+	cJSON_AddItemToArray(m_node, m_pArena != nullptr ? m_pArena->createNumber(value) : cJSON_CreateNumber((double)value));
 } // addInt
 
 
@@ -115,7 +173,7 @@ void JsonArray::addObject(JsonObject value) {
  * @param [in] value The string value to add to the array.
  */
 void JsonArray::addString(std::string value) {
-	cJSON_AddItemToArray(m_node, cJSON_CreateString(value.c_str()));
+	cJSON_AddItemToArray(m_node, m_pArena != nullptr ? m_pArena->createString(value.data(), value.length()) : cJSON_CreateString(value.c_str()));
 } // addString
 
 
@@ -162,7 +220,7 @@ int JsonArray::getInt(int item) {
  */
 JsonObject JsonArray::getObject(int item) {
 	cJSON *node = cJSON_GetArrayItem(m_node, item);
-	return JsonObject(node);
+	return JsonObject(node, m_pArena);
 } // getObject
 
 
@@ -212,13 +270,14 @@ std::size_t JsonArray::size() {
 /**
  * @brief Constructor
  */
-JsonObject::JsonObject(cJSON* node) {
-	m_node = node;
+JsonObject::JsonObject(cJSON* node, JsonArena* pArena) {
+	m_node   = node;
+	m_pArena = pArena;
 } // JsonObject
 
 JsonArray JsonObject::getArray(std::string name) {
 	cJSON *node = cJSON_GetObjectItem(m_node, name.c_str());
-	return JsonArray(node);
+	return JsonArray(node, m_pArena);
 }
 
 
@@ -271,7 +330,7 @@ int JsonObject::getInt(std::string name) {
  */
 JsonObject JsonObject::getObject(std::string name) {
 	cJSON *node = cJSON_GetObjectItem(m_node, name.c_str());
-	return JsonObject(node);
+	return JsonObject(node, m_pArena);
 } // getObject
 
 
@@ -314,6 +373,10 @@ bool JsonObject::isValid() {
  * @return N/A.
  */
 void JsonObject::setArray(std::string name, JsonArray array) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, array.m_node);
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), array.m_node);
 } // setArray
 
@@ -325,6 +388,10 @@ void JsonObject::setArray(std::string name, JsonArray array) {
  * @return N/A.
  */
 void JsonObject::setBoolean(std::string name, bool value) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, m_pArena->createBoolean(value));
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), value?cJSON_CreateTrue():cJSON_CreateFalse());
 } // setBoolean
 
@@ -336,6 +403,10 @@ void JsonObject::setBoolean(std::string name, bool value) {
  * @return N/A.
  */
 void JsonObject::setDouble(std::string name, double value) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, m_pArena->createNumber(value));
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), cJSON_CreateNumber(value));
 } // setDouble
 
@@ -347,6 +418,10 @@ void JsonObject::setDouble(std::string name, double value) {
  * @return N/A.
  */
 void JsonObject::setInt(std::string name, int value) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, m_pArena->createNumber(value));
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), cJSON_CreateNumber((double)value));
 } // setInt
 
@@ -358,6 +433,10 @@ void JsonObject::setInt(std::string name, int value) {
  * @return N/A.
  */
 void JsonObject::setObject(std::string name, JsonObject value) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, value.m_node);
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), value.m_node);
 } // setObject
 
@@ -369,6 +448,10 @@ void JsonObject::setObject(std::string name, JsonObject value) {
  * @return N/A.
  */
 void JsonObject::setString(std::string name, std::string value) {
+	if (m_pArena != nullptr) {
+		m_pArena->addItem(m_node, name, m_pArena->createString(value.data(), value.length()));
+		return;
+	}
 	cJSON_AddItemToObject(m_node, name.c_str(), cJSON_CreateString(value.c_str()));
 } // setString
 
@@ -395,3 +478,1473 @@ std::string JsonObject::toStringUnformatted() {
 	free(data);
 	return ret;
 } // toStringUnformatted
+
+
+/**
+ * @brief Builds a document in an arena from the events of a JsonParser.
+ */
+class JsonArena::Builder : public JsonHandler {
+public:
+	Builder(JsonArena* pArena) {
+		m_pArena = pArena;
+		m_pRoot  = nullptr;
+		m_depth  = 0;
+		m_key    = nullptr;
+		m_failed = false;
+	}
+
+	cJSON* getRoot() {
+		return m_failed ? nullptr : m_pRoot;
+	}
+
+	void onStartObject() {
+		cJSON* pItem = m_pArena->createNode(cJSON_Object);
+		add(pItem);
+		m_stack[m_depth++] = pItem;
+	}
+
+	void onEndObject() {
+		m_depth--;
+	}
+
+	void onStartArray() {
+		cJSON* pItem = m_pArena->createNode(cJSON_Array);
+		add(pItem);
+		m_stack[m_depth++] = pItem;
+	}
+
+	void onEndArray() {
+		m_depth--;
+	}
+
+	void onKey(const char* key, size_t length) {
+		m_key = m_pArena->intern(key, length);
+	}
+
+	void onString(const char* value, size_t length) {
+		add(m_pArena->createString(value, length));
+	}
+
+	void onNumber(double value) {
+		add(m_pArena->createNumber(value));
+	}
+
+	void onBoolean(bool value) {
+		add(m_pArena->createBoolean(value));
+	}
+
+	void onNull() {
+		add(m_pArena->createNode(cJSON_NULL));
+	}
+
+private:
+	/**
+	 * @brief Add a new item to the container being built, or make it the root.
+	 * @param [in] pItem The new item.
+	 */
+	void add(cJSON* pItem) {
+		if (pItem == nullptr) {
+			m_failed = true;
+			return;
+		}
+		if (m_depth == 0) {
+			m_pRoot = pItem;
+			return;
+		}
+		cJSON* pParent = m_stack[m_depth - 1];
+		if ((pParent->type & 0xFF) == cJSON_Object) {
+			if (m_key == nullptr) {
+				m_failed = true;
+				return;
+			}
+			pItem->string = (char*) m_key;
+			pItem->type |= cJSON_StringIsConst;
+		}
+		cJSON_AddItemToArray(pParent, pItem);
+	}
+
+	JsonArena*  m_pArena;
+	cJSON*      m_pRoot;
+	cJSON*      m_stack[JSON_PARSER_MAX_DEPTH]; // The containers being built.
+	uint8_t     m_depth;
+	const char* m_key;    // The interned key of the next member of an object.
+	bool        m_failed; // Did the arena run out of memory?
+}; // JsonArena::Builder
+
+
+/**
+ * @brief Construct an arena.
+ * The first block is allocated now so that it is carved from the heap before the heap fragments.
+ * @param [in] blockSize The size of the first block and the smallest size of any further block.
+ */
+JsonArena::JsonArena(size_t blockSize) {
+	m_pBlocks   = nullptr;
+	m_blockSize = blockSize;
+	memset(m_keys, 0, sizeof(m_keys));
+	m_pToken    = nullptr;
+	m_tokenSize = 0;
+	addBlock(blockSize);
+} // JsonArena
+
+
+/**
+ * @brief Destroy the arena and every document it holds.
+ */
+JsonArena::~JsonArena() {
+	freeBlocks();
+	free(m_pToken);
+} // ~JsonArena
+
+
+/**
+ * @brief Allocate a block and make it the one that is allocated from.
+ * @param [in] size The usable size of the block.
+ */
+void JsonArena::addBlock(size_t size) {
+	Block* pBlock = (Block*) malloc(sizeof(Block) + size);
+	if (pBlock == nullptr) {
+		return;
+	}
+	pBlock->next = m_pBlocks;
+	pBlock->size = size;
+	pBlock->used = 0;
+	m_pBlocks    = pBlock;
+} // addBlock
+
+
+/**
+ * @brief Add a member to an object held in the arena.
+ * @param [in] pObject The object.
+ * @param [in] name The name of the member.  It is interned rather than copied.
+ * @param [in] pItem The value of the member.
+ */
+void JsonArena::addItem(cJSON* pObject, const std::string& name, cJSON* pItem) {
+	const char* key = intern(name.data(), name.length());
+	if (pItem == nullptr || key == nullptr) {
+		return;
+	}
+	pItem->string = (char*) key;
+	pItem->type |= cJSON_StringIsConst;
+	cJSON_AddItemToArray(pObject, pItem); // Links the item without copying the key.
+} // addItem
+
+
+/**
+ * @brief Allocate memory from the arena.
+ * The memory is aligned for any type and is only released when the arena is reset or destroyed.
+ * @param [in] size The number of bytes needed.
+ * @return The memory or nullptr if no further block could be allocated.
+ */
+void* JsonArena::allocate(size_t size) {
+	size = (size + 7) & ~(size_t) 7;
+	if (m_pBlocks == nullptr || m_pBlocks->size - m_pBlocks->used < size) {
+		addBlock(size > m_blockSize ? size : m_blockSize);
+		if (m_pBlocks == nullptr || m_pBlocks->size - m_pBlocks->used < size) {
+			return nullptr;
+		}
+	}
+	// The data of a block follows its header, rounded up to 8 bytes.
+	uint8_t* pData = (uint8_t*) m_pBlocks + ((sizeof(Block) + 7) & ~(size_t) 7) + m_pBlocks->used;
+	m_pBlocks->used += size;
+	return pData;
+} // allocate
+
+
+cJSON* JsonArena::createBoolean(bool value) {
+	cJSON* pItem = createNode(value ? cJSON_True : cJSON_False);
+	if (pItem != nullptr) {
+		pItem->valueint = value ? 1 : 0;
+	}
+	return pItem;
+} // createBoolean
+
+
+/**
+ * @brief Create an empty node of the given type.
+ * @param [in] type The cJSON type of the node.
+ * @return The node or nullptr if the arena is out of memory.
+ */
+cJSON* JsonArena::createNode(int type) {
+	cJSON* pItem = (cJSON*) allocate(sizeof(cJSON));
+	if (pItem != nullptr) {
+		memset(pItem, 0, sizeof(cJSON));
+		pItem->type = type;
+	}
+	return pItem;
+} // createNode
+
+
+cJSON* JsonArena::createNumber(double value) {
+	cJSON* pItem = createNode(cJSON_Number);
+	if (pItem != nullptr) {
+		pItem->valuedouble = value;
+		// Saturate like cJSON does rather than overflow the int.
+		if (value >= INT_MAX) {
+			pItem->valueint = INT_MAX;
+		} else if (value <= INT_MIN) {
+			pItem->valueint = INT_MIN;
+		} else {
+			pItem->valueint = (int) value;
+		}
+	}
+	return pItem;
+} // createNumber
+
+
+/**
+ * @brief Create a string node.
+ * The value is copied into the arena.  Values are not interned, only keys are.
+ * @param [in] value The string.
+ * @param [in] length The length of the string.
+ * @return The node or nullptr if the arena is out of memory.
+ */
+cJSON* JsonArena::createString(const char* value, size_t length) {
+	cJSON* pItem = createNode(cJSON_String);
+	char* pCopy  = (char*) allocate(length + 1);
+	if (pItem == nullptr || pCopy == nullptr) {
+		return nullptr;
+	}
+	memcpy(pCopy, value, length);
+	pCopy[length] = '\0';
+	pItem->valuestring = pCopy;
+	pItem->type |= cJSON_IsReference; // The value is not to be freed by cJSON.
+	return pItem;
+} // createString
+
+
+/**
+ * @brief Release every block.
+ */
+void JsonArena::freeBlocks() {
+	while (m_pBlocks != nullptr) {
+		Block* pNext = m_pBlocks->next;
+		free(m_pBlocks);
+		m_pBlocks = pNext;
+	}
+} // freeBlocks
+
+
+/**
+ * @brief Get the number of bytes of heap the arena holds.
+ * @return The total size of the arena's blocks.
+ */
+size_t JsonArena::getSize() {
+	size_t size = 0;
+	for (Block* pBlock = m_pBlocks; pBlock != nullptr; pBlock = pBlock->next) {
+		size += pBlock->size;
+	}
+	return size;
+} // getSize
+
+
+/**
+ * @brief Get the number of bytes used by the documents in the arena.
+ * @return The number of bytes allocated since the arena was last reset.
+ */
+size_t JsonArena::getUsed() {
+	size_t used = 0;
+	for (Block* pBlock = m_pBlocks; pBlock != nullptr; pBlock = pBlock->next) {
+		used += pBlock->used;
+	}
+	return used;
+} // getUsed
+
+
+/**
+ * @brief Get the single copy of a key held in the arena, adding it if it is new.
+ * @param [in] key The key.
+ * @param [in] length The length of the key.
+ * @return The interned, null terminated key or nullptr if the arena is out of memory.
+ */
+const char* JsonArena::intern(const char* key, size_t length) {
+	uint32_t hash = 2166136261U; // FNV-1a
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t) key[i]) * 16777619U;
+	}
+	InternedKey** ppBucket = &m_keys[hash % JSON_ARENA_INTERN_BUCKETS];
+	for (InternedKey* pEntry = *ppBucket; pEntry != nullptr; pEntry = pEntry->next) {
+		const char* entryKey = (const char*) (pEntry + 1);
+		if (pEntry->length == length && memcmp(entryKey, key, length) == 0) {
+			return entryKey;
+		}
+	}
+	InternedKey* pEntry = (InternedKey*) allocate(sizeof(InternedKey) + length + 1);
+	if (pEntry == nullptr) {
+		return nullptr;
+	}
+	char* entryKey = (char*) (pEntry + 1);
+	memcpy(entryKey, key, length);
+	entryKey[length] = '\0';
+	pEntry->length = length;
+	pEntry->next   = *ppBucket;
+	*ppBucket      = pEntry;
+	return entryKey;
+} // intern
+
+
+/**
+ * @brief Get a buffer for the parser to hold the tokens of a document in.
+ * The buffer is kept for the next document and only grows when a longer document comes along, so
+ * parsing documents of a similar size doesn't allocate once the first has been parsed.
+ * @param [in] length The longest token, not counting its terminator.
+ * @return The buffer or nullptr if out of memory.
+ */
+char* JsonArena::getToken(size_t length) {
+	if (length + 1 > m_tokenSize) {
+		free(m_pToken);
+		m_pToken    = (char*) malloc(length + 1);
+		m_tokenSize = m_pToken == nullptr ? 0 : length + 1;
+	}
+	return m_pToken;
+} // getToken
+
+
+/**
+ * @brief Parse a JSON document into the arena.
+ * @param [in] text The JSON text.
+ * @return The root node or nullptr if the text is not valid JSON or the arena is out of memory.
+ */
+cJSON* JsonArena::parse(const std::string& text) {
+	Builder builder(this);
+	char* pToken = getToken(text.length()); // No token can be longer than the text.
+	if (pToken == nullptr) {
+		return nullptr;
+	}
+	JsonParser parser(&builder, pToken, text.length());
+	if (!parser.parse(text.data(), text.length()) || !parser.finish()) {
+		return nullptr;
+	}
+	return builder.getRoot();
+} // parse
+
+
+/**
+ * @brief Release every document held in the arena.
+ * If the documents needed more than one block, the blocks are replaced by one block of their
+ * combined size so that the next document of the same size fits without further allocation.
+ */
+void JsonArena::reset() {
+	if (m_pBlocks != nullptr && m_pBlocks->next == nullptr) {
+		m_pBlocks->used = 0;
+	} else {
+		size_t size = getSize();
+		freeBlocks();
+		addBlock(size > m_blockSize ? size : m_blockSize);
+	}
+	memset(m_keys, 0, sizeof(m_keys));
+} // reset
+
+
+/**
+ * @brief Release every document held in the arena and the heap that large documents left behind.
+ * The arena is returned to a single block of the size it was constructed with and the token buffer
+ * is freed.  Call this after an unusually large document so that its high-water mark isn't kept.
+ */
+void JsonArena::shrink() {
+	freeBlocks();
+	addBlock(m_blockSize);
+	memset(m_keys, 0, sizeof(m_keys));
+	free(m_pToken);
+	m_pToken    = nullptr;
+	m_tokenSize = 0;
+} // shrink
+
+
+JsonHandler::~JsonHandler() {}
+void JsonHandler::onStartObject() {}
+void JsonHandler::onEndObject() {}
+void JsonHandler::onStartArray() {}
+void JsonHandler::onEndArray() {}
+void JsonHandler::onKey(const char* key, size_t length) {}
+void JsonHandler::onString(const char* value, size_t length) {}
+void JsonHandler::onNumber(double value) {}
+void JsonHandler::onBoolean(bool value) {}
+void JsonHandler::onNull() {}
+
+
+/**
+ * @brief Determine if the text is a number as defined by the JSON grammar.
+ * @param [in] text The null terminated text to check.
+ * @return True if the text is a valid JSON number.
+ */
+static bool isJsonNumber(const char* text) {
+	const char* p = text;
+	if (*p == '-') p++;
+	if (*p == '0') {
+		p++;
+	} else if (isdigit((unsigned char)*p)) {
+		while (isdigit((unsigned char)*p)) p++;
+	} else {
+		return false;
+	}
+	if (*p == '.') {
+		p++;
+		if (!isdigit((unsigned char)*p)) return false;
+		while (isdigit((unsigned char)*p)) p++;
+	}
+	if (*p == 'e' || *p == 'E') {
+		p++;
+		if (*p == '+' || *p == '-') p++;
+		if (!isdigit((unsigned char)*p)) return false;
+		while (isdigit((unsigned char)*p)) p++;
+	}
+	return *p == 0;
+} // isJsonNumber
+
+
+/**
+ * @brief Construct a streaming parser.
+ * @param [in] pHandler The handler to receive the parse events.
+ * @param [in] maxTokenLength The longest string, key or number that may appear in the document.
+ */
+JsonParser::JsonParser(JsonHandler* pHandler, size_t maxTokenLength) {
+	m_pHandler       = pHandler;
+	m_maxTokenLength = maxTokenLength;
+	m_token          = (char*) malloc(maxTokenLength + 1);
+	m_ownsToken      = true;
+	reset();
+} // JsonParser
+
+
+/**
+ * @brief Construct a streaming parser that keeps its tokens in a buffer of the caller.
+ * @param [in] pHandler The handler to receive the parse events.
+ * @param [in] pToken A buffer of at least maxTokenLength + 1 bytes that outlives the parser.
+ * @param [in] maxTokenLength The longest string, key or number that may appear in the document.
+ */
+JsonParser::JsonParser(JsonHandler* pHandler, char* pToken, size_t maxTokenLength) {
+	m_pHandler       = pHandler;
+	m_maxTokenLength = maxTokenLength;
+	m_token          = pToken;
+	m_ownsToken      = false;
+	reset();
+} // JsonParser
+
+
+JsonParser::~JsonParser() {
+	if (m_ownsToken) {
+		free(m_token);
+	}
+} // ~JsonParser
+
+
+/**
+ * @brief Append a unicode code point to the token as UTF-8.
+ * @param [in] codePoint The code point to append.
+ * @return False if the token buffer is full.
+ */
+bool JsonParser::appendCodePoint(uint32_t codePoint) {
+	if (codePoint < 0x80) {
+		return appendToken(codePoint);
+	}
+	if (codePoint < 0x800) {
+		return appendToken(0xC0 | (codePoint >> 6)) &&
+			appendToken(0x80 | (codePoint & 0x3F));
+	}
+	if (codePoint < 0x10000) {
+		return appendToken(0xE0 | (codePoint >> 12)) &&
+			appendToken(0x80 | ((codePoint >> 6) & 0x3F)) &&
+			appendToken(0x80 | (codePoint & 0x3F));
+	}
+	return appendToken(0xF0 | (codePoint >> 18)) &&
+		appendToken(0x80 | ((codePoint >> 12) & 0x3F)) &&
+		appendToken(0x80 | ((codePoint >> 6) & 0x3F)) &&
+		appendToken(0x80 | (codePoint & 0x3F));
+} // appendCodePoint
+
+
+/**
+ * @brief Append a character to the token.
+ * @param [in] c The character to append.
+ * @return False if the token buffer is full.
+ */
+bool JsonParser::appendToken(char c) {
+	if (m_tokenLength >= m_maxTokenLength) {
+		return error("Token too long");
+	}
+	m_token[m_tokenLength++] = c;
+	return true;
+} // appendToken
+
+
+/**
+ * @brief Close the innermost container.
+ * @param [in] isObject True if the closing character was '}' and false for ']'.
+ * @return False if the closing character doesn't match the open container.
+ */
+bool JsonParser::endContainer(bool isObject) {
+	bool openIsObject = (m_containers & (1u << (m_depth - 1))) != 0;
+	if (openIsObject != isObject) {
+		return error(isObject ? "Unexpected '}'" : "Unexpected ']'");
+	}
+	m_depth--;
+	m_containers &= ~(1u << m_depth);
+	if (isObject) {
+		m_pHandler->onEndObject();
+	} else {
+		m_pHandler->onEndArray();
+	}
+	endValue();
+	return true;
+} // endContainer
+
+
+/**
+ * @brief Report the number held in the token.
+ * @return False if the token is not a valid number.
+ */
+bool JsonParser::endNumber() {
+	m_token[m_tokenLength] = 0;
+	if (!isJsonNumber(m_token)) {
+		return error("Invalid number");
+	}
+	m_pHandler->onNumber(strtod(m_token, nullptr));
+	endValue();
+	return true;
+} // endNumber
+
+
+/**
+ * @brief Move on after a complete value.
+ * @return N/A.
+ */
+void JsonParser::endValue() {
+	m_state = m_depth == 0 ? STATE_DONE : STATE_COMMA_OR_END;
+} // endValue
+
+
+/**
+ * @brief Record a syntax error.  All further input is rejected until reset() is called.
+ * @param [in] message A description of the error.
+ * @return False.
+ */
+bool JsonParser::error(const char* message) {
+	if (m_state != STATE_ERROR) {
+		m_error = message;
+		m_state = STATE_ERROR;
+	}
+	return false;
+} // error
+
+
+/**
+ * @brief Process one character of input.
+ * @param [in] c The character.
+ * @return False if a syntax error was found.
+ */
+bool JsonParser::feed(char c) {
+	// A number has no terminator of its own; the first character that can't be part of it ends it
+	// and is then processed as normal.
+	if (m_state == STATE_NUMBER) {
+		if (isdigit((unsigned char)c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+			return appendToken(c);
+		}
+		if (!endNumber()) {
+			return false;
+		}
+	}
+
+	switch(m_state) {
+		case STATE_STRING: {
+			if (m_highSurrogate != 0 && c != '\\') {
+				m_highSurrogate = 0;
+				if (!appendCodePoint(0xFFFD)) return false; // Unpaired surrogate.
+			}
+			if (c == '"') {
+				if (m_highSurrogate != 0) {
+					m_highSurrogate = 0;
+					if (!appendCodePoint(0xFFFD)) return false;
+				}
+				m_token[m_tokenLength] = 0;
+				if (m_isKey) {
+					m_pHandler->onKey(m_token, m_tokenLength);
+					m_state = STATE_COLON;
+				} else {
+					m_pHandler->onString(m_token, m_tokenLength);
+					endValue();
+				}
+				return true;
+			}
+			if (c == '\\') {
+				m_state = STATE_STRING_ESCAPE;
+				return true;
+			}
+			if ((uint8_t)c < 0x20) {
+				return error("Control character in string");
+			}
+			return appendToken(c);
+		}
+
+		case STATE_STRING_ESCAPE: {
+			m_state = STATE_STRING;
+			if (c != 'u' && m_highSurrogate != 0) {
+				m_highSurrogate = 0;
+				if (!appendCodePoint(0xFFFD)) return false;
+			}
+			switch(c) {
+				case '"':
+				case '\\':
+				case '/': return appendToken(c);
+				case 'b': return appendToken('\b');
+				case 'f': return appendToken('\f');
+				case 'n': return appendToken('\n');
+				case 'r': return appendToken('\r');
+				case 't': return appendToken('\t');
+				case 'u': {
+					m_state     = STATE_STRING_UNICODE;
+					m_codePoint = 0;
+					m_hexCount  = 0;
+					return true;
+				}
+				default: return error("Invalid escape");
+			}
+		}
+
+		case STATE_STRING_UNICODE: {
+			if (!isxdigit((unsigned char)c)) {
+				return error("Invalid \\u escape");
+			}
+			m_codePoint = (m_codePoint << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+			if (++m_hexCount < 4) {
+				return true;
+			}
+			m_state = STATE_STRING;
+			if (m_highSurrogate != 0) {
+				uint32_t high = m_highSurrogate;
+				m_highSurrogate = 0;
+				if (m_codePoint >= 0xDC00 && m_codePoint <= 0xDFFF) {
+					return appendCodePoint(0x10000 + ((high - 0xD800) << 10) + (m_codePoint - 0xDC00));
+				}
+				if (!appendCodePoint(0xFFFD)) return false;
+			}
+			if (m_codePoint >= 0xD800 && m_codePoint <= 0xDBFF) {
+				m_highSurrogate = m_codePoint; // Wait for the low half.
+				return true;
+			}
+			if (m_codePoint >= 0xDC00 && m_codePoint <= 0xDFFF) {
+				return appendCodePoint(0xFFFD);
+			}
+			return appendCodePoint(m_codePoint);
+		}
+
+		case STATE_LITERAL: {
+			if (c != m_literal[m_literalIndex]) {
+				return error("Invalid literal");
+			}
+			if (m_literal[++m_literalIndex] != 0) {
+				return true;
+			}
+			if (m_literal[0] == 'n') {
+				m_pHandler->onNull();
+			} else {
+				m_pHandler->onBoolean(m_literal[0] == 't');
+			}
+			endValue();
+			return true;
+		}
+
+		case STATE_ERROR: {
+			return false;
+		}
+
+		default: {
+			break;
+		}
+	} // switch
+
+	// The remaining states are between tokens where white space is allowed.
+	if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+		return true;
+	}
+
+	switch(m_state) {
+		case STATE_VALUE_OR_END: {
+			if (c == ']') {
+				return endContainer(false);
+			}
+			return startValue(c);
+		}
+
+		case STATE_VALUE: {
+			return startValue(c);
+		}
+
+		case STATE_KEY_OR_END: {
+			if (c == '}') {
+				return endContainer(true);
+			}
+		}
+		// Fall through
+
+		case STATE_KEY: {
+			if (c != '"') {
+				return error("Expected a key");
+			}
+			m_tokenLength = 0;
+			m_isKey       = true;
+			m_state       = STATE_STRING;
+			return true;
+		}
+
+		case STATE_COLON: {
+			if (c != ':') {
+				return error("Expected ':'");
+			}
+			m_state = STATE_VALUE;
+			return true;
+		}
+
+		case STATE_COMMA_OR_END: {
+			bool inObject = (m_containers & (1u << (m_depth - 1))) != 0;
+			if (c == ',') {
+				m_state = inObject ? STATE_KEY : STATE_VALUE;
+				return true;
+			}
+			if (c == '}' || c == ']') {
+				return endContainer(c == '}');
+			}
+			return error(inObject ? "Expected ',' or '}'" : "Expected ',' or ']'");
+		}
+
+		default: {
+			return error("Unexpected data after value");
+		}
+	} // switch
+} // feed
+
+
+/**
+ * @brief Complete parsing at the end of the input.
+ * @return True if exactly one complete JSON value was parsed.
+ */
+bool JsonParser::finish() {
+	if (m_state == STATE_NUMBER && !endNumber()) {
+		return false;
+	}
+	if (m_state == STATE_DONE) {
+		return true;
+	}
+	return error("Unexpected end of input");
+} // finish
+
+
+/**
+ * @brief Get a description of the syntax error that stopped the parse.
+ * @return The error description or nullptr if there has been no error.
+ */
+const char* JsonParser::getError() {
+	return m_error;
+} // getError
+
+
+/**
+ * @brief Get the number of characters consumed.  After an error, this is the offset of the offending character.
+ * @return The number of characters consumed.
+ */
+size_t JsonParser::getOffset() {
+	return m_offset;
+} // getOffset
+
+
+/**
+ * @brief Parse the next chunk of the document.
+ *
+ * Chunks may split the document anywhere, including within strings and numbers.  Call finish()
+ * once the last chunk has been parsed.
+ *
+ * @param [in] pData The chunk.
+ * @param [in] length The length of the chunk.
+ * @return False if a syntax error was found.
+ */
+bool JsonParser::parse(const char* pData, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (!feed(pData[i])) {
+			return false;
+		}
+		m_offset++;
+	}
+	return true;
+} // parse
+
+
+/**
+ * @brief Parse a whole document from a stream.
+ *
+ * The stream is read in chunks of JSON_PARSER_CHUNK_SIZE bytes until it is exhausted, so a document
+ * arriving over a Socket (through a SocketInputRecordStreambuf) or a WebSocket (through the
+ * WebSocketInputStreambuf passed to WebSocketHandler::onMessage) is never held in memory.
+ *
+ * @param [in] pStreambuf The stream from which to read the document.
+ * @return True if exactly one complete JSON value was parsed.
+ */
+bool JsonParser::parse(std::streambuf* pStreambuf) {
+	char buffer[JSON_PARSER_CHUNK_SIZE];
+	while(true) {
+		std::streamsize count = pStreambuf->sgetn(buffer, sizeof(buffer));
+		if (count <= 0) {
+			break;
+		}
+		if (!parse(buffer, count)) {
+			return false;
+		}
+	}
+	return finish();
+} // parse
+
+
+/**
+ * @brief Prepare the parser to parse a new document.
+ * @return N/A.
+ */
+void JsonParser::reset() {
+	m_state         = STATE_VALUE;
+	m_tokenLength   = 0;
+	m_containers    = 0;
+	m_depth         = 0;
+	m_isKey         = false;
+	m_codePoint     = 0;
+	m_hexCount      = 0;
+	m_highSurrogate = 0;
+	m_literal       = nullptr;
+	m_literalIndex  = 0;
+	m_offset        = 0;
+	m_error         = nullptr;
+	if (m_token == nullptr) {
+		error("Out of memory");
+	}
+} // reset
+
+
+/**
+ * @brief Begin a new value.
+ * @param [in] c The first character of the value.
+ * @return False if the character can't start a value.
+ */
+bool JsonParser::startValue(char c) {
+	switch(c) {
+		case '{':
+		case '[': {
+			if (m_depth >= JSON_PARSER_MAX_DEPTH) {
+				return error("Nesting too deep");
+			}
+			if (c == '{') {
+				m_containers |= (1u << m_depth);
+			}
+			m_depth++;
+			if (c == '{') {
+				m_pHandler->onStartObject();
+				m_state = STATE_KEY_OR_END;
+			} else {
+				m_pHandler->onStartArray();
+				m_state = STATE_VALUE_OR_END;
+			}
+			return true;
+		}
+
+		case '"': {
+			m_tokenLength = 0;
+			m_isKey       = false;
+			m_state       = STATE_STRING;
+			return true;
+		}
+
+		case 't':
+		case 'f':
+		case 'n': {
+			m_literal      = c == 't' ? "true" : (c == 'f' ? "false" : "null");
+			m_literalIndex = 1;
+			m_state        = STATE_LITERAL;
+			return true;
+		}
+
+		default: {
+			if (c == '-' || isdigit((unsigned char)c)) {
+				m_tokenLength = 0;
+				m_state       = STATE_NUMBER;
+				return appendToken(c);
+			}
+			return error("Expected a value");
+		}
+	}
+} // startValue
+
+
+JsonBinder::JsonBinder() {
+	m_containers    = 0;
+	m_depth         = 0;
+	m_pathLength[0] = 0;
+	m_path.reserve(64);
+} // JsonBinder
+
+
+/**
+ * @brief Bind a boolean variable to a path in the document.
+ * @param [in] path The dotted path of the value, for example "wifi.dhcp".
+ * @param [in] pValue The variable to receive the value.
+ */
+void JsonBinder::bind(std::string path, bool* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_BOOLEAN, pValue});
+} // bind
+
+
+/**
+ * @brief Bind an int variable to a path in the document.
+ * @param [in] path The dotted path of the value.
+ * @param [in] pValue The variable to receive the value.
+ */
+void JsonBinder::bind(std::string path, int* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_INT, pValue});
+} // bind
+
+
+/**
+ * @brief Bind a double variable to a path in the document.
+ * @param [in] path The dotted path of the value.
+ * @param [in] pValue The variable to receive the value.
+ */
+void JsonBinder::bind(std::string path, double* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_DOUBLE, pValue});
+} // bind
+
+
+/**
+ * @brief Bind a string variable to a path in the document.
+ * @param [in] path The dotted path of the value.
+ * @param [in] pValue The variable to receive the value.
+ */
+void JsonBinder::bind(std::string path, std::string* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_STRING, pValue});
+} // bind
+
+
+/**
+ * @brief Bind a vector of ints to the path of an array of numbers in the document.
+ * @param [in] path The dotted path of the array.
+ * @param [in] pValue The vector to which the array elements are appended.
+ */
+void JsonBinder::bind(std::string path, std::vector<int>* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_INT_ARRAY, pValue});
+} // bind
+
+
+/**
+ * @brief Bind a vector of strings to the path of an array of strings in the document.
+ * @param [in] path The dotted path of the array.
+ * @param [in] pValue The vector to which the array elements are appended.
+ */
+void JsonBinder::bind(std::string path, std::vector<std::string>* pValue) {
+	m_bindings.push_back(Binding{path, TYPE_STRING_ARRAY, pValue});
+} // bind
+
+
+/**
+ * @brief Close the innermost container.
+ * @return N/A.
+ */
+void JsonBinder::endContainer() {
+	if (m_depth == 0) {
+		return;
+	}
+	m_depth--;
+	m_containers &= ~(1u << m_depth);
+	m_path.resize(m_pathLength[m_depth]);
+} // endContainer
+
+
+/**
+ * @brief Find the binding for the current path.
+ * @param [in] type The type of binding required.
+ * @return The binding or nullptr if there is none.
+ */
+JsonBinder::Binding* JsonBinder::find(Type type) {
+	for (auto& binding : m_bindings) {
+		if (binding.type == type && binding.path == m_path) {
+			return &binding;
+		}
+	}
+	return nullptr;
+} // find
+
+
+/**
+ * @brief Determine if the current value is an element of an array.
+ * @return True if the innermost container is an array.
+ */
+bool JsonBinder::inArray() {
+	return m_depth > 0 && (m_containers & (1u << (m_depth - 1))) == 0;
+} // inArray
+
+
+/**
+ * @brief Open a container at the current path.
+ * @param [in] isObject True for an object and false for an array.
+ * @return N/A.
+ */
+void JsonBinder::startContainer(bool isObject) {
+	if (m_depth >= JSON_PARSER_MAX_DEPTH) {
+		return;
+	}
+	if (isObject) {
+		m_containers |= (1u << m_depth);
+	}
+	m_depth++;
+	m_pathLength[m_depth] = m_path.length();
+} // startContainer
+
+
+void JsonBinder::onStartObject() {
+	startContainer(true);
+} // onStartObject
+
+
+void JsonBinder::onEndObject() {
+	endContainer();
+} // onEndObject
+
+
+void JsonBinder::onStartArray() {
+	startContainer(false);
+} // onStartArray
+
+
+void JsonBinder::onEndArray() {
+	endContainer();
+} // onEndArray
+
+
+/**
+ * @brief Set the current path to the member of the innermost object named by the key.
+ */
+void JsonBinder::onKey(const char* key, size_t length) {
+	m_path.resize(m_pathLength[m_depth]);
+	if (!m_path.empty()) {
+		m_path += '.';
+	}
+	m_path.append(key, length);
+} // onKey
+
+
+void JsonBinder::onString(const char* value, size_t length) {
+	if (inArray()) {
+		Binding* pBinding = find(TYPE_STRING_ARRAY);
+		if (pBinding != nullptr) {
+			((std::vector<std::string>*) pBinding->pValue)->push_back(std::string(value, length));
+		}
+		return;
+	}
+	Binding* pBinding = find(TYPE_STRING);
+	if (pBinding != nullptr) {
+		((std::string*) pBinding->pValue)->assign(value, length);
+	}
+} // onString
+
+
+void JsonBinder::onNumber(double value) {
+	if (inArray()) {
+		Binding* pBinding = find(TYPE_INT_ARRAY);
+		if (pBinding != nullptr) {
+			((std::vector<int>*) pBinding->pValue)->push_back((int) value);
+		}
+		return;
+	}
+	Binding* pBinding = find(TYPE_INT);
+	if (pBinding != nullptr) {
+		*(int*) pBinding->pValue = (int) value;
+		return;
+	}
+	pBinding = find(TYPE_DOUBLE);
+	if (pBinding != nullptr) {
+		*(double*) pBinding->pValue = value;
+	}
+} // onNumber
+
+
+void JsonBinder::onBoolean(bool value) {
+	Binding* pBinding = find(TYPE_BOOLEAN);
+	if (pBinding != nullptr && !inArray()) {
+		*(bool*) pBinding->pValue = value;
+	}
+} // onBoolean
+
+
+/**
+ * @brief Construct a writer whose output is sent as the body of an HTTP response.
+ * The response is given a content type of application/json unless its header has already been sent.
+ * @param [in] pResponse The response to which the JSON is sent.
+ */
+JsonWriter::JsonWriter(HttpResponse* pResponse) : JsonWriter((Socket*) nullptr) {
+	m_sinkType  = SINK_HTTP_RESPONSE;
+	m_pResponse = pResponse;
+	pResponse->addHeader(HttpRequest::HTTP_HEADER_CONTENT_TYPE, "application/json");
+} // JsonWriter
+
+
+/**
+ * @brief Construct a writer whose output is sent down a socket.
+ * @param [in] pSocket The socket to which the JSON is sent.
+ */
+JsonWriter::JsonWriter(Socket* pSocket) {
+	m_sinkType    = SINK_SOCKET;
+	m_pResponse   = nullptr;
+	m_pSocket     = pSocket;
+	m_pWebSocket  = nullptr;
+	m_length      = 0;
+	m_hasElements = 0;
+	m_depth       = 0;
+	m_afterName   = false;
+	m_flushed     = false;
+	m_ended       = false;
+	m_failed      = false;
+} // JsonWriter
+
+
+/**
+ * @brief Construct a writer whose output is sent as a single (possibly fragmented) web socket text message.
+ * @param [in] pWebSocket The web socket to which the JSON is sent.
+ */
+JsonWriter::JsonWriter(WebSocket* pWebSocket) : JsonWriter((Socket*) nullptr) {
+	m_sinkType   = SINK_WEBSOCKET;
+	m_pWebSocket = pWebSocket;
+} // JsonWriter
+
+
+/**
+ * @brief Destroy the writer, sending anything not yet sent.
+ */
+JsonWriter::~JsonWriter() {
+	end();
+} // ~JsonWriter
+
+
+void JsonWriter::addBoolean(bool value) {
+	startValue();
+	if (value) {
+		write("true", 4);
+	} else {
+		write("false", 5);
+	}
+} // addBoolean
+
+
+void JsonWriter::addBoolean(const char* name, bool value) {
+	writeName(name);
+	addBoolean(value);
+} // addBoolean
+
+
+/**
+ * @brief Add a number.
+ * Numbers are written with the fewest digits that read back as the same double.  NaN and the
+ * infinities have no JSON representation and are written as null.
+ * @param [in] value The number.
+ */
+void JsonWriter::addDouble(double value) {
+	if (isnan(value) || isinf(value)) {
+		addNull();
+		return;
+	}
+	startValue();
+	char text[32];
+	int length = snprintf(text, sizeof(text), "%.15g", value);
+	if (strtod(text, nullptr) != value) {
+		length = snprintf(text, sizeof(text), "%.17g", value);
+	}
+	write(text, length);
+} // addDouble
+
+
+void JsonWriter::addDouble(const char* name, double value) {
+	writeName(name);
+	addDouble(value);
+} // addDouble
+
+
+/**
+ * @brief Add an integer.
+ * @param [in] value The integer.
+ */
+void JsonWriter::addInt(int64_t value) {
+	startValue();
+	char text[21];
+	char* p = text + sizeof(text);
+	uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+	do {
+		*--p = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0) {
+		*--p = '-';
+	}
+	write(p, text + sizeof(text) - p);
+} // addInt
+
+
+void JsonWriter::addInt(const char* name, int64_t value) {
+	writeName(name);
+	addInt(value);
+} // addInt
+
+
+void JsonWriter::addNull() {
+	startValue();
+	write("null", 4);
+} // addNull
+
+
+void JsonWriter::addNull(const char* name) {
+	writeName(name);
+	addNull();
+} // addNull
+
+
+void JsonWriter::addString(const char* value) {
+	startValue();
+	writeQuoted(value, strlen(value));
+} // addString
+
+
+void JsonWriter::addString(const std::string& value) {
+	startValue();
+	writeQuoted(value.data(), value.length());
+} // addString
+
+
+void JsonWriter::addString(const char* name, const char* value) {
+	writeName(name);
+	addString(value);
+} // addString
+
+
+void JsonWriter::addString(const char* name, const std::string& value) {
+	writeName(name);
+	addString(value);
+} // addString
+
+
+/**
+ * @brief Finish the document, sending anything not yet sent.
+ * For a web socket this sends the final fragment of the message.  Nothing more may be added after
+ * calling end().  The sink itself (for example the HttpResponse) is not closed.
+ */
+void JsonWriter::end() {
+	if (m_ended) {
+		return;
+	}
+	flush(true);
+	m_ended = true;
+} // end
+
+
+void JsonWriter::endArray() {
+	if (m_failed) {
+		return;
+	}
+	write(']');
+	if (m_depth > 0) {
+		m_depth--;
+	}
+} // endArray
+
+
+void JsonWriter::endObject() {
+	if (m_failed) {
+		return;
+	}
+	write('}');
+	if (m_depth > 0) {
+		m_depth--;
+	}
+} // endObject
+
+
+/**
+ * @brief Send what has been written so far to the sink.
+ */
+void JsonWriter::flush() {
+	flush(false);
+} // flush
+
+
+/**
+ * @brief Pass the buffered output to the sink.
+ * @param [in] isLast True if this is the end of the document.
+ */
+void JsonWriter::flush(bool isLast) {
+	if (m_ended) {
+		return;
+	}
+	switch(m_sinkType) {
+		case SINK_HTTP_RESPONSE: {
+			if (m_length > 0) {
+				m_pResponse->sendData((uint8_t*) m_buffer, m_length);
+			}
+			break;
+		}
+
+		case SINK_SOCKET: {
+			if (m_length > 0) {
+				m_pSocket->send((uint8_t*) m_buffer, m_length);
+			}
+			break;
+		}
+
+		case SINK_WEBSOCKET: {
+			// Every fragment but the last must carry data; the last may be empty.
+			if (m_length > 0 || isLast) {
+				m_pWebSocket->sendFragment((uint8_t*) m_buffer, m_length, !m_flushed, isLast, WebSocket::SEND_TYPE_TEXT);
+				m_flushed = true;
+			}
+			break;
+		}
+	}
+	m_length = 0;
+} // flush
+
+
+/**
+ * @brief Has everything added to the writer been written?
+ * @return False if objects or arrays were nested deeper than JSON_WRITER_MAX_DEPTH.
+ */
+bool JsonWriter::isValid() {
+	return !m_failed;
+} // isValid
+
+
+void JsonWriter::startArray() {
+	if (m_depth >= JSON_WRITER_MAX_DEPTH) {   // Too deep to keep track of the commas.
+		m_failed = true;
+	}
+	if (m_failed) {
+		return;
+	}
+	startValue();
+	write('[');
+	m_hasElements &= ~(1u << m_depth);
+	m_depth++;
+} // startArray
+
+
+void JsonWriter::startArray(const char* name) {
+	writeName(name);
+	startArray();
+} // startArray
+
+
+void JsonWriter::startObject() {
+	if (m_depth >= JSON_WRITER_MAX_DEPTH) {   // Too deep to keep track of the commas.
+		m_failed = true;
+	}
+	if (m_failed) {
+		return;
+	}
+	startValue();
+	write('{');
+	m_hasElements &= ~(1u << m_depth);
+	m_depth++;
+} // startObject
+
+
+void JsonWriter::startObject(const char* name) {
+	writeName(name);
+	startObject();
+} // startObject
+
+
+/**
+ * @brief Write the separator, if any, needed before a new value.
+ */
+void JsonWriter::startValue() {
+	if (m_afterName) {
+		m_afterName = false;
+		return;
+	}
+	if (m_depth == 0) {
+		return;
+	}
+	uint32_t bit = 1u << (m_depth - 1);
+	if (m_hasElements & bit) {
+		write(',');
+	} else {
+		m_hasElements |= bit;
+	}
+} // startValue
+
+
+void JsonWriter::write(char c) {
+	if (m_failed) {
+		return;
+	}
+	if (m_length == sizeof(m_buffer)) {
+		flush(false);
+	}
+	m_buffer[m_length++] = c;
+} // write
+
+
+void JsonWriter::write(const char* pData, size_t length) {
+	if (m_failed) {
+		return;
+	}
+	while (length > 0) {
+		if (m_length == sizeof(m_buffer)) {
+			flush(false);
+		}
+		size_t count = sizeof(m_buffer) - m_length;
+		if (count > length) {
+			count = length;
+		}
+		memcpy(m_buffer + m_length, pData, count);
+		m_length += count;
+		pData    += count;
+		length   -= count;
+	}
+} // write
+
+
+/**
+ * @brief Write the name of an object member.
+ * @param [in] name The member name.
+ */
+void JsonWriter::writeName(const char* name) {
+	startValue();
+	writeQuoted(name, strlen(name));
+	write(':');
+	m_afterName = true;
+} // writeName
+
+
+/**
+ * @brief Write a string as a quoted and escaped JSON string.
+ * Characters that need no escaping are copied in runs.  UTF-8 sequences are passed through.
+ * @param [in] value The string.
+ * @param [in] length The length of the string.
+ */
+void JsonWriter::writeQuoted(const char* value, size_t length) {
+	static const char hex[] = "0123456789abcdef";
+	write('"');
+	size_t start = 0;
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = value[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		write(value + start, i - start);
+		start = i + 1;
+		switch(c) {
+			case '"':  write("\\\"", 2); break;
+			case '\\': write("\\\\", 2); break;
+			case '\b': write("\\b", 2); break;
+			case '\f': write("\\f", 2); break;
+			case '\n': write("\\n", 2); break;
+			case '\r': write("\\r", 2); break;
+			case '\t': write("\\t", 2); break;
+			default: {
+				char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+				write(escape, sizeof(escape));
+				break;
+			}
+		}
+	}
+	write(value + start, length - start);
+	write('"');
+} // writeQuoted
@@ -8,11 +8,26 @@
 #ifndef COMPONENTS_CPP_UTILS_JSON_H_
 #define COMPONENTS_CPP_UTILS_JSON_H_
 #include <cJSON.h>
+#include <stdint.h>
 #include <string>
+#include <streambuf>
+#include <vector>
+
+#define JSON_PARSER_MAX_DEPTH  (32)  // Deepest nesting of objects and arrays the streaming parser accepts.
+#define JSON_PARSER_MAX_TOKEN  (256) // Default longest string, key or number the streaming parser buffers.
+#define JSON_PARSER_CHUNK_SIZE (128) // Size of the stack buffer used when parsing from a streambuf.
+#define JSON_WRITER_BUFFER_SIZE (256) // Size of the buffer a JsonWriter fills before flushing to its sink.
+#define JSON_WRITER_MAX_DEPTH   (32)  // Deepest nesting of objects and arrays a JsonWriter accepts.
+#define JSON_ARENA_BLOCK_SIZE     (1024) // Default size of the block a JsonArena starts with.
+#define JSON_ARENA_INTERN_BUCKETS (32)   // Hash buckets used to intern object keys.
 
 // Forward declarations
 class JsonObject;
 class JsonArray;
+class JsonArena;
+class HttpResponse;
+class Socket;
+class WebSocket;
 
 /**
  * @brief Top level JSON handler.
@@ -20,11 +35,15 @@ class JsonArray;
 class JSON {
 public:
 	static JsonObject createObject();
+	static JsonObject createObject(JsonArena* pArena);
 	static JsonArray  createArray();
+	static JsonArray  createArray(JsonArena* pArena);
 	static void       deleteObject(JsonObject jsonObject);
 	static void       deleteArray(JsonArray jsonArray);
 	static JsonObject parseObject(std::string text);
+	static JsonObject parseObject(std::string text, JsonArena* pArena);
 	static JsonArray  parseArray(std::string text);
+	static JsonArray  parseArray(std::string text, JsonArena* pArena);
 }; // JSON
 
 
@@ -48,13 +67,17 @@ public:
 	std::string toStringUnformatted();
 	std::size_t size();
 private:
-	JsonArray(cJSON* node);
+	JsonArray(cJSON* node, JsonArena* pArena = nullptr);
 	friend class JSON;
 	friend class JsonObject;
 	/**
 	 * @brief The underlying cJSON node.
 	 */
 	cJSON *m_node;
+	/**
+	 * @brief The arena that holds the node or nullptr if it is on the heap.
+	 */
+	JsonArena* m_pArena;
 }; // JsonArray
 
 
@@ -81,14 +104,346 @@ public:
 	std::string toStringUnformatted();
 
 private:
-	JsonObject(cJSON* node);
+	JsonObject(cJSON* node, JsonArena* pArena = nullptr);
 	friend class JSON;
 	friend class JsonArray;
 	/**
 	 * @brief The underlying cJSON node.
 	 */
 	cJSON* m_node;
+	/**
+	 * @brief The arena that holds the node or nullptr if it is on the heap.
+	 */
+	JsonArena* m_pArena;
 }; // JsonObject
 
 
+/**
+ * @brief Memory that holds whole JSON documents and is released in one go.
+ *
+ * A document created with JSON::parseObject() or JSON::createObject() is a tree of cJSON nodes in which
+ * every node, key and string value is a separate heap allocation.  On a device that handles requests for
+ * days those allocations fragment the heap.  A document created with an arena instead has all of its
+ * nodes and strings carved out of the arena's blocks, keys are interned so that a key that appears many
+ * times is stored once, and the whole document is released by reset() or by destroying the arena.
+ * The JsonObject and JsonArray API is unchanged, so code that reads or builds documents doesn't care
+ * where they live.
+ *
+ * When a document outgrows the current block a further block is added.  reset() then replaces the
+ * blocks by a single block big enough for all of them, so an arena that is reused for similar
+ * documents settles on one allocation.  The buffer that parsing uses for tokens is kept in the same way.
+ * Both are high-water marks: after one unusually large document the arena holds that much heap until
+ * it is destroyed or shrink() is called, which returns it to a single block of the size it was
+ * constructed with.
+ *
+ * @code{.cpp}
+ * JsonArena arena;   // One per handler task, lives as long as the task.
+ * ...
+ * JsonObject request = JSON::parseObject(pRequest->getBody(), &arena);
+ * JsonObject reply   = JSON::createObject(&arena);
+ * reply.setInt("count", request.getArray("items").size());
+ * pResponse->sendData(reply.toStringUnformatted());
+ * arena.reset();     // Releases both documents.
+ * @endcode
+ *
+ * Documents in an arena must not be passed to JSON::deleteObject() or JSON::deleteArray() (the calls
+ * are ignored) and must not be mixed with heap documents within one tree.
+ */
+class JsonArena {
+public:
+	JsonArena(size_t blockSize = JSON_ARENA_BLOCK_SIZE);
+	~JsonArena();
+	size_t getSize();
+	size_t getUsed();
+	void   reset();
+	void   shrink();
+
+private:
+	friend class JSON;
+	friend class JsonArray;
+	friend class JsonObject;
+	class Builder;
+	struct Block {
+		Block* next;
+		size_t size; // Bytes of data following the header.
+		size_t used;
+	};
+	struct InternedKey {
+		InternedKey* next;
+		size_t       length; // The key follows the entry.
+	};
+	void        addBlock(size_t size);
+	void        addItem(cJSON* pObject, const std::string& name, cJSON* pItem);
+	void*       allocate(size_t size);
+	cJSON*      createBoolean(bool value);
+	cJSON*      createNode(int type);
+	cJSON*      createNumber(double value);
+	cJSON*      createString(const char* value, size_t length);
+	void        freeBlocks();
+	char*       getToken(size_t length);
+	const char* intern(const char* key, size_t length);
+	cJSON*      parse(const std::string& text);
+
+	Block*       m_pBlocks;   // The block being allocated from, followed by those that filled up.
+	size_t       m_blockSize;
+	InternedKey* m_keys[JSON_ARENA_INTERN_BUCKETS];
+	char*        m_pToken;    // The token buffer lent to the parser, kept from one parse to the next.
+	size_t       m_tokenSize;
+}; // JsonArena
+
+
+/**
+ * @brief Receiver of the events produced by a JsonParser.
+ *
+ * Override the methods for the events of interest; the default implementations do nothing.
+ * String and key values are only valid for the duration of the call.
+ */
+class JsonHandler {
+public:
+	virtual ~JsonHandler();
+	virtual void onStartObject();
+	virtual void onEndObject();
+	virtual void onStartArray();
+	virtual void onEndArray();
+	virtual void onKey(const char* key, size_t length);
+	virtual void onString(const char* value, size_t length);
+	virtual void onNumber(double value);
+	virtual void onBoolean(bool value);
+	virtual void onNull();
+}; // JsonHandler
+
+
+/**
+ * @brief A streaming (SAX style) JSON parser.
+ *
+ * Unlike JSON::parseObject(), which needs the whole document in memory and then builds a cJSON node
+ * for every value, the streaming parser is fed the document in chunks of any size and reports each
+ * value to a JsonHandler as soon as it is complete.  Its memory use is fixed when it is constructed:
+ * one token buffer (the longest string, key or number that may appear) plus a bit per nesting level.
+ *
+ * @code{.cpp}
+ * class MyHandler : public JsonHandler {
+ *    void onKey(const char* key, size_t length) { ... }
+ *    void onNumber(double value) { ... }
+ * };
+ *
+ * MyHandler handler;
+ * JsonParser parser(&handler);
+ * parser.parse(pWebSocketInputStreambuf); // or a SocketInputRecordStreambuf
+ * @endcode
+ */
+class JsonParser {
+public:
+	JsonParser(JsonHandler* pHandler, size_t maxTokenLength = JSON_PARSER_MAX_TOKEN);
+	JsonParser(JsonHandler* pHandler, char* pToken, size_t maxTokenLength);
+	~JsonParser();
+	bool        finish();
+	const char* getError();
+	size_t      getOffset();
+	bool        parse(const char* pData, size_t length);
+	bool        parse(std::streambuf* pStreambuf);
+	void        reset();
+
+private:
+	enum State {
+		STATE_VALUE,          // Expecting a value.
+		STATE_VALUE_OR_END,   // After '[', expecting a value or ']'.
+		STATE_KEY,            // After ',' in an object, expecting a key.
+		STATE_KEY_OR_END,     // After '{', expecting a key or '}'.
+		STATE_COLON,          // After a key, expecting ':'.
+		STATE_COMMA_OR_END,   // After a value in a container, expecting ',' or the end of the container.
+		STATE_STRING,         // Within a string or key.
+		STATE_STRING_ESCAPE,  // After a '\' within a string.
+		STATE_STRING_UNICODE, // Within the four hex digits of a '\u' escape.
+		STATE_NUMBER,         // Within a number.
+		STATE_LITERAL,        // Within true, false or null.
+		STATE_DONE,           // A complete value has been parsed, only white space may follow.
+		STATE_ERROR           // A syntax error was found.
+	};
+	bool appendCodePoint(uint32_t codePoint);
+	bool appendToken(char c);
+	bool endContainer(bool isObject);
+	bool endNumber();
+	void endValue();
+	bool error(const char* message);
+	bool feed(char c);
+	bool startValue(char c);
+
+	JsonHandler* m_pHandler;
+	char*        m_token;          // Buffer for the string, key or number being parsed.
+	bool         m_ownsToken;      // Was the buffer allocated by the parser?
+	size_t       m_tokenLength;
+	size_t       m_maxTokenLength;
+	State        m_state;
+	uint32_t     m_containers;     // One bit per nesting level, 1 for an object and 0 for an array.
+	uint8_t      m_depth;
+	bool         m_isKey;          // Is the string being parsed a key?
+	uint32_t     m_codePoint;      // The \u escape being accumulated.
+	uint8_t      m_hexCount;
+	uint32_t     m_highSurrogate;  // The first half of a UTF-16 surrogate pair, or 0.
+	const char*  m_literal;        // The literal (true/false/null) being matched.
+	uint8_t      m_literalIndex;
+	size_t       m_offset;         // Number of characters consumed.
+	const char*  m_error;
+}; // JsonParser
+
+
+/**
+ * @brief A JsonHandler that stores values from the document into variables.
+ *
+ * Each variable is bound to the dotted path of the value within the document.  Arrays of numbers or
+ * strings are bound to vectors.  Values that have no binding, or whose type doesn't match the
+ * binding, are skipped, so a document can be mapped onto a C++ struct without building a tree.
+ *
+ * @code{.cpp}
+ * struct Config {
+ *    std::string      ssid;
+ *    int              port = 80;
+ *    bool             dhcp = true;
+ *    std::vector<int> channels;
+ * } config;
+ *
+ * JsonBinder binder;
+ * binder.bind("wifi.ssid", &config.ssid);
+ * binder.bind("wifi.dhcp", &config.dhcp);
+ * binder.bind("port",      &config.port);
+ * binder.bind("channels",  &config.channels);
+ * JsonParser parser(&binder);
+ * std::string text = R"({"wifi": {"ssid": "home", "dhcp": false}, "port": 8080, "channels": [1, 6, 11]})";
+ * if (!parser.parse(text.data(), text.length()) || !parser.finish()) {
+ *    ESP_LOGE(tag, "Bad config: %s at offset %d", parser.getError(), parser.getOffset());
+ * }
+ * @endcode
+ */
+class JsonBinder : public JsonHandler {
+public:
+	JsonBinder();
+	void bind(std::string path, bool* pValue);
+	void bind(std::string path, int* pValue);
+	void bind(std::string path, double* pValue);
+	void bind(std::string path, std::string* pValue);
+	void bind(std::string path, std::vector<int>* pValue);
+	void bind(std::string path, std::vector<std::string>* pValue);
+
+	void onStartObject();
+	void onEndObject();
+	void onStartArray();
+	void onEndArray();
+	void onKey(const char* key, size_t length);
+	void onString(const char* value, size_t length);
+	void onNumber(double value);
+	void onBoolean(bool value);
+
+private:
+	enum Type {
+		TYPE_BOOLEAN,
+		TYPE_INT,
+		TYPE_DOUBLE,
+		TYPE_STRING,
+		TYPE_INT_ARRAY,
+		TYPE_STRING_ARRAY
+	};
+	struct Binding {
+		std::string path;
+		Type        type;
+		void*       pValue;
+	};
+	void     endContainer();
+	Binding* find(Type type);
+	bool     inArray();
+	void     startContainer(bool isObject);
+
+	std::vector<Binding> m_bindings;
+	std::string          m_path;                                 // Path of the value about to be reported.
+	size_t               m_pathLength[JSON_PARSER_MAX_DEPTH + 1]; // Length of the path of each open container.
+	uint32_t             m_containers;                           // One bit per nesting level, 1 for an object.
+	uint8_t              m_depth;
+}; // JsonBinder
+
+
+/**
+ * @brief A JSON writer that streams its output.
+ *
+ * Building a reply with JSON::createObject() allocates a cJSON node for every value and toString()
+ * then allocates the whole rendering.  A JsonWriter instead serializes each value as it is added
+ * into a fixed buffer held within the writer and, whenever that buffer fills, hands it to its sink:
+ * an HttpResponse, a Socket or a WebSocket (as a fragmented text message).  No heap memory is used.
+ * Commas, quoting and escaping are handled by the writer.  Objects and arrays nest at most
+ * JSON_WRITER_MAX_DEPTH deep; a deeper one stops the writer, which then writes nothing more and
+ * whose isValid() is false.
+ *
+ * @code{.cpp}
+ * void handleStatus(HttpRequest* pRequest, HttpResponse* pResponse) {
+ *    JsonWriter writer(pResponse);
+ *    writer.startObject();
+ *    writer.addString("ssid", ssid);
+ *    writer.addInt("rssi", rssi);
+ *    writer.startArray("clients");
+ *    for (auto& client : clients) {
+ *       writer.addString(client);
+ *    }
+ *    writer.endArray();
+ *    writer.endObject();
+ *    writer.end();
+ *    pResponse->close();
+ * }
+ * @endcode
+ */
+class JsonWriter {
+public:
+	JsonWriter(HttpResponse* pResponse);
+	JsonWriter(Socket* pSocket);
+	JsonWriter(WebSocket* pWebSocket);
+	~JsonWriter();
+
+	void addBoolean(bool value);
+	void addBoolean(const char* name, bool value);
+	void addDouble(double value);
+	void addDouble(const char* name, double value);
+	void addInt(int64_t value);
+	void addInt(const char* name, int64_t value);
+	void addNull();
+	void addNull(const char* name);
+	void addString(const char* value);
+	void addString(const std::string& value);
+	void addString(const char* name, const char* value);
+	void addString(const char* name, const std::string& value);
+	void end();
+	void endArray();
+	void endObject();
+	void flush();
+	bool isValid();
+	void startArray();
+	void startArray(const char* name);
+	void startObject();
+	void startObject(const char* name);
+
+private:
+	enum SinkType {
+		SINK_HTTP_RESPONSE,
+		SINK_SOCKET,
+		SINK_WEBSOCKET
+	};
+	void flush(bool isLast);
+	void startValue();
+	void write(char c);
+	void write(const char* pData, size_t length);
+	void writeName(const char* name);
+	void writeQuoted(const char* value, size_t length);
+
+	SinkType      m_sinkType;
+	HttpResponse* m_pResponse;
+	Socket*       m_pSocket;
+	WebSocket*    m_pWebSocket;
+	char          m_buffer[JSON_WRITER_BUFFER_SIZE];
+	size_t        m_length;       // Bytes in m_buffer waiting to be flushed.
+	uint32_t      m_hasElements;  // One bit per nesting level, set once the container has an element.
+	uint8_t       m_depth;
+	bool          m_afterName;    // A member name has just been written; the value needs no comma.
+	bool          m_flushed;      // Has anything been passed to the sink yet?
+	bool          m_ended;
+	bool          m_failed;       // Nesting went past JSON_WRITER_MAX_DEPTH; nothing more is written.
+}; // JsonWriter
+
+
 #endif /* COMPONENTS_CPP_UTILS_JSON_H_ */
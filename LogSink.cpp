@@ -0,0 +1,225 @@
+/*
+ * LogSink.cpp
+ *
+ *  Created on: Feb 14, 2018
+ *      Author: kolban
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include "FreeRTOS.h"
+#include "Task.h"
+#include "LogSink.h"
+
+#define LOG_SINK_REPORT_INTERVAL (1000)  // Least time between reports of dropped and suppressed lines (ms).
+
+static const char* LOG_TAG = "LogSink";
+
+/**
+ * @brief The rate at which one tag has been logging.
+ * Tokens are counted in thousandths of a line so that they can be topped up every millisecond.
+ */
+struct TagRate {
+	uint32_t hash;      // Hash of the tag, 0 for an unused entry.
+	uint32_t tokens;    // Thousandths of a line that may be logged now.
+	uint32_t lastTime;  // When the tokens were last topped up (ms).
+};
+
+static Ringbuffer*       pBuffer         = nullptr;
+static uint16_t          tagRate         = LOG_SINK_TAG_RATE;
+static TagRate           tagRates[LOG_SINK_TAGS];
+static portMUX_TYPE      tagLock         = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t droppedCount    = 0;
+static volatile uint32_t suppressedCount = 0;
+
+
+/**
+ * @brief Decide whether a tag may log another line.
+ * The tag is taken from the formatted line which, for ESP_LOGx, looks like "D (1234) tag: message".
+ * Errors are always allowed.
+ * @param [in] line The formatted line.
+ * @param [in] length The length of the line.
+ * @return True if the line may be logged.
+ */
+static bool allowLine(const char* line, size_t length) {
+	const char* pEnd   = line + length;
+	const char* pLevel = line;
+	if (*pLevel == '\033') {                             // Skip the color, if any.
+		pLevel = (const char*) memchr(line, 'm', length);
+		if (pLevel == nullptr) {
+			return true;
+		}
+		pLevel++;
+	}
+	if (pLevel >= pEnd || *pLevel == 'E') {
+		return true;
+	}
+	const char* pTag = (const char*) memchr(pLevel, ')', pEnd - pLevel);
+	if (pTag == nullptr) {
+		return true;
+	}
+	uint32_t hash = 2166136261u;                         // FNV-1a of the tag.
+	for (pTag += 2; pTag < pEnd && *pTag != ':'; pTag++) {
+		hash = (hash ^ (uint8_t) *pTag) * 16777619u;
+	}
+	if (hash == 0) {
+		hash = 1;
+	}
+
+	uint32_t now = FreeRTOS::getTimeSinceStart();
+	bool allowed = false;
+	portENTER_CRITICAL(&tagLock);
+	TagRate* pRate = nullptr;
+	for (int i = 0; i < LOG_SINK_TAGS; i++) {
+		if (tagRates[i].hash == hash) {
+			pRate = &tagRates[i];
+			break;
+		}
+		if (pRate == nullptr || tagRates[i].hash == 0 ||
+				(pRate->hash != 0 && now - tagRates[i].lastTime > now - pRate->lastTime)) {
+			pRate = &tagRates[i];                            // An unused or the least recently seen entry.
+		}
+	}
+	if (pRate->hash != hash) {
+		pRate->hash     = hash;
+		pRate->tokens   = tagRate * 1000;
+		pRate->lastTime = now;
+	}
+	if (now - pRate->lastTime >= 1000) {                // A second refills the bucket.
+		pRate->tokens = tagRate * 1000;
+	} else {
+		pRate->tokens += (now - pRate->lastTime) * tagRate;
+	}
+	if (pRate->tokens > tagRate * 1000u) {
+		pRate->tokens = tagRate * 1000;
+	}
+	pRate->lastTime = now;
+	if (pRate->tokens >= 1000) {
+		pRate->tokens -= 1000;
+		allowed = true;
+	} else {
+		suppressedCount++;
+	}
+	portEXIT_CRITICAL(&tagLock);
+	return allowed;
+} // allowLine
+
+
+/**
+ * @brief Replacement for the vprintf used by the ESP-IDF logging library.
+ * The line is formatted and queued for the drain task without waiting.
+ * @param [in] format The format of the line.
+ * @param [in] args The arguments of the format.
+ * @return The length of the formatted line.
+ */
+static int logVprintf(const char* format, va_list args) {
+	char line[LOG_SINK_LINE_SIZE];
+	int length = vsnprintf(line, sizeof(line), format, args);
+	if (length <= 0) {
+		return length;
+	}
+	if (length >= (int) sizeof(line)) {     // Truncated, but still end the line.
+		length = sizeof(line) - 1;
+		line[length - 1] = '\n';
+	}
+	if (!allowLine(line, length)) {
+		return length;
+	}
+	if (pBuffer->send(line, length, 0) != pdTRUE) {
+		portENTER_CRITICAL(&tagLock);
+		droppedCount++;
+		portEXIT_CRITICAL(&tagLock);
+	}
+	return length;
+} // logVprintf
+
+
+/**
+ * @brief The task that writes queued log lines to the console.
+ */
+class LogSinkTask: public Task {
+public:
+	LogSinkTask(): Task("LogSink", 2048, 1) {
+	}
+
+private:
+	void run(void* data) {
+		uint32_t reportedDropped    = 0;
+		uint32_t reportedSuppressed = 0;
+		uint32_t lastReport         = 0;
+		while (1) {
+			size_t size;
+			char* pLine = (char*) pBuffer->receive(&size, LOG_SINK_REPORT_INTERVAL / portTICK_PERIOD_MS);
+			if (pLine != nullptr) {
+				fwrite(pLine, 1, size, stdout);
+				pBuffer->returnItem(pLine);
+			}
+			// Don't log the report, it would be subject to the limits that it's reporting.
+			uint32_t now        = FreeRTOS::getTimeSinceStart();
+			uint32_t dropped    = droppedCount;
+			uint32_t suppressed = suppressedCount;
+			if ((dropped != reportedDropped || suppressed != reportedSuppressed) && now - lastReport >= LOG_SINK_REPORT_INTERVAL) {
+				printf("W (%u) LogSink: %u lines dropped, %u lines suppressed\n",
+					esp_log_timestamp(), dropped - reportedDropped, suppressed - reportedSuppressed);
+				reportedDropped    = dropped;
+				reportedSuppressed = suppressed;
+				lastReport         = now;
+			}
+		}
+	} // run
+}; // LogSinkTask
+
+
+/**
+ * @brief Get the number of lines dropped because the buffer was full.
+ * @return The number of lines dropped.
+ */
+uint32_t LogSink::getDroppedCount() {
+	return droppedCount;
+} // getDroppedCount
+
+
+/**
+ * @brief Get the number of lines suppressed because their tag was logging too quickly.
+ * @return The number of lines suppressed.
+ */
+uint32_t LogSink::getSuppressedCount() {
+	return suppressedCount;
+} // getSuppressedCount
+
+
+/**
+ * @brief Route all ESP_LOGx output through the sink.
+ * Installing the sink a second time has no effect.
+ * @param [in] bufferSize The bytes of log lines that can wait to be written.
+ * @param [in] tagRate The lines per second allowed from one tag.
+ */
+void LogSink::install(size_t bufferSize, uint16_t tagRate) {
+	if (pBuffer != nullptr) {
+		return;
+	}
+	memset(tagRates, 0, sizeof(tagRates));
+	setTagRate(tagRate);
+	Ringbuffer* pRingbuffer = new Ringbuffer(bufferSize);
+	if (!pRingbuffer->isValid()) {
+		delete pRingbuffer;
+		ESP_LOGE(LOG_TAG, "Unable to allocate a %d byte log buffer, the sink is not installed", bufferSize);
+		return;
+	}
+	pBuffer = pRingbuffer;
+	LogSinkTask* pTask = new LogSinkTask();
+	pTask->start();
+	::esp_log_set_vprintf(logVprintf);
+} // install
+
+
+/**
+ * @brief Set the rate at which one tag may log.
+ * A tag may log a burst of this many lines after which further lines are suppressed until it slows down.
+ * @param [in] linesPerSecond The lines per second allowed from one tag.
+ */
+void LogSink::setTagRate(uint16_t linesPerSecond) {
+	::tagRate = linesPerSecond;
+} // setTagRate
@@ -0,0 +1,43 @@
+/*
+ * LogSink.h
+ *
+ *  Created on: Feb 14, 2018
+ *      Author: kolban
+ */
+
+#ifndef COMPONENTS_CPP_UTILS_LOGSINK_H_
+#define COMPONENTS_CPP_UTILS_LOGSINK_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_SINK_BUFFER_SIZE (4096)  // Default bytes of log lines that can wait to be written.
+#define LOG_SINK_LINE_SIZE   (160)   // Longest log line; longer lines are truncated.
+#define LOG_SINK_TAG_RATE    (20)    // Default lines per second allowed from one tag.
+#define LOG_SINK_TAGS        (16)    // Tags whose rates are tracked; the least recently seen is forgotten.
+
+/**
+ * @brief Write log output from a background task so that logging never waits for the UART.
+ *
+ * Once installed, every ESP_LOGx line is formatted by the caller into a ring buffer and returns
+ * straight away.  A low priority task drains the buffer to the console.  A line that doesn't fit in
+ * the buffer is dropped rather than waiting for space, and each tag may only log so many lines per
+ * second with the rest suppressed.  Errors are never suppressed.  The numbers of dropped and suppressed
+ * lines are reported by the drain task as they happen.
+ *
+ * This lets debug logging stay enabled in code, such as socket handling, where writing each line at
+ * serial speed would otherwise throttle the network stack.
+ *
+ * @code{.cpp}
+ * LogSink::install();
+ * ESP_LOGD(tag, "This returns without waiting for the UART");
+ * @endcode
+ */
+class LogSink {
+public:
+	static uint32_t getDroppedCount();
+	static uint32_t getSuppressedCount();
+	static void     install(size_t bufferSize = LOG_SINK_BUFFER_SIZE, uint16_t tagRate = LOG_SINK_TAG_RATE);
+	static void     setTagRate(uint16_t linesPerSecond);
+};
+
+#endif /* COMPONENTS_CPP_UTILS_LOGSINK_H_ */
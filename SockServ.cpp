@@ -41,6 +41,7 @@ SockServ::SockServ() {
 	m_port        = 0;  // Unknown port.
 	m_acceptQueue = xQueueCreate(1, sizeof(Socket));
 	m_useSSL      = false;
+	m_pConnectionLimiter = nullptr;
 	m_clientSemaphore.take("SockServ");   // Create the queue; deleted in the destructor.
 } // SockServ
 
@@ -65,8 +66,8 @@ SockServ::~SockServ() {
 	try {
 		while(1) {
 			ESP_LOGD(LOG_TAG, "Waiting on accept");
-			Socket tempSock = pSockServ->m_serverSocket.accept();
-			if (!tempSock.isValid()) {
+			Socket tempSock = pSockServ->m_serverSocket.accept(pSockServ->m_pConnectionLimiter);
+			if (!tempSock.isValid()) {   // Includes connections rejected by the connection limiter.
 				continue;
 			}
 
@@ -98,7 +99,13 @@ int SockServ::connectedCount() {
  */
 void SockServ::disconnect(Socket s) {
 	auto search = m_clientSet.find(s);
+	if (search == m_clientSet.end()) {
+		return;
+	}
 	m_clientSet.erase(search);
+	if (m_pConnectionLimiter != nullptr) {
+		m_pConnectionLimiter->release();
+	}
 } // disconnect
 
 
@@ -149,6 +156,17 @@ void SockServ::sendData(uint8_t* data, size_t length) {
 } // sendData
 
 
+/**
+ * @brief Limit the connections accepted.
+ * Connections that the limiter doesn't admit are closed as soon as they are accepted.  An admitted
+ * connection counts as open until it is passed to disconnect().  Must be called before start().
+ * @param [in] pLimiter The limiter or nullptr for no limit.
+ */
+void SockServ::setConnectionLimiter(ConnectionLimiter* pLimiter) {
+	m_pConnectionLimiter = pLimiter;
+} // setConnectionLimiter
+
+
 /**
  * @brief Set the port number to use.
  * @param port The port number to use.
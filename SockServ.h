@@ -6,6 +6,7 @@
 #include <string>
 #include <set>
 #include "Socket.h"
+#include "ConnectionLimiter.h"
 #include "FreeRTOS.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
@@ -39,6 +40,7 @@ private:
 	std::set<Socket>    m_clientSet;
 	QueueHandle_t       m_acceptQueue;
 	bool                m_useSSL;
+	ConnectionLimiter*  m_pConnectionLimiter;
 
 public:
 	SockServ(uint16_t port);
@@ -50,6 +52,7 @@ public:
 	size_t receiveData(Socket s, void* pData, size_t maxData);
 	void   sendData(uint8_t* data, size_t length);
 	void   sendData(std::string str);
+	void   setConnectionLimiter(ConnectionLimiter* pLimiter);
 	void   setPort(uint16_t port);
 	void   setSSL(bool use=true);
 	void   start();
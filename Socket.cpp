@@ -17,11 +17,13 @@
 
 #include <errno.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <lwip/sockets.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <unistd.h>
+#include "ConnectionLimiter.h"
 #include "GeneralUtils.h"
 #include "SSLUtils.h"
 #include "sdkconfig.h"
@@ -55,13 +57,20 @@ Socket::~Socket() {
 
 /**
  * @brief Accept a new socket.
+ * If a limiter is given, it decides whether the new connection is admitted before any TLS handshake
+ * is performed.  A connection that isn't admitted is closed and an invalid socket is returned; the
+ * caller must release() the limiter when an admitted connection ends.
+ * @param [in] pLimiter The admission control for new connections or nullptr for none.
+ * @param [out] pAcceptTime If not nullptr, set to the time (esp_timer_get_time()) at which the
+ * connection arrived, before any TLS handshake.
+ * @return The socket of the new connection.
  */
-Socket Socket::accept() {
+Socket Socket::accept(ConnectionLimiter* pLimiter, int64_t* pAcceptTime) {
 	struct sockaddr addr;
 	getBind(&addr);
 	ESP_LOGD(LOG_TAG, ">> accept: Accepting on %s; sockFd: %d, using SSL: %d", addressToString(&addr).c_str(), m_sock, getSSL());
 	struct sockaddr_in client_addr;
-	socklen_t sin_size;
+	socklen_t sin_size = sizeof(client_addr);
 	int clientSockFD = ::lwip_accept_r(m_sock,  (struct sockaddr *)&client_addr, &sin_size);
 	//printf("------> new connection client %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
 	if (clientSockFD == -1) {
@@ -69,9 +78,17 @@ Socket Socket::accept() {
 		ESP_LOGE(LOG_TAG, "accept(): %s, m_sock=%d", strerror(errno), m_sock);
 		throw se;
 	}
+	if (pAcceptTime != nullptr) {
+		*pAcceptTime = esp_timer_get_time();
+	}
 
 	ESP_LOGD(LOG_TAG, " - accept: Received new client!: sockFd: %d", clientSockFD);
 	Socket newSocket;
+	if (pLimiter != nullptr && !pLimiter->admit(client_addr.sin_addr.s_addr)) {
+		::lwip_close_r(clientSockFD);
+		ESP_LOGD(LOG_TAG, "<< accept: Connection not admitted");
+		return newSocket;
+	}
 	newSocket.m_sock = clientSockFD;
 	if (getSSL()) {
 		newSocket.setSSL(true);
@@ -249,6 +266,20 @@ bool Socket::getSSL() const {
 	return m_useSSL;
 }
 
+/**
+ * @brief Get the address of the remote end of a connected socket.
+ * @return The IPv4 address in network byte order or 0 if it isn't known.
+ */
+uint32_t Socket::getPeerAddress() const {
+	struct sockaddr_in addr;
+	socklen_t size = sizeof(addr);
+	if (::lwip_getpeername_r(m_sock, (struct sockaddr*) &addr, &size) != 0) {
+		return 0;
+	}
+	return addr.sin_addr.s_addr;
+} // getPeerAddress
+
+
 bool Socket::isValid() {
 	return m_sock != -1;
 } // isValid
@@ -365,8 +396,8 @@ size_t Socket::receive(uint8_t* data, size_t length, bool exact) {
 		if (getSSL()) {
 			do {
 				rc = mbedtls_ssl_read(&m_sslContext, data, length);
-				ESP_LOGD(LOG_TAG, "rc=%d, MBEDTLS_ERR_SSL_WANT_READ=%d", rc, MBEDTLS_ERR_SSL_WANT_READ);
 			} while(rc == MBEDTLS_ERR_SSL_WANT_WRITE || rc == MBEDTLS_ERR_SSL_WANT_READ);
+			ESP_LOGV(LOG_TAG, "receive: mbedtls_ssl_read rc=%d", rc);
 		} else {
 			rc = ::lwip_recv_r(m_sock, data, length, 0);
 			if (rc == -1) {
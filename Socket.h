@@ -49,6 +49,8 @@ private:
 	int m_errno;
 };
 
+class ConnectionLimiter;
+
 /**
  * @brief Encapsulate a socket.
  *
@@ -61,7 +63,7 @@ public:
 	Socket();
 	virtual ~Socket();
 
-	Socket accept();
+	Socket accept(ConnectionLimiter* pLimiter = nullptr, int64_t* pAcceptTime = nullptr);
 	static std::string addressToString(struct sockaddr* addr);
 	int  bind(uint16_t port, uint32_t address);
 	int  close();
@@ -73,6 +75,7 @@ public:
 	int  setTimeout(uint32_t seconds);
 	void getBind(struct sockaddr* pAddr);
 	int  getFD() const;
+	uint32_t getPeerAddress() const;
 	bool getSSL() const;
 	bool isValid();
 	int  listen(uint16_t port, bool isDatagram=false, bool reuseAddress=false);
@@ -3,6 +3,10 @@
  *
  * See also:
  * * https://tools.ietf.org/html/rfc1350
+ * * https://tools.ietf.org/html/rfc2347 - Option extension
+ * * https://tools.ietf.org/html/rfc2348 - Blocksize option
+ * * https://tools.ietf.org/html/rfc2349 - Timeout interval and transfer size options
+ * * https://tools.ietf.org/html/rfc7440 - Windowsize option
  *  Created on: May 21, 2017
  *      Author: kolban
  */
@@ -15,6 +19,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include <Socket.h>
 
 #include "sdkconfig.h"
@@ -33,7 +39,8 @@ enum opcode {
 	TFTP_OPCODE_WRQ   = 2, // Write request
 	TFTP_OPCODE_DATA  = 3, // Data
 	TFTP_OPCODE_ACK   = 4, // Acknowledgement
-	TFTP_OPCODE_ERROR = 5  // Error
+	TFTP_OPCODE_ERROR = 5, // Error
+	TFTP_OPCODE_OACK  = 6  // Option acknowledgement (RFC 2347)
 };
 
 enum ERRORCODE {
@@ -44,157 +51,658 @@ enum ERRORCODE {
 	ERROR_CODE_ILLEGAL_OPERATION = 4,
 	ERROR_CODE_UNKNOWN_ID        = 5,
 	ERROR_CODE_FILE_EXISTS       = 6,
-	ERROR_CODE_UNKNOWN_USER      = 7
+	ERROR_CODE_UNKNOWN_USER      = 7,
+	ERROR_CODE_OPTION_REFUSED    = 8
 };
 
 /**
- * Size of the TFTP data payload.
+ * Results from receivePacket() other than a received length.
  */
-const int TFTP_DATA_SIZE=512;
-
-struct data_packet {
-	uint16_t blockNumber;
-	std::string data;
+enum RECEIVE_RESULT {
+	RECEIVE_IGNORED = -1, // The packet was not for this transaction and has been dealt with.
+	RECEIVE_ERROR   = -2  // A socket error or an error packet from the partner.  The transfer must end.
 };
 
+/**
+ * Size of the TFTP header (opcode and block number) preceding the data payload.
+ */
+const int TFTP_HEADER_SIZE = 4;
+
+/**
+ * Size of the largest request packet (RRQ/WRQ with options) we will accept.
+ */
+const int TFTP_REQUEST_SIZE = 512;
+
+
+/**
+ * @brief Determine if two addresses identify the same transfer partner (address and port).
+ * @param [in] pAddr1 The first address.
+ * @param [in] pAddr2 The second address.
+ * @return True if the addresses are the same.
+ */
+static bool isSameTID(struct sockaddr* pAddr1, struct sockaddr* pAddr2) {
+	struct sockaddr_in* pIn1 = (struct sockaddr_in*) pAddr1;
+	struct sockaddr_in* pIn2 = (struct sockaddr_in*) pAddr2;
+	return pIn1->sin_addr.s_addr == pIn2->sin_addr.s_addr && pIn1->sin_port == pIn2->sin_port;
+} // isSameTID
+
+
+/**
+ * @brief Build the key under which a transaction is tracked from its partner's address and port.
+ * @param [in] pAddr The partner address.
+ * @return The key.
+ */
+static uint64_t tidKey(struct sockaddr* pAddr) {
+	struct sockaddr_in* pIn = (struct sockaddr_in*) pAddr;
+	return ((uint64_t) ntohl(pIn->sin_addr.s_addr) << 16) | ntohs(pIn->sin_port);
+} // tidKey
+
+
+/**
+ * @brief Send an error packet to an address.
+ * @param [in] pSocket The socket to send through.
+ * @param [in] pAddr The address to send to.
+ * @param [in] code Error code to send.
+ * @param [in] message Explanation message.
+ * @return N/A.
+ */
+static void sendErrorTo(Socket* pSocket, struct sockaddr* pAddr, uint16_t code, std::string message) {
+/*
+ *  2 bytes     2 bytes      string    1 byte
+ *  -----------------------------------------
+ * | Opcode |  ErrorCode |   ErrMsg   |   0  |
+ *  -----------------------------------------
+ */
+	int size = 2  + 2 + message.length() + 1;
+	uint8_t *buf = (uint8_t *)malloc(size);
+	*(uint16_t *)(&buf[0]) = htons(opcode::TFTP_OPCODE_ERROR);
+	*(uint16_t *)(&buf[2]) = htons(code);
+	strcpy((char *)(&buf[4]), message.c_str());
+	pSocket->sendTo(buf, size, pAddr);
+	free(buf);
+} // sendErrorTo
 
 
 TFTP::TFTP() {
-	m_baseDir = "";
+	m_baseDir         = "";
+	m_maxBlockSize    = TFTP_MAX_BLKSIZE;
+	m_maxWindowSize   = TFTP_MAX_WINDOWSIZE;
+	m_maxTransactions = TFTP_MAX_TRANSACTIONS;
 }
 
 TFTP::~TFTP() {
+	for (auto& entry : m_transactions) {
+		delete entry.second;
+	}
 }
 
+
+/**
+ * @brief Receive a request on the server socket and start a transaction for it.
+ *
+ * A request from a client that already has a transaction in progress is a retransmission of
+ * its original request and is ignored; the transaction's own timer will resend our response.
+ *
+ * @param [in] pServerSocket The server socket on which a request is waiting.
+ * @return N/A.
+ */
+void TFTP::acceptRequest(Socket* pServerSocket) {
+	uint8_t buf[TFTP_REQUEST_SIZE + 1];
+	struct sockaddr partnerAddress;
+
+	int length = pServerSocket->receiveFrom(buf, TFTP_REQUEST_SIZE, &partnerAddress);
+	if (length < 4) {
+		ESP_LOGE(tag, "acceptRequest: Request too short: %d", length);
+		return;
+	}
+	buf[length] = 0; // Guarantee termination of the final string.
+
+	uint64_t key = tidKey(&partnerAddress);
+	if (m_transactions.find(key) != m_transactions.end()) {
+		ESP_LOGD(tag, "Ignoring repeated request from %s", Socket::addressToString(&partnerAddress).c_str());
+		return;
+	}
+	if (m_transactions.size() >= m_maxTransactions) {
+		ESP_LOGW(tag, "Refusing request from %s, %d transfers in progress",
+			Socket::addressToString(&partnerAddress).c_str(), m_transactions.size());
+		sendErrorTo(pServerSocket, &partnerAddress, ERROR_CODE_NOTDEFINED, "Server busy");
+		return;
+	}
+
+	TFTP_Transaction *pTFTPTransaction = new TFTP_Transaction();
+	pTFTPTransaction->setBaseDir(m_baseDir);
+	pTFTPTransaction->setMaxBlockSize(m_maxBlockSize);
+	pTFTPTransaction->setMaxWindowSize(m_maxWindowSize);
+	uint16_t receivedOpCode = pTFTPTransaction->parseRequest(buf, length, &partnerAddress);
+	switch(receivedOpCode) {
+	// Handle the write request (client file upload)
+		case opcode::TFTP_OPCODE_WRQ: {
+			pTFTPTransaction->processWRQ();
+			break;
+		}
+
+	// Handle the read request (server file download)
+		case opcode::TFTP_OPCODE_RRQ: {
+			pTFTPTransaction->processRRQ();
+			break;
+		}
+
+		default: {
+			sendErrorTo(pServerSocket, &partnerAddress, ERROR_CODE_ILLEGAL_OPERATION, "Expected RRQ or WRQ");
+			break;
+		}
+	}
+	if (pTFTPTransaction->isFinished()) {
+		delete pTFTPTransaction;
+	} else {
+		m_transactions[key] = pTFTPTransaction;
+	}
+} // acceptRequest
+
+
 /**
  * @brief Start a TFTP transaction.
  * @return N/A.
  */
 TFTP::TFTP_Transaction::TFTP_Transaction() {
-	m_baseDir  = "";
-	m_filename = "";
-	m_mode     = "";
-	m_opCode   = -1;
+	m_baseDir       = "";
+	m_filename      = "";
+	m_mode          = "";
+	m_opCode        = -1;
+	m_blockSize     = TFTP_DEFAULT_BLKSIZE;
+	m_windowSize    = TFTP_DEFAULT_WINDOWSIZE;
+	m_timeout       = TFTP_DEFAULT_TIMEOUT;
+	m_maxBlockSize  = TFTP_MAX_BLKSIZE;
+	m_maxWindowSize = TFTP_MAX_WINDOWSIZE;
+	m_state         = STATE_DONE;
+	m_file          = nullptr;
+	m_buffer        = nullptr;
+	m_sendTime      = 0;
+	m_retries       = 0;
+	m_baseBlock     = 0;
+	m_nextBlock     = 0;
+	m_lastBlock     = 0;
+	m_fileBlock     = 0;
+	m_resentFrom    = 0;
+	m_windowCount   = 0;
+	m_gapAcked      = false;
 } // TFTP_Transaction
 
 
+TFTP::TFTP_Transaction::~TFTP_Transaction() {
+	finish();
+} // ~TFTP_Transaction
+
+
 /**
- * @brief Process a client read request.
+ * @brief Release the resources of the transaction and mark it as done.
  * @return N/A.
  */
+void TFTP::TFTP_Transaction::finish() {
+	if (m_file != nullptr) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+	if (m_buffer != nullptr) {
+		free(m_buffer);
+		m_buffer = nullptr;
+	}
+	if (m_partnerSocket.isValid()) {
+		m_partnerSocket.close();
+	}
+	m_state = STATE_DONE;
+} // finish
 
-void TFTP::TFTP_Transaction::processRRQ() {
-/*
- *   2 bytes     2 bytes     n bytes
- *  ----------------------------------
- * | Opcode |   Block #  |   Data     |
- *  ----------------------------------
+
+/**
+ * @brief Get the time at which the transaction will time out if nothing arrives.
+ * @return The deadline in milliseconds since start (see FreeRTOS::getTimeSinceStart()).
+ */
+uint32_t TFTP::TFTP_Transaction::getDeadline() {
+	return m_sendTime + m_timeout * 1000;
+} // getDeadline
+
+
+/**
+ * @brief Get the file descriptor of the socket on which the transaction receives.
+ * @return The file descriptor.
+ */
+int TFTP::TFTP_Transaction::getFD() {
+	return m_partnerSocket.getFD();
+} // getFD
+
+
+/**
+ * @brief Process an acknowledgment received during a read request.
+ *
+ * An acknowledgment of the whole window slides the window forward.  An acknowledgment of only part
+ * of the window (the client noticed a gap) causes us to resume sending from the block after the
+ * last one acknowledged.
  *
+ * @param [in] blockNumber The block number that was acknowledged.
+ * @return N/A.
  */
-	FILE *file;
-	bool finished = false;
+void TFTP::TFTP_Transaction::handleAck(uint16_t blockNumber) {
+	if (m_state == STATE_OPTION_ACK) {
+		if (blockNumber == 0) {
+			m_state   = STATE_TRANSFER;
+			m_retries = 0;
+			sendWindow();
+		}
+		return;
+	}
 
-	ESP_LOGD(tag, "Reading TFTP data from file: %s", m_filename.c_str());
-	std::string tmpName = m_baseDir + "/" + m_filename;
-	/*
-	struct stat buf;
-	if (stat(tmpName.c_str(), &buf) != 0) {
-		ESP_LOGE(tag, "Stat file: %s: %s", tmpName.c_str(), strerror(errno));
+	// Map the 16 bit block number onto the outstanding range [m_baseBlock-1, m_nextBlock-1].
+	// Anything outside of that range is a stale acknowledgment of an earlier window.  Ignored
+	// acks deliberately leave m_sendTime alone so they can't postpone the retransmission.
+	uint16_t acked = (uint16_t)(blockNumber - (uint16_t)(m_baseBlock - 1));
+	if (acked > m_nextBlock - m_baseBlock) {
+		ESP_LOGD(tag, "processRRQ: Ignoring stale ack for block %d", blockNumber);
+		return;
+	}
+	if (acked == 0) {
+		// A duplicate of the previous ack means the client lost the first block of the window.
+		// Resend the window only once per window base; answering every duplicate would lead
+		// to the "Sorcerer's Apprentice" packet storm.
+		if (m_resentFrom != m_baseBlock) {
+			ESP_LOGD(tag, "processRRQ: Duplicate ack for block %d, resending window", blockNumber);
+			m_resentFrom = m_baseBlock;
+			m_nextBlock  = m_baseBlock;
+			sendWindow();
+		}
 		return;
 	}
-	int length = buf.st_size;
-	*/
 
-	int blockNumber = 1;
+	m_baseBlock += acked;
+	m_retries = 0;
+	if (m_lastBlock != 0 && m_baseBlock > m_lastBlock) {
+		ESP_LOGD(tag, "File sent");
+		finish();
+		return;
+	}
+	// A partial window ack means the client dropped everything after the gap.
+	m_nextBlock = m_baseBlock;
+	sendWindow();
+} // handleAck
 
-	file = fopen(tmpName.c_str(), "r");
-	if (file == nullptr) {
-		ESP_LOGE(tag, "Failed to open file for reading: %s: %s", tmpName.c_str(), strerror(errno));
-		sendError(ERROR_CODE_FILE_NOT_FOUND, tmpName);
+
+/**
+ * @brief Process a data block received during a write request.
+ *
+ * Data blocks are written to the file as they arrive in order.  We acknowledge after every
+ * m_windowSize blocks, after the final short block, and, once, when a block arrives out of
+ * order so that the client can resume from the last block we hold.
+ *
+ * @param [in] blockNumber The block number of the data in m_buffer.
+ * @param [in] dataLength The length of the data following the header in m_buffer.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::handleData(uint16_t blockNumber, size_t dataLength) {
+/*
+ *        2 bytes    2 bytes       n bytes
+ *        ---------------------------------
+ * DATA  |  03   |   Block #  |    Data    |
+ *        ---------------------------------
+ * The opcode for data is 0x03 - TFTP_OPCODE_DATA
+ */
+	if (blockNumber != (uint16_t)(m_baseBlock + 1)) {
+		// Out of order or duplicate block.  Tell the client where we are, once per gap unless
+		// the client is still sending stale blocks a full timeout after our last ack (it was lost).
+		ESP_LOGD(tag, "processWRQ: Received block %d but expected %d", blockNumber, (uint16_t)(m_baseBlock + 1));
+		if (!m_gapAcked || (int32_t)(FreeRTOS::getTimeSinceStart() - getDeadline()) >= 0) {
+			sendAck((uint16_t) m_baseBlock);
+			m_gapAcked    = true;
+			m_windowCount = 0;
+		}
 		return;
 	}
 
-	struct {
-		uint16_t opCode;
-		uint16_t blockNumber;
-		uint8_t buf[TFTP_DATA_SIZE];
-	} record;
+	if (fwrite(&m_buffer[TFTP_HEADER_SIZE], 1, dataLength, m_file) != dataLength) {
+		ESP_LOGE(tag, "processWRQ: Write failed: %s", strerror(errno));
+		sendError(ERROR_CODE_NO_SPACE, "Write failed");
+		finish();
+		return;
+	}
+	m_baseBlock++;
+	m_windowCount++;
+	m_retries  = 0;
+	m_gapAcked = false;
+	ESP_LOGD(tag, "Block: %d, size: %d", blockNumber, dataLength);
+
+	if (dataLength < m_blockSize) {
+		// The final block.  Close the file now so that it is complete while we dally.
+		fclose(m_file);
+		m_file = nullptr;
+		sendAck(blockNumber);
+		m_state = STATE_DALLY;
+		return;
+	}
+	if (m_windowCount >= m_windowSize) {
+		sendAck(blockNumber);
+		m_windowCount = 0;
+	}
+} // handleData
 
-	record.opCode = htons(TFTP_OPCODE_DATA); // Set the op code to be DATA.
 
-	while(!finished) {
+/**
+ * @brief Determine if the transaction has completed (successfully or not).
+ * @return True if the transaction has completed and can be deleted.
+ */
+bool TFTP::TFTP_Transaction::isFinished() {
+	return m_state == STATE_DONE;
+} // isFinished
 
-		record.blockNumber = htons(blockNumber);
 
-		int sizeRead = fread(record.buf, 1, TFTP_DATA_SIZE, file);
+/**
+ * @brief Handle a packet waiting on the transaction's socket.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::onReceive() {
+	if (m_opCode == TFTP_OPCODE_RRQ) {
+		struct {
+			uint16_t opCode;
+			uint16_t blockNumber;
+		} ackData;
+
+		int sizeRead = receivePacket((uint8_t *)&ackData, sizeof(ackData));
+		if (sizeRead == RECEIVE_IGNORED) {
+			return;
+		}
+		if (sizeRead == RECEIVE_ERROR) {
+			finish();
+			return;
+		}
+		if (sizeRead != sizeof(ackData) || ntohs(ackData.opCode) != opcode::TFTP_OPCODE_ACK) {
+			ESP_LOGE(tag, "processRRQ: Expected an ACK packet");
+			sendError(ERROR_CODE_ILLEGAL_OPERATION, "Expected ACK");
+			finish();
+			return;
+		}
+		handleAck(ntohs(ackData.blockNumber));
+		return;
+	}
+
+	int receivedSize = receivePacket(m_buffer, TFTP_HEADER_SIZE + m_blockSize);
+	if (receivedSize == RECEIVE_IGNORED) {
+		return;
+	}
+	if (receivedSize == RECEIVE_ERROR) {
+		finish();
+		return;
+	}
+	if (receivedSize < TFTP_HEADER_SIZE || ntohs(*(uint16_t*)(&m_buffer[0])) != TFTP_OPCODE_DATA) {
+		ESP_LOGE(tag, "processWRQ: Expected a DATA packet");
+		sendError(ERROR_CODE_ILLEGAL_OPERATION, "Expected DATA");
+		finish();
+		return;
+	}
+	uint16_t blockNumber = ntohs(*(uint16_t*)(&m_buffer[2]));
+	if (m_state == STATE_DALLY) {
+		// Our final ack was lost and the client resent its last block.
+		if (blockNumber == (uint16_t) m_baseBlock) {
+			sendAck(blockNumber);
+		}
+		return;
+	}
+	handleData(blockNumber, receivedSize - TFTP_HEADER_SIZE);
+} // onReceive
 
-		ESP_LOGD(tag, "Sending data to %s, blockNumber=%d, size=%d",
-				Socket::addressToString(&m_partnerAddress).c_str(), blockNumber, sizeRead);
 
-		m_partnerSocket.sendTo((uint8_t*)&record, sizeRead+4, &m_partnerAddress);
+/**
+ * @brief Handle the expiry of the transaction's deadline with nothing received.
+ * We resend whatever the partner should have replied to.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::onTimeout() {
+	if (m_state == STATE_DALLY) {
+		ESP_LOGD(tag, "File received");
+		finish();
+		return;
+	}
+	if (++m_retries > TFTP_MAX_RETRIES) {
+		ESP_LOGE(tag, "Too many retransmissions to %s", Socket::addressToString(&m_partnerAddress).c_str());
+		sendError(ERROR_CODE_NOTDEFINED, "Timeout");
+		finish();
+		return;
+	}
+	if (m_state == STATE_OPTION_ACK || (m_opCode == TFTP_OPCODE_WRQ && m_baseBlock == 0 && !m_options.empty())) {
+		sendOptionAck();
+	} else if (m_opCode == TFTP_OPCODE_RRQ) {
+		ESP_LOGD(tag, "processRRQ: Timeout, resending from block %d", m_baseBlock);
+		m_nextBlock = m_baseBlock;
+		sendWindow();
+	} else {
+		sendAck((uint16_t) m_baseBlock);
+		m_windowCount = 0;
+	}
+} // onTimeout
 
 
-		if (sizeRead < TFTP_DATA_SIZE) {
-			finished = true;
-		} else {
-			waitForAck(blockNumber);
+/**
+ * @brief Parse the options that follow the filename and mode in a request.
+ *
+ * Each option is a pair of null terminated strings; a name and a value.  Options we understand are
+ * clamped to our limits and recorded in m_options so that they can be acknowledged.  Options we
+ * don't understand are silently ignored as required by RFC 2347.
+ *
+ * @param [in] pData The first byte after the mode string.
+ * @param [in] length The number of bytes remaining in the request.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::parseOptions(const uint8_t* pData, size_t length) {
+	const char* p   = (const char*) pData;
+	const char* end = p + length;
+	while (p < end) {
+		const char* pName = p;
+		const char* pNameEnd = (const char*) memchr(pName, 0, end - pName);
+		if (pNameEnd == nullptr || pNameEnd + 1 >= end) break;
+		const char* pValue = pNameEnd + 1;
+		const char* pValueEnd = (const char*) memchr(pValue, 0, end - pValue);
+		if (pValueEnd == nullptr) break;
+		p = pValueEnd + 1;
+
+		std::string name(pName);
+		GeneralUtils::toLower(name);
+		long value = strtol(pValue, nullptr, 10);
+		ESP_LOGD(tag, "Option: %s=%s", name.c_str(), pValue);
+
+		if (name == "blksize") {
+			if (value < 8 || value > 65464) continue;
+			if (value > m_maxBlockSize) value = m_maxBlockSize;
+			m_blockSize = value;
+			m_options.push_back(std::make_pair(name, std::to_string(value)));
+		} else if (name == "windowsize") {
+			if (value < 1 || value > 65535) continue;
+			if (value > m_maxWindowSize) value = m_maxWindowSize;
+			m_windowSize = value;
+			m_options.push_back(std::make_pair(name, std::to_string(value)));
+		} else if (name == "timeout") {
+			if (value < 1 || value > 255) continue;
+			m_timeout = value;
+			m_options.push_back(std::make_pair(name, std::to_string(value)));
+		} else if (name == "tsize") {
+			if (value < 0) continue;
+			// For a RRQ the value is filled in with the file size once the file has been opened.
+			m_options.push_back(std::make_pair(name, std::to_string(value)));
 		}
-		blockNumber++; // Increment the block number.
 	}
-	ESP_LOGD(tag, "File sent");
-} // processRRQ
+} // parseOptions
 
 
 /**
- * @brief Process a client write request.
- * @return N/A.
+ * @brief Parse a client request.
+ * A %TFTP server waits for requests to send or receive files.  A request can be
+ * either WRQ (write request) which is a request from the client to write a new local
+ * file or it can be a RRQ (read request) which is a request from the client to
+ * read a local file.  For either we create the socket on which the transfer will take place.
+ * @param [in] pData The request packet.  It must be followed by a terminating null byte.
+ * @param [in] length The length of the request packet.
+ * @param [in] pPartnerAddress The address from which the request was received.
+ * @return The op code received.
  */
-void TFTP::TFTP_Transaction::processWRQ() {
+uint16_t TFTP::TFTP_Transaction::parseRequest(uint8_t* pData, size_t length, struct sockaddr* pPartnerAddress) {
 /*
- *        2 bytes    2 bytes       n bytes
- *        ---------------------------------
- * DATA  |  03   |   Block #  |    Data    |
- *        ---------------------------------
- * The opcode for data is 0x03 - TFTP_OPCODE_DATA
+ *        2 bytes    string   1 byte     string   1 byte   string  1 byte  string  1 byte
+ *        -------------------------------------------------------------------------------
+ * RRQ/  | 01/02 |  Filename  |   0  |    Mode    |   0  |  opt1  |   0  | value1 |   0  | ...
+ * WRQ    -------------------------------------------------------------------------------
  */
-	struct recv_data {
-		uint16_t opCode;
-		uint16_t blockNumber;
-		uint8_t  data;
-	} *pRecv_data;
+	m_partnerAddress = *pPartnerAddress;
 
-	struct sockaddr recvAddr;
-	uint8_t dataBuffer[TFTP_DATA_SIZE + 2 + 2];
-	bool finished = false;
+	// Save the filename, mode and op code.
 
-	FILE *file;
+	m_filename = std::string((char *)(pData + 2));
+	size_t modeOffset = 3 + m_filename.length();
+	if (modeOffset < length) {
+		m_mode = std::string((char *)(pData + modeOffset));
+		size_t optionsOffset = modeOffset + m_mode.length() + 1;
+		if (optionsOffset < length) {
+			parseOptions(pData + optionsOffset, length - optionsOffset);
+		}
+	}
+	m_opCode = ntohs(*(uint16_t*)pData);
+	switch(m_opCode) {
 
+		// Handle the Write Request command.
+		case TFTP_OPCODE_WRQ:
+		// Handle the Read request command.
+		case TFTP_OPCODE_RRQ: {
+			m_partnerSocket.createSocket(true);
+			m_partnerSocket.bind(0, INADDR_ANY);
+			break;
+		}
+
+		default: {
+			ESP_LOGD(tag, "Un-handled opcode: %d", m_opCode);
+			break;
+		}
+	}
+	return m_opCode;
+} // parseRequest
+
+
+/**
+ * @brief Start processing a client read request.
+ *
+ * Blocks are sent in windows of m_windowSize blocks after which we wait for an acknowledgment.
+ * Blocks are re-read from the file rather than held in memory so RAM use is a single block
+ * regardless of the window size.  When the client asked for options we answer with an OACK
+ * rather than the first data block and the client confirms the OACK with an ACK of block 0.
+ *
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::processRRQ() {
+	ESP_LOGD(tag, "Reading TFTP data from file: %s", m_filename.c_str());
+	std::string tmpName = m_baseDir + "/" + m_filename;
+
+	m_file = fopen(tmpName.c_str(), "r");
+	if (m_file == nullptr) {
+		ESP_LOGE(tag, "Failed to open file for reading: %s: %s", tmpName.c_str(), strerror(errno));
+		sendError(ERROR_CODE_FILE_NOT_FOUND, tmpName);
+		finish();
+		return;
+	}
+
+	m_buffer = (uint8_t*) malloc(TFTP_HEADER_SIZE + m_blockSize);
+	if (m_buffer == nullptr) {
+		ESP_LOGE(tag, "processRRQ: Unable to allocate block buffer of %d bytes", m_blockSize);
+		sendError(ERROR_CODE_NOTDEFINED, "Out of memory");
+		finish();
+		return;
+	}
+	*(uint16_t*)(&m_buffer[0]) = htons(TFTP_OPCODE_DATA); // Set the op code to be DATA.
+
+	// Block numbers are tracked as 32 bit values so that files of more than 65535 blocks can
+	// be sent.  Only the low 16 bits go on the wire.
+	m_baseBlock  = 1;
+	m_nextBlock  = 1;
+	m_lastBlock  = 0;
+	m_fileBlock  = 1;
+	m_resentFrom = 0;
+
+	if (m_options.empty()) {
+		m_state = STATE_TRANSFER;
+		sendWindow();
+		return;
+	}
+	for (auto& option : m_options) {
+		if (option.first == "tsize") {
+			struct stat buf;
+			if (stat(tmpName.c_str(), &buf) == 0) {
+				option.second = std::to_string(buf.st_size);
+			}
+		}
+	}
+	m_state = STATE_OPTION_ACK;
+	sendOptionAck();
+} // processRRQ
+
+
+/**
+ * @brief Start processing a client write request.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::processWRQ() {
 	ESP_LOGD(tag, "Writing TFTP data to file: %s", m_filename.c_str());
 	std::string tmpName = m_baseDir + "/" + m_filename;
-	file = fopen(tmpName.c_str(), "w");
-	if (file == nullptr) {
+	m_file = fopen(tmpName.c_str(), "w");
+	if (m_file == nullptr) {
 		ESP_LOGE(tag, "Failed to open file for writing: %s: %s", tmpName.c_str(), strerror(errno));
+		sendError(ERROR_CODE_ACCESS_VIOLATION, tmpName);
+		finish();
 		return;
 	}
-	while(!finished) {
-		pRecv_data = (struct recv_data *)dataBuffer;
-		int receivedSize = m_partnerSocket.receiveFrom(dataBuffer, sizeof(dataBuffer), &recvAddr);
-		if (receivedSize == -1) {
-			ESP_LOGE(tag, "rc == -1 from receive_from");
-		}
-		struct data_packet dp;
-		dp.blockNumber = ntohs(pRecv_data->blockNumber);
-		dp.data = std::string((char *)&pRecv_data->data, receivedSize-4);
-		fwrite(dp.data.data(), dp.data.length(), 1, file);
-		sendAck(dp.blockNumber);
-		ESP_LOGD(tag, "Block size: %d", dp.data.length());
-		if (dp.data.length() < TFTP_DATA_SIZE) {
-			finished = true;
-		}
-	} // Finished
-	fclose(file);
-	m_partnerSocket.close();
-} // process
+
+	m_buffer = (uint8_t*) malloc(TFTP_HEADER_SIZE + m_blockSize);
+	if (m_buffer == nullptr) {
+		ESP_LOGE(tag, "processWRQ: Unable to allocate block buffer of %d bytes", m_blockSize);
+		sendError(ERROR_CODE_NOTDEFINED, "Out of memory");
+		finish();
+		return;
+	}
+
+	m_baseBlock   = 0;
+	m_windowCount = 0;
+	m_gapAcked    = false;
+	m_state       = STATE_TRANSFER;
+
+	// Tell the client to start sending.  With options this is an OACK, otherwise an ACK of block 0.
+	if (m_options.empty()) {
+		sendAck(0);
+	} else {
+		sendOptionAck();
+	}
+} // processWRQ
+
+
+/**
+ * @brief Receive a packet from our transfer partner.
+ *
+ * Packets arriving from any other address or port are answered with an "Unknown transfer ID"
+ * error and otherwise ignored.  An ERROR packet from the partner terminates the transfer.
+ *
+ * @param [in] pData The buffer into which to receive.
+ * @param [in] length The size of the buffer.
+ * @return The size of the packet received, RECEIVE_IGNORED or RECEIVE_ERROR.
+ */
+int TFTP::TFTP_Transaction::receivePacket(uint8_t* pData, size_t length) {
+	struct sockaddr recvAddr;
+	int rc = m_partnerSocket.receiveFrom(pData, length, &recvAddr);
+	if (rc < 0) {
+		ESP_LOGE(tag, "receivePacket: %s", strerror(errno));
+		return RECEIVE_ERROR;
+	}
+	if (!isSameTID(&recvAddr, &m_partnerAddress)) {
+		ESP_LOGD(tag, "receivePacket: Packet from unknown partner %s", Socket::addressToString(&recvAddr).c_str());
+		sendErrorTo(&m_partnerSocket, &recvAddr, ERROR_CODE_UNKNOWN_ID, "Unknown transfer ID");
+		return RECEIVE_IGNORED;
+	}
+	if (rc >= 2 && ntohs(*(uint16_t*)(&pData[0])) == TFTP_OPCODE_ERROR) {
+		ESP_LOGE(tag, "receivePacket: Partner reported error %d", rc >= 4 ? ntohs(*(uint16_t*)(&pData[2])) : 0);
+		return RECEIVE_ERROR;
+	}
+	return rc;
+} // receivePacket
 
 
 /**
@@ -215,9 +723,80 @@ void TFTP::TFTP_Transaction::sendAck(uint16_t blockNumber) {
 
 	ESP_LOGD(tag, "Sending ack to %s, blockNumber=%d", Socket::addressToString(&m_partnerAddress).c_str(), blockNumber);
 	m_partnerSocket.sendTo((uint8_t *)&ackData, sizeof(ackData), &m_partnerAddress);
+	m_sendTime = FreeRTOS::getTimeSinceStart();
 } // sendAck
 
 
+/**
+ * @brief Send an error indication to the client.
+ * @param [in] code Error code to send to the client.
+ * @param [in] message Explanation message.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::sendError(uint16_t code, std::string message) {
+	sendErrorTo(&m_partnerSocket, &m_partnerAddress, code, message);
+} // sendError
+
+
+/**
+ * @brief Send an option acknowledgment listing the options we accepted.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::sendOptionAck() {
+/*
+ *   2 bytes    string   1 byte  string  1 byte
+ *  ----------------------------------------------
+ * | Opcode |  opt1  |   0   |  value1 |   0   | ...
+ *  ----------------------------------------------
+ */
+	std::string packet;
+	packet += (char) 0;
+	packet += (char) TFTP_OPCODE_OACK;
+	for (auto& option : m_options) {
+		packet += option.first;
+		packet += (char) 0;
+		packet += option.second;
+		packet += (char) 0;
+	}
+	ESP_LOGD(tag, "Sending OACK to %s", Socket::addressToString(&m_partnerAddress).c_str());
+	m_partnerSocket.sendTo((uint8_t*) packet.data(), packet.length(), &m_partnerAddress);
+	m_sendTime = FreeRTOS::getTimeSinceStart();
+} // sendOptionAck
+
+
+/**
+ * @brief Send every block of the current window that has not yet been sent.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::sendWindow() {
+/*
+ *   2 bytes     2 bytes     n bytes
+ *  ----------------------------------
+ * | Opcode |   Block #  |   Data     |
+ *  ----------------------------------
+ *
+ */
+	while (m_nextBlock < m_baseBlock + m_windowSize && (m_lastBlock == 0 || m_nextBlock <= m_lastBlock)) {
+		if (m_fileBlock != m_nextBlock) {
+			fseek(m_file, (long)(m_nextBlock - 1) * m_blockSize, SEEK_SET);
+		}
+		size_t sizeRead = fread(&m_buffer[TFTP_HEADER_SIZE], 1, m_blockSize, m_file);
+		m_fileBlock = m_nextBlock + 1;
+		*(uint16_t*)(&m_buffer[2]) = htons((uint16_t) m_nextBlock);
+
+		ESP_LOGD(tag, "Sending data to %s, blockNumber=%d, size=%d",
+				Socket::addressToString(&m_partnerAddress).c_str(), m_nextBlock, sizeRead);
+
+		m_partnerSocket.sendTo(m_buffer, sizeRead + TFTP_HEADER_SIZE, &m_partnerAddress);
+		m_sendTime = FreeRTOS::getTimeSinceStart();
+		if (sizeRead < m_blockSize) {
+			m_lastBlock = m_nextBlock;
+		}
+		m_nextBlock++;
+	}
+} // sendWindow
+
+
 /**
  * @brief Start being a TFTP server.
  *
@@ -228,33 +807,66 @@ void TFTP::TFTP_Transaction::sendAck(uint16_t blockNumber) {
  */
 void TFTP::start(uint16_t port) {
 /*
- * Loop forever.  At the start of the loop we block waiting for an incoming client request.
- * The requests that we are expecting are either a request to read a file from the server
- * or write a file to the server.  Once we have received a request we then call the appropriate
- * handler to handle that type of request.  When the request has been completed, we start again.
+ * Loop forever.  Each time around the loop we wait until either a new request arrives on the server
+ * socket, a packet arrives for one of the transactions in progress or the earliest retransmission
+ * deadline passes.  Whatever happened is passed to the owning transaction and transactions that have
+ * completed are discarded.
  */
 	ESP_LOGD(tag, "Starting TFTP::start() on port %d", port);
 	Socket serverSocket;
 	serverSocket.listen(port, true); // Create a listening socket that is a datagram.
 	while(true) {
-		// This would be a good place to start a transaction in the background.
-		TFTP_Transaction *pTFTPTransaction = new TFTP_Transaction();
-		pTFTPTransaction->setBaseDir(m_baseDir);
-		uint16_t receivedOpCode = pTFTPTransaction->waitForRequest(&serverSocket);
-		switch(receivedOpCode) {
-		// Handle the write request (client file upload)
-			case opcode::TFTP_OPCODE_WRQ: {
-				pTFTPTransaction->processWRQ();
-				break;
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(serverSocket.getFD(), &readSet);
+		int maxFd = serverSocket.getFD();
+
+		uint32_t now  = FreeRTOS::getTimeSinceStart();
+		int32_t  wait = -1; // Milliseconds until the earliest deadline, -1 if there is none.
+		for (auto& entry : m_transactions) {
+			int fd = entry.second->getFD();
+			FD_SET(fd, &readSet);
+			if (fd > maxFd) {
+				maxFd = fd;
+			}
+			int32_t remaining = (int32_t)(entry.second->getDeadline() - now);
+			if (remaining < 0) {
+				remaining = 0;
+			}
+			if (wait < 0 || remaining < wait) {
+				wait = remaining;
 			}
+		}
+
+		struct timeval tv;
+		tv.tv_sec  = wait / 1000;
+		tv.tv_usec = (wait % 1000) * 1000;
+		int rc = ::select(maxFd + 1, &readSet, nullptr, nullptr, wait < 0 ? nullptr : &tv);
+		if (rc == -1) {
+			ESP_LOGE(tag, "Error with select: %s", strerror(errno));
+			continue;
+		}
 
-		// Handle the read request (server file download)
-			case opcode::TFTP_OPCODE_RRQ: {
-				pTFTPTransaction->processRRQ();
-				break;
+		now = FreeRTOS::getTimeSinceStart();
+		for (auto it = m_transactions.begin(); it != m_transactions.end(); ) {
+			TFTP_Transaction* pTFTPTransaction = it->second;
+			if (FD_ISSET(pTFTPTransaction->getFD(), &readSet)) {
+				pTFTPTransaction->onReceive();
+			} else if ((int32_t)(pTFTPTransaction->getDeadline() - now) <= 0) {
+				pTFTPTransaction->onTimeout();
+			}
+			if (pTFTPTransaction->isFinished()) {
+				delete pTFTPTransaction;
+				it = m_transactions.erase(it);
+			} else {
+				++it;
 			}
 		}
-		delete pTFTPTransaction;
+
+		// New requests are accepted last so that transactions which just completed free their slot first.
+		if (FD_ISSET(serverSocket.getFD(), &readSet)) {
+			acceptRequest(&serverSocket);
+		}
 	} // End while loop
 } // run
 
@@ -282,115 +894,52 @@ void TFTP::setBaseDir(std::string baseDir) {
 
 
 /**
- * @brief Wait for an acknowledgment from the client.
- * After having sent data to the client, we expect an acknowledment back from the client.
- * This function causes us to wait for an incoming acknowledgment.
+ * @brief Set the largest block size we will agree to.
+ * @param [in] maxBlockSize The largest block size in bytes.
+ * @return N/A.
  */
-void TFTP::TFTP_Transaction::waitForAck(uint16_t blockNumber) {
-	struct {
-		uint16_t opCode;
-		uint16_t blockNumber;
-	} ackData;
-
-	ESP_LOGD(tag, "TFTP: Waiting for an acknowledgment request");
-	int sizeRead = m_partnerSocket.receiveFrom((uint8_t *)&ackData, sizeof(ackData), &m_partnerAddress);
-	ESP_LOGD(tag, "TFTP: Received some data.");
-
-	if (sizeRead != sizeof(ackData)) {
-		ESP_LOGE(tag, "waitForAck: Received %d but expected %d", sizeRead, sizeof(ackData));
-		sendError(ERROR_CODE_NOTDEFINED, "Ack not correct size");
-		return;
-	}
-
-	ackData.opCode      = ntohs(ackData.opCode);
-	ackData.blockNumber = ntohs(ackData.blockNumber);
-
-	if (ackData.opCode != opcode::TFTP_OPCODE_ACK) {
-		ESP_LOGE(tag, "waitForAck: Received opcode %d but expected %d", ackData.opCode, opcode::TFTP_OPCODE_ACK);
-		return;
-	}
-
-	if (ackData.blockNumber != blockNumber) {
-		ESP_LOGE(tag, "waitForAck: Blocknumber received %d but expected %d", ackData.blockNumber, blockNumber);
-		return;
-	}
-} // waitForAck
+void TFTP::TFTP_Transaction::setMaxBlockSize(uint16_t maxBlockSize) {
+	m_maxBlockSize = maxBlockSize;
+} // setMaxBlockSize
 
 
 /**
- * @brief Wait for a client request.
- * A %TFTP server waits for requests to send or receive files.  A request can be
- * either WRQ (write request) which is a request from the client to write a new local
- * file or it can be a RRQ (read request) which is a request from the client to
- * read a local file.
- * @param pServerSocket The server socket on which to listen for client requests.
- * @return The op code received.
- */
-uint16_t TFTP::TFTP_Transaction::waitForRequest(Socket *pServerSocket) {
-/*
- *        2 bytes    string   1 byte     string   1 byte
- *        -----------------------------------------------
- * RRQ/  | 01/02 |  Filename  |   0  |    Mode    |   0  |
- * WRQ    -----------------------------------------------
+ * @brief Set the largest block size we will agree to when a client requests the blksize option.
+ * Larger blocks mean fewer packets but each transaction holds one block of RAM.
+ * @param [in] maxBlockSize The largest block size in bytes.  The default is TFTP_MAX_BLKSIZE.
+ * @return N/A.
  */
-	union {
-		uint8_t buf[TFTP_DATA_SIZE];
-		uint16_t opCode;
-	} record;
-	size_t length = 100;
-
-	ESP_LOGD(tag, "TFTP: Waiting for a request");
-	pServerSocket->receiveFrom(record.buf, length, &m_partnerAddress);
+void TFTP::setMaxBlockSize(uint16_t maxBlockSize) {
+	m_maxBlockSize = maxBlockSize;
+} // setMaxBlockSize
 
-	// Save the filename, mode and op code.
 
-	m_filename = std::string((char *)(record.buf + 2));
-	m_mode     = std::string((char *)(record.buf + 3 + m_filename.length()));
-	m_opCode   = ntohs(record.opCode);
-	switch(m_opCode) {
+/**
+ * @brief Set the number of transfers that may be in progress at the same time.
+ * Each transfer holds an open file, a socket and one block of RAM.
+ * @param [in] maxTransactions The number of concurrent transfers.  The default is TFTP_MAX_TRANSACTIONS.
+ * @return N/A.
+ */
+void TFTP::setMaxTransactions(uint8_t maxTransactions) {
+	m_maxTransactions = maxTransactions;
+} // setMaxTransactions
 
-		// Handle the Write Request command.
-		case TFTP_OPCODE_WRQ: {
-			m_partnerSocket.createSocket(true);
-			m_partnerSocket.bind(0, INADDR_ANY);
-			sendAck(0);
-			break;
-		}
 
+/**
+ * @brief Set the largest window size we will agree to.
+ * @param [in] maxWindowSize The largest number of blocks in flight.
+ * @return N/A.
+ */
+void TFTP::TFTP_Transaction::setMaxWindowSize(uint16_t maxWindowSize) {
+	m_maxWindowSize = maxWindowSize;
+} // setMaxWindowSize
 
-		// Handle the Read request command.
-		case TFTP_OPCODE_RRQ: {
-			m_partnerSocket.createSocket(true);
-			m_partnerSocket.bind(0, INADDR_ANY);
-			break;
-		}
-
-		default: {
-			ESP_LOGD(tag, "Un-handled opcode: %d", m_opCode);
-			break;
-		}
-	}
-	return m_opCode;
-} // waitForRequest
 
 /**
- * @brief Send an error indication to the client.
- * @param [in] code Error code to send to the client.
- * @param [in] message Explanation message.
+ * @brief Set the largest window size we will agree to when a client requests the windowsize option.
+ * @param [in] maxWindowSize The largest number of blocks in flight.  The default is TFTP_MAX_WINDOWSIZE.
  * @return N/A.
  */
-void TFTP::TFTP_Transaction::sendError(uint16_t code, std::string message) {
-/*
- *  2 bytes     2 bytes      string    1 byte
- *  -----------------------------------------
- * | Opcode |  ErrorCode |   ErrMsg   |   0  |
- *  -----------------------------------------
- */
-	int size = 2  + 2 + message.length() + 1;
-	uint8_t *buf = (uint8_t *)malloc(size);
-	*(uint16_t *)(&buf[0]) = htons(opcode::TFTP_OPCODE_ERROR);
-	*(uint16_t *)(&buf[2]) = htons(code);
-	strcpy((char *)(&buf[4]), message.c_str());
-	m_partnerSocket.sendTo(buf, size, &m_partnerAddress);
-	free(buf);
-} // sendError
+void TFTP::setMaxWindowSize(uint16_t maxWindowSize) {
+	m_maxWindowSize = maxWindowSize;
+} // setMaxWindowSize
@@ -7,8 +7,19 @@
 
 #ifndef COMPONENTS_CPP_UTILS_TFTP_H_
 #define COMPONENTS_CPP_UTILS_TFTP_H_
-#define TFTP_DEFAULT_PORT (69)
+#define TFTP_DEFAULT_PORT       (69)
+#define TFTP_DEFAULT_BLKSIZE    (512)  // RFC 1350 block size used when no blksize option is negotiated.
+#define TFTP_MAX_BLKSIZE        (1468) // Largest block that fits a 1500 byte MTU (IP + UDP + TFTP headers).
+#define TFTP_DEFAULT_WINDOWSIZE (1)    // RFC 1350 lock-step behaviour when no windowsize option is negotiated.
+#define TFTP_MAX_WINDOWSIZE     (16)
+#define TFTP_DEFAULT_TIMEOUT    (1)    // Retransmission timeout in seconds.
+#define TFTP_MAX_RETRIES        (5)
+#define TFTP_MAX_TRANSACTIONS   (4)    // Concurrent transfers before new requests are refused.
+#include <stdio.h>
+#include <map>
 #include <string>
+#include <vector>
+#include <utility>
 #include <Socket.h>
 /**
  * @brief A %TFTP server.
@@ -18,6 +29,17 @@
  * both a server and a client.  The protocol leverages UDP as opposed to connection
  * oriented (TCP).  The specification can be found <a href="https://tools.ietf.org/html/rfc1350">here</a>.
  *
+ * The server supports option negotiation (<a href="https://tools.ietf.org/html/rfc2347">RFC 2347</a>)
+ * for the `blksize` (RFC 2348), `timeout` and `tsize` (RFC 2349) and `windowsize`
+ * (<a href="https://tools.ietf.org/html/rfc7440">RFC 7440</a>) options.  A client that asks for a
+ * larger block size and a window of several blocks is no longer limited to 512 bytes per round trip.
+ * Lost packets are recovered by timeout based retransmission of the outstanding window.
+ *
+ * Several transfers may be in progress at the same time.  Each is tracked by the address and port of
+ * its client and all of them are serviced by the single task that calls start(), which waits on the
+ * sockets of every transfer together with their retransmission deadlines.  Requests beyond
+ * setMaxTransactions() are refused with a "Server busy" error.
+ *
  * Here is an example fragment which mounts a file system and then starts a %TFTP server
  * to provide access to its content.
  *
@@ -30,7 +52,11 @@
  * tftp.start();
  * @endcode
  *
- * On Linux, I recommend the <a href="https://linux.die.net/man/1/atftp">atftp</a> client.
+ * On Linux, I recommend the <a href="https://linux.die.net/man/1/atftp">atftp</a> client.  For example:
+ *
+ * @code
+ * atftp --option "blksize 1468" --option "windowsize 8" -g -r firmware.bin <esp32 address>
+ * @endcode
  */
 class TFTP {
 public:
@@ -38,20 +64,47 @@ public:
 	virtual ~TFTP();
 	void start(uint16_t port=TFTP_DEFAULT_PORT);
 	void setBaseDir(std::string baseDir);
+	void setMaxBlockSize(uint16_t maxBlockSize);
+	void setMaxTransactions(uint8_t maxTransactions);
+	void setMaxWindowSize(uint16_t maxWindowSize);
 	/**
 	 * @brief Internal class for %TFTP processing.
+	 *
+	 * A transaction is a state machine.  processRRQ() or processWRQ() starts the transfer and from then on
+	 * the owning server calls onReceive() when the transaction's socket is readable and onTimeout() when
+	 * getDeadline() has passed, until isFinished() returns true.
 	 */
 	class TFTP_Transaction {
 	public:
 		TFTP_Transaction();
-		void processWRQ();
-		void processRRQ();
-		void sendAck(uint16_t blockNumber);
-		void sendError(uint16_t code, std::string message);
-		void setBaseDir(std::string baseDir);
-		void waitForAck(uint16_t blockNumber);
-		uint16_t waitForRequest(Socket *pServerSocket);
+		~TFTP_Transaction();
+		uint32_t getDeadline();
+		int      getFD();
+		bool     isFinished();
+		void     onReceive();
+		void     onTimeout();
+		uint16_t parseRequest(uint8_t* pData, size_t length, struct sockaddr* pPartnerAddress);
+		void     processWRQ();
+		void     processRRQ();
+		void     sendAck(uint16_t blockNumber);
+		void     sendError(uint16_t code, std::string message);
+		void     setBaseDir(std::string baseDir);
+		void     setMaxBlockSize(uint16_t maxBlockSize);
+		void     setMaxWindowSize(uint16_t maxWindowSize);
 	private:
+		enum State {
+			STATE_OPTION_ACK, // RRQ: OACK sent, waiting for the ack of block 0.
+			STATE_TRANSFER,   // Data is flowing.
+			STATE_DALLY,      // WRQ: final ack sent, waiting in case the client resends its last block.
+			STATE_DONE        // Finished, the transaction can be deleted.
+		};
+		void finish();
+		void handleAck(uint16_t blockNumber);
+		void handleData(uint16_t blockNumber, size_t dataLength);
+		void parseOptions(const uint8_t* pData, size_t length);
+		int  receivePacket(uint8_t* pData, size_t length);
+		void sendOptionAck();
+		void sendWindow();
 		/**
 		 * Socket on which the server will communicate with the client..
 		 */
@@ -61,9 +114,32 @@ public:
 		std::string m_filename; // The name of the file.
 		std::string m_mode;
 		std::string m_baseDir; // The base directory.
+		uint16_t    m_blockSize;     // The negotiated block size.
+		uint16_t    m_windowSize;    // The negotiated number of blocks sent before an ack is required.
+		uint16_t    m_timeout;       // The negotiated retransmission timeout in seconds.
+		uint16_t    m_maxBlockSize;  // Largest block size we are willing to accept.
+		uint16_t    m_maxWindowSize; // Largest window size we are willing to accept.
+		std::vector<std::pair<std::string, std::string>> m_options; // Options to acknowledge in the OACK.
+		State       m_state;
+		FILE*       m_file;
+		uint8_t*    m_buffer;        // One block plus header, used to send (RRQ) or receive (WRQ).
+		uint32_t    m_sendTime;      // When we last sent something that expects a reply.
+		int         m_retries;       // Consecutive timeouts without progress.
+		uint32_t    m_baseBlock;     // RRQ: oldest block not yet acknowledged.  WRQ: last block received in order.
+		uint32_t    m_nextBlock;     // RRQ: next block to be sent.
+		uint32_t    m_lastBlock;     // RRQ: the final (short) block once it is known, otherwise 0.
+		uint32_t    m_fileBlock;     // RRQ: block at which the file position currently sits.
+		uint32_t    m_resentFrom;    // RRQ: window base for which a duplicate ack already caused a resend.
+		uint16_t    m_windowCount;   // WRQ: blocks received since the last ack.
+		bool        m_gapAcked;      // WRQ: have we already acked for the current gap?
 	};
 private:
+	void acceptRequest(Socket* pServerSocket);
 	std::string m_baseDir;
+	uint16_t    m_maxBlockSize;
+	uint16_t    m_maxWindowSize;
+	uint8_t     m_maxTransactions;
+	std::map<uint64_t, TFTP_Transaction*> m_transactions; // Active transfers keyed by client address and port.
 };
 
 #endif /* COMPONENTS_CPP_UTILS_TFTP_H_ */
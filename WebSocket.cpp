@@ -373,6 +373,42 @@ void WebSocket::send(uint8_t* data, uint16_t length, uint8_t sendType) {
 }
 
 
+/**
+ * @brief Send one fragment of a message down the web socket.
+ * See the WebSocket spec (RFC6455) section "5.4 Fragmentation".  A message whose total length is not
+ * known up front can be sent as a sequence of fragments.  The first carries the payload type, the
+ * rest are continuations and the last has the FIN bit set.  A message of a single fragment is both
+ * first and last.
+ * @param [in] data The data of this fragment.
+ * @param [in] length The length of the data.
+ * @param [in] isFirst True if this is the first fragment of the message.
+ * @param [in] isLast True if this is the last fragment of the message.
+ * @param [in] sendType The type of payload.  Either SEND_TYPE_TEXT or SEND_TYPE_BINARY.
+ */
+void WebSocket::sendFragment(uint8_t* data, uint16_t length, bool isFirst, bool isLast, uint8_t sendType) {
+	ESP_LOGD(LOG_TAG, ">> sendFragment: Length: %d, first: %d, last: %d", length, isFirst, isLast);
+	Frame frame;
+	frame.fin    = isLast ? 1 : 0;
+	frame.rsv1   = 0;
+	frame.rsv2   = 0;
+	frame.rsv3   = 0;
+	frame.opCode = !isFirst ? OPCODE_CONTINUE : (sendType==SEND_TYPE_TEXT?OPCODE_TEXT:OPCODE_BINARY);
+	frame.mask   = 0;
+	if (length < 126) {
+		frame.len = length;
+		m_socket.send((uint8_t *)&frame, sizeof(frame));
+	} else {
+		frame.len = 126;
+		m_socket.send((uint8_t *)&frame, sizeof(frame));
+		m_socket.send(htons(length));  // Convert to network byte order from host byte order
+	}
+	if (length > 0) {
+		m_socket.send(data, length);
+	}
+	ESP_LOGD(LOG_TAG, "<< sendFragment");
+} // sendFragment
+
+
 /**
  * @brief Set the Web socket handler associated with this Websocket.
  *
@@ -92,6 +92,7 @@ public:
 	Socket            getSocket();
 	void              send(std::string data, uint8_t sendType = SEND_TYPE_BINARY);
 	void              send(uint8_t* data, uint16_t length, uint8_t sendType = SEND_TYPE_BINARY);
+	void              sendFragment(uint8_t* data, uint16_t length, bool isFirst, bool isLast, uint8_t sendType = SEND_TYPE_BINARY);
 	void              setHandler(WebSocketHandler *handler);
 }; // WebSocket
 